@@ -1,22 +1,21 @@
 /*
  * file_modem.c
  * 
- * File modem receiver and transmitter. Currently supports only
+ * File modem receiver and transmitter. Currently supports the
  * X-Modem Receiver (both basic X-Modem, with CRC, and with 1k support!)
+ * and a X-Modem Sender for data streams.
  * Reference used: http://pauillac.inria.fr/~doligez/zmodem/ymodem.txt
  *
  * Created: 19.03.2021 16:20:44
  *  Author: gfcwfzkm
  */ 
 
-#include "file_modem.h"
+#include "file_modem_int.h"
+#include <string.h>
 #include <util/delay.h>
-
-/* Supported Packet Sizes. Theoretically, more sizes could be added
- * (Possible Z-Modem Implementation in the future? */
-#define PCK_SIZ	128
-#define PCK_1K	1024
-
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
 
 #define SOH		0x01	// Start of Packet, 256 Bytes
 #define STX		0x02	// Start of Packet, 1024 Bytes
@@ -25,82 +24,141 @@
 #define NAK		0x15	// Initiate checksum transmission or report corrupted data
 #define CAN		0x18	// Abort by the sender
 #define CRC16	0x43	// 'C', initiate CRC-16 transmission
+#define SUB		0x1A	// Padding of the last packet (CP/M End of File)
 #ifdef XMODEM_NON_STANDARD
 #define ABORT1	0x41	// Abort by the sender-client-user, small 'a'
 #define ABORT2	0x61	// Abort by the sender-client-user, large 'A'
 #endif
-
-#define MAX_ERR	10		// Amount of Retries before the receiver gives up
-#define SRT_TRY	5		// Amount of retries to initiate a CRC transmission, followed by retries of checksum transmission,
-						// before the receiver gives up
-
-#define TIMEOUT	3000	// Timeout time in seconds
-						// I know, the original docs state 10 seconds, but I feel
-						// like that it's a bit long, at 10 retries.
+#ifdef XMODEM_FILL_EXT
+#define FILL	0x1C	// Start of a run-length fill record
+#define FILLREQ	0x46	// 'F', initiate CRC-16 transmission with fill records
+#define FILL_REC	5	// Size of a fill record: 4 Bytes Count, 1 Byte Fill-Value
+#define FILL_MIN	16	// Shortest run the sender replaces by a fill record
+#define FILL_TRY	1	// Amount of tries to request fill records before falling back to plain CRC
+#endif
 
 /* Work-Buffer that will hold the data packet */
-static uint8_t u8a_workbuf[PCK_1K];
-enum packageResult {PCK_128_RECV,PCK_1K_RECV,PCK_EOT,PCK_TIMEOUT,PCK_INVALID,PCK_CANCEL};
+FM_THREAD uint8_t u8a_workbuf[WORKBUF_SIZ];
+enum packageResult {PCK_128_RECV,PCK_1K_RECV,PCK_EOT,PCK_TIMEOUT,PCK_INVALID,PCK_CANCEL,PCK_DUPLICATE,
+#ifdef XMODEM_FILL_EXT
+	PCK_FILL_RECV
+#endif
+};
 
 /**
-  * @brief Calculates the CRC Checksum of a data packet
+  * @brief Updates the X-Modem CRC-16 with one more byte
   *
-  * @param buf	The data buffer
-  * @param siz
+  * Gets called for every byte while the packet is still arriving, so the
+  * CPU is done with the check as soon as the last byte is in. On AVR the
+  * optimized version of the avr-libc is used.
+  *
+  * @param crc	The CRC so far, start with zero
+  * @param data	The next data byte
   */
-static uint16_t _crc16(const uint8_t *buf, uint32_t count)
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t data)
 {
-	uint16_t crc = 0;
-	uint8_t i = 0;
+#ifdef __AVR__
+	return _crc_xmodem_update(crc, data);
+#else
+	uint8_t i;
 	
-	while(count--)
+	crc = crc ^ (uint16_t)data << 8;
+	for (i = 0; i < 8; i++)
 	{
-		crc = crc ^ *buf++ << 8;
-		
-		for (i = 0; i < 8; i++)
+		if (crc & 0x8000)
 		{
-			if (crc & 0x8000)
-			{
-				crc = crc << 1 ^ 0x1021;
-			}
-			else
-			{
-				crc = crc << 1;
-			}
+			crc = crc << 1 ^ 0x1021;
+		}
+		else
+		{
+			crc = crc << 1;
 		}
 	}
 	return crc;
+#endif
 }
 
 /**
-  * @brief Checks if the packet is valid or not
+  * @brief Updates a CRC-32 (IEEE 802.3, reflected) with one more byte
   *
-  * @param use_crc	If Zero, one-byte checksum will be used, else 2-byte CRC,
-  *					- also holds the received CRC number
-  * @param buf		Pointer to the data packet
-  * @param count	Packet Size Length (128 or 1024)
+  * Start with 0xFFFFFFFF and invert the result after the last byte.
   *
-  * @return			One if the check failed, zero if it was successful       */
-static uint8_t _checkPacket(uint8_t use_crc, uint16_t crc_checksum, const uint8_t *buf, uint16_t count)
+  * @param crc	The CRC so far
+  * @param data	The next data byte
+  */
+uint32_t _crc32_update(uint32_t crc, uint8_t data)
 {
-	if (use_crc)
-	{
-		/* X-Modem with 16-bit CRC */
-		uint16_t calced_crc = _crc16(buf, count);
-		if (calced_crc != crc_checksum)			return 1;
-	}
-	else
+	uint8_t i;
+	
+	crc ^= data;
+	for (i = 0; i < 8; i++)
 	{
-		/* X-Modem with basic 8-bit checksum */
-		uint16_t cnt_i = 0;
-		uint8_t checksum = 0;
-		for (cnt_i = 0; cnt_i < count; cnt_i++)
+		if (crc & 1)
+		{
+			crc = (crc >> 1) ^ 0xEDB88320UL;
+		}
+		else
 		{
-			checksum += buf[cnt_i];
+			crc = crc >> 1;
 		}
-		if (checksum != (uint8_t)crc_checksum)	return 1;
 	}
-	return 0;
+	return crc;
+}
+
+/**
+  * @brief Stores a number LSB first, as in N-Modem frames and the record files
+  *        of the sinks and caches
+  */
+void _fm_put16(uint8_t *p_buf, uint16_t u16_val)
+{
+	p_buf[0] = (uint8_t)u16_val;
+	p_buf[1] = (uint8_t)(u16_val >> 8);
+}
+
+void _fm_put32(uint8_t *p_buf, uint32_t u32_val)
+{
+	_fm_put16(p_buf, (uint16_t)u32_val);
+	_fm_put16(&p_buf[2], (uint16_t)(u32_val >> 16));
+}
+
+void _fm_put64(uint8_t *p_buf, FSIZE_t val)
+{
+	_fm_put32(p_buf, (uint32_t)val);
+	_fm_put32(&p_buf[4], (uint32_t)((uint64_t)val >> 32));
+}
+
+/**
+  * @brief Reads a number stored LSB first
+  */
+uint16_t _fm_get16(const uint8_t *p_buf)
+{
+	return p_buf[0] | (uint16_t)p_buf[1] << 8;
+}
+
+uint32_t _fm_get32(const uint8_t *p_buf)
+{
+	return _fm_get16(p_buf) | (uint32_t)_fm_get16(&p_buf[2]) << 16;
+}
+
+FSIZE_t _fm_get64(const uint8_t *p_buf)
+{
+	return (FSIZE_t)(_fm_get32(p_buf) | (uint64_t)_fm_get32(&p_buf[4]) << 32);
+}
+
+/**
+  * @brief Check Byte of a record, stored in its last Byte
+  *
+  * @param u8_len	Length of the record, with the check Byte
+  */
+uint8_t _fm_check(const uint8_t *p_rec, uint8_t u8_len)
+{
+	uint8_t u8_sum = 0, u8_pos;
+
+	for (u8_pos = 0; u8_pos < u8_len - 1; u8_pos++)
+	{
+		u8_sum += p_rec[u8_pos];
+	}
+	return (uint8_t)~u8_sum;
 }
 
 /**
@@ -112,19 +170,36 @@ static uint8_t _checkPacket(uint8_t use_crc, uint16_t crc_checksum, const uint8_
   * @param c	Pointer to a single unsigned byte, where the received char should be stored
   * @return		1 on error, 0 if successful
   */
-uint8_t (*_recByte)(uint8_t*, uint16_t);
+FM_THREAD uint8_t (*_recByte)(uint8_t*, uint16_t);
 
 /**
   * @brief Send one Byte via UART
   *
   * @param c	Byte to send
   */
-void (*_sendByte)(uint8_t);
+FM_THREAD void (*_sendByte)(uint8_t);
+
+/**
+  * @brief Send a block of Bytes via UART (optional, NULL if not available)
+  *
+  * @param p_data	Bytes to send, may point into flash or a mapped file
+  * @param len		Amount of Bytes
+  */
+FM_THREAD void (*_sendBlock)(const uint8_t*, uint16_t);
 
 /**
   * @brief Instantly flushes the Rx Buffer
   */
-void (*_flushRx)(void);
+FM_THREAD void (*_flushRx)(void);
+
+/**
+  * @brief Waits an amount of milliseconds (optional, NULL for _delay_ms)
+  *
+  * @param ms	Time to wait
+  */
+FM_THREAD void (*_delay)(uint16_t);
+
+FM_THREAD struct fm_tune _fm_tune = FM_TUNE_DEFAULT;
 
 /** 
   * @brief Receives a packet, checks it's CRC and the expected packet number
@@ -132,16 +207,21 @@ void (*_flushRx)(void);
   * @param data			Pointer to the receive Buffer (Must be 1024 Bytes large (1k-XMODEM + 3 Head Chars + 2CRC 
   * @param expPacketNum	Expected Packet Number that the sender should transmit. Will be checked by this function
   * @param useCRC		Zero if basic Checksum has to be used, 1 if 16-bit CRC has to be used
+  * @param useFill		Non-zero if fill records have been negotiated and are accepted
   *
   * @return		Result of the receiving process: 0 for a normal packet, 1 for a 1k packet, 2 for a EndOfFile,
-  *             3 for a general timeout, 4 for a Check Error, 5 for Abort */
-static enum packageResult _receivePacket(uint8_t *p_data, uint8_t u8_expPacketNum, uint8_t b_useCRC)
+  *             3 for a general timeout, 4 for a Check Error, 5 for Abort, 6 for the previous packet
+  *             once more (our ACK got lost), 7 for a fill record */
+static enum packageResult _receivePacket(uint8_t *p_data, uint8_t u8_expPacketNum, uint8_t b_useCRC, uint8_t b_useFill)
 {
-	uint16_t u16_pck_siz, u16_cnt, u16_recvCRC = 0;
+	uint16_t u16_pck_siz, u16_cnt, u16_recvCRC = 0, u16_calcCRC = 0;
 	uint8_t u8_pckNum[2], u8_ch = 0;
 	
+#ifndef XMODEM_FILL_EXT
+	(void)b_useFill;
+#endif
 	// receive and process first byte
-	if (_recByte(&u8_ch, TIMEOUT))		return PCK_TIMEOUT;	
+	if (_fm_recByte(&u8_ch))		return PCK_TIMEOUT;	
 	switch(u8_ch)
 	{
 		case SOH:	// Normal Packet Size (128 Bytes)
@@ -150,9 +230,17 @@ static enum packageResult _receivePacket(uint8_t *p_data, uint8_t u8_expPacketNu
 		case STX:	// 1k-XMODEM (1024 Bytes)
 			u16_pck_siz = PCK_1K;
 			break;
+#ifdef XMODEM_FILL_EXT
+		case FILL:	// Run-length fill record, only if negotiated
+			if (!b_useFill)	return PCK_INVALID;
+			u16_pck_siz = FILL_REC;
+			break;
+#endif
 		case EOT:	// End of File - No more data to be received
 			return PCK_EOT;
-		case CAN:	// Abort (not fully standard?)
+		case CAN:	// Abort, two in a row. A single one might be line noise
+			if (_fm_recByte(&u8_ch))	return PCK_TIMEOUT;
+			return (u8_ch == CAN) ? PCK_CANCEL : PCK_INVALID;
 #ifdef XMODEM_NON_STANDARD
 		case ABORT1:
 		case ABORT2:
@@ -166,29 +254,38 @@ static enum packageResult _receivePacket(uint8_t *p_data, uint8_t u8_expPacketNu
 	}
 	
 	/* Read the packet Number & inversed packet number */
-	if (_recByte(&u8_ch, TIMEOUT))	return PCK_TIMEOUT;
+	if (_fm_recByte(&u8_ch))	return PCK_TIMEOUT;
 	u8_pckNum[0] = u8_ch;
-	if (_recByte(&u8_ch, TIMEOUT))	return PCK_TIMEOUT;
+	if (_fm_recByte(&u8_ch))	return PCK_TIMEOUT;
 	u8_pckNum[1] = u8_ch;
 	
-	/* Start receiving the data finally */
+	/* Start receiving the data finally. The CRC / Checksum is calculated on the fly,
+	 * which keeps the receiver from being busy for a whole packet after the last byte */
 	for (u16_cnt = 0; u16_cnt < u16_pck_siz; u16_cnt++)
 	{
-		if (_recByte(&u8_ch, TIMEOUT))	return PCK_TIMEOUT;
+		if (_fm_recByte(&u8_ch))	return PCK_TIMEOUT;
 		p_data[u16_cnt] = u8_ch;
+		if (b_useCRC)
+		{
+			u16_calcCRC = _crc16_update(u16_calcCRC, u8_ch);
+		}
+		else
+		{
+			u16_calcCRC += u8_ch;
+		}
 	}
 	
 	/* Receive the checksum / CRC at the end */
 	if (b_useCRC)
 	{
-		if (_recByte(&u8_ch, TIMEOUT))	return PCK_TIMEOUT;
+		if (_fm_recByte(&u8_ch))	return PCK_TIMEOUT;
 		u16_recvCRC = (uint16_t)u8_ch << 8;
-		if (_recByte(&u8_ch, TIMEOUT))	return PCK_TIMEOUT;
+		if (_fm_recByte(&u8_ch))	return PCK_TIMEOUT;
 		u16_recvCRC |= u8_ch;
 	}
 	else
 	{
-		if (_recByte(&u8_ch, TIMEOUT))	return PCK_TIMEOUT;
+		if (_fm_recByte(&u8_ch))	return PCK_TIMEOUT;
 		u16_recvCRC = u8_ch;
 	}
 	
@@ -196,23 +293,101 @@ static enum packageResult _receivePacket(uint8_t *p_data, uint8_t u8_expPacketNu
 	/* Start by checking the packet ID first */
 	u8_pckNum[1] = ~u8_pckNum[1];
 	if (u8_pckNum[0] != u8_pckNum[1])	return PCK_INVALID;
-	if (u8_pckNum[0] != u8_expPacketNum)		return PCK_INVALID;
 	
-	/* Check Checksum / CRC of the packet */
-	if (_checkPacket(b_useCRC, u16_recvCRC, p_data, u16_pck_siz))	return 4;
+	/* Check Checksum / CRC of the packet, the basic checksum is only 8 bits wide */
+	if (!b_useCRC)	u16_calcCRC &= 0xFF;
+	if (u16_calcCRC != u16_recvCRC)	return PCK_INVALID;
+	
+	/* The sender repeats the previous packet if our ACK got lost on the way */
+	if (u8_pckNum[0] == (uint8_t)(u8_expPacketNum - 1))	return PCK_DUPLICATE;
+	if (u8_pckNum[0] != u8_expPacketNum)		return PCK_INVALID;
 	
 	/* Check if normal or 1k package has been processed, return that info */
 	if (u16_pck_siz == PCK_SIZ)	return PCK_128_RECV;
+#ifdef XMODEM_FILL_EXT
+	if (u16_pck_siz == FILL_REC)	return PCK_FILL_RECV;
+#endif
 	return PCK_1K_RECV;
 }
 
-/*
-To-Do: Implementing a transmitting function to have a proper transceiver library
-static uint8_t _transmitPacket(uint8_t *data, uint8_t packetID, uint8_t useCRC)
+/**
+  * @brief Sends a packet, including header and CRC / Checksum
+  *
+  * With a block send function, the data goes out straight from where it is
+  * (work buffer, flash, mapped file) without being copied. The check is
+  * calculated over it beforehand.
+  *
+  * @param u8_type		Start of the packet: SOH, STX or FILL
+  * @param u8_pckNum	Packet Number
+  * @param p_data		Data of the packet
+  * @param u16_len		Length of the data (128, 1024 or FILL_REC)
+  * @param b_useCRC		Zero if basic Checksum has to be used, 1 if 16-bit CRC has to be used
+  */
+static void _sendPacket(uint8_t u8_type, uint8_t u8_pckNum, const uint8_t *p_data, uint16_t u16_len, uint8_t b_useCRC)
+{
+	uint16_t u16_cnt, u16_check = 0;
+	uint8_t u8a_frame[3];
+	
+	u8a_frame[0] = u8_type;
+	u8a_frame[1] = u8_pckNum;
+	u8a_frame[2] = ~u8_pckNum;
+	
+	if (_sendBlock)
+	{
+		for (u16_cnt = 0; u16_cnt < u16_len; u16_cnt++)
+		{
+			u16_check = b_useCRC ? _crc16_update(u16_check, p_data[u16_cnt]) : u16_check + p_data[u16_cnt];
+		}
+		_sendBlock(u8a_frame, 3);
+		_sendBlock(p_data, u16_len);
+		/* The check goes through the block function as well, to keep the order */
+		u8a_frame[0] = (uint8_t)(u16_check >> 8);
+		u8a_frame[1] = (uint8_t)u16_check;
+		_sendBlock(b_useCRC ? &u8a_frame[0] : &u8a_frame[1], b_useCRC ? 2 : 1);
+		return;
+	}
+	
+	_sendByte(u8a_frame[0]);
+	_sendByte(u8a_frame[1]);
+	_sendByte(u8a_frame[2]);
+	for (u16_cnt = 0; u16_cnt < u16_len; u16_cnt++)
+	{
+		_sendByte(p_data[u16_cnt]);
+		u16_check = b_useCRC ? _crc16_update(u16_check, p_data[u16_cnt]) : u16_check + p_data[u16_cnt];
+	}
+	
+	if (b_useCRC)
+	{
+		_sendByte((uint8_t)(u16_check >> 8));
+	}
+	_sendByte((uint8_t)u16_check);
+}
+
+/**
+  * @brief Sends a packet until the receiver acknowledges it
+  *
+  * @return		FM_OK if acknowledged, FM_ABORTED if the receiver cancelled
+  *				or FM_TIMEOUT after MAX_ERR failed attempts
+  */
+static enum file_modem _transmitPacket(uint8_t u8_type, uint8_t u8_pckNum, const uint8_t *p_data, uint16_t u16_len, uint8_t b_useCRC)
 {
+	uint8_t u8_tries, u8_ch;
 	
+	for (u8_tries = 0; u8_tries < MAX_ERR; u8_tries++)
+	{
+		/* Leftover pokes or garbage must not be taken as answer */
+		_flushRx();
+		_sendPacket(u8_type, u8_pckNum, p_data, u16_len, b_useCRC);
+		
+		if (_recByte(&u8_ch, TIMEOUT))	continue;
+		if (u8_ch == ACK)	return FM_OK;
+		/* Two CANs in a row cancel the transfer, a single one might be line noise */
+		if ( (u8_ch == CAN) && !_recByte(&u8_ch, TIMEOUT) && (u8_ch == CAN) )	return FM_ABORTED;
+		/* NAK or anything else: Send it again */
+		FM_STAT(retries);
+	}
+	return FM_TIMEOUT;
 }
-*/
 
 // Todo: seperate xmodem and ymodem calls being handled by the same function:
 uint8_t _modem_receive(FIL *ffd, uint32_t *maxsize)
@@ -232,7 +407,7 @@ uint8_t _modem_receive(FIL *ffd, uint32_t *maxsize)
 	/* --- Main Receive Loop --- */
 	do{
 		/* Receive the Packet */
-		u8_pckRes = _receivePacket(u8a_workbuf, u8_pckCnt, b_useCRC);
+		u8_pckRes = _receivePacket(u8a_workbuf, u8_pckCnt, b_useCRC, 0);
 		
 		/* Process the result of the packet-receiving */
 		switch(u8_pckRes)
@@ -315,6 +490,9 @@ uint8_t _modem_receive(FIL *ffd, uint32_t *maxsize)
 /**
   * @brief Initialize the file modem by passing the nessesairy communication functions
   *
+  * On hosts the functions are set for the calling thread, the thread of
+  * every port passes its own.
+  *
   * @param recByte	Function Pointer for the receiver. Gets called with a single uint8_t
   *                 pointer for the received byte, and a uint16_t that states
   *                 the timeout time in Milliseconds. Has to return 0 if successful or
@@ -330,19 +508,95 @@ void file_modem_init(uint8_t (*recByte)(uint8_t*,uint16_t), void (*sendByte)(uin
 	_flushRx = flushRx;
 }
 
-enum file_modem xmodem_receive(FIL *p_ffd, uint32_t *p_maxsize)
+/**
+  * @brief Sets an optional function to send a whole block of Bytes at once
+  *
+  * If set, the senders hand the packet data to it in one piece, straight
+  * from where it is stored, instead of calling sendByte for every Byte.
+  *
+  * @param sendBlock	Function Pointer that sends the given amount of Bytes
+  *						and returns once they may be changed again. NULL to
+  *						go back to sendByte.
+  */
+void file_modem_block(void (*sendBlock)(const uint8_t*, uint16_t))
+{
+	_sendBlock = sendBlock;
+}
+
+/**
+  * @brief Sets an optional function the library waits with instead of _delay_ms
+  *
+  * The timeouts are up to recByte already, this covers the pauses (see
+  * fm_tune.pace). Lets an RTOS task sleep instead of busy waiting, or a
+  * simulation advance its virtual clock.
+  *
+  * @param delay	Function Pointer that returns after the given amount of
+  *					milliseconds. NULL to go back to _delay_ms.
+  */
+void file_modem_delay(void (*delay)(uint16_t))
+{
+	_delay = delay;
+}
+
+/**
+  * @brief Sets the link parameters for the following transfers
+  *
+  * On hosts they hold for the calling thread only, the ports receiving in
+  * other threads keep theirs.
+  *
+  * Out of range values are limited: packet and window to what N-Modem has
+  * been compiled for, timeout and retries to at least one.
+  *
+  * @param p_tune	Parameters to use, NULL for the defaults (FM_TUNE_DEFAULT)
+  */
+void file_modem_tune(const struct fm_tune *p_tune)
+{
+	static const struct fm_tune defaults = FM_TUNE_DEFAULT;
+	
+	_fm_tune = p_tune ? *p_tune : defaults;
+	if (!_fm_tune.timeout)	_fm_tune.timeout = 1;
+	if (!_fm_tune.maxErr)	_fm_tune.maxErr = 1;
+	if (!_fm_tune.packet || (_fm_tune.packet > NMODEM_PACKET))	_fm_tune.packet = NMODEM_PACKET;
+	if (!_fm_tune.window || (_fm_tune.window > NMODEM_WINDOW))	_fm_tune.window = NMODEM_WINDOW;
+}
+
+/**
+  * @brief Pause after an accepted packet, gives slow senders time
+  */
+static void _pace(void)
+{
+	uint8_t u8_ms;
+	
+	if (_delay)
+	{
+		_delay(_fm_tune.pace);
+		return;
+	}
+	/* _delay_ms wants a constant */
+	for (u8_ms = 0; u8_ms < _fm_tune.pace; u8_ms++)
+	{
+		_delay_ms(1);
+	}
+}
+
+enum file_modem xmodem_receive(FIL *p_ffd, FSIZE_t *p_maxsize)
 {
 	enum packageResult packetResult;// Result of the function _receivePacket to process
-	uint8_t packetCounter = 1;	// Packet Counter. Xmodem starts with Packet 1. Can roll over
+	uint8_t packetCounter = 1;	// Packet Counter. Xmodem starts with Packet 1. Rolls over after 255,
+								// as the protocol wants it. The file position is totalBytesWritten
 	uint8_t failedAttempts = 0;	// Counter of Timeouts or CRC/Checksum Errors. Resets
 								// after every successfully received packet.
-	uint8_t useCRC = 0;			// States if 16-bit CRC or basic 8-Bit Checksum has to be used
+	uint8_t useCRC = 1;			// States if 16-bit CRC or basic 8-Bit Checksum has to be used
+#ifdef XMODEM_FILL_EXT
+	uint8_t useFill = 1;		// States if fill records are requested / have been accepted by the sender
+	uint32_t fillCount;			// Amount of Bytes a fill record stands for
+#endif
 	uint8_t excecuteLoop = 0;	// Loop and Function-Result variable. This function loops as
 								// long as excecuteLoop is Zero
-	uint16_t fs_bytesWritten;	// For (fatfs) f_write, to check if all Bytes have been written
 	uint16_t bytesReceived;		// Holds if a 128 Bytes or 1k Bytes Packet has been received
-	uint32_t totalBytesWritten = 0;	// Amount of total Bytes received & written. Will be
+	FSIZE_t totalBytesWritten = 0;	// Amount of total Bytes received & written. Will be
 								// copied into *maxsize at function end.
+	FSIZE_t maxSize = _fm_limit(p_ffd, *p_maxsize, f_tell(p_ffd));	// Limit of the application or the file system
 	uint8_t initialTransmission = 1;// States that the transmission just started 
 								// For CRC/Checkum negotiation
 	
@@ -350,6 +604,7 @@ enum file_modem xmodem_receive(FIL *p_ffd, uint32_t *p_maxsize)
 	
 	/* Dump Rx Buffer before we start, just to be safe */
 	_flushRx();
+	_fm_statStart();
 	
 	/* --- Main Receive Loop --- */
 	do{
@@ -357,6 +612,13 @@ enum file_modem xmodem_receive(FIL *p_ffd, uint32_t *p_maxsize)
 		 * Try 3 times to initiate a CRC transmission, else fall back to Checksum transmission.*/
 		if (initialTransmission)
 		{
+#ifdef XMODEM_FILL_EXT
+			if (useFill)
+			{
+				_sendByte(FILLREQ);
+			}
+			else
+#endif
 			if (useCRC)
 			{
 				_sendByte(CRC16);
@@ -368,7 +630,11 @@ enum file_modem xmodem_receive(FIL *p_ffd, uint32_t *p_maxsize)
 		}
 		
 		/* Receive the Packet */
-		packetResult = _receivePacket(u8a_workbuf, packetCounter, useCRC);
+#ifdef XMODEM_FILL_EXT
+		packetResult = _receivePacket(u8a_workbuf, packetCounter, useCRC, useFill);
+#else
+		packetResult = _receivePacket(u8a_workbuf, packetCounter, useCRC, 0);
+#endif
 		
 		/* Process the result of the packet-receiving */
 		switch(packetResult)
@@ -385,53 +651,125 @@ enum file_modem xmodem_receive(FIL *p_ffd, uint32_t *p_maxsize)
 				 * Writing the packet size into bytesReceived */
 				bytesReceived = ((packetResult==PCK_1K_RECV) ? PCK_1K : PCK_SIZ);
 				
-				/* Write the received Bytes from the buffer into the fileystem */
-				f_write(p_ffd, u8a_workbuf, bytesReceived, &fs_bytesWritten);
-				
-				/* Disk full? Lets hope not! */
-				if (fs_bytesWritten < bytesReceived)
+				/* File size larger than originally allowed/states? Same check as
+				 * for fill records: the packet may end at maxSize, not beyond */
+				if (bytesReceived > maxSize - totalBytesWritten)
 				{
-					// Error, Disk full!
-					return 5;
+					// Error, max size reached!
+					return FM_SIZE_EXCEEDED;
 				}
 				
-				/* File size larger than originally allowed/states? */
-				totalBytesWritten += bytesReceived;
-				if(totalBytesWritten >= *p_maxsize)
+				/* Write the received Bytes from the buffer into the fileystem.
+				 * Disk full? Lets hope not! */
+				if (_fm_write(p_ffd, u8a_workbuf, bytesReceived))
 				{
-					// Error, max size reached!
-					return 6;
+					// Error, Disk full!
+					return FM_DISK_FULL;
 				}
+				_fm_statPacket(bytesReceived);
+				totalBytesWritten += bytesReceived;
 				
 				/* Syncing the FS to reduce the data loss at a sudden power-down */
 				//f_sync(p_ffd);
 				/* No delay -> ExtraPUTTY crashes without a error message after a few hundred
 				 * packages. Seems to work usable with a delay of 5ms tho, and definitely faster
-				 * than with f_sync each time */
-				_delay_ms(10);
+				 * than with f_sync each time. The pause is part of the link parameters */
+				_pace();
 				/* Informing the Sender, that the packet has been recieved, processed
 				 * and that we're ready for the next packet. */
 				_sendByte(ACK);
 				
 				loopCnt++;
 				break;
+#ifdef XMODEM_FILL_EXT
+			case PCK_FILL_RECV:	/* Run-length fill record received */
+				packetCounter++;
+				failedAttempts = 0;
+				initialTransmission = 0;
+				
+				/* Fill record: 4 Bytes count (MSB first) followed by the fill value */
+				fillCount = ((uint32_t)u8a_workbuf[0] << 24) | ((uint32_t)u8a_workbuf[1] << 16) |
+							((uint32_t)u8a_workbuf[2] << 8) | u8a_workbuf[3];
+				
+				/* Check the size before writing anything, the count comes from the sender */
+				if (fillCount > maxSize - totalBytesWritten)
+				{
+					// Error, max size reached!
+					return FM_SIZE_EXCEEDED;
+				}
+				
+				_fm_statPacket(fillCount);
+				
+				/* Materialize the run out of the work buffer, 1k at a time */
+				memset(u8a_workbuf, u8a_workbuf[4], PCK_1K);
+				totalBytesWritten += fillCount;
+				while (fillCount)
+				{
+					bytesReceived = (fillCount > PCK_1K) ? PCK_1K : (uint16_t)fillCount;
+					if (_fm_write(p_ffd, u8a_workbuf, bytesReceived))
+					{
+						// Error, Disk full!
+						return FM_DISK_FULL;
+					}
+					fillCount -= bytesReceived;
+				}
+				
+				_pace();
+				_sendByte(ACK);
+				break;
+#endif
 			case PCK_EOT:	/* End of File received */
-				f_sync(p_ffd);
+				if (_fm_sync(p_ffd))	return FM_DISK_FULL;
 				_sendByte(ACK);
 				failedAttempts = 0;
 				excecuteLoop = 1;
 				break;
+			case PCK_DUPLICATE:	/* Previous packet again, the sender missed our ACK */
+				if (!initialTransmission)
+				{
+					/* Acknowledge it once more, without writing it again. Counts as
+					 * failed attempt, a sender repeating it forever gets nowhere */
+					FM_STAT(retries);
+					if (++failedAttempts >= MAX_ERR)
+					{
+						excecuteLoop = 3;
+						break;
+					}
+					_sendByte(ACK);
+					break;
+				}
+				/* Nothing received yet, so it can't be a repetition */
+				/* fall through */
 			case PCK_TIMEOUT:	/* Timeout */
 			case PCK_INVALID:	/* Checksum / Packet-ID / CRC Error */
 				/* Flush the Rx Buffer, assumed we have received only gibberish */
 				_flushRx();
 				
+				if (packetResult == PCK_TIMEOUT)
+				{
+					FM_STAT(timeouts);
+				}
+				else
+				{
+					FM_STAT(errors);
+				}
+				
 				if (initialTransmission)
 				{
 					/* Still negotiating if CRC or Checksum has to be used?
 					 * After SRT_TRY amount of failed attempts, fall back to
 					 * classic checksum (which client doesn't support CRC anyways?) */
 					failedAttempts++;
+#ifdef XMODEM_FILL_EXT
+					/* Fill records are only asked for FILL_TRY times, a sender that
+					 * doesn't know them just ignores the 'F' */
+					if ( (failedAttempts == FILL_TRY) && useFill)
+					{
+						useFill = 0;
+						failedAttempts = 0;
+					}
+					else
+#endif
 					if ( (failedAttempts == SRT_TRY) && useCRC)
 					{
 						useCRC = 0;
@@ -451,6 +789,7 @@ enum file_modem xmodem_receive(FIL *p_ffd, uint32_t *p_maxsize)
 					{
 						excecuteLoop = 3;
 					}
+					FM_STAT(retries);
 					_sendByte(NAK);
 				}
 				break;
@@ -471,3 +810,225 @@ enum file_modem xmodem_receive(FIL *p_ffd, uint32_t *p_maxsize)
 	/* Return the Result */
 	return (enum file_modem)(--excecuteLoop);
 }
+
+/* State of a running X-Modem transmission */
+struct xmodemSend {
+	uint8_t packetCounter;		// Packet Counter. Xmodem starts with Packet 1. Can roll over
+	uint8_t useCRC;				// States if 16-bit CRC or basic 8-Bit Checksum has to be used
+	uint8_t useFill;			// Receiver asked for fill records
+	uint16_t packetSize;		// Largest packet to use: 1k with CRC, else 128
+	FSIZE_t totalBytesSent;
+};
+
+/**
+  * @brief Waits for the receiver to poke us, which also tells CRC or Checksum
+  *
+  * @return		FM_OK, FM_INVALID_START if the receiver doesn't show up or
+  *				FM_ABORTED if it cancelled
+  */
+static enum file_modem _xmodem_start(struct xmodemSend *p_xs)
+{
+	uint8_t failedAttempts = 0, u8_ch;
+	
+	memset(p_xs, 0, sizeof(struct xmodemSend));
+	p_xs->packetCounter = 1;
+	_fm_statStart();
+	
+	do{
+		if (_recByte(&u8_ch, TIMEOUT))
+		{
+			u8_ch = 0;
+			if (++failedAttempts >= MAX_ERR)	return FM_INVALID_START;
+		}
+		else if (u8_ch == CAN)
+		{
+			return FM_ABORTED;
+		}
+	}while( (u8_ch != CRC16) && (u8_ch != NAK)
+#ifdef XMODEM_FILL_EXT
+		&& (u8_ch != FILLREQ)
+#endif
+	);
+	p_xs->useCRC = (u8_ch != NAK);
+#ifdef XMODEM_FILL_EXT
+	p_xs->useFill = (u8_ch == FILLREQ);
+#endif
+	p_xs->packetSize = p_xs->useCRC ? PCK_1K : PCK_SIZ;
+	return FM_OK;
+}
+
+/**
+  * @brief Sends the next packet out of the data that is waiting
+  *
+  * A run at the start of the data that is longer than a fill record (or all
+  * that is left) goes as fill record, if the receiver asked for them. Else a
+  * 1k packet if there is enough data for it, or a 128 Byte packet. If there
+  * isn't even enough for that, the data is copied to the work buffer and
+  * padded with SUB, which only happens for the last packet.
+  *
+  * @param p_data	Data waiting to be sent
+  * @param u16_len	Amount of data waiting
+  * @param p_sent	Holds how many Bytes of the data have been sent
+  *
+  * @return			Result of _transmitPacket
+  */
+static enum file_modem _xmodem_sendData(struct xmodemSend *p_xs, const uint8_t *p_data, uint16_t u16_len, uint16_t *p_sent)
+{
+	enum file_modem result;
+	uint16_t sent;
+#ifdef XMODEM_FILL_EXT
+	uint8_t fillRecord[FILL_REC];	// Count & Fill-Value of a fill record
+	uint16_t runLength;			// Identical Bytes at the start of the data
+	
+	for (runLength = 1; (runLength < u16_len) && (p_data[runLength] == p_data[0]); runLength++);
+	if ( p_xs->useFill && ((runLength >= FILL_MIN) || (runLength == u16_len)) )
+	{
+		fillRecord[0] = 0;
+		fillRecord[1] = 0;
+		fillRecord[2] = (uint8_t)(runLength >> 8);
+		fillRecord[3] = (uint8_t)runLength;
+		fillRecord[4] = p_data[0];
+		result = _transmitPacket(FILL, p_xs->packetCounter, fillRecord, FILL_REC, p_xs->useCRC);
+		sent = runLength;
+	}
+	else
+#endif
+	{
+		sent = ((u16_len >= PCK_1K) && (p_xs->packetSize == PCK_1K)) ? PCK_1K : PCK_SIZ;
+		if (u16_len < sent)
+		{
+			if (p_data != u8a_workbuf)	memcpy(u8a_workbuf, p_data, u16_len);
+			memset(&u8a_workbuf[u16_len], SUB, sent - u16_len);
+			p_data = u8a_workbuf;
+		}
+		result = _transmitPacket((sent == PCK_1K) ? STX : SOH, p_xs->packetCounter, p_data, sent, p_xs->useCRC);
+		if (sent > u16_len)	sent = u16_len;
+	}
+	
+	if (result == FM_OK)
+	{
+		_fm_statPacket(sent);
+		p_xs->packetCounter++;
+		p_xs->totalBytesSent += sent;
+		*p_sent = sent;
+	}
+	else if (result == FM_ABORTED)
+	{
+		_flushRx();
+	}
+	return result;
+}
+
+/**
+  * @brief Sends End of Transmission until it gets acknowledged
+  */
+static enum file_modem _xmodem_finish(void)
+{
+	uint8_t failedAttempts, u8_ch;
+	
+	for (failedAttempts = 0; failedAttempts < MAX_ERR; failedAttempts++)
+	{
+		_flushRx();
+		_sendByte(EOT);
+		if (!_recByte(&u8_ch, TIMEOUT) && (u8_ch == ACK))	return FM_OK;
+	}
+	return FM_TIMEOUT;
+}
+
+/**
+  * @brief Sends a data stream with X-Modem, pulling the data from a producer
+  *
+  * Meant for data that isn't stored in a file (logs, sensor dumps, RAM
+  * snapshots) and of which the length isn't known beforehand. Only the work
+  * buffer is used for buffering: Packets get sent as soon as they are full.
+  * If the producer hands out less than asked for, all full 128 Byte packets
+  * are sent right away, so slowly trickling data doesn't stall the receiver.
+  * With a CRC receiver 1k packets are used, the last packet is padded with
+  * SUB. A receiver asking for fill records gets runs of identical Bytes as
+  * fill records, if XMODEM_FILL_EXT is enabled.
+  *
+  * @param produce	Producer callback. Gets a buffer and the amount of Bytes
+  *					that fit into it and returns how many it stored. May block
+  *					until there is data, returns zero at the end of the stream.
+  * @param p_size	Holds the amount of Bytes sent at the end
+  *
+  * @return			FM_OK if successful, else the reason of the failure
+  */
+enum file_modem xmodem_send_stream(uint16_t (*produce)(uint8_t*, uint16_t), FSIZE_t *p_size)
+{
+	struct xmodemSend xs;		// State of the transmission
+	enum file_modem result;		// Result of the packet transmission
+	uint8_t endOfData = 0;		// Producer has no more data
+	uint16_t bufferFill = 0;	// Bytes waiting in the work buffer
+	uint16_t requested, produced;
+	uint16_t sent;				// Bytes of the buffer sent by the last packet
+	
+	*p_size = 0;
+	result = _xmodem_start(&xs);
+	if (result != FM_OK)	return result;
+	
+	/* --- Main Send Loop --- */
+	do{
+		/* Fill the buffer up to a packet. Stop early if the producer has less
+		 * than asked for, but enough for a small packet */
+		while (!endOfData && (bufferFill < xs.packetSize))
+		{
+			requested = xs.packetSize - bufferFill;
+			produced = produce(&u8a_workbuf[bufferFill], requested);
+			if (produced > requested)	produced = requested;
+			if (!produced)	endOfData = 1;
+			bufferFill += produced;
+			if ( (produced < requested) && (bufferFill >= PCK_SIZ) )	break;
+		}
+		if (!bufferFill)	break;
+		
+		result = _xmodem_sendData(&xs, u8a_workbuf, bufferFill, &sent);
+		*p_size = xs.totalBytesSent;
+		if (result != FM_OK)	return result;
+		
+		bufferFill -= sent;
+		memmove(u8a_workbuf, &u8a_workbuf[sent], bufferFill);
+	}while(bufferFill || !endOfData);
+	
+	return _xmodem_finish();
+}
+
+/**
+  * @brief Sends a memory region with X-Modem, without copying it
+  *
+  * The packets are sent straight out of the region, the work buffer is only
+  * used for the padded last packet. Works for anything that is mapped into
+  * the address space: RAM, memory mapped (XIP) flash of a MCU or a file
+  * mapped with mmap. Flash that needs special instructions to be read (like
+  * the program memory of classic AVRs) can't be sent this way, use
+  * xmodem_send_stream() with a producer reading it instead.
+  * Most efficient together with file_modem_block(), which hands the packets
+  * to the UART driver (DMA) as a whole.
+  *
+  * @param p_data	Start of the memory region
+  * @param len		Length of the memory region, beyond 4 GiB with exFAT's
+  *					64-bit FSIZE_t (a mapped file on a host)
+  *
+  * @return			FM_OK if successful, else the reason of the failure
+  */
+enum file_modem xmodem_send_memory(const uint8_t *p_data, FSIZE_t len)
+{
+	struct xmodemSend xs;		// State of the transmission
+	enum file_modem result;		// Result of the packet transmission
+	uint16_t sent;				// Bytes of the region sent by the last packet
+	
+	result = _xmodem_start(&xs);
+	if (result != FM_OK)	return result;
+	
+	/* --- Main Send Loop --- */
+	while (len)
+	{
+		result = _xmodem_sendData(&xs, p_data, (len > xs.packetSize) ? xs.packetSize : (uint16_t)len, &sent);
+		if (result != FM_OK)	return result;
+		
+		p_data += sent;
+		len -= sent;
+	}
+	
+	return _xmodem_finish();
+}
@@ -14,10 +14,304 @@
 
 #define XMODEM_NON_STANDARD
 
-enum file_modem {FM_OK,FM_INVALID_START,FM_TIMEOUT,FM_ABORTED};
+/* Run-length fill records (non-standard, negotiated). The receiver first pokes
+ * the sender with 'F' instead of 'C'. A sender that knows the extension answers
+ * with CRC-16 packets and may replace runs of identical bytes by a fill record:
+ *   FILL | Blk# | ~Blk# | Count (4 Bytes, MSB first) | Byte | CRC-16 (over Count & Byte)
+ * A fill record consumes a block number like any other packet. Senders that
+ * don't know it ignore the 'F' and the receiver falls back to 'C' / NAK. */
+//#define XMODEM_FILL_EXT
+
+/* N-Modem, the native protocol (see nmodem.c). Amount of packets the receiver
+ * accepts ahead of the first missing one (max. 32) and the largest packet size
+ * it offers (max. 1024) */
+#ifndef NMODEM_WINDOW
+#define NMODEM_WINDOW	8
+#endif
+#ifndef NMODEM_PACKET
+#define NMODEM_PACKET	1024
+#endif
+
+/* Kermit receiver (see kermit.c). Packets it keeps ahead of a missing one
+ * (sliding window, max. 31) and the longest packet it accepts (max. 9024).
+ * The window needs KERMIT_WINDOW * KERMIT_MAXL Bytes of RAM. Define
+ * KERMIT_EXTERNAL_POOL if it always comes from file_modem_pool(). */
+#ifndef KERMIT_WINDOW
+#define KERMIT_WINDOW	4
+#endif
+#ifndef KERMIT_MAXL
+#define KERMIT_MAXL		1024
+#endif
+
+/* Link parameters, the defaults are used until file_modem_tune() sets others.
+ * nmodem_probe() measures the link and picks them for the session. */
+struct fm_tune {
+	uint16_t timeout;		// Timeout waiting for a Byte or an answer, ms
+	uint8_t maxErr;			// Retries before giving up
+	uint8_t pace;			// Pause after every accepted X-Modem packet, ms
+	uint16_t packet;		// Largest N-Modem packet offered, up to NMODEM_PACKET
+	uint8_t window;			// N-Modem window offered, up to NMODEM_WINDOW
+};
+
+/* The original docs state a timeout of 10 seconds, but that's a bit long at
+ * 10 retries. Without the pause ExtraPUTTY crashes without an error message
+ * after a few hundred packets. */
+#define FM_TUNE_DEFAULT	{3000, 10, 10, NMODEM_PACKET, NMODEM_WINDOW}
+
+/* Buffer pool, see fm_pool.c. Fixed size buffers with a reference count each
+ * in memory the application provides, FM_POOL_MEM(count, size) Bytes for
+ * count buffers of size Bytes. The struct belongs to the pool. */
+#ifndef FM_POOL_ALIGN
+#ifdef __AVR__
+#define FM_POOL_ALIGN	1
+#else
+#define FM_POOL_ALIGN	64
+#endif
+#endif
+#define FM_POOL_BLOCK(size)			(((uint32_t)(size) + FM_POOL_ALIGN) / FM_POOL_ALIGN * FM_POOL_ALIGN)
+#define FM_POOL_MEM(count, size)	((count) * FM_POOL_BLOCK(size) + FM_POOL_ALIGN - 1)
+struct fm_pool {
+	uint8_t *p_free;			// First free buffer, chained through their first Bytes
+	uint16_t bufSize;			// Usable size of a buffer
+	uint16_t count;				// Buffers in the pool
+	uint16_t available;			// Buffers not in use
+};
+
+/* Transfer statistics, counted by the receive functions once enabled with
+ * file_modem_stats(). The counters only ever grow and are written by the
+ * receiving thread alone, other threads may read them at any time without
+ * locking (see fm_stats_prometheus()). latency[n] counts the times between two
+ * accepted packets of up to FM_STATS_BOUNDS[n] milliseconds, the last bucket
+ * all the longer ones. */
+#define FM_STATS_BUCKETS	10
+#define FM_STATS_BOUNDS		{5, 10, 20, 50, 100, 200, 500, 1000, 3000}
+
+struct fm_stats {
+	FSIZE_t bytes;			// Payload Bytes stored
+	uint32_t packets;		// Packets accepted
+	uint32_t retries;		// Packets asked for again or received twice
+	uint32_t timeouts;		// Timeouts while waiting for a packet
+	uint32_t errors;		// Damaged or unexpected packets
+	uint32_t latency[FM_STATS_BUCKETS];
+	uint32_t latencySum;	// Sum of all times in latency[], in milliseconds
+};
+
+/* Write scheduler for host processes receiving on many ports into the same
+ * disk, see fm_sched.c. Every file registered with fm_sched_open() becomes a
+ * session, whose writes are buffered and written in large batches, taking
+ * turns with the other sessions according to their weight. The structs belong
+ * to the scheduler, the application only provides the memory. */
+struct fm_session {
+	FIL *p_ffd;					// File of the session
+	uint8_t *p_buf[2];			// Halves of the session buffer
+	uint32_t halfSize;
+	uint32_t fill[2];			// Bytes in each half
+	FSIZE_t offset[2];			// File offset of each half
+	uint32_t seq[2];			// Queue order of each half
+	uint8_t queued[2];			// 0: Free, 1: Waiting for the disk, 2: Being written
+	uint8_t active;				// Half currently filled
+	uint8_t weight;				// Share of the disk
+	uint8_t failed;				// A write of the session failed
+	uint32_t deficit;			// Bytes the session may still write this round
+	FSIZE_t position;			// File offset of the next write
+	struct fm_session *p_next;
+};
+
+struct fm_sched {
+	struct fm_session *p_sessions;
+	struct fm_session *p_cursor;	// Session the round robin continues with
+	uint32_t quantum;
+	void (*lockQueue)(void);
+	void (*unlockQueue)(void);
+	void (*lockDisk)(void);
+	void (*unlockDisk)(void);
+};
+
+/* Files of known size, see file_modem_expect(). The file is allocated in one
+ * piece and the disk driver gets the sectors it is going to be written to,
+ * through disk_ioctl() with FM_CTRL_WRITE_HINT and an LBA_t[2] of the first
+ * sector and the count. An SD driver may pre-erase them (ACMD23, or CMD32/
+ * CMD33/CMD38) and keep a multiple block write (CMD25) open while the writes
+ * continue where the last one ended, until CTRL_SYNC or another sector.
+ * Drivers that don't know the code return RES_PARERR, which is fine. */
+#ifndef FM_CTRL_WRITE_HINT
+#define FM_CTRL_WRITE_HINT	0x60
+#endif
+#ifndef FM_EXPECT_FILES
+#define FM_EXPECT_FILES		4
+#endif
+
+/* Fan-out of a transfer to several sinks, see fm_sink.c. Set up the sinks
+ * with fm_sink_init() or fm_sink_file(), the application only provides the
+ * memory. failed tells which sinks got all the data. */
+struct fm_sink {
+	uint8_t (*write)(void *p_ctx, FSIZE_t offset, const uint8_t *p_buf, uint16_t u16_len);
+	uint8_t (*sync)(void *p_ctx);
+	void *p_ctx;
+	uint8_t *p_buf;				// Buffer, NULL if every packet gets written right away
+	uint16_t bufSize;
+	uint16_t fill;				// Bytes in the buffer
+	FSIZE_t offset;				// File offset of the buffer
+	FSIZE_t position;			// File offset of the next write
+	uint32_t syncEvery;			// Sync interval in Bytes, zero only at the end of the file
+	uint32_t unsynced;			// Bytes since the last sync
+	uint8_t failed;
+};
+
+/* When a transfer with a fan-out fails */
+enum fm_fanout_policy {FM_FANOUT_ALL, FM_FANOUT_FIRST, FM_FANOUT_ANY};
+
+struct fm_fanout {
+	FIL *p_ffd;					// File passed to the receive function
+	struct fm_sink *p_sinks;
+	uint8_t count;
+	uint8_t policy;
+	struct fm_fanout *p_next;
+};
+
+/* Deduplicating sink, see fm_dedup.c. Files are stored as a manifest of
+ * blocks in a content-addressed block store shared by all of them, blocks
+ * already in the store aren't written again. FM_DEDUP_BLOCK is the largest
+ * block and the slot size in the block file. */
+#ifndef FM_DEDUP_BLOCK
+#ifdef __AVR__
+#define FM_DEDUP_BLOCK	512
+#else
+#define FM_DEDUP_BLOCK	4096
+#endif
+#endif
+struct fm_dedup_entry {
+	uint32_t crc;				// CRC-32 of the block
+	uint32_t block;				// Number of the block in the store
+	uint16_t len;				// Length of the block, zero if the entry is free
+};
+struct fm_dedup {
+	FIL *p_blocks;				// Block file
+	FIL *p_index;				// CRC-32 and length of every block
+	struct fm_dedup_entry *p_table;	// Lookup table, open addressing by CRC-32
+	uint16_t tableSize;
+	uint16_t used;				// Entries in use
+	uint32_t count;				// Blocks in the store
+	uint32_t hits;				// Blocks found in the store instead of written
+	FSIZE_t saved;				// Bytes not written thanks to them
+};
+struct fm_dedup_file {
+	struct fm_dedup *p_store;
+	FIL *p_manifest;
+};
+
+/* Compressing sink, see fm_pack.c. Every chunk (up to FM_PACK_CHUNK Bytes)
+ * is packed on its own and listed in a chunk index, fm_pack_read() reads
+ * the file back from any offset. FM_PACK_HASH entries of the match finder
+ * live in the struct. */
+#ifndef FM_PACK_CHUNK
+#ifdef __AVR__
+#define FM_PACK_CHUNK	512
+#define FM_PACK_HASH	256
+#else
+#define FM_PACK_CHUNK	4096
+#define FM_PACK_HASH	2048
+#endif
+#endif
+struct fm_pack {
+	FIL *p_data;				// Packed chunks
+	FIL *p_index;				// Offset, data offset and lengths of every chunk
+	uint8_t *p_work;			// Packed chunk being written or read
+	uint8_t *p_chunk;			// Unpacked chunk for reading
+	FSIZE_t chunkOffset;		// Offset of the chunk in p_chunk
+	uint16_t chunkLen;			// Its length, zero if none is loaded
+	uint16_t chunk;				// Chunk size of the file, from the index
+	FSIZE_t raw;				// Bytes of the file
+	FSIZE_t packed;				// Bytes in the data file
+	uint16_t hash[FM_PACK_HASH];	// Positions of 3 Byte sequences in the chunk
+};
+
+/* Tuning cache, see fm_peer.c. The link parameters, protocol and baud rate
+ * that worked for a peer are kept in a file and used for the next session
+ * with it. The application only provides the memory. */
+#define FM_PEER_RECORD	18
+enum fm_protocol {FM_PROTO_XMODEM, FM_PROTO_NMODEM, FM_PROTO_KERMIT};
+struct fm_peer {
+	FIL *p_ffd;					// Cache file
+	FSIZE_t slot;				// Offset of the record of the peer
+	uint32_t id;				// Identity of the peer, see fm_peer_id()
+	uint32_t baud;				// Baud rate that worked, zero if it doesn't matter
+	uint8_t protocol;			// Protocol that worked (enum fm_protocol)
+	uint8_t fails;				// Sessions failed since the record has been written
+	uint8_t cached;				// The session uses the record
+	struct fm_tune tune;		// Link parameters that worked
+};
+
+/* Progress journal, see fm_journal.c. A sink that records, at every sync,
+ * up to which offset the file is on the disk and its CRC-32 up to there, so
+ * an interrupted transfer can restart from that offset. ranges[] holds data
+ * written beyond a gap (out of order), one per gap in the N-Modem window.
+ * The application only provides the memory. */
+#define FM_JOURNAL_RECORD	21
+#ifndef FM_JOURNAL_RANGES
+#define FM_JOURNAL_RANGES	((NMODEM_WINDOW + 1) / 2)
+#endif
+struct fm_journal_range {
+	FSIZE_t start, end;
+};
+struct fm_journal {
+	FIL *p_data;				// File the data goes to
+	FIL *p_log;					// Journal file
+	uint32_t id;				// Identity of the transfer
+	uint32_t seq;				// Sequence number of the last record
+	FSIZE_t durable;			// The file is on the disk up to here
+	uint32_t durableCrc;		// CRC-32 of the file up to durable
+	FSIZE_t written;			// Everything below has been written
+	FSIZE_t hashed;				// The CRC-32 runs up to here, at most written
+	uint32_t crc;				// CRC-32 so far, not inverted yet
+	struct fm_journal_range ranges[FM_JOURNAL_RANGES];
+	uint8_t rangeCount;
+};
+
+enum file_modem {FM_OK,FM_INVALID_START,FM_TIMEOUT,FM_ABORTED,FM_DISK_FULL=5,FM_SIZE_EXCEEDED};
 
 void file_modem_init(uint8_t (*recByte)(uint8_t*,uint16_t), void (*sendByte)(uint8_t), void (*flushRx)(void));
-enum file_modem xmodem_receive(FIL *p_ffd, uint32_t *p_maxsize);
+void file_modem_block(void (*sendBlock)(const uint8_t*, uint16_t));
+void file_modem_delay(void (*delay)(uint16_t));
+void file_modem_tune(const struct fm_tune *p_tune);
+void file_modem_pool(struct fm_pool *p_pool);
+enum file_modem xmodem_receive(FIL *p_ffd, FSIZE_t *p_maxsize);
+enum file_modem nmodem_receive(FIL *p_ffd, FSIZE_t *p_maxsize);
+enum file_modem nmodem_resume(FIL *p_ffd, FSIZE_t *p_maxsize, FSIZE_t start);
+enum file_modem kermit_receive(FIL *p_ffd, FSIZE_t *p_maxsize);
+enum file_modem nmodem_probe(struct fm_tune *p_tune, uint32_t (*millis)(void));
+enum file_modem xmodem_send_stream(uint16_t (*produce)(uint8_t*, uint16_t), FSIZE_t *p_size);
+enum file_modem xmodem_send_memory(const uint8_t *p_data, FSIZE_t len);
+void file_modem_stats(struct fm_stats *p_stats, uint32_t (*millis)(void));
+uint16_t fm_stats_prometheus(const struct fm_stats *p_stats, const char *const *p_ports, uint8_t u8_count,
+	char *p_buf, uint16_t u16_len);
+void file_modem_expect(FIL *p_ffd, FSIZE_t size);
+void fm_sched_init(struct fm_sched *p_sched, uint32_t u32_quantum, void (*lockQueue)(void), void (*unlockQueue)(void),
+	void (*lockDisk)(void), void (*unlockDisk)(void));
+void fm_sched_open(struct fm_session *p_s, FIL *p_ffd, uint8_t *p_buf, uint32_t u32_size, uint8_t u8_weight);
+uint8_t fm_sched_close(struct fm_session *p_s);
+void fm_sink_init(struct fm_sink *p_s, uint8_t (*write)(void*, FSIZE_t, const uint8_t*, uint16_t),
+	uint8_t (*sync)(void*), void *p_ctx, uint8_t *p_buf, uint16_t u16_size, uint32_t u32_syncEvery);
+void fm_sink_file(struct fm_sink *p_s, FIL *p_ffd, uint8_t *p_buf, uint16_t u16_size, uint32_t u32_syncEvery);
+void fm_fanout_open(struct fm_fanout *p_f, FIL *p_ffd, struct fm_sink *p_sinks, uint8_t u8_count, uint8_t u8_policy);
+uint8_t fm_fanout_close(struct fm_fanout *p_f);
+uint8_t fm_dedup_open(struct fm_dedup *p_d, FIL *p_blocks, FIL *p_index, struct fm_dedup_entry *p_table,
+	uint16_t u16_size);
+void fm_sink_dedup(struct fm_sink *p_s, struct fm_dedup_file *p_f, struct fm_dedup *p_store, FIL *p_manifest,
+	uint8_t *p_buf, uint16_t u16_size);
+uint8_t fm_dedup_restore(struct fm_dedup *p_d, FIL *p_manifest, FIL *p_dst, uint8_t *p_buf, uint16_t u16_size);
+uint16_t fm_pool_init(struct fm_pool *p_pool, void *p_mem, uint32_t u32_size, uint16_t u16_bufSize);
+uint8_t *fm_pool_get(struct fm_pool *p_pool);
+uint8_t fm_pool_ref(struct fm_pool *p_pool, uint8_t *p_buf);
+void fm_pool_put(struct fm_pool *p_pool, uint8_t *p_buf);
+uint8_t fm_pack_open(struct fm_pack *p_pk, FIL *p_data, FIL *p_index, uint8_t *p_work, uint8_t *p_chunk);
+void fm_sink_pack(struct fm_sink *p_s, struct fm_pack *p_pk, uint8_t *p_buf, uint16_t u16_size, uint32_t u32_syncEvery);
+uint8_t fm_pack_read(struct fm_pack *p_pk, FSIZE_t offset, uint8_t *p_buf, uint16_t u16_len, uint16_t *p_got);
+uint32_t fm_peer_id(const char *p_port, const char *p_peer);
+uint8_t fm_peer_begin(struct fm_peer *p_p, FIL *p_cache, uint32_t u32_id);
+uint8_t fm_peer_end(struct fm_peer *p_p, enum file_modem result, uint8_t u8_protocol, uint32_t u32_baud);
+uint8_t fm_journal_open(struct fm_journal *p_j, FIL *p_data, FIL *p_log, uint32_t u32_id);
+void fm_sink_journal(struct fm_sink *p_s, struct fm_journal *p_j, uint8_t *p_buf, uint16_t u16_size, uint32_t u32_syncEvery);
 
 /*
 This is in the works / To do:
@@ -26,4 +320,4 @@ uint8_t ymoden_receive(FATFS *p_fs, uint32_t *p_maxsize, char *p_filename);
 uint8_t ymoden_transmit(FIL *ffd, uint32_t u32_fileSize, char *sendName);
 */
 
-#endif /* FILE_MODEM_H_ */
\ No newline at end of file
+#endif /* FILE_MODEM_H_ */
\ No newline at end of file
@@ -0,0 +1,101 @@
+/*
+ * file_modem_int.h
+ *
+ * Internals shared between the protocol engines of the file modem.
+ * Not meant to be included by the application, use file_modem.h instead.
+ *
+ * Created: 18.10.2026 10:02:17
+ *  Author: gfcwfzkm
+ */ 
+
+
+#ifndef FILE_MODEM_INT_H_
+#define FILE_MODEM_INT_H_
+
+#include "file_modem.h"
+
+/* Supported Packet Sizes. Theoretically, more sizes could be added
+ * (Possible Z-Modem Implementation in the future? */
+#define PCK_SIZ	128
+#define PCK_1K	1024
+
+#define SRT_TRY	5		// Amount of retries to initiate a CRC transmission, followed by retries of checksum transmission,
+						// before the receiver gives up
+
+/* Storage class of the state of a transfer: Work buffer, callbacks, link
+ * parameters, pool, the engine state and the statistics belong to the thread
+ * running it. A host process may receive on several ports, one thread each,
+ * every thread sets up its own port with file_modem_init() and friends.
+ * On AVR, or without thread local storage, there is one receiver at a time. */
+#ifdef __AVR__
+#define FM_THREAD
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define FM_THREAD	_Thread_local
+#elif defined(__GNUC__)
+#define FM_THREAD	__thread
+#else
+#define FM_THREAD
+#endif
+
+/* Link parameters in use, see file_modem_tune() */
+extern FM_THREAD struct fm_tune _fm_tune;
+#define MAX_ERR	(_fm_tune.maxErr)	// Amount of Retries before the receiver gives up
+#define TIMEOUT	(_fm_tune.timeout)	// Timeout time in milliseconds
+
+/* Size of the shared work buffer. Large enough for a 1k X-Modem packet or
+ * a N-Modem data frame (Type, Offset, Payload and CRC-32) */
+#define WORKBUF_SIZ	(PCK_1K + 9)
+
+extern FM_THREAD uint8_t u8a_workbuf[WORKBUF_SIZ];
+
+/* Pool of the application, NULL if the engines use their own memory */
+extern FM_THREAD struct fm_pool *_fm_pool;
+
+extern FM_THREAD uint8_t (*_recByte)(uint8_t*, uint16_t);
+extern FM_THREAD void (*_sendByte)(uint8_t);
+extern FM_THREAD void (*_sendBlock)(const uint8_t*, uint16_t);
+extern FM_THREAD void (*_flushRx)(void);
+extern FM_THREAD void (*_delay)(uint16_t);
+
+uint32_t _crc32_update(uint32_t crc, uint8_t data);
+
+/* Numbers stored LSB first and the check Byte of records, see file_modem.c */
+void _fm_put16(uint8_t *p_buf, uint16_t u16_val);
+void _fm_put32(uint8_t *p_buf, uint32_t u32_val);
+void _fm_put64(uint8_t *p_buf, FSIZE_t val);
+uint16_t _fm_get16(const uint8_t *p_buf);
+uint32_t _fm_get32(const uint8_t *p_buf);
+FSIZE_t _fm_get64(const uint8_t *p_buf);
+uint8_t _fm_check(const uint8_t *p_rec, uint8_t u8_len);
+
+/* Run of Bytes holding none of the three, see fm_scan.c */
+uint16_t _fm_span(const uint8_t *p_buf, uint16_t u16_len, uint8_t u8_a, uint8_t u8_b, uint8_t u8_c);
+
+/* Statistics, see fm_stats.c. Counting is skipped if they aren't enabled */
+extern FM_THREAD struct fm_stats *_stats;
+#define FM_STAT(field)	do { if (_stats) _stats->field++; } while (0)
+void _fm_statStart(void);
+void _fm_statPacket(uint32_t u32_bytes);
+
+/* Clock set with file_modem_stats(), NULL if none. The receivers read their
+ * packets with _fm_recByte(), which times out at once after the idle deadline */
+extern FM_THREAD uint32_t (*_fm_millis)(void);
+uint8_t _fm_idle(void);
+#define _fm_recByte(p_ch)	( (_fm_millis && _fm_idle()) || _recByte((p_ch), TIMEOUT) )
+
+/* Storage, used by the receive functions, see fm_sink.c. Writes to the sinks
+ * if the file has a fan-out, to the file otherwise. Zero if successful, one if not. */
+uint8_t _fm_write(FIL *p_ffd, const uint8_t *p_buf, uint16_t u16_len);
+uint8_t _fm_seek(FIL *p_ffd, FSIZE_t offset);
+uint8_t _fm_sync(FIL *p_ffd);
+FSIZE_t _fm_limit(FIL *p_ffd, FSIZE_t maxsize, FSIZE_t from);
+uint8_t _fm_hasFanout(FIL *p_ffd);
+
+/* File access, see fm_sched.c. Goes straight to FatFs unless the file belongs
+ * to a session of the write scheduler. */
+uint8_t _fm_fileWrite(FIL *p_ffd, const uint8_t *p_buf, uint16_t u16_len);
+uint8_t _fm_fileSeek(FIL *p_ffd, FSIZE_t offset);
+uint8_t _fm_fileSync(FIL *p_ffd);
+uint8_t _fm_fileTrim(FIL *p_ffd);
+
+#endif /* FILE_MODEM_INT_H_ */
@@ -0,0 +1,286 @@
+/*
+ * fm_dedup.c
+ *
+ * Deduplicating sink: Received data is cut into blocks of up to
+ * FM_DEDUP_BLOCK Bytes (the buffer of the sink), every block is looked up
+ * by its CRC-32 in a content-addressed block store shared by all files.
+ * A block the store already holds costs no write but a manifest record,
+ * so the same asset received under several names is stored once.
+ *
+ * Block store, two files:
+ *   Blocks: Block n at offset n * FM_DEDUP_BLOCK
+ *   Index:  CRC-32 (4) | Length (2), one record per block, LSB first
+ * The index is written after the block, a block without index record (power
+ * lost in between) doesn't exist and gets overwritten by the next new one.
+ * That order alone doesn't reach the disk, FatFs may write the index sector
+ * first. But it stores the new size of a file only on a sync, and the sink
+ * syncs the blocks, then the index, then the manifest: Index records past
+ * the last sync don't count after a power loss, the ones before have their
+ * block on the disk. A matching CRC is confirmed by comparing the stored
+ * block, a collision only costs a new block.
+ *
+ * Manifest, the file the sink stands for, one record per written chunk:
+ *   Offset (8) | Block (4) | Length (2)
+ * Records are replayed in order by fm_dedup_restore(), later ones win.
+ *
+ * The lookup table lives in RAM (provided by the application) and is filled
+ * from the index by fm_dedup_open(). Once it is full, further new blocks are
+ * still stored but not found again.
+ *
+ * Created: 19.10.2026 00:22:08
+ *  Author: gfcwfzkm
+ */
+
+#include "file_modem_int.h"
+#include <string.h>
+
+#define DD_INDEX	6		// Length of an index record
+#define DD_RECORD	14		// Length of a manifest record
+#define DD_CMP		32		// Bytes compared at once
+
+/**
+  * @brief Reads exactly the requested Bytes
+  *
+  * @return		Zero if successful, one if not
+  */
+static uint8_t _read(FIL *p_ffd, FSIZE_t offset, uint8_t *p_buf, uint16_t u16_len)
+{
+	UINT got;
+
+	if (f_lseek(p_ffd, offset) != FR_OK)	return 1;
+	return (f_read(p_ffd, p_buf, u16_len, &got) != FR_OK) || (got != u16_len);
+}
+
+/**
+  * @brief Writes exactly the given Bytes
+  *
+  * @return		Zero if successful, one if not
+  */
+static uint8_t _write(FIL *p_ffd, FSIZE_t offset, const uint8_t *p_buf, uint16_t u16_len)
+{
+	UINT written;
+
+	if (f_lseek(p_ffd, offset) != FR_OK)	return 1;
+	return (f_write(p_ffd, p_buf, u16_len, &written) != FR_OK) || (written != u16_len);
+}
+
+/**
+  * @brief Puts a block into the lookup table, if there is room left
+  */
+static void _insert(struct fm_dedup *p_d, uint32_t u32_crc, uint32_t u32_block, uint16_t u16_len)
+{
+	struct fm_dedup_entry *p_e;
+	uint16_t u16_pos = (uint16_t)(u32_crc % p_d->tableSize);
+
+	if (p_d->used >= p_d->tableSize)	return;
+	for (p_e = &p_d->p_table[u16_pos]; p_e->len; p_e = &p_d->p_table[u16_pos])
+	{
+		if (++u16_pos == p_d->tableSize)	u16_pos = 0;
+	}
+	p_e->crc = u32_crc;
+	p_e->block = u32_block;
+	p_e->len = u16_len;
+	p_d->used++;
+}
+
+/**
+  * @brief Compares data with a stored block
+  *
+  * @return		One if they are the same, zero if not or the block can't be read
+  */
+static uint8_t _same(struct fm_dedup *p_d, uint32_t u32_block, const uint8_t *p_buf, uint16_t u16_len)
+{
+	uint8_t u8a_cmp[DD_CMP];
+	FSIZE_t offset = (FSIZE_t)u32_block * FM_DEDUP_BLOCK;
+	uint16_t u16_part;
+
+	while (u16_len)
+	{
+		u16_part = (u16_len > DD_CMP) ? DD_CMP : u16_len;
+		if (_read(p_d->p_blocks, offset, u8a_cmp, u16_part))	return 0;
+		if (memcmp(u8a_cmp, p_buf, u16_part))					return 0;
+		offset += u16_part;
+		p_buf += u16_part;
+		u16_len -= u16_part;
+	}
+	return 1;
+}
+
+/**
+  * @brief Finds a block with the given content, stores a new one if there is none
+  *
+  * @param p_block	Gets the number of the block
+  *
+  * @return		Zero if successful, one on a disk error
+  */
+static uint8_t _lookup(struct fm_dedup *p_d, const uint8_t *p_buf, uint16_t u16_len, uint32_t *p_block)
+{
+	struct fm_dedup_entry *p_e;
+	uint8_t u8a_index[DD_INDEX];
+	uint32_t u32_crc = 0xFFFFFFFFUL;
+	uint16_t u16_pos, u16_probes;
+
+	for (u16_pos = 0; u16_pos < u16_len; u16_pos++)
+	{
+		u32_crc = _crc32_update(u32_crc, p_buf[u16_pos]);
+	}
+	u32_crc = ~u32_crc;
+
+	/* Linear probing, an empty entry ends the search */
+	u16_pos = (uint16_t)(u32_crc % p_d->tableSize);
+	for (u16_probes = 0; u16_probes < p_d->tableSize; u16_probes++)
+	{
+		p_e = &p_d->p_table[u16_pos];
+		if (!p_e->len)	break;
+		if ( (p_e->crc == u32_crc) && (p_e->len == u16_len) && _same(p_d, p_e->block, p_buf, u16_len) )
+		{
+			*p_block = p_e->block;
+			p_d->hits++;
+			p_d->saved += u16_len;
+			return 0;
+		}
+		if (++u16_pos == p_d->tableSize)	u16_pos = 0;
+	}
+
+	/* New block: Data first, the index record makes it valid */
+	*p_block = p_d->count;
+	if (_write(p_d->p_blocks, (FSIZE_t)p_d->count * FM_DEDUP_BLOCK, p_buf, u16_len))	return 1;
+	_fm_put32(&u8a_index[0], u32_crc);
+	_fm_put16(&u8a_index[4], u16_len);
+	if (_write(p_d->p_index, (FSIZE_t)p_d->count * DD_INDEX, u8a_index, DD_INDEX))	return 1;
+	_insert(p_d, u32_crc, p_d->count, u16_len);
+	p_d->count++;
+	return 0;
+}
+
+static uint8_t _dedupWrite(void *p_ctx, FSIZE_t offset, const uint8_t *p_buf, uint16_t u16_len)
+{
+	struct fm_dedup_file *p_f = (struct fm_dedup_file*)p_ctx;
+	uint8_t u8a_rec[DD_RECORD];
+	uint32_t u32_block;
+	uint16_t u16_part;
+
+	while (u16_len)
+	{
+		u16_part = (u16_len > FM_DEDUP_BLOCK) ? FM_DEDUP_BLOCK : u16_len;
+		if (_lookup(p_f->p_store, p_buf, u16_part, &u32_block))	return 1;
+
+		_fm_put32(&u8a_rec[0], (uint32_t)offset);
+		_fm_put32(&u8a_rec[4], (uint32_t)((uint64_t)offset >> 32));
+		_fm_put32(&u8a_rec[8], u32_block);
+		_fm_put16(&u8a_rec[12], u16_part);
+		if (_write(p_f->p_manifest, f_size(p_f->p_manifest), u8a_rec, DD_RECORD))	return 1;
+
+		offset += u16_part;
+		p_buf += u16_part;
+		u16_len -= u16_part;
+	}
+	return 0;
+}
+
+static uint8_t _dedupSync(void *p_ctx)
+{
+	struct fm_dedup_file *p_f = (struct fm_dedup_file*)p_ctx;
+
+	/* Blocks before the index, the index before the manifest pointing to it */
+	if (f_sync(p_f->p_store->p_blocks) != FR_OK)	return 1;
+	if (f_sync(p_f->p_store->p_index) != FR_OK)		return 1;
+	return (f_sync(p_f->p_manifest) != FR_OK);
+}
+
+/**
+  * @brief Opens the block store and fills the lookup table from its index
+  *
+  * @param p_d			Block store, the application only provides the memory
+  * @param p_blocks		Block file, opened for reading and writing
+  * @param p_index		Index file, opened for reading and writing
+  * @param p_table		Lookup table, about twice as many entries as blocks expected
+  * @param u16_size		Entries in the lookup table, at least one
+  *
+  * @return		Zero if successful, one on a disk error or without a table
+  */
+uint8_t fm_dedup_open(struct fm_dedup *p_d, FIL *p_blocks, FIL *p_index, struct fm_dedup_entry *p_table,
+	uint16_t u16_size)
+{
+	uint8_t u8a_index[DD_INDEX];
+	uint32_t u32_block;
+
+	if (!u16_size)	return 1;
+	memset(p_d, 0, sizeof(struct fm_dedup));
+	memset(p_table, 0, u16_size * sizeof(struct fm_dedup_entry));
+	p_d->p_blocks = p_blocks;
+	p_d->p_index = p_index;
+	p_d->p_table = p_table;
+	p_d->tableSize = u16_size;
+	p_d->count = (uint32_t)(f_size(p_index) / DD_INDEX);
+
+	for (u32_block = 0; u32_block < p_d->count; u32_block++)
+	{
+		if (_read(p_index, (FSIZE_t)u32_block * DD_INDEX, u8a_index, DD_INDEX))	return 1;
+		_insert(p_d, _fm_get32(&u8a_index[0]), u32_block, _fm_get16(&u8a_index[4]));
+	}
+	return 0;
+}
+
+/**
+  * @brief Sets up a sink storing a file through a block store
+  *
+  * The buffer decides the block size, up to FM_DEDUP_BLOCK Bytes. Files
+  * received in order are cut at the same offsets, so the same file always
+  * gives the same blocks.
+  *
+  * @param p_s			Sink to set up
+  * @param p_f			Context of the sink, the application only provides the memory
+  * @param p_store		Block store, see fm_dedup_open()
+  * @param p_manifest	Manifest of the file, opened for writing and empty
+  * @param p_buf		Buffer of the sink, FM_DEDUP_BLOCK Bytes
+  * @param u16_size		Size of the buffer
+  */
+void fm_sink_dedup(struct fm_sink *p_s, struct fm_dedup_file *p_f, struct fm_dedup *p_store, FIL *p_manifest,
+	uint8_t *p_buf, uint16_t u16_size)
+{
+	p_f->p_store = p_store;
+	p_f->p_manifest = p_manifest;
+	if (u16_size > FM_DEDUP_BLOCK)	u16_size = FM_DEDUP_BLOCK;
+	fm_sink_init(p_s, _dedupWrite, _dedupSync, p_f, p_buf, u16_size, 0);
+}
+
+/**
+  * @brief Writes the content of a manifest into a plain file
+  *
+  * @param p_d			Block store holding the blocks of the manifest
+  * @param p_manifest	Manifest, opened for reading
+  * @param p_dst		Destination, opened for writing
+  * @param p_buf		Copy buffer
+  * @param u16_size		Size of the copy buffer
+  *
+  * @return		Zero if successful, one on a disk error or a broken manifest
+  */
+uint8_t fm_dedup_restore(struct fm_dedup *p_d, FIL *p_manifest, FIL *p_dst, uint8_t *p_buf, uint16_t u16_size)
+{
+	uint8_t u8a_rec[DD_RECORD];
+	FSIZE_t record, offset, source;
+	uint32_t u32_block;
+	uint16_t u16_len, u16_part;
+
+	for (record = 0; record + DD_RECORD <= f_size(p_manifest); record += DD_RECORD)
+	{
+		if (_read(p_manifest, record, u8a_rec, DD_RECORD))	return 1;
+		offset = (FSIZE_t)(_fm_get32(&u8a_rec[0]) | (uint64_t)_fm_get32(&u8a_rec[4]) << 32);
+		u32_block = _fm_get32(&u8a_rec[8]);
+		u16_len = _fm_get16(&u8a_rec[12]);
+		if ( (u32_block >= p_d->count) || (u16_len > FM_DEDUP_BLOCK) )	return 1;
+
+		source = (FSIZE_t)u32_block * FM_DEDUP_BLOCK;
+		while (u16_len)
+		{
+			u16_part = (u16_len > u16_size) ? u16_size : u16_len;
+			if (_read(p_d->p_blocks, source, p_buf, u16_part))	return 1;
+			if (_write(p_dst, offset, p_buf, u16_part))			return 1;
+			source += u16_part;
+			offset += u16_part;
+			u16_len -= u16_part;
+		}
+	}
+	return (f_sync(p_dst) != FR_OK);
+}
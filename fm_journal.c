@@ -0,0 +1,227 @@
+/*
+ * fm_journal.c
+ *
+ * Progress journal: A sink writing the received data to a file and, at every
+ * sync of the sink, recording up to which offset the file is on the disk and
+ * the CRC-32 of the file up to there. After a power loss fm_journal_open()
+ * cuts the file back to that offset, the transfer restarts from it and the
+ * CRC-32 goes on from the recorded one, nothing has to be read again. The
+ * journal costs a small write and a sync per sync interval of the sink.
+ *
+ * Journal file, two record slots, LSB first:
+ *   Id (4) | Sequence (4) | Offset (8) | CRC-32 (4) | Check
+ * Check is the sum of all other Bytes, inverted. The records go to the slots
+ * in turns, a record torn by a power loss leaves the previous one intact.
+ * The one with the higher sequence number counts, if it belongs to the
+ * transfer (Id).
+ *
+ * The data is synced before its record is written. Data arriving in order
+ * is hashed right away. Packets arriving out of order (N-Modem) are
+ * remembered as ranges until the gap before them has been filled, and read
+ * back from the file at the next sync.
+ *
+ * Created: 19.10.2026 09:12:37
+ *  Author: gfcwfzkm
+ */
+
+#include "file_modem_int.h"
+#include <string.h>
+
+#define JN_READ		32		// Bytes read back at once
+
+/**
+  * @brief Hashes data continuing the hashed part of the file
+  */
+static void _hash(struct fm_journal *p_j, const uint8_t *p_buf, uint16_t u16_len)
+{
+	uint16_t u16_pos;
+
+	for (u16_pos = 0; u16_pos < u16_len; u16_pos++)
+	{
+		p_j->crc = _crc32_update(p_j->crc, p_buf[u16_pos]);
+	}
+	p_j->hashed += u16_len;
+}
+
+/**
+  * @brief Remembers data written beyond a gap
+  *
+  * Overlapping and adjoining ranges are merged. If there is no room left the
+  * range is dropped: The journal then stops before it, which is safe.
+  */
+static void _addRange(struct fm_journal *p_j, FSIZE_t start, FSIZE_t end)
+{
+	struct fm_journal_range *p_r;
+	uint8_t u8_idx;
+
+	for (u8_idx = 0; u8_idx < p_j->rangeCount; u8_idx++)
+	{
+		p_r = &p_j->ranges[u8_idx];
+		if ( (start > p_r->end) || (end < p_r->start) )	continue;
+		if (start < p_r->start)	p_r->start = start;
+		if (end > p_r->end)		p_r->end = end;
+		return;
+	}
+	if (p_j->rangeCount == FM_JOURNAL_RANGES)	return;
+	p_j->ranges[p_j->rangeCount].start = start;
+	p_j->ranges[p_j->rangeCount].end = end;
+	p_j->rangeCount++;
+}
+
+/**
+  * @brief Adds the ranges the gapless part has reached to it
+  */
+static void _joinRanges(struct fm_journal *p_j)
+{
+	uint8_t u8_idx = 0;
+
+	while (u8_idx < p_j->rangeCount)
+	{
+		if (p_j->ranges[u8_idx].start > p_j->written)
+		{
+			u8_idx++;
+			continue;
+		}
+		if (p_j->ranges[u8_idx].end > p_j->written)	p_j->written = p_j->ranges[u8_idx].end;
+		/* The gapless part may reach another one now */
+		p_j->ranges[u8_idx] = p_j->ranges[--p_j->rangeCount];
+		u8_idx = 0;
+	}
+}
+
+/**
+  * @brief Hashes what got joined from the ranges by reading it back
+  *
+  * Only called right after the data has been synced.
+  *
+  * @return		Zero if successful, one on a disk error
+  */
+static uint8_t _catchUp(struct fm_journal *p_j)
+{
+	uint8_t u8a_buf[JN_READ];
+	UINT got;
+
+	if (p_j->hashed == p_j->written)	return 0;
+	if (f_lseek(p_j->p_data, p_j->hashed) != FR_OK)	return 1;
+	while (p_j->hashed < p_j->written)
+	{
+		got = (p_j->written - p_j->hashed > JN_READ) ? JN_READ : (UINT)(p_j->written - p_j->hashed);
+		if ( (f_read(p_j->p_data, u8a_buf, got, &got) != FR_OK) || !got )	return 1;
+		_hash(p_j, u8a_buf, (uint16_t)got);
+	}
+	return 0;
+}
+
+static uint8_t _journalWrite(void *p_ctx, FSIZE_t offset, const uint8_t *p_buf, uint16_t u16_len)
+{
+	struct fm_journal *p_j = (struct fm_journal*)p_ctx;
+	FSIZE_t end = offset + u16_len;
+
+	if (_fm_fileSeek(p_j->p_data, offset) || _fm_fileWrite(p_j->p_data, p_buf, u16_len))	return 1;
+
+	if (offset > p_j->written)
+	{
+		_addRange(p_j, offset, end);
+	}
+	else if (end > p_j->written)
+	{
+		/* In order, unless there is joined data left to read back */
+		if (p_j->hashed == p_j->written)	_hash(p_j, &p_buf[p_j->hashed - offset], (uint16_t)(end - p_j->hashed));
+		p_j->written = end;
+		_joinRanges(p_j);
+	}
+	return 0;
+}
+
+/**
+  * @brief Syncs the data, then records how far it got
+  */
+static uint8_t _journalSync(void *p_ctx)
+{
+	struct fm_journal *p_j = (struct fm_journal*)p_ctx;
+	uint8_t u8a_rec[FM_JOURNAL_RECORD];
+	UINT written;
+
+	if (_fm_fileSync(p_j->p_data) || _catchUp(p_j))	return 1;
+	if (p_j->hashed == p_j->durable)	return 0;
+
+	_fm_put32(&u8a_rec[0], p_j->id);
+	_fm_put32(&u8a_rec[4], p_j->seq + 1);
+	_fm_put64(&u8a_rec[8], p_j->hashed);
+	_fm_put32(&u8a_rec[16], ~p_j->crc);
+	u8a_rec[FM_JOURNAL_RECORD - 1] = _fm_check(u8a_rec, FM_JOURNAL_RECORD);
+
+	if (f_lseek(p_j->p_log, ((p_j->seq + 1) & 1) * FM_JOURNAL_RECORD) != FR_OK)	return 1;
+	if ( (f_write(p_j->p_log, u8a_rec, FM_JOURNAL_RECORD, &written) != FR_OK) ||
+		(written != FM_JOURNAL_RECORD) || (f_sync(p_j->p_log) != FR_OK) )		return 1;
+
+	p_j->seq++;
+	p_j->durable = p_j->hashed;
+	p_j->durableCrc = ~p_j->crc;
+	return 0;
+}
+
+/**
+  * @brief Opens the journal of a transfer and cuts the file back to what it recorded
+  *
+  * Afterwards p_j->durable is the offset the transfer has to restart from
+  * (zero for a new transfer, see nmodem_resume()) and p_j->durableCrc the
+  * CRC-32 of the file up to there. Anything beyond it is cut off.
+  *
+  * @param p_j		Journal, stays in use until the transfer is done
+  * @param p_data	File the data goes to, opened for reading and writing
+  * @param p_log		Journal file, opened for reading and writing
+  * @param u32_id	Identity of the transfer, e.g. fm_peer_id() over the file
+  *					name and the sender. A record of another one is ignored.
+  *
+  * @return		Zero if successful, one on a disk error
+  */
+uint8_t fm_journal_open(struct fm_journal *p_j, FIL *p_data, FIL *p_log, uint32_t u32_id)
+{
+	uint8_t u8a_rec[2][FM_JOURNAL_RECORD];
+	uint8_t u8_slot, b_found = 0;
+	FSIZE_t offset;
+	UINT got = 0;
+
+	memset(p_j, 0, sizeof(struct fm_journal));
+	p_j->p_data = p_data;
+	p_j->p_log = p_log;
+	p_j->id = u32_id;
+	p_j->crc = 0xFFFFFFFFUL;
+
+	if ( (f_lseek(p_log, 0) != FR_OK) || (f_read(p_log, u8a_rec, sizeof(u8a_rec), &got) != FR_OK) )	return 1;
+	for (u8_slot = 0; (UINT)(u8_slot + 1) * FM_JOURNAL_RECORD <= got; u8_slot++)
+	{
+		if ( (u8a_rec[u8_slot][FM_JOURNAL_RECORD - 1] != _fm_check(u8a_rec[u8_slot], FM_JOURNAL_RECORD)) ||
+			(_fm_get32(&u8a_rec[u8_slot][0]) != u32_id) )	continue;
+		/* Newer, also across the wrap of the sequence number */
+		if ( b_found && ((int32_t)(_fm_get32(&u8a_rec[u8_slot][4]) - p_j->seq) <= 0) )	continue;
+		offset = _fm_get64(&u8a_rec[u8_slot][8]);
+		/* The data is synced before its record, a shorter file isn't ours */
+		if (f_size(p_data) < offset)	continue;
+
+		b_found = 1;
+		p_j->seq = _fm_get32(&u8a_rec[u8_slot][4]);
+		p_j->durable = offset;
+		p_j->durableCrc = _fm_get32(&u8a_rec[u8_slot][16]);
+	}
+	p_j->hashed = p_j->written = p_j->durable;
+	if (b_found)	p_j->crc = ~p_j->durableCrc;
+
+	if (f_lseek(p_data, p_j->durable) != FR_OK)	return 1;
+	return (f_truncate(p_data) != FR_OK);
+}
+
+/**
+  * @brief Sets up a sink writing to the file of a journal
+  *
+  * Every sync of the sink (every u32_syncEvery Bytes and at the end of the
+  * file) records the progress. The sink starts at p_j->durable, where a
+  * resumed transfer continues. The other parameters are the same as for
+  * fm_sink_init().
+  */
+void fm_sink_journal(struct fm_sink *p_s, struct fm_journal *p_j, uint8_t *p_buf, uint16_t u16_size, uint32_t u32_syncEvery)
+{
+	fm_sink_init(p_s, _journalWrite, _journalSync, p_j, p_buf, u16_size, u32_syncEvery);
+	p_s->position = p_j->durable;
+}
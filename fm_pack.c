@@ -0,0 +1,359 @@
+/*
+ * fm_pack.c
+ *
+ * Compressing sink: Every chunk of received data (the sink buffer, up to
+ * FM_PACK_CHUNK Bytes) is compressed on its own before it hits the card,
+ * chunks that don't get smaller are stored as they are. A chunk index
+ * makes the file seekable, fm_pack_read() only unpacks the chunk it needs.
+ *
+ * Data file: The packed chunks, one after the other.
+ * Index file, LSB first: Chunk size (2), then one record per chunk:
+ *   Offset (8) | Data offset (8) | Length (2) | Packed length (2)
+ * The chunk size is the buffer of the sink that wrote the file. Offset is
+ * the position of the chunk in the received file. A packed length equal to
+ * the length marks a stored chunk.
+ *
+ * The chunks use the LZF format: A control Byte below 32 is followed by
+ * that many literal Bytes plus one. Any other one is a back reference:
+ *   LLLooooo [Extra length] oooooooo
+ * L is the length minus 2 (7: plus the extra length Byte), o the distance
+ * minus 1, up to 8 KiB back within the chunk. The compressor finds matches
+ * of 3 Bytes with a hash table over the chunk (FM_PACK_HASH entries).
+ *
+ * Created: 19.10.2026 00:58:41
+ *  Author: gfcwfzkm
+ */
+
+#include "file_modem_int.h"
+#include <string.h>
+
+#define PK_HEADER	2		// Length of the index header, the chunk size
+#define PK_RECORD	20		// Length of an index record
+#define PK_LITERALS	32		// Longest literal run
+#define PK_MAXLEN	264		// Longest back reference
+#define PK_MAXOFF	8192	// Farthest back reference
+
+#define PK_HASH(p)	((((uint16_t)(p)[0] << 8 | (p)[1]) ^ ((uint16_t)(p)[2] << 4) ^ ((p)[0] >> 3)) % FM_PACK_HASH)
+
+/**
+  * @brief Compresses a chunk
+  *
+  * @param p_pk		Compressor, for its hash table
+  * @param p_in		Chunk
+  * @param u16_len	Length of the chunk
+  * @param p_out	Room for the packed chunk, u16_len Bytes
+  *
+  * @return			Length of the packed chunk, zero if it doesn't get smaller
+  */
+static uint16_t _compress(struct fm_pack *p_pk, const uint8_t *p_in, uint16_t u16_len, uint8_t *p_out)
+{
+	uint16_t u16_ip = 0, u16_op = 1, u16_ref, u16_off, u16_match, u16_max;
+	uint8_t u8_lit = 0;
+	uint16_t *p_slot;
+
+	/* Positions plus one, zero is an empty entry */
+	memset(p_pk->hash, 0, sizeof(p_pk->hash));
+	if (u16_len < 2)	return 0;
+
+	while (u16_ip < u16_len)
+	{
+		u16_match = 0;
+		if (u16_ip + 2 < u16_len)
+		{
+			p_slot = &p_pk->hash[PK_HASH(&p_in[u16_ip])];
+			u16_ref = *p_slot;
+			*p_slot = u16_ip + 1;
+			if (u16_ref && (u16_ip - u16_ref < PK_MAXOFF) && !memcmp(&p_in[u16_ref - 1], &p_in[u16_ip], 3))
+			{
+				u16_ref--;
+				u16_max = u16_len - u16_ip;
+				if (u16_max > PK_MAXLEN)	u16_max = PK_MAXLEN;
+				for (u16_match = 3; (u16_match < u16_max) && (p_in[u16_ref + u16_match] == p_in[u16_ip + u16_match]); u16_match++);
+			}
+		}
+
+		if (u16_match)
+		{
+			/* Close the literal run, or drop its unused control Byte */
+			if (u8_lit)	p_out[u16_op - u8_lit - 1] = u8_lit - 1;
+			else		u16_op--;
+			if (u16_op + 4 >= u16_len)	return 0;
+
+			u16_off = u16_ip - u16_ref - 1;
+			if (u16_match - 2 < 7)
+			{
+				p_out[u16_op++] = (uint8_t)((u16_off >> 8) + ((u16_match - 2) << 5));
+			}
+			else
+			{
+				p_out[u16_op++] = (uint8_t)((u16_off >> 8) + (7 << 5));
+				p_out[u16_op++] = (uint8_t)(u16_match - 2 - 7);
+			}
+			p_out[u16_op++] = (uint8_t)u16_off;
+			u16_ip += u16_match;
+			u16_op++;
+			u8_lit = 0;
+		}
+		else
+		{
+			if (u16_op + 1 >= u16_len)	return 0;
+			p_out[u16_op++] = p_in[u16_ip++];
+			if (++u8_lit == PK_LITERALS)
+			{
+				p_out[u16_op - u8_lit - 1] = PK_LITERALS - 1;
+				u16_op++;
+				u8_lit = 0;
+			}
+		}
+	}
+	if (u8_lit)	p_out[u16_op - u8_lit - 1] = u8_lit - 1;
+	else		u16_op--;
+	return (u16_op < u16_len) ? u16_op : 0;
+}
+
+/**
+  * @brief Unpacks a chunk
+  *
+  * @return			Zero if it unpacked to exactly u16_len Bytes, one if not
+  */
+static uint8_t _decompress(const uint8_t *p_in, uint16_t u16_inLen, uint8_t *p_out, uint16_t u16_len)
+{
+	uint16_t u16_ip = 0, u16_op = 0, u16_run, u16_off;
+	uint8_t u8_ctrl;
+
+	while (u16_ip < u16_inLen)
+	{
+		u8_ctrl = p_in[u16_ip++];
+		if (u8_ctrl < PK_LITERALS)
+		{
+			u16_run = u8_ctrl + 1;
+			if ( (u16_ip + u16_run > u16_inLen) || (u16_op + u16_run > u16_len) )	return 1;
+			memcpy(&p_out[u16_op], &p_in[u16_ip], u16_run);
+			u16_ip += u16_run;
+			u16_op += u16_run;
+		}
+		else
+		{
+			u16_run = u8_ctrl >> 5;
+			if ( (u16_run == 7) && (u16_ip < u16_inLen) )	u16_run += p_in[u16_ip++];
+			u16_run += 2;
+			if (u16_ip >= u16_inLen)	return 1;
+			u16_off = ((uint16_t)(u8_ctrl & 0x1F) << 8 | p_in[u16_ip++]) + 1;
+			if ( (u16_off > u16_op) || (u16_op + u16_run > u16_len) )	return 1;
+			/* Byte by Byte, the reference may overlap what it produces */
+			for (; u16_run; u16_run--, u16_op++)
+			{
+				p_out[u16_op] = p_out[u16_op - u16_off];
+			}
+		}
+	}
+	return (u16_op != u16_len);
+}
+
+static uint8_t _write(FIL *p_ffd, FSIZE_t offset, const uint8_t *p_buf, uint16_t u16_len)
+{
+	UINT written;
+
+	if (f_lseek(p_ffd, offset) != FR_OK)	return 1;
+	return (f_write(p_ffd, p_buf, u16_len, &written) != FR_OK) || (written != u16_len);
+}
+
+static uint8_t _read(FIL *p_ffd, FSIZE_t offset, uint8_t *p_buf, uint16_t u16_len)
+{
+	UINT got;
+
+	if (f_lseek(p_ffd, offset) != FR_OK)	return 1;
+	return (f_read(p_ffd, p_buf, u16_len, &got) != FR_OK) || (got != u16_len);
+}
+
+static uint8_t _packWrite(void *p_ctx, FSIZE_t offset, const uint8_t *p_buf, uint16_t u16_len)
+{
+	struct fm_pack *p_pk = (struct fm_pack*)p_ctx;
+	uint8_t u8a_rec[PK_RECORD];
+	uint16_t u16_part, u16_packed;
+
+	if (!f_size(p_pk->p_index))
+	{
+		_fm_put16(u8a_rec, p_pk->chunk);
+		if (_write(p_pk->p_index, 0, u8a_rec, PK_HEADER))	return 1;
+	}
+
+	while (u16_len)
+	{
+		u16_part = (u16_len > p_pk->chunk) ? p_pk->chunk : u16_len;
+		u16_packed = _compress(p_pk, p_buf, u16_part, p_pk->p_work);
+
+		/* Data first, the index record makes the chunk part of the file */
+		if (_write(p_pk->p_data, p_pk->packed, u16_packed ? p_pk->p_work : p_buf, u16_packed ? u16_packed : u16_part))
+		{
+			return 1;
+		}
+		_fm_put64(&u8a_rec[0], offset);
+		_fm_put64(&u8a_rec[8], p_pk->packed);
+		_fm_put16(&u8a_rec[16], u16_part);
+		_fm_put16(&u8a_rec[18], u16_packed ? u16_packed : u16_part);
+		if (_write(p_pk->p_index, f_size(p_pk->p_index), u8a_rec, PK_RECORD))	return 1;
+
+		if (offset + u16_part > p_pk->raw)	p_pk->raw = offset + u16_part;
+		p_pk->packed += u16_packed ? u16_packed : u16_part;
+		offset += u16_part;
+		p_buf += u16_part;
+		u16_len -= u16_part;
+	}
+	return 0;
+}
+
+static uint8_t _packSync(void *p_ctx)
+{
+	struct fm_pack *p_pk = (struct fm_pack*)p_ctx;
+
+	if (f_sync(p_pk->p_data) != FR_OK)	return 1;
+	return (f_sync(p_pk->p_index) != FR_OK);
+}
+
+/**
+  * @brief Opens a packed file for fm_pack_read(), or an empty one for fm_sink_pack()
+  *
+  * @param p_pk		Packed file, the application only provides the memory
+  * @param p_data	Data file
+  * @param p_index	Index file
+  * @param p_work	Room for a packed chunk, FM_PACK_CHUNK Bytes
+  * @param p_chunk	Room for an unpacked chunk, FM_PACK_CHUNK Bytes. Only for
+  *					reading, may be NULL when writing.
+  *
+  * @return			Zero if successful, one on a disk error or a chunk size
+  *					larger than FM_PACK_CHUNK
+  */
+uint8_t fm_pack_open(struct fm_pack *p_pk, FIL *p_data, FIL *p_index, uint8_t *p_work, uint8_t *p_chunk)
+{
+	uint8_t u8a_rec[PK_RECORD];
+	uint32_t u32_records;
+
+	memset(p_pk, 0, sizeof(struct fm_pack));
+	p_pk->p_data = p_data;
+	p_pk->p_index = p_index;
+	p_pk->p_work = p_work;
+	p_pk->p_chunk = p_chunk;
+	p_pk->packed = f_size(p_data);
+
+	/* An empty file gets the chunk size of the sink writing it */
+	if (f_size(p_index) < PK_HEADER)	return 0;
+	if (_read(p_index, 0, u8a_rec, PK_HEADER))	return 1;
+	p_pk->chunk = _fm_get16(u8a_rec);
+	if (!p_pk->chunk || (p_pk->chunk > FM_PACK_CHUNK))	return 1;
+
+	/* The file ends with the last chunk, unless an earlier one has been sent again */
+	u32_records = (uint32_t)((f_size(p_index) - PK_HEADER) / PK_RECORD);
+	if (!u32_records)	return 0;
+	if (_read(p_index, PK_HEADER + (FSIZE_t)(u32_records - 1) * PK_RECORD, u8a_rec, PK_RECORD))	return 1;
+	p_pk->raw = _fm_get64(&u8a_rec[0]) + _fm_get16(&u8a_rec[16]);
+	return 0;
+}
+
+/**
+  * @brief Sets up a sink compressing into a packed file
+  *
+  * The buffer decides the chunk size, up to FM_PACK_CHUNK Bytes. Larger
+  * chunks pack better, reading a single Byte unpacks a whole chunk. A file
+  * written before keeps its chunk size.
+  *
+  * @param p_s		Sink to set up
+  * @param p_pk		Packed file from fm_pack_open()
+  * @param p_buf	Buffer of the sink
+  * @param u16_size	Size of the buffer
+  * @param u32_syncEvery	Syncs after this many Bytes, zero only at the end of the file
+  */
+void fm_sink_pack(struct fm_sink *p_s, struct fm_pack *p_pk, uint8_t *p_buf, uint16_t u16_size, uint32_t u32_syncEvery)
+{
+	if (u16_size > FM_PACK_CHUNK)	u16_size = FM_PACK_CHUNK;
+	if (!p_pk->chunk)	p_pk->chunk = u16_size;
+	fm_sink_init(p_s, _packWrite, _packSync, p_pk, p_buf, u16_size, u32_syncEvery);
+}
+
+/**
+  * @brief Finds the chunk holding an offset and unpacks it into p_chunk
+  *
+  * Chunks of a file received in order have the chunk size of the file, the
+  * one needed is found right away. Otherwise the index is searched, a later
+  * record for the same offset wins (data sent again).
+  *
+  * @return		Zero if successful, one if the offset isn't in the file or on an error
+  */
+static uint8_t _loadChunk(struct fm_pack *p_pk, FSIZE_t offset)
+{
+	uint8_t u8a_rec[PK_RECORD];
+	uint32_t u32_records;
+	uint32_t u32_rec, u32_found = 0xFFFFFFFFUL;
+	FSIZE_t start;
+
+	if (p_pk->chunkLen && (offset >= p_pk->chunkOffset) && (offset < p_pk->chunkOffset + p_pk->chunkLen))	return 0;
+
+	if (!p_pk->chunk || (f_size(p_pk->p_index) < PK_HEADER))	return 1;
+	u32_records = (uint32_t)((f_size(p_pk->p_index) - PK_HEADER) / PK_RECORD);
+	u32_rec = (uint32_t)(offset / p_pk->chunk);
+	if ( (u32_rec < u32_records) && !_read(p_pk->p_index, PK_HEADER + (FSIZE_t)u32_rec * PK_RECORD, u8a_rec, PK_RECORD) )
+	{
+		start = _fm_get64(&u8a_rec[0]);
+		if ( (offset >= start) && (offset < start + _fm_get16(&u8a_rec[16])) )	u32_found = u32_rec;
+	}
+	if (u32_found == 0xFFFFFFFFUL)
+	{
+		for (u32_rec = 0; u32_rec < u32_records; u32_rec++)
+		{
+			if (_read(p_pk->p_index, PK_HEADER + (FSIZE_t)u32_rec * PK_RECORD, u8a_rec, PK_RECORD))	return 1;
+			start = _fm_get64(&u8a_rec[0]);
+			if ( (offset >= start) && (offset < start + _fm_get16(&u8a_rec[16])) )	u32_found = u32_rec;
+		}
+		if (u32_found == 0xFFFFFFFFUL)	return 1;
+	}
+	if (_read(p_pk->p_index, PK_HEADER + (FSIZE_t)u32_found * PK_RECORD, u8a_rec, PK_RECORD))	return 1;
+
+	p_pk->chunkLen = 0;
+	if ( (_fm_get16(&u8a_rec[16]) > FM_PACK_CHUNK) || (_fm_get16(&u8a_rec[18]) > _fm_get16(&u8a_rec[16])) )	return 1;
+	if (_fm_get16(&u8a_rec[18]) == _fm_get16(&u8a_rec[16]))
+	{
+		if (_read(p_pk->p_data, _fm_get64(&u8a_rec[8]), p_pk->p_chunk, _fm_get16(&u8a_rec[16])))	return 1;
+	}
+	else
+	{
+		if (_read(p_pk->p_data, _fm_get64(&u8a_rec[8]), p_pk->p_work, _fm_get16(&u8a_rec[18])))	return 1;
+		if (_decompress(p_pk->p_work, _fm_get16(&u8a_rec[18]), p_pk->p_chunk, _fm_get16(&u8a_rec[16])))	return 1;
+	}
+	p_pk->chunkOffset = _fm_get64(&u8a_rec[0]);
+	p_pk->chunkLen = _fm_get16(&u8a_rec[16]);
+	return 0;
+}
+
+/**
+  * @brief Reads from a packed file
+  *
+  * @param p_pk		Packed file from fm_pack_open(), with a chunk buffer
+  * @param offset	Position in the received file
+  * @param p_buf	Destination
+  * @param u16_len	Bytes wanted
+  * @param p_got	Gets the Bytes read, less than wanted at the end of the file
+  *
+  * @return		Zero if successful, one on a disk error or a damaged chunk
+  */
+uint8_t fm_pack_read(struct fm_pack *p_pk, FSIZE_t offset, uint8_t *p_buf, uint16_t u16_len, uint16_t *p_got)
+{
+	uint16_t u16_part;
+
+	*p_got = 0;
+	while (u16_len)
+	{
+		if (_loadChunk(p_pk, offset))
+		{
+			/* Past the last chunk is the end of the file, anything else is damage */
+			return (offset < p_pk->raw);
+		}
+		u16_part = (uint16_t)(p_pk->chunkOffset + p_pk->chunkLen - offset);
+		if (u16_part > u16_len)	u16_part = u16_len;
+		memcpy(p_buf, &p_pk->p_chunk[offset - p_pk->chunkOffset], u16_part);
+		offset += u16_part;
+		p_buf += u16_part;
+		u16_len -= u16_part;
+		*p_got += u16_part;
+	}
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * fm_peer.c
+ *
+ * Tuning cache: The link parameters, protocol and baud rate that worked for
+ * a peer are kept in a small file, one record per port/peer, so the next
+ * session with the same peer starts from them instead of the defaults or
+ * another probe.
+ *
+ * Record (FM_PEER_RECORD Bytes, multi-Byte values LSB first):
+ *   Id (4) | Baud (4) | Protocol | Fails | Timeout (2) | MaxErr | Pace |
+ *   Packet (2) | Window | Check
+ * Check is the sum of all other Bytes, inverted. A record that doesn't add up
+ * (e.g. power lost while writing it) is treated as not cached.
+ *
+ * Fails counts the sessions that failed since the record has been written.
+ * A cached record is only used while it is zero: If conditions changed, the
+ * first failing session sends the next one back to the defaults, and the
+ * next successful session stores what worked then.
+ *
+ * Created: 18.10.2026 23:24:36
+ *  Author: gfcwfzkm
+ */
+
+#include "file_modem_int.h"
+#include <string.h>
+
+/**
+  * @brief Writes the record of a peer to its slot in the cache file
+  *
+  * @return		Zero if written, one on a disk error
+  */
+static uint8_t _store(const struct fm_peer *p_p)
+{
+	uint8_t u8a_rec[FM_PEER_RECORD];
+	UINT written;
+
+	_fm_put32(&u8a_rec[0], p_p->id);
+	_fm_put32(&u8a_rec[4], p_p->baud);
+	u8a_rec[8] = p_p->protocol;
+	u8a_rec[9] = p_p->fails;
+	_fm_put16(&u8a_rec[10], p_p->tune.timeout);
+	u8a_rec[12] = p_p->tune.maxErr;
+	u8a_rec[13] = p_p->tune.pace;
+	_fm_put16(&u8a_rec[14], p_p->tune.packet);
+	u8a_rec[16] = p_p->tune.window;
+	u8a_rec[FM_PEER_RECORD - 1] = _fm_check(u8a_rec, FM_PEER_RECORD);
+
+	if (f_lseek(p_p->p_ffd, p_p->slot) != FR_OK)	return 1;
+	if ( (f_write(p_p->p_ffd, u8a_rec, FM_PEER_RECORD, &written) != FR_OK) ||
+		(written != FM_PEER_RECORD) )				return 1;
+	return (f_sync(p_p->p_ffd) != FR_OK);
+}
+
+/**
+  * @brief Identity of a port/peer pair, the key of the cache
+  *
+  * FNV-1a over both names, e.g. the port and the serial number or name the
+  * device reported.
+  *
+  * @param p_port	Name of the port, may be NULL
+  * @param p_peer	Name of the peer, may be NULL
+  */
+uint32_t fm_peer_id(const char *p_port, const char *p_peer)
+{
+	uint32_t u32_hash = 2166136261UL;
+
+	while (p_port && *p_port)
+	{
+		u32_hash = (u32_hash ^ (uint8_t)*p_port++) * 16777619UL;
+	}
+	/* Separator, "ab" + "c" isn't "a" + "bc" */
+	u32_hash = (u32_hash ^ 0xFF) * 16777619UL;
+	while (p_peer && *p_peer)
+	{
+		u32_hash = (u32_hash ^ (uint8_t)*p_peer++) * 16777619UL;
+	}
+	return u32_hash;
+}
+
+/**
+  * @brief Looks a peer up in the cache and sets the link parameters for the session
+  *
+  * Call before opening the port: If the peer is cached, p_p->baud and
+  * p_p->protocol tell what to use. Otherwise the defaults are set and the
+  * caller may probe the link (nmodem_probe()) or use its own choice.
+  *
+  * @param p_p		Peer, stays in use until fm_peer_end()
+  * @param p_cache	Cache file, opened for reading and writing
+  * @param u32_id	Identity of the peer, see fm_peer_id()
+  *
+  * @return		One if the cached parameters are used, zero if the defaults
+  */
+uint8_t fm_peer_begin(struct fm_peer *p_p, FIL *p_cache, uint32_t u32_id)
+{
+	uint8_t u8a_rec[FM_PEER_RECORD];
+	UINT got;
+
+	memset(p_p, 0, sizeof(struct fm_peer));
+	p_p->p_ffd = p_cache;
+	p_p->id = u32_id;
+	file_modem_tune(NULL);
+	p_p->tune = _fm_tune;
+
+	/* A new peer gets the slot behind the last record */
+	p_p->slot = f_size(p_cache) / FM_PEER_RECORD * FM_PEER_RECORD;
+	if (f_lseek(p_cache, 0) != FR_OK)	return 0;
+	while ( (f_read(p_cache, u8a_rec, FM_PEER_RECORD, &got) == FR_OK) && (got == FM_PEER_RECORD) )
+	{
+		if (_fm_get32(&u8a_rec[0]) != u32_id)	continue;
+		p_p->slot = f_tell(p_cache) - FM_PEER_RECORD;
+		if (u8a_rec[FM_PEER_RECORD - 1] != _fm_check(u8a_rec, FM_PEER_RECORD))	return 0;
+
+		p_p->fails = u8a_rec[9];
+		p_p->baud = _fm_get32(&u8a_rec[4]);
+		p_p->protocol = u8a_rec[8];
+		p_p->tune.timeout = _fm_get16(&u8a_rec[10]);
+		p_p->tune.maxErr = u8a_rec[12];
+		p_p->tune.pace = u8a_rec[13];
+		p_p->tune.packet = _fm_get16(&u8a_rec[14]);
+		p_p->tune.window = u8a_rec[16];
+		if (p_p->fails)	return 0;
+		file_modem_tune(&p_p->tune);
+		p_p->tune = _fm_tune;
+		p_p->cached = 1;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+  * @brief Records how the session with a peer went
+  *
+  * After a successful transfer the link parameters in use (possibly picked by
+  * nmodem_probe() in the meantime), the protocol and the baud rate become the
+  * record of the peer. A failed transfer marks the record, so the next
+  * session doesn't use it, and sets the defaults right away for a retry.
+  *
+  * @param p_p			Peer from fm_peer_begin()
+  * @param result		Result of the receive function
+  * @param u8_protocol	Protocol used (enum fm_protocol)
+  * @param u32_baud		Baud rate used, zero if it doesn't matter
+  *
+  * @return		Zero if the cache has been written, one on a disk error
+  */
+uint8_t fm_peer_end(struct fm_peer *p_p, enum file_modem result, uint8_t u8_protocol, uint32_t u32_baud)
+{
+	if (result == FM_OK)
+	{
+		p_p->tune = _fm_tune;
+		p_p->protocol = u8_protocol;
+		p_p->baud = u32_baud;
+		p_p->fails = 0;
+	}
+	else
+	{
+		/* Nothing worth keeping for a peer never seen working */
+		if (!p_p->cached && (p_p->slot >= f_size(p_p->p_ffd)))	return 0;
+		if (p_p->fails < 0xFF)	p_p->fails++;
+		p_p->cached = 0;
+		file_modem_tune(NULL);
+	}
+	return _store(p_p);
+}
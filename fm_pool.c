@@ -0,0 +1,116 @@
+/*
+ * fm_pool.c
+ *
+ * Buffer pool: Fixed size buffers carved out of memory the application
+ * provides once, so the protocol engines never allocate while receiving.
+ * Every buffer starts on a FM_POOL_ALIGN boundary (a cache line on hosts)
+ * and is followed by its reference count:
+ *   Buffer (bufSize) | References | Padding up to FM_POOL_ALIGN
+ * Free buffers are chained through their first Bytes, taking and returning
+ * a buffer only touches the head of that list.
+ *
+ * A buffer is returned once the last holder lets go of it, e.g. a packet
+ * still waiting in the window of the engine and in the buffer of a sink.
+ * The pool isn't locked, it belongs to the thread receiving with it.
+ *
+ * Created: 18.10.2026 23:51:19
+ *  Author: gfcwfzkm
+ */
+
+#include "file_modem_int.h"
+#include <stddef.h>
+
+/* Pool the engines take their buffers from, see file_modem_pool() */
+FM_THREAD struct fm_pool *_fm_pool;
+
+/**
+  * @brief Sets up a pool in the given memory
+  *
+  * @param p_pool		Pool, the application only provides the memory
+  * @param p_mem		Memory for the buffers, see FM_POOL_MEM() for the size
+  * @param u32_size		Size of the memory
+  * @param u16_bufSize	Usable size of each buffer, at least the size of a pointer
+  *
+  * @return		Amount of buffers in the pool
+  */
+uint16_t fm_pool_init(struct fm_pool *p_pool, void *p_mem, uint32_t u32_size, uint16_t u16_bufSize)
+{
+	uint8_t *p_block = (uint8_t*)p_mem;
+	uint8_t **pp_link = &p_pool->p_free;
+	uint32_t u32_block = FM_POOL_BLOCK(u16_bufSize);
+	uint8_t u8_skip = (uint8_t)((FM_POOL_ALIGN - ((uintptr_t)p_block % FM_POOL_ALIGN)) % FM_POOL_ALIGN);
+
+	p_pool->bufSize = u16_bufSize;
+	p_pool->count = 0;
+	if (u16_bufSize < sizeof(uint8_t*))	u32_size = 0;
+	if (u32_size > u8_skip)
+	{
+		p_block += u8_skip;
+		u32_size -= u8_skip;
+		for (; (u32_size >= u32_block) && (p_pool->count < 0xFFFF); u32_size -= u32_block, p_block += u32_block)
+		{
+			p_block[u16_bufSize] = 0;
+			*pp_link = p_block;
+			pp_link = (uint8_t**)p_block;
+			p_pool->count++;
+		}
+	}
+	*pp_link = NULL;
+	p_pool->available = p_pool->count;
+	return p_pool->count;
+}
+
+/**
+  * @brief Takes a buffer out of the pool, the caller holds the only reference
+  *
+  * @return		The buffer, NULL if all of them are in use
+  */
+uint8_t *fm_pool_get(struct fm_pool *p_pool)
+{
+	uint8_t *p_buf = p_pool->p_free;
+
+	if (!p_buf)	return NULL;
+	p_pool->p_free = *(uint8_t**)p_buf;
+	p_pool->available--;
+	p_buf[p_pool->bufSize] = 1;
+	return p_buf;
+}
+
+/**
+  * @brief Adds a holder to a buffer, it needs another fm_pool_put()
+  *
+  * @return		Zero if successful, one if the buffer has got 255 holders
+  *				already. The caller must not keep the buffer then.
+  */
+uint8_t fm_pool_ref(struct fm_pool *p_pool, uint8_t *p_buf)
+{
+	if (p_buf[p_pool->bufSize] == 0xFF)	return 1;
+	p_buf[p_pool->bufSize]++;
+	return 0;
+}
+
+/**
+  * @brief Lets go of a buffer, the last holder returns it to the pool
+  */
+void fm_pool_put(struct fm_pool *p_pool, uint8_t *p_buf)
+{
+	if (!p_buf || !p_buf[p_pool->bufSize])	return;
+	if (--p_buf[p_pool->bufSize])			return;
+	*(uint8_t**)p_buf = p_pool->p_free;
+	p_pool->p_free = p_buf;
+	p_pool->available++;
+}
+
+/**
+  * @brief Lets the protocol engines take their buffers from a pool of the application
+  *
+  * Several ports receiving one after the other can share the memory this
+  * way. Buffers smaller than an engine needs aren't used by it, the engine
+  * falls back to its own memory then.
+  *
+  * @param p_pool	Pool, NULL for the memory of the engines
+  */
+void file_modem_pool(struct fm_pool *p_pool)
+{
+	_fm_pool = p_pool;
+}
@@ -0,0 +1,69 @@
+/*
+ * fm_scan.c
+ *
+ * Scanning kernel of the escape and framing codecs: How many Bytes in a row
+ * need no special treatment, i.e. up to the next COBS zero or Kermit prefix
+ * character. The codecs copy such runs in one piece instead of looking at
+ * every Byte on its own.
+ *
+ * On x86 hosts 16 Bytes are compared at once (SSE2, part of every x86-64),
+ * on other hosts a machine word (SWAR: a Byte is zero if subtracting one
+ * borrows into its top bit). The AVR compares Byte by Byte, it has no wider
+ * registers to gain anything from. tools/fm_scanbench.c measures them.
+ *
+ * Created: 19.10.2026 11:26:05
+ *  Author: gfcwfzkm
+ */
+
+#include "file_modem_int.h"
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+  * @brief Length of the run at the start of the buffer holding none of three Bytes
+  *
+  * Pass the same Byte more than once to look for fewer.
+  *
+  * @return		Position of the first of the Bytes, u16_len if none is there
+  */
+uint16_t _fm_span(const uint8_t *p_buf, uint16_t u16_len, uint8_t u8_a, uint8_t u8_b, uint8_t u8_c)
+{
+	uint16_t u16_pos = 0;
+#if defined(__SSE2__)
+	const __m128i a = _mm_set1_epi8((char)u8_a);
+	const __m128i b = _mm_set1_epi8((char)u8_b);
+	const __m128i c = _mm_set1_epi8((char)u8_c);
+	__m128i v;
+	int mask;
+
+	for (; u16_pos + 16 <= u16_len; u16_pos += 16)
+	{
+		v = _mm_loadu_si128((const __m128i*)&p_buf[u16_pos]);
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, a), _mm_cmpeq_epi8(v, b)),
+			_mm_cmpeq_epi8(v, c)));
+		if (mask)	return u16_pos + (uint16_t)__builtin_ctz((unsigned int)mask);
+	}
+#elif !defined(__AVR__)
+	const unsigned long ones = (unsigned long)-1 / 0xFF;	// 0x01 in every Byte
+	const unsigned long high = ones << 7;
+	unsigned long word, xa, xb, xc;
+
+	/* Stops at the word holding a match, the Byte loop below finds it */
+	for (; u16_pos + sizeof(word) <= u16_len; u16_pos += sizeof(word))
+	{
+		memcpy(&word, &p_buf[u16_pos], sizeof(word));
+		xa = word ^ (ones * u8_a);
+		xb = word ^ (ones * u8_b);
+		xc = word ^ (ones * u8_c);
+		if ( (((xa - ones) & ~xa) | ((xb - ones) & ~xb) | ((xc - ones) & ~xc)) & high )	break;
+	}
+#endif
+	while ( (u16_pos < u16_len) && (p_buf[u16_pos] != u8_a) && (p_buf[u16_pos] != u8_b) &&
+		(p_buf[u16_pos] != u8_c) )
+	{
+		u16_pos++;
+	}
+	return u16_pos;
+}
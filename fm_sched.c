@@ -0,0 +1,517 @@
+/*
+ * fm_sched.c
+ *
+ * File access of the file modem and a write scheduler for host processes
+ * running many transfers on the same disk at once.
+ *
+ * Without the scheduler the receive functions write straight to FatFs. With
+ * it, every file registered as session collects its packets in a buffer of
+ * its own. A full buffer gets queued and the session goes on with the second
+ * half of its buffer while the queue is written out in large batches: The
+ * sessions take turns (deficit round robin, weighted by their priority) and
+ * the queued batches of the same file are written together, sorted by
+ * offset. Only a session that runs out of buffer space writes the queue,
+ * the others keep receiving meanwhile.
+ *
+ * Every port receives in a thread of its own, the state of its transfer is
+ * kept per thread (FM_THREAD). The sessions share the queue: Two locks are
+ * needed, a short one for the queue and one for the disk, held while a batch
+ * is written. Both may be NULL in a single threaded program.
+ *
+ * Files of known size are allocated in one piece, with the sectors handed to
+ * the disk driver as write hint (file_modem_expect()).
+ *
+ * Created: 18.10.2026 18:11:30
+ *  Author: gfcwfzkm
+ */
+
+#include "file_modem_int.h"
+#include "diskio.h"
+#include <string.h>
+
+/* Largest chunk handed to f_write, UINT is only 16 bits wide on AVR */
+#define SCHED_CHUNK	0x4000
+
+/* Write scheduler in use, NULL if the files are written directly */
+static struct fm_sched *_sched;
+static uint32_t _queueSeq;		// Order in which the buffer halves got queued
+
+/* Files allocated for their expected size, cut back to what got written at
+ * the end of the file, see file_modem_expect(). Slots are claimed and freed
+ * under the queue lock, every port looks up only its own file. */
+static struct {
+	FIL *p_ffd;
+	FSIZE_t end;				// Furthest Byte written so far
+} _expected[FM_EXPECT_FILES];
+static uint8_t _expectedCount;
+
+static void _lockQueue(void)
+{
+	if (_sched->lockQueue)	_sched->lockQueue();
+}
+
+static void _unlockQueue(void)
+{
+	if (_sched->unlockQueue)	_sched->unlockQueue();
+}
+
+/**
+  * @brief Locks the expected files all ports share, with the queue lock of
+  *        the scheduler. Does nothing without one.
+  */
+static void _fm_lock(void)
+{
+	if (_sched)	_lockQueue();
+}
+
+static void _fm_unlock(void)
+{
+	if (_sched)	_unlockQueue();
+}
+
+/**
+  * @brief Finds the session a file belongs to
+  *
+  * @return		The session, NULL if the file is written directly
+  */
+static struct fm_session *_findSession(FIL *p_ffd)
+{
+	struct fm_session *p_s;
+
+	if (!_sched)	return NULL;
+	_lockQueue();
+	for (p_s = _sched->p_sessions; p_s && (p_s->p_ffd != p_ffd); p_s = p_s->p_next);
+	_unlockQueue();
+	return p_s;
+}
+
+/**
+  * @brief Picks the next session to write a batch of, deficit round robin
+  *
+  * Every round, each session with queued data earns its weight in quanta.
+  * A session may write its oldest batch once it has earned enough for it.
+  * Has to be called with the queue locked.
+  *
+  * @param p_half	Holds the buffer half to write
+  * @return			The session, NULL if nothing is queued
+  */
+static struct fm_session *_pickSession(uint8_t *p_half)
+{
+	struct fm_session *p_s;
+
+	/* Anything queued at all? A half being written (2) doesn't count */
+	for (p_s = _sched->p_sessions; p_s && (p_s->queued[0] != 1) && (p_s->queued[1] != 1); p_s = p_s->p_next);
+	if (!p_s)	return NULL;
+
+	for (;;)
+	{
+		for (p_s = _sched->p_cursor ? _sched->p_cursor : _sched->p_sessions; p_s; p_s = p_s->p_next)
+		{
+			if ( (p_s->queued[0] != 1) && (p_s->queued[1] != 1) )
+			{
+				/* Idle sessions don't save up */
+				p_s->deficit = 0;
+				continue;
+			}
+			if (p_s->queued[0] != 1)		*p_half = 1;
+			else if (p_s->queued[1] != 1)	*p_half = 0;
+			else							*p_half = ((int32_t)(p_s->seq[0] - p_s->seq[1]) < 0) ? 0 : 1;
+			if (p_s->deficit >= p_s->fill[*p_half])
+			{
+				p_s->deficit -= p_s->fill[*p_half];
+				_sched->p_cursor = p_s;
+				return p_s;
+			}
+			p_s->deficit += _sched->quantum * p_s->weight;
+		}
+		_sched->p_cursor = NULL;
+	}
+}
+
+/**
+  * @brief Writes one queued buffer half to the disk, with the disk locked
+  *
+  * @return		Zero if successful, one if the disk is full or failed
+  */
+static uint8_t _writeHalf(struct fm_session *p_s, uint8_t u8_half)
+{
+	uint32_t u32_done = 0;
+	UINT chunk, fs_bytesWritten;
+
+	if (f_tell(p_s->p_ffd) != p_s->offset[u8_half])
+	{
+		if (f_lseek(p_s->p_ffd, p_s->offset[u8_half]) != FR_OK)	return 1;
+	}
+	while (u32_done < p_s->fill[u8_half])
+	{
+		chunk = (p_s->fill[u8_half] - u32_done > SCHED_CHUNK) ? SCHED_CHUNK : (UINT)(p_s->fill[u8_half] - u32_done);
+		if (f_write(p_s->p_ffd, &p_s->p_buf[u8_half][u32_done], chunk, &fs_bytesWritten) != FR_OK)	return 1;
+		if (fs_bytesWritten < chunk)	return 1;
+		u32_done += chunk;
+	}
+	return 0;
+}
+
+/**
+  * @brief Writes the queue until a buffer half of a session is on the disk
+  *
+  * The session picked by the round robin gets its oldest batch written. All
+  * the other batches queued for the same file follow right away, lowest
+  * offset first, so the disk sees long sequential writes.
+  */
+static void _flushUntil(struct fm_session *p_own, uint8_t u8_ownHalf)
+{
+	struct fm_session *p_s, *p_next;
+	uint8_t u8_half, u8_nextHalf, b_failed;
+	FIL *p_file;
+
+	if (_sched->lockDisk)	_sched->lockDisk();
+	_lockQueue();
+	while (p_own->queued[u8_ownHalf])
+	{
+		p_s = _pickSession(&u8_half);
+		if (!p_s)	break;
+		p_file = p_s->p_ffd;
+
+		do{
+			/* Taken off the queue while being written, to not get picked twice */
+			p_s->queued[u8_half] = 2;
+			_unlockQueue();
+			b_failed = _writeHalf(p_s, u8_half);
+			_lockQueue();
+			if (b_failed)	p_s->failed = 1;
+			p_s->fill[u8_half] = 0;
+			p_s->queued[u8_half] = 0;
+
+			/* Next batch of the same file: The lowest offset still queued */
+			p_next = NULL;
+			for (p_s = _sched->p_sessions; p_s; p_s = p_s->p_next)
+			{
+				if (p_s->p_ffd != p_file)	continue;
+				for (u8_half = 0; u8_half < 2; u8_half++)
+				{
+					if ( (p_s->queued[u8_half] == 1) && (!p_next || (p_s->offset[u8_half] < p_next->offset[u8_nextHalf])) )
+					{
+						p_next = p_s;
+						u8_nextHalf = u8_half;
+					}
+				}
+			}
+			p_s = p_next;
+			u8_half = u8_nextHalf;
+		}while(p_s);
+	}
+	_unlockQueue();
+	if (_sched->unlockDisk)	_sched->unlockDisk();
+}
+
+/**
+  * @brief Queues the half of the buffer being filled and switches to the other one
+  *
+  * Writes the queue first if the other half is still waiting for the disk.
+  */
+static void _queueActive(struct fm_session *p_s)
+{
+	uint8_t u8_other = p_s->active ^ 1, b_waiting;
+
+	if (!p_s->fill[p_s->active])	return;
+	/* The flags change while another session writes the queue */
+	_lockQueue();
+	p_s->seq[p_s->active] = _queueSeq++;
+	p_s->queued[p_s->active] = 1;
+	b_waiting = (p_s->queued[u8_other] != 0);
+	_unlockQueue();
+
+	if (b_waiting)	_flushUntil(p_s, u8_other);
+	p_s->active = u8_other;
+}
+
+/**
+  * @brief Finds the entry of a file allocated for its expected size
+  *
+  * @return		Index in _expected[], FM_EXPECT_FILES if the file has none
+  */
+static uint8_t _findExpected(const FIL *p_ffd)
+{
+	uint8_t u8_idx;
+
+	for (u8_idx = 0; (u8_idx < FM_EXPECT_FILES) && (_expected[u8_idx].p_ffd != p_ffd); u8_idx++);
+	return u8_idx;
+}
+
+/**
+  * @brief Remembers how far an expected file has been written
+  */
+static void _written(const FIL *p_ffd, FSIZE_t end)
+{
+	uint8_t u8_idx = _findExpected(p_ffd);
+
+	if ( (u8_idx < FM_EXPECT_FILES) && (end > _expected[u8_idx].end) )	_expected[u8_idx].end = end;
+}
+
+/**
+  * @brief Writes data to the file at the current position
+  *
+  * @return		Zero if successful, one if the disk is full or failed. With the
+  *				scheduler, failures show up on one of the following calls.
+  */
+uint8_t _fm_fileWrite(FIL *p_ffd, const uint8_t *p_buf, uint16_t u16_len)
+{
+	struct fm_session *p_s = _findSession(p_ffd);
+	UINT fs_bytesWritten;
+	uint32_t u32_free;
+	uint16_t u16_part;
+
+	if (!p_s)
+	{
+		if (f_write(p_ffd, p_buf, u16_len, &fs_bytesWritten) != FR_OK)	return 1;
+		if (_expectedCount)	_written(p_ffd, f_tell(p_ffd));
+		return (fs_bytesWritten < u16_len);
+	}
+
+	while (u16_len)
+	{
+		if (!p_s->fill[p_s->active])	p_s->offset[p_s->active] = p_s->position;
+		u32_free = p_s->halfSize - p_s->fill[p_s->active];
+		u16_part = (u16_len > u32_free) ? (uint16_t)u32_free : u16_len;
+		memcpy(&p_s->p_buf[p_s->active][p_s->fill[p_s->active]], p_buf, u16_part);
+		p_s->fill[p_s->active] += u16_part;
+		p_s->position += u16_part;
+		p_buf += u16_part;
+		u16_len -= u16_part;
+		if (p_s->fill[p_s->active] == p_s->halfSize)	_queueActive(p_s);
+	}
+	if (_expectedCount)	_written(p_ffd, p_s->position);
+	return p_s->failed;
+}
+
+/**
+  * @brief Moves the write position of the file
+  *
+  * @return		Zero if successful, one if the seek failed
+  */
+uint8_t _fm_fileSeek(FIL *p_ffd, FSIZE_t offset)
+{
+	struct fm_session *p_s = _findSession(p_ffd);
+
+	if (!p_s)
+	{
+		if (f_tell(p_ffd) == offset)	return 0;
+		return (f_lseek(p_ffd, offset) != FR_OK);
+	}
+
+	/* The buffer only holds consecutive data */
+	if (p_s->position != offset)
+	{
+		_queueActive(p_s);
+		p_s->position = offset;
+	}
+	return p_s->failed;
+}
+
+/**
+  * @brief Writes everything buffered for the file and syncs it
+  *
+  * @return		Zero if successful, one if writing failed
+  */
+uint8_t _fm_fileSync(FIL *p_ffd)
+{
+	struct fm_session *p_s = _findSession(p_ffd);
+	uint8_t u8_half, b_waiting;
+
+	if (p_s)
+	{
+		_queueActive(p_s);
+		for (u8_half = 0; u8_half < 2; u8_half++)
+		{
+			_lockQueue();
+			b_waiting = (p_s->queued[u8_half] != 0);
+			_unlockQueue();
+			if (b_waiting)	_flushUntil(p_s, u8_half);
+		}
+		if (_sched->lockDisk)	_sched->lockDisk();
+		if (f_sync(p_ffd) != FR_OK)	p_s->failed = 1;
+		if (_sched->unlockDisk)	_sched->unlockDisk();
+		return p_s->failed;
+	}
+	return (f_sync(p_ffd) != FR_OK);
+}
+
+/**
+  * @brief Cuts a file allocated for its expected size back to what got written
+  *
+  * Called at the end of the file (_fm_sync()), once the data has been written.
+  * A sender announcing more than it sends leaves no allocated tail behind.
+  *
+  * @return		Zero if successful or nothing to do, one if the disk failed
+  */
+uint8_t _fm_fileTrim(FIL *p_ffd)
+{
+	uint8_t u8_idx = _findExpected(p_ffd), u8_result = 0;
+	FSIZE_t position;
+
+	if (u8_idx == FM_EXPECT_FILES)	return 0;
+	if (f_size(p_ffd) > _expected[u8_idx].end)
+	{
+		if (_sched && _sched->lockDisk)	_sched->lockDisk();
+		position = f_tell(p_ffd);
+		if ( (f_lseek(p_ffd, _expected[u8_idx].end) != FR_OK) || (f_truncate(p_ffd) != FR_OK) ||
+			(f_lseek(p_ffd, (position < _expected[u8_idx].end) ? position : _expected[u8_idx].end) != FR_OK) ||
+			(f_sync(p_ffd) != FR_OK) )
+		{
+			u8_result = 1;
+		}
+		if (_sched && _sched->unlockDisk)	_sched->unlockDisk();
+	}
+	_fm_lock();
+	_expected[u8_idx].p_ffd = NULL;
+	_expectedCount--;
+	_fm_unlock();
+	return u8_result;
+}
+
+/**
+  * @brief Announces the size of a file before receiving it
+  *
+  * The file gets allocated in one piece (f_expand(), needs FF_USE_EXPAND) and
+  * the disk driver is told which sectors follow, see FM_CTRL_WRITE_HINT. At
+  * the end of the file it is cut back to what actually arrived. Kermit calls
+  * it by itself if the sender tells the size, the other protocols don't know
+  * it up front: Call it before the receive function if the application does.
+  *
+  * Only done for an empty file without fan-out, and for up to FM_EXPECT_FILES
+  * files at once. Otherwise, or if the disk has no contiguous space left, the
+  * file is written as usual.
+  *
+  * @param p_ffd	File opened for writing, at position zero
+  * @param size		Expected size in Bytes. Zero forgets the file again, e.g.
+  *					after a failed transfer, and cuts it back to what got
+  *					written like at the end of the file.
+  */
+void file_modem_expect(FIL *p_ffd, FSIZE_t size)
+{
+#if FF_USE_EXPAND
+	uint8_t u8_idx = _findExpected(p_ffd);
+	FATFS *p_fs = p_ffd->obj.fs;
+	LBA_t range[2];
+	UINT sectorSize;
+	FRESULT result;
+
+	if (!size)
+	{
+		_fm_fileTrim(p_ffd);
+		return;
+	}
+	if ( (u8_idx < FM_EXPECT_FILES) || f_size(p_ffd) || f_tell(p_ffd) || _fm_hasFanout(p_ffd) )	return;
+
+	/* Claim a slot before expanding, another port may be looking for one */
+	_fm_lock();
+	u8_idx = _findExpected(NULL);
+	if (u8_idx < FM_EXPECT_FILES)
+	{
+		_expected[u8_idx].p_ffd = p_ffd;
+		_expected[u8_idx].end = 0;
+		_expectedCount++;
+	}
+	_fm_unlock();
+	if (u8_idx == FM_EXPECT_FILES)	return;
+
+	if (_sched && _sched->lockDisk)	_sched->lockDisk();
+	result = f_expand(p_ffd, size, 1);
+	if (result == FR_OK)
+	{
+#if FF_MAX_SS != FF_MIN_SS
+		sectorSize = p_fs->ssize;
+#else
+		sectorSize = FF_MAX_SS;
+#endif
+		range[0] = p_fs->database + (LBA_t)p_fs->csize * (p_ffd->obj.sclust - 2);
+		range[1] = (LBA_t)((size + sectorSize - 1) / sectorSize);
+		disk_ioctl(p_fs->pdrv, FM_CTRL_WRITE_HINT, range);
+	}
+	if (_sched && _sched->unlockDisk)	_sched->unlockDisk();
+
+	/* Not allocated, the file is written as usual */
+	if (result != FR_OK)
+	{
+		_fm_lock();
+		_expected[u8_idx].p_ffd = NULL;
+		_expectedCount--;
+		_fm_unlock();
+	}
+#else
+	(void)p_ffd;
+	(void)size;
+#endif
+}
+
+/**
+  * @brief Sets up the write scheduler, all receive functions use it from now on
+  *
+  * @param p_sched		Scheduler to set up. NULL turns it off again, which may
+  *						only happen with no sessions left.
+  * @param u32_quantum	Bytes a session with weight 1 may write per round
+  * @param lockQueue	Locks the queue, short. NULL if single threaded.
+  * @param unlockQueue	Unlocks the queue
+  * @param lockDisk		Locks the disk while a batch is written. NULL if single threaded.
+  * @param unlockDisk	Unlocks the disk
+  */
+void fm_sched_init(struct fm_sched *p_sched, uint32_t u32_quantum, void (*lockQueue)(void), void (*unlockQueue)(void),
+	void (*lockDisk)(void), void (*unlockDisk)(void))
+{
+	_sched = p_sched;
+	if (!p_sched)	return;
+	memset(p_sched, 0, sizeof(struct fm_sched));
+	p_sched->quantum = u32_quantum ? u32_quantum : 1;
+	p_sched->lockQueue = lockQueue;
+	p_sched->unlockQueue = unlockQueue;
+	p_sched->lockDisk = lockDisk;
+	p_sched->unlockDisk = unlockDisk;
+}
+
+/**
+  * @brief Registers a file as session, its writes get buffered and scheduled
+  *
+  * Call before the receive function, with the file opened and positioned.
+  *
+  * @param p_s		Session, stays in use until fm_sched_close()
+  * @param p_ffd	File the session writes to
+  * @param p_buf	Buffer of the session, split in two halves
+  * @param u32_size	Size of the buffer. Larger buffers give larger batches.
+  * @param u8_weight	Priority: Share of the disk relative to the other sessions, at least 1
+  */
+void fm_sched_open(struct fm_session *p_s, FIL *p_ffd, uint8_t *p_buf, uint32_t u32_size, uint8_t u8_weight)
+{
+	memset(p_s, 0, sizeof(struct fm_session));
+	p_s->p_ffd = p_ffd;
+	p_s->p_buf[0] = p_buf;
+	p_s->halfSize = u32_size / 2;
+	p_s->p_buf[1] = p_buf + p_s->halfSize;
+	p_s->weight = u8_weight ? u8_weight : 1;
+	p_s->position = f_tell(p_ffd);
+
+	_lockQueue();
+	p_s->p_next = _sched->p_sessions;
+	_sched->p_sessions = p_s;
+	_unlockQueue();
+}
+
+/**
+  * @brief Writes what is left of a session and removes it
+  *
+  * Also needed after a failed transfer, which might leave data buffered.
+  *
+  * @return		Zero if all data of the session got written, one if not
+  */
+uint8_t fm_sched_close(struct fm_session *p_s)
+{
+	struct fm_session **pp_s;
+	uint8_t u8_result = _fm_fileSync(p_s->p_ffd);
+
+	_lockQueue();
+	for (pp_s = &_sched->p_sessions; *pp_s && (*pp_s != p_s); pp_s = &(*pp_s)->p_next);
+	if (*pp_s)	*pp_s = p_s->p_next;
+	if (_sched->p_cursor == p_s)	_sched->p_cursor = NULL;
+	_unlockQueue();
+	return u8_result;
+}
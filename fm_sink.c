@@ -0,0 +1,297 @@
+/*
+ * fm_sink.c
+ *
+ * Storage of the receive functions and the fan-out of a transfer to several
+ * sinks, e.g. a file on the SD card and a flash staging slot.
+ *
+ * A sink is a write function with a context, an optional sync function, an
+ * optional buffer and its own sync interval. A file registered with
+ * fm_fanout_open() doesn't get written itself, every packet the receive
+ * function accepts goes to all its sinks instead, one after the other from
+ * the receive buffer. Sinks without buffer get every packet right away,
+ * sinks with one collect the packets until it is full, e.g. to write whole
+ * flash pages.
+ *
+ * If a sink fails it is left out from then on. Whether the transfer goes on
+ * depends on the policy of the fan-out.
+ *
+ * The list of fan-outs belongs to the thread receiving (FM_THREAD), like the
+ * rest of the state of a transfer: A port opens the fan-outs of its files in
+ * its own thread and no lock is needed.
+ *
+ * Created: 18.10.2026 19:02:47
+ *  Author: gfcwfzkm
+ */
+
+#include "file_modem_int.h"
+#include <string.h>
+
+/* Files with a fan-out, of the port receiving in this thread */
+static FM_THREAD struct fm_fanout *_fanouts;
+
+/**
+  * @brief Finds the fan-out of a file
+  *
+  * @return		The fan-out, NULL if the file is written itself
+  */
+static struct fm_fanout *_findFanout(FIL *p_ffd)
+{
+	struct fm_fanout *p_f;
+
+	for (p_f = _fanouts; p_f && (p_f->p_ffd != p_ffd); p_f = p_f->p_next);
+	return p_f;
+}
+
+/**
+  * @brief Writes the buffer of a sink, marks the sink failed if that didn't work
+  */
+static void _flushSink(struct fm_sink *p_s)
+{
+	if (!p_s->fill || p_s->failed)	return;
+	if (p_s->write(p_s->p_ctx, p_s->offset, p_s->p_buf, p_s->fill))	p_s->failed = 1;
+	p_s->fill = 0;
+}
+
+/**
+  * @brief Writes the buffer of a sink and syncs it
+  */
+static void _syncSink(struct fm_sink *p_s)
+{
+	_flushSink(p_s);
+	if (p_s->failed)	return;
+	if (p_s->sync && p_s->sync(p_s->p_ctx))	p_s->failed = 1;
+	p_s->unsynced = 0;
+}
+
+/**
+  * @brief Passes data on to a sink, directly or through its buffer
+  */
+static void _writeSink(struct fm_sink *p_s, const uint8_t *p_buf, uint16_t u16_len)
+{
+	uint16_t u16_part;
+
+	if (p_s->failed)	return;
+	p_s->unsynced += u16_len;
+	if (!p_s->p_buf)
+	{
+		if (p_s->write(p_s->p_ctx, p_s->position, p_buf, u16_len))	p_s->failed = 1;
+		p_s->position += u16_len;
+	}
+	else
+	{
+		/* The buffer only holds consecutive data */
+		if (p_s->fill && (p_s->offset + p_s->fill != p_s->position))	_flushSink(p_s);
+		while (u16_len && !p_s->failed)
+		{
+			if (!p_s->fill)	p_s->offset = p_s->position;
+			u16_part = p_s->bufSize - p_s->fill;
+			if (u16_part > u16_len)	u16_part = u16_len;
+			memcpy(&p_s->p_buf[p_s->fill], p_buf, u16_part);
+			p_s->fill += u16_part;
+			p_s->position += u16_part;
+			p_buf += u16_part;
+			u16_len -= u16_part;
+			if (p_s->fill == p_s->bufSize)	_flushSink(p_s);
+		}
+	}
+	if (p_s->syncEvery && (p_s->unsynced >= p_s->syncEvery))	_syncSink(p_s);
+}
+
+/**
+  * @brief Checks the sinks against the policy of the fan-out
+  *
+  * @return		Zero if the transfer may go on, one if not
+  */
+static uint8_t _fanoutResult(const struct fm_fanout *p_f)
+{
+	uint8_t u8_sink, u8_failed = 0;
+
+	for (u8_sink = 0; u8_sink < p_f->count; u8_sink++)
+	{
+		u8_failed += p_f->p_sinks[u8_sink].failed;
+	}
+	switch (p_f->policy)
+	{
+		case FM_FANOUT_FIRST:	return p_f->p_sinks[0].failed;
+		case FM_FANOUT_ANY:		return (u8_failed == p_f->count);
+		default:				return (u8_failed != 0);
+	}
+}
+
+/**
+  * @brief Stores data the receive function accepted
+  *
+  * @return		Zero if successful, one if the transfer has to stop
+  */
+uint8_t _fm_write(FIL *p_ffd, const uint8_t *p_buf, uint16_t u16_len)
+{
+	struct fm_fanout *p_f = _findFanout(p_ffd);
+	uint8_t u8_sink;
+
+	if (!p_f)	return _fm_fileWrite(p_ffd, p_buf, u16_len);
+	for (u8_sink = 0; u8_sink < p_f->count; u8_sink++)
+	{
+		_writeSink(&p_f->p_sinks[u8_sink], p_buf, u16_len);
+	}
+	return _fanoutResult(p_f);
+}
+
+/**
+  * @brief Moves the position the next data gets stored at
+  */
+uint8_t _fm_seek(FIL *p_ffd, FSIZE_t offset)
+{
+	struct fm_fanout *p_f = _findFanout(p_ffd);
+	uint8_t u8_sink;
+
+	if (!p_f)	return _fm_fileSeek(p_ffd, offset);
+	for (u8_sink = 0; u8_sink < p_f->count; u8_sink++)
+	{
+		p_f->p_sinks[u8_sink].position = offset;
+	}
+	return 0;
+}
+
+/**
+  * @brief Makes everything stored so far persistent, at the end of a file
+  */
+uint8_t _fm_sync(FIL *p_ffd)
+{
+	struct fm_fanout *p_f = _findFanout(p_ffd);
+	uint8_t u8_sink, u8_result;
+
+	if (p_f)
+	{
+		for (u8_sink = 0; u8_sink < p_f->count; u8_sink++)
+		{
+			_syncSink(&p_f->p_sinks[u8_sink]);
+		}
+		u8_result = _fanoutResult(p_f);
+	}
+	else
+	{
+		u8_result = _fm_fileSync(p_ffd);
+	}
+	/* Only after the data, the file may be the one of a sink */
+	return u8_result | _fm_fileTrim(p_ffd);
+}
+
+/**
+  * @brief Tells whether the data of a file goes to a fan-out
+  */
+uint8_t _fm_hasFanout(FIL *p_ffd)
+{
+	return (_findFanout(p_ffd) != NULL);
+}
+
+/**
+  * @brief Limits the size of a transfer to what the file can hold
+  *
+  * Files on FAT volumes end at 4 GiB - 1, only exFAT allows larger ones. The
+  * transfer gets FM_SIZE_EXCEEDED then, instead of running into a full disk.
+  * Sinks of a fan-out don't have such a limit.
+  *
+  * @param maxsize	Limit set by the application
+  * @param from		File offset the limit counts from. f_tell for receivers
+  *					counting the Bytes they wrote, zero for the ones comparing
+  *					absolute offsets.
+  * @return			The lower one of both limits
+  */
+FSIZE_t _fm_limit(FIL *p_ffd, FSIZE_t maxsize, FSIZE_t from)
+{
+	FSIZE_t room;
+
+	if (_findFanout(p_ffd))	return maxsize;
+#if FF_FS_EXFAT
+	if (p_ffd->obj.fs->fs_type == FS_EXFAT)	return maxsize;
+#endif
+	room = 0xFFFFFFFFUL - from;
+	return (maxsize > room) ? room : maxsize;
+}
+
+/**
+  * @brief Sets up a sink
+  *
+  * @param p_s			Sink to set up
+  * @param write		Writes Bytes to an offset, returns zero if successful
+  * @param sync			Makes the written data persistent, returns zero if
+  *						successful. NULL if not needed.
+  * @param p_ctx		Passed on to write and sync
+  * @param p_buf		Buffer of the sink, NULL to get every packet right away
+  * @param u16_size		Size of the buffer
+  * @param u32_syncEvery	Syncs after this many Bytes, zero only at the end of the file
+  */
+void fm_sink_init(struct fm_sink *p_s, uint8_t (*write)(void*, FSIZE_t, const uint8_t*, uint16_t),
+	uint8_t (*sync)(void*), void *p_ctx, uint8_t *p_buf, uint16_t u16_size, uint32_t u32_syncEvery)
+{
+	memset(p_s, 0, sizeof(struct fm_sink));
+	p_s->write = write;
+	p_s->sync = sync;
+	p_s->p_ctx = p_ctx;
+	p_s->p_buf = u16_size ? p_buf : NULL;
+	p_s->bufSize = u16_size;
+	p_s->syncEvery = u32_syncEvery;
+}
+
+static uint8_t _fileWrite(void *p_ctx, FSIZE_t offset, const uint8_t *p_buf, uint16_t u16_len)
+{
+	if (_fm_fileSeek((FIL*)p_ctx, offset))	return 1;
+	return _fm_fileWrite((FIL*)p_ctx, p_buf, u16_len);
+}
+
+static uint8_t _fileSync(void *p_ctx)
+{
+	return _fm_fileSync((FIL*)p_ctx);
+}
+
+/**
+  * @brief Sets up a sink writing to a file, opened for writing
+  *
+  * Goes through the write scheduler if the file is a session of it. The
+  * parameters are the same as for fm_sink_init().
+  */
+void fm_sink_file(struct fm_sink *p_s, FIL *p_ffd, uint8_t *p_buf, uint16_t u16_size, uint32_t u32_syncEvery)
+{
+	fm_sink_init(p_s, _fileWrite, _fileSync, p_ffd, p_buf, u16_size, u32_syncEvery);
+	p_s->position = f_tell(p_ffd);
+}
+
+/**
+  * @brief Sends everything the receive functions write to a file to several sinks instead
+  *
+  * Call before the receive function. The file is only used to tell the
+  * transfers apart and may be one of the sinks (see fm_sink_file()).
+  *
+  * @param p_f		Fan-out, stays in use until fm_fanout_close()
+  * @param p_ffd	File passed to the receive function
+  * @param p_sinks	Array with the sinks, set up with fm_sink_init() or fm_sink_file()
+  * @param u8_count	Amount of sinks
+  * @param u8_policy	When the transfer fails (enum fm_fanout_policy): If any
+  *					sink fails, if the first one does or only if all of them do
+  */
+void fm_fanout_open(struct fm_fanout *p_f, FIL *p_ffd, struct fm_sink *p_sinks, uint8_t u8_count, uint8_t u8_policy)
+{
+	p_f->p_ffd = p_ffd;
+	p_f->p_sinks = p_sinks;
+	p_f->count = u8_count;
+	p_f->policy = u8_policy;
+	p_f->p_next = _fanouts;
+	_fanouts = p_f;
+}
+
+/**
+  * @brief Writes what is left in the sink buffers and removes the fan-out
+  *
+  * The failed flag of every sink tells which of them got all the data.
+  *
+  * @return		Zero if the sinks are fine according to the policy, one if not
+  */
+uint8_t fm_fanout_close(struct fm_fanout *p_f)
+{
+	struct fm_fanout **pp_f;
+	uint8_t u8_result = _fm_sync(p_f->p_ffd);
+
+	for (pp_f = &_fanouts; *pp_f && (*pp_f != p_f); pp_f = &(*pp_f)->p_next);
+	if (*pp_f)	*pp_f = p_f->p_next;
+	return u8_result;
+}
@@ -0,0 +1,260 @@
+/*
+ * fm_stats.c
+ *
+ * Transfer statistics of the file modem: Counters and a packet latency
+ * histogram, filled by the receive functions, and an export of them in the
+ * Prometheus text format for a host-side transfer service with several ports.
+ *
+ * Every port has its own struct fm_stats, written only by the thread running
+ * the transfer on it. Which statistics and clock are in use is kept per thread
+ * on hosts (FM_THREAD), like the rest of the transfer, every port's thread
+ * calls file_modem_stats() for its own. The export reads them without
+ * locking, from a copy of each port's struct: The counters only grow and a
+ * scrape that catches a packet half counted is off by one packet. Counters
+ * wider than the host writes at once can tear though, bytes on a 32-bit host
+ * with a 64-bit FSIZE_t: The export copies until two copies of it agree,
+ * which makes a torn value unlikely but not impossible.
+ *
+ * Created: 18.10.2026 16:25:10
+ *  Author: gfcwfzkm
+ */
+
+#include "file_modem_int.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Statistics of the running transfer, NULL if disabled */
+FM_THREAD struct fm_stats *_stats;
+
+/* Millisecond clock for the latency histogram and the idle deadline, NULL if
+ * not available */
+FM_THREAD uint32_t (*_fm_millis)(void);
+static FM_THREAD uint32_t _lastPacket;
+
+static const uint16_t _bounds[FM_STATS_BUCKETS - 1] = FM_STATS_BOUNDS;
+
+/**
+  * @brief Enables the transfer statistics of the calling thread
+  *
+  * @param p_stats	Statistics to count into, NULL disables them. Aren't cleared,
+  *					so the counters keep growing over several transfers.
+  * @param millis	Function returning a millisecond timestamp, used for the
+  *					latency histogram and the idle deadline of the receivers.
+  *					NULL if there is none, the histogram stays empty and the
+  *					receivers have no deadline then. May be given without
+  *					statistics, for the deadline alone.
+  */
+void file_modem_stats(struct fm_stats *p_stats, uint32_t (*millis)(void))
+{
+	_stats = p_stats;
+	_fm_millis = millis;
+}
+
+/**
+  * @brief Starts the latency measurement, called at the start of a transfer
+  */
+void _fm_statStart(void)
+{
+	if (_fm_millis)	_lastPacket = _fm_millis();
+}
+
+/**
+  * @brief Counts an accepted packet and the time since the previous one
+  *
+  * @param u32_bytes	Payload Bytes the packet added to the file, a fill
+  *						record stands for up to 4 GiB
+  */
+void _fm_statPacket(uint32_t u32_bytes)
+{
+	uint32_t now = 0, elapsed = 0;
+	uint8_t u8_bucket = 0;
+
+	/* The deadline needs the time of the packet even without statistics */
+	if (_fm_millis)
+	{
+		now = _fm_millis();
+		elapsed = now - _lastPacket;
+		_lastPacket = now;
+	}
+
+	if (!_stats)	return;
+	_stats->packets++;
+	_stats->bytes += u32_bytes;
+
+	if (!_fm_millis)	return;
+
+	while ( (u8_bucket < FM_STATS_BUCKETS - 1) && (elapsed > _bounds[u8_bucket]) )
+	{
+		u8_bucket++;
+	}
+	_stats->latency[u8_bucket]++;
+	_stats->latencySum += elapsed;
+}
+
+/**
+  * @brief Checks the idle deadline of the receivers
+  *
+  * A peer trickling garbage, damaged or repeated packets, one Byte just within
+  * TIMEOUT after the other, never makes MAX_ERR timeouts in a row and can keep
+  * a receiver busy for hours. With a clock the receivers give up once no packet
+  * was accepted for twice the time a silent peer costs, MAX_ERR timeouts.
+  *
+  * @return		One if the deadline is over, zero if not or without a clock
+  */
+uint8_t _fm_idle(void)
+{
+	if (!_fm_millis)	return 0;
+	return (_fm_millis() - _lastPacket) > 2UL * MAX_ERR * TIMEOUT;
+}
+
+/**
+  * @brief Appends formatted text to the export buffer, like snprintf
+  *
+  * @return		Zero if it fit, one if the buffer is full
+  */
+static uint8_t _fm_append(char *p_buf, uint16_t u16_len, uint16_t *p_pos, const char *p_fmt, ...)
+{
+	va_list args;
+	int written;
+
+	if (*p_pos >= u16_len)	return 1;
+	va_start(args, p_fmt);
+	written = vsnprintf(&p_buf[*p_pos], u16_len - *p_pos, p_fmt, args);
+	va_end(args);
+	if ( (written < 0) || (written >= u16_len - *p_pos) )	return 1;
+	*p_pos += written;
+	return 0;
+}
+
+/**
+  * @brief Converts a counter into a decimal number, avr-libc's printf can't
+  *        print 64-bit numbers
+  *
+  * @param p_end	End of the buffer, 21 Bytes are enough for any counter
+  * @return			Start of the zero terminated number
+  */
+static char *_fm_decimal(char *p_end, FSIZE_t val)
+{
+	*--p_end = '\0';
+	do{
+		*--p_end = '0' + (char)(val % 10);
+		val /= 10;
+	}while(val);
+	return p_end;
+}
+
+/**
+  * @brief Copies the statistics of a port while its thread keeps counting
+  *
+  * Again until bytes is the same in two copies, it may be wider than what
+  * the host reads and writes at once.
+  */
+static void _fm_snapshot(struct fm_stats *p_snap, const struct fm_stats *p_stats)
+{
+	uint8_t u8_try = 0;
+
+	do{
+		memcpy(p_snap, p_stats, sizeof(struct fm_stats));
+	}while( (p_snap->bytes != *(const volatile FSIZE_t *)&p_stats->bytes) && (++u8_try < 8) );
+}
+
+/**
+  * @brief Exports the statistics of several ports in the Prometheus text format
+  *
+  * Every metric gets a port label. The latency is exported as histogram in
+  * seconds, as Prometheus expects it.
+  *
+  * @param p_stats	Array with the statistics of every port
+  * @param p_ports	Array with the names of the ports, used as label
+  * @param u8_count	Amount of ports
+  * @param p_buf	Buffer for the text, gets zero terminated
+  * @param u16_len	Size of the buffer
+  *
+  * @return			Length of the text, zero if the buffer is too small
+  */
+uint16_t fm_stats_prometheus(const struct fm_stats *p_stats, const char *const *p_ports, uint8_t u8_count,
+	char *p_buf, uint16_t u16_len)
+{
+	static const struct {
+		const char *p_name;		// Metric name, without the fm_ prefix and _total suffix
+		const char *p_help;
+		uint8_t u8_offset;		// Offset of the counter in struct fm_stats
+	} counters[] = {
+		{"bytes",		"Payload bytes stored",							offsetof(struct fm_stats, bytes)},
+		{"packets",		"Packets accepted",								offsetof(struct fm_stats, packets)},
+		{"retries",		"Packets asked for again or received twice",	offsetof(struct fm_stats, retries)},
+		{"timeouts",	"Timeouts while waiting for a packet",			offsetof(struct fm_stats, timeouts)},
+		{"errors",		"Damaged or unexpected packets",				offsetof(struct fm_stats, errors)},
+	};
+	struct fm_stats snap;
+	uint16_t u16_pos = 0;
+	uint8_t u8_metric, u8_port, u8_bucket;
+	uint32_t u32_val;
+	FSIZE_t val;
+	char number[21];
+	uint8_t b_full = 0;
+
+	if (!u16_len)	return 0;
+
+	for (u8_metric = 0; u8_metric < sizeof(counters) / sizeof(counters[0]); u8_metric++)
+	{
+		b_full |= _fm_append(p_buf, u16_len, &u16_pos, "# HELP fm_%s_total %s\n# TYPE fm_%s_total counter\n",
+			counters[u8_metric].p_name, counters[u8_metric].p_help, counters[u8_metric].p_name);
+		for (u8_port = 0; u8_port < u8_count; u8_port++)
+		{
+			_fm_snapshot(&snap, &p_stats[u8_port]);
+			/* bytes is a FSIZE_t, the others are 32 bits wide */
+			if (counters[u8_metric].u8_offset == offsetof(struct fm_stats, bytes))
+			{
+				val = snap.bytes;
+			}
+			else
+			{
+				memcpy(&u32_val, (const uint8_t *)&snap + counters[u8_metric].u8_offset, sizeof(u32_val));
+				val = u32_val;
+			}
+			b_full |= _fm_append(p_buf, u16_len, &u16_pos, "fm_%s_total{port=\"%s\"} %s\n",
+				counters[u8_metric].p_name, p_ports[u8_port], _fm_decimal(&number[sizeof(number)], val));
+		}
+	}
+
+	b_full |= _fm_append(p_buf, u16_len, &u16_pos, "# HELP fm_packet_latency_seconds %s\n"
+		"# TYPE fm_packet_latency_seconds histogram\n", "Time between two accepted packets");
+	for (u8_port = 0; u8_port < u8_count; u8_port++)
+	{
+		/* Copy first, the histogram should add up even if a packet gets counted meanwhile */
+		_fm_snapshot(&snap, &p_stats[u8_port]);
+		u32_val = 0;
+		for (u8_bucket = 0; u8_bucket < FM_STATS_BUCKETS; u8_bucket++)
+		{
+			/* Prometheus buckets count everything up to their bound */
+			u32_val += snap.latency[u8_bucket];
+			if (u8_bucket < FM_STATS_BUCKETS - 1)
+			{
+				b_full |= _fm_append(p_buf, u16_len, &u16_pos,
+					"fm_packet_latency_seconds_bucket{port=\"%s\",le=\"%u.%03u\"} %lu\n", p_ports[u8_port],
+					_bounds[u8_bucket] / 1000, _bounds[u8_bucket] % 1000, (unsigned long)u32_val);
+			}
+			else
+			{
+				b_full |= _fm_append(p_buf, u16_len, &u16_pos,
+					"fm_packet_latency_seconds_bucket{port=\"%s\",le=\"+Inf\"} %lu\n", p_ports[u8_port],
+					(unsigned long)u32_val);
+			}
+		}
+		b_full |= _fm_append(p_buf, u16_len, &u16_pos,
+			"fm_packet_latency_seconds_sum{port=\"%s\"} %lu.%03lu\n"
+			"fm_packet_latency_seconds_count{port=\"%s\"} %lu\n",
+			p_ports[u8_port], (unsigned long)(snap.latencySum / 1000), (unsigned long)(snap.latencySum % 1000),
+			p_ports[u8_port], (unsigned long)u32_val);
+	}
+
+	if (b_full)
+	{
+		p_buf[0] = '\0';
+		return 0;
+	}
+	return u16_pos;
+}
@@ -0,0 +1,873 @@
+/*
+ * kermit.c
+ *
+ * Kermit receiver, sharing the transport callbacks and the FatFs storage
+ * with the X-Modem and N-Modem receivers. Besides basic Kermit it supports
+ * the extensions that make it usable on fast links:
+ *  - Long packets, up to KERMIT_MAXL Bytes
+ *  - Sliding windows, up to KERMIT_WINDOW packets are kept ahead of a
+ *    missing one, lost packets get NAKed selectively
+ *  - Repeat count compression and 8th-bit prefixing
+ *  - Locking shifts (SO/SI) for 7-bit links, along with 8th-bit prefixing,
+ *    and unprefixed control characters from senders that know the link is
+ *    8-bit clean
+ *  - Block check types 1, 2 and 3 (CRC-16)
+ *  - Attribute packets, a file announced larger than *p_maxsize is refused
+ *
+ * One file is received per session. The file header's name is ignored, the
+ * data goes into the file passed by the application. Another file of a batch
+ * is answered with an error packet.
+ *
+ * Reference used: Frank da Cruz, Kermit Protocol Manual, 6th Edition,
+ * including the long packet, sliding window and locking shift extensions.
+ *
+ * Created: 18.10.2026 13:41:09
+ *  Author: gfcwfzkm
+ */
+
+#include "file_modem_int.h"
+#include <string.h>
+
+#if (KERMIT_WINDOW < 1) || (KERMIT_WINDOW > 31)
+#error "KERMIT_WINDOW has to be between 1 and 31"
+#endif
+#if (KERMIT_MAXL < 94) || (KERMIT_MAXL > 9024)
+#error "KERMIT_MAXL has to be between 94 and 9024"
+#endif
+
+#define K_MARK	0x01	// SOH, start of every packet
+#define K_CR	0x0D	// Default end of line
+#define K_SO	0x0E	// Locking shift: Shift-Out, following characters have the 8th bit set
+#define K_SI	0x0F	// Locking shift: Shift-In, back to 7 bits
+#define K_DLE	0x10	// Locking shift: take the next character as data, even if it's a SO/SI
+#define K_QCTL	0x23	// '#', default control prefix
+#define K_MAXL	94		// Longest normal (not long) packet
+
+#define K_CAP_MORE	0x01	// Another CAPAS field follows
+#define K_CAP_LP	0x02	// Capability: Long packets
+#define K_CAP_SW	0x04	// Capability: Sliding windows
+#define K_CAP_AT	0x08	// Capability: Attribute packets
+#define K_CAP_LS	0x20	// Capability: Locking shifts
+
+#define K_REPLY		16		// Largest data field of a packet the receiver sends
+#define K_FRAMING	11		// Mark, long packet header, check and end of line around the data
+
+/* Valid packets that don't slide the window (duplicates, packets outside of
+ * it or before the Send-Init) the receiver takes before it gives up */
+#define K_IDLE_PACKETS	(2 * MAX_ERR * KERMIT_WINDOW)
+
+#define TOCHAR(x)	((uint8_t)((x) + 32))	// Number to printable character
+#define UNCHAR(x)	((uint8_t)((x) - 32))	// Printable character to number
+#define CTL(x)		((uint8_t)((x) ^ 64))	// Control character to printable and back
+
+enum kermitPacketResult {KP_OK,KP_TIMEOUT,KP_INVALID,KP_RESYNC};
+enum kermitPhase {KS_INIT,KS_FILE,KS_DATA};
+
+/* Parameters negotiated with the Send-Init packet and the receive window */
+static FM_THREAD struct
+{
+	uint8_t eol;		// End of line the sender wants behind our packets
+	uint8_t npad;		// Amount of padding characters before our packets
+	uint8_t padc;		// Padding character
+	uint8_t qctl;		// Control prefix of the sender
+	uint8_t qbin;		// 8th-bit prefix, zero if not in use
+	uint8_t rept;		// Repeat prefix, zero if not in use
+	uint8_t chkt;		// Block check type, 1 to 3
+	uint8_t window;		// Negotiated window size
+	uint8_t lockShift;	// Locking shifts in use
+	uint8_t shifted;	// Locking shift state, 0x80 after SO
+	uint8_t wlo;		// Sequence number of the lowest packet not processed yet
+	uint8_t slotBase;	// Slot holding packet wlo
+	uint8_t slots;		// Window slots with a buffer, the most the window may have
+	struct fm_pool *p_pool;	// Pool the slot buffers come from
+	uint32_t stored;	// Bit n set: packet wlo + n is stored in its slot
+	uint16_t outFill;	// Decoded Bytes waiting in the work buffer
+	FSIZE_t total;		// Bytes written to the file so far
+} k;
+
+/* Window slots, holding the still encoded data field of a packet. The
+ * buffers come from the pool of the application, or from kslotPool if it
+ * hasn't got one or its buffers are too small. With KERMIT_EXTERNAL_POOL
+ * there is no kslotPool, the RAM for it is saved. */
+static FM_THREAD uint8_t *p_kslot[KERMIT_WINDOW];
+#ifndef KERMIT_EXTERNAL_POOL
+static FM_THREAD uint8_t u8a_kslotMem[FM_POOL_MEM(KERMIT_WINDOW, KERMIT_MAXL)];
+static FM_THREAD struct fm_pool kslotPool;
+#endif
+static FM_THREAD uint16_t u16a_kslotLen[KERMIT_WINDOW];
+static FM_THREAD uint8_t u8a_kslotType[KERMIT_WINDOW];
+
+/**
+  * @brief Takes buffers for the window slots out of a pool
+  *
+  * @return		Amount of slots with a buffer
+  */
+static uint8_t _k_takeSlots(struct fm_pool *p_pool)
+{
+	uint8_t u8_slots;
+
+	k.p_pool = p_pool;
+	for (u8_slots = 0; u8_slots < KERMIT_WINDOW; u8_slots++)
+	{
+		p_kslot[u8_slots] = fm_pool_get(p_pool);
+		if (!p_kslot[u8_slots])	break;
+	}
+	return u8_slots;
+}
+
+/**
+  * @brief Adds a character to a block check
+  *
+  * Type 1 and 2 are plain sums, the folding happens in _k_checkChars.
+  * Type 3 is the CRC-CCITT as Kermit uses it (reflected, starting at zero).
+  */
+static uint16_t _k_checkUpdate(uint16_t u16_check, uint8_t u8_ch, uint8_t u8_chkt)
+{
+	uint8_t i;
+
+	if (u8_chkt != 3)	return u16_check + u8_ch;
+
+	u16_check ^= u8_ch;
+	for (i = 0; i < 8; i++)
+	{
+		if (u16_check & 1)
+		{
+			u16_check = (u16_check >> 1) ^ 0x8408;
+		}
+		else
+		{
+			u16_check = u16_check >> 1;
+		}
+	}
+	return u16_check;
+}
+
+/**
+  * @brief Converts a block check into the characters that are sent
+  *
+  * @param p_out	Room for up to 3 characters
+  * @return			Amount of check characters, same as the check type
+  */
+static uint8_t _k_checkChars(uint16_t u16_check, uint8_t u8_chkt, uint8_t *p_out)
+{
+	switch(u8_chkt)
+	{
+		case 2:
+			p_out[0] = TOCHAR((u16_check >> 6) & 0x3F);
+			p_out[1] = TOCHAR(u16_check & 0x3F);
+			break;
+		case 3:
+			p_out[0] = TOCHAR((u16_check >> 12) & 0x0F);
+			p_out[1] = TOCHAR((u16_check >> 6) & 0x3F);
+			p_out[2] = TOCHAR(u16_check & 0x3F);
+			break;
+		default:
+			p_out[0] = TOCHAR((u16_check + ((u16_check & 0xC0) >> 6)) & 0x3F);
+			u8_chkt = 1;
+			break;
+	}
+	return u8_chkt;
+}
+
+/**
+  * @brief Sends a packet, with padding and end of line as the sender asked for
+  *
+  * @param u8_type	Packet type ('Y', 'N', 'E')
+  * @param u8_seq	Sequence number
+  * @param p_data	Data field, only printable characters
+  * @param u8_len	Length of the data field
+  * @param u8_chkt	Block check type to use
+  */
+static void _k_sendPacket(uint8_t u8_type, uint8_t u8_seq, const uint8_t *p_data, uint8_t u8_len, uint8_t u8_chkt)
+{
+	uint8_t u8a_head[3], u8a_chk[3], u8_cnt, u8_chkLen;
+	uint16_t u16_check = 0;
+
+	u8a_head[0] = TOCHAR(u8_len + 2 + u8_chkt);
+	u8a_head[1] = TOCHAR(u8_seq & 0x3F);
+	u8a_head[2] = u8_type;
+
+	for (u8_cnt = 0; u8_cnt < k.npad; u8_cnt++)
+	{
+		_sendByte(k.padc);
+	}
+	_sendByte(K_MARK);
+	for (u8_cnt = 0; u8_cnt < 3; u8_cnt++)
+	{
+		u16_check = _k_checkUpdate(u16_check, u8a_head[u8_cnt], u8_chkt);
+		_sendByte(u8a_head[u8_cnt]);
+	}
+	for (u8_cnt = 0; u8_cnt < u8_len; u8_cnt++)
+	{
+		u16_check = _k_checkUpdate(u16_check, p_data[u8_cnt], u8_chkt);
+		_sendByte(p_data[u8_cnt]);
+	}
+	u8_chkLen = _k_checkChars(u16_check, u8_chkt, u8a_chk);
+	for (u8_cnt = 0; u8_cnt < u8_chkLen; u8_cnt++)
+	{
+		_sendByte(u8a_chk[u8_cnt]);
+	}
+	_sendByte(k.eol);
+}
+
+/**
+  * @brief Sends an error packet, which ends the transfer on the sender's side
+  */
+static void _k_sendError(const char *p_msg)
+{
+	_k_sendPacket('E', k.wlo, (const uint8_t *)p_msg, (uint8_t)strlen(p_msg), k.chkt);
+}
+
+/**
+  * @brief Sends the error packet matching why storing the data failed
+  */
+static void _k_sendFailure(enum file_modem result)
+{
+	switch(result)
+	{
+		case FM_DISK_FULL:		_k_sendError("Disk full");				break;
+		case FM_SIZE_EXCEEDED:	_k_sendError("File too large");			break;
+		case FM_ABORTED:		_k_sendError("Damaged data encoding");	break;
+		default:				_k_sendError("Receiver failed");		break;
+	}
+}
+
+/**
+  * @brief Receives one character of a packet
+  *
+  * @return		KP_OK, KP_TIMEOUT, or KP_RESYNC if a new packet starts
+  */
+static enum kermitPacketResult _k_receiveChar(uint8_t *p_ch)
+{
+	if (_fm_recByte(p_ch))	return KP_TIMEOUT;
+	if (*p_ch == K_MARK)			return KP_RESYNC;
+	return KP_OK;
+}
+
+/**
+  * @brief Receives the rest of a packet after its mark
+  *
+  * The data field goes straight into the window slot of the packet if it
+  * is inside the window and not stored yet, else it is only checked.
+  *
+  * @param p_seq	Sequence number of the packet
+  * @param p_type	Packet type
+  * @return			KP_OK if the packet is valid
+  */
+static enum kermitPacketResult _k_readPacket(uint8_t *p_seq, uint8_t *p_type)
+{
+	enum kermitPacketResult result;
+	uint8_t u8a_head[6], u8a_chk[3], u8_ch, u8_cnt, u8_chkt, u8_chkLen, u8_dist;
+	uint8_t *p_slot = 0;
+	uint16_t u16_len, u16_cnt, u16_check = 0, u16_headCheck = 0;
+
+	/* LEN, SEQ and TYPE */
+	for (u8_cnt = 0; u8_cnt < 3; u8_cnt++)
+	{
+		result = _k_receiveChar(&u8a_head[u8_cnt]);
+		if (result != KP_OK)	return result;
+	}
+	if ( (u8a_head[1] < 32) || (u8a_head[1] > 95) )	return KP_INVALID;
+	*p_seq = UNCHAR(u8a_head[1]);
+	*p_type = u8a_head[2];
+
+	/* Send-Init and its repetitions always use the single character check */
+	u8_chkt = (*p_type == 'S') ? 1 : k.chkt;
+
+	/* A long packet has LEN zero, followed by LENX1, LENX2 and a header check */
+	u8_cnt = (UNCHAR(u8a_head[0]) == 0) ? 6 : 3;
+	for (u16_cnt = 3; u16_cnt < u8_cnt; u16_cnt++)
+	{
+		result = _k_receiveChar(&u8a_head[u16_cnt]);
+		if (result != KP_OK)	return result;
+	}
+	for (u16_cnt = 0; u16_cnt < u8_cnt; u16_cnt++)
+	{
+		if (u16_cnt < 5)	u16_headCheck = _k_checkUpdate(u16_headCheck, u8a_head[u16_cnt], 1);
+		u16_check = _k_checkUpdate(u16_check, u8a_head[u16_cnt], u8_chkt);
+	}
+
+	if (u8_cnt == 6)
+	{
+		_k_checkChars(u16_headCheck, 1, u8a_chk);
+		if (u8a_head[5] != u8a_chk[0])	return KP_INVALID;
+		/* LENX counts data and check */
+		u16_len = (uint16_t)UNCHAR(u8a_head[3]) * 95 + UNCHAR(u8a_head[4]);
+	}
+	else
+	{
+		/* LEN counts SEQ, TYPE, data and check */
+		u16_len = UNCHAR(u8a_head[0]);
+		if (u16_len < 2)	return KP_INVALID;
+		u16_len -= 2;
+	}
+	if ( (u16_len < u8_chkt) || (u16_len - u8_chkt > KERMIT_MAXL) )	return KP_INVALID;
+	u16_len -= u8_chkt;
+
+	/* Store into the window slot of the packet, if it's one we need */
+	u8_dist = (*p_seq - k.wlo) & 0x3F;
+	if ( (u8_dist < k.window) && !(k.stored & (1UL << u8_dist)) )
+	{
+		p_slot = p_kslot[(k.slotBase + u8_dist) % k.slots];
+	}
+
+	for (u16_cnt = 0; u16_cnt < u16_len; u16_cnt++)
+	{
+		result = _k_receiveChar(&u8_ch);
+		if (result != KP_OK)	return result;
+		u16_check = _k_checkUpdate(u16_check, u8_ch, u8_chkt);
+		if (p_slot)	p_slot[u16_cnt] = u8_ch;
+	}
+
+	u8_chkLen = _k_checkChars(u16_check, u8_chkt, u8a_chk);
+	for (u8_cnt = 0; u8_cnt < u8_chkLen; u8_cnt++)
+	{
+		result = _k_receiveChar(&u8_ch);
+		if (result != KP_OK)	return result;
+		if (u8_ch != u8a_chk[u8_cnt])	return KP_INVALID;
+	}
+
+	if (p_slot)
+	{
+		u16a_kslotLen[(k.slotBase + u8_dist) % k.slots] = u16_len;
+		u8a_kslotType[(k.slotBase + u8_dist) % k.slots] = *p_type;
+	}
+	return KP_OK;
+}
+
+/**
+  * @brief Waits for the next packet and receives it
+  *
+  * Everything between packets (end of line, padding, noise) gets dropped.
+  * A mark in the middle of a packet starts over with the new packet. More
+  * noise than a packet could be long, or more restarts than the receiver
+  * retries, count as a damaged packet, so a stream of garbage can't keep
+  * the receiver in here. A whole packet may go by before the next mark, if
+  * the receiver flushed its input in the middle of one.
+  */
+static enum kermitPacketResult _k_receivePacket(uint8_t *p_seq, uint8_t *p_type)
+{
+	enum kermitPacketResult result;
+	uint16_t u16_skipped = 0;
+	uint8_t u8_restarts = 0;
+	uint8_t u8_ch;
+
+	do{
+		if (_fm_recByte(&u8_ch))				return KP_TIMEOUT;
+		if (++u16_skipped > KERMIT_MAXL + K_FRAMING)	return KP_INVALID;
+	}while(u8_ch != K_MARK);
+
+	do{
+		result = _k_readPacket(p_seq, p_type);
+		if ( (result == KP_RESYNC) && (++u8_restarts > MAX_ERR) )	return KP_INVALID;
+	}while(result == KP_RESYNC);
+
+	return result;
+}
+
+/**
+  * @brief Writes the decoded Bytes waiting in the work buffer to the file
+  *
+  * @return		FM_OK or FM_DISK_FULL
+  */
+static enum file_modem _k_flush(FIL *p_ffd)
+{
+	if (!k.outFill)	return FM_OK;
+	if (_fm_write(p_ffd, u8a_workbuf, k.outFill))	return FM_DISK_FULL;
+	k.outFill = 0;
+	return FM_OK;
+}
+
+/**
+  * @brief Decodes the data field of a data packet into the file
+  *
+  * Undoes the repeat, 8th-bit and control prefixing and the locking shifts.
+  * The decoded Bytes are collected in the work buffer and written in chunks.
+  *
+  * @param p_data	Encoded data field
+  * @param u16_len	Length of the data field
+  * @param u32_max	Maximum amount of Bytes the file may grow to
+  *
+  * @return			FM_OK, FM_DISK_FULL or FM_SIZE_EXCEEDED. FM_ABORTED if the
+  *					data field ends in the middle of a prefixed character.
+  */
+static enum file_modem _k_decode(FIL *p_ffd, const uint8_t *p_data, uint16_t u16_len, FSIZE_t maxSize)
+{
+	uint16_t u16_pos = 0, u16_run, u16_part;
+	uint8_t u8_ch, u8_ch7, u8_rpt, u8_b8, b_quoted, b_literal = 0, u8_litRpt = 1, u8_litB8 = 0;
+
+	while (u16_pos < u16_len)
+	{
+		/* Without 8th-bit prefixes and shifts, everything up to the next prefix
+		 * is data as it is and gets copied in one piece */
+		if (!k.qbin && !k.lockShift)
+		{
+			u16_run = _fm_span(&p_data[u16_pos], u16_len - u16_pos, k.qctl, k.rept ? k.rept : k.qctl, k.qctl);
+			if (u16_run > maxSize - k.total)	return FM_SIZE_EXCEEDED;
+			k.total += u16_run;
+			while (u16_run)
+			{
+				u16_part = WORKBUF_SIZ - k.outFill;
+				if (u16_part > u16_run)	u16_part = u16_run;
+				memcpy(&u8a_workbuf[k.outFill], &p_data[u16_pos], u16_part);
+				k.outFill += u16_part;
+				u16_pos += u16_part;
+				u16_run -= u16_part;
+				if ( (k.outFill == WORKBUF_SIZ) && (_k_flush(p_ffd) != FM_OK) )	return FM_DISK_FULL;
+			}
+			if (u16_pos == u16_len)	break;
+		}
+		u8_ch = p_data[u16_pos++];
+
+		/* Repeat prefix: Count, followed by the (prefixed) character. Prefixes
+		 * in front of a DLE are meant for the character behind the DLE */
+		u8_rpt = b_literal ? u8_litRpt : 1;
+		if (k.rept && (u8_ch == k.rept))
+		{
+			if (u16_pos + 1 >= u16_len)	return FM_ABORTED;
+			u8_rpt = UNCHAR(p_data[u16_pos++]);
+			u8_ch = p_data[u16_pos++];
+		}
+
+		/* 8th-bit prefix inverts the 8th bit of the shift state */
+		u8_b8 = k.shifted ^ (b_literal ? u8_litB8 : 0);
+		if (k.qbin && (u8_ch == k.qbin))
+		{
+			if (u16_pos >= u16_len)	return FM_ABORTED;
+			u8_b8 ^= 0x80;
+			u8_ch = p_data[u16_pos++];
+		}
+
+		/* Control prefix, only characters out of the control range get converted */
+		b_quoted = 0;
+		if (u8_ch == k.qctl)
+		{
+			if (u16_pos >= u16_len)	return FM_ABORTED;
+			u8_ch = p_data[u16_pos++];
+			u8_ch7 = u8_ch & 0x7F;
+			if ( ((u8_ch7 >= 0x40) && (u8_ch7 <= 0x5F)) || (u8_ch7 == 0x3F) )
+			{
+				u8_ch = CTL(u8_ch);
+			}
+			b_quoted = 1;
+		}
+		u8_ch7 = u8_ch & 0x7F;
+
+		/* Prefixed SO and SI switch the shift state, a prefixed DLE
+		 * makes the next character data, even if it is a SO or SI */
+		if (k.lockShift && b_quoted && !b_literal)
+		{
+			if (u8_ch7 == K_SO)
+			{
+				k.shifted = 0x80;
+				continue;
+			}
+			if (u8_ch7 == K_SI)
+			{
+				k.shifted = 0;
+				continue;
+			}
+			if (u8_ch7 == K_DLE)
+			{
+				b_literal = 1;
+				u8_litRpt = u8_rpt;
+				u8_litB8 = u8_b8 ^ k.shifted;
+				continue;
+			}
+		}
+		b_literal = 0;
+
+		/* The 8th bit only comes from the prefix and the shifts on a 7-bit
+		 * link, 8-bit clean links just send it as is */
+		if (k.qbin)	u8_ch = u8_ch7 | u8_b8;
+
+		if (u8_rpt > maxSize - k.total)	return FM_SIZE_EXCEEDED;
+		k.total += u8_rpt;
+		while (u8_rpt--)
+		{
+			u8a_workbuf[k.outFill++] = u8_ch;
+			if ( (k.outFill == WORKBUF_SIZ) && (_k_flush(p_ffd) != FM_OK) )	return FM_DISK_FULL;
+		}
+	}
+	return FM_OK;
+}
+
+/**
+  * @brief Checks if a character can be used as prefix (8th-bit or repeat)
+  */
+static uint8_t _k_isPrefix(uint8_t u8_ch)
+{
+	return ( ((u8_ch >= 33) && (u8_ch <= 62)) || ((u8_ch >= 96) && (u8_ch <= 126)) );
+}
+
+/**
+  * @brief Takes over the parameters of the sender's Send-Init packet and
+  *        builds our answer with the parameters both sides agree on
+  *
+  * Unused fields at the end of the packet fall back to their defaults.
+  *
+  * @param p_data	Data field of the Send-Init packet
+  * @param u16_len	Length of the data field
+  * @param p_reply	Room for our Send-Init parameters (K_REPLY Bytes)
+  * @return			Length of our parameters
+  */
+static uint8_t _k_sendInit(const uint8_t *p_data, uint16_t u16_len, uint8_t *p_reply)
+{
+	uint8_t u8_senderCaps = 0, u8_caps, u8_pos = 9;
+
+	k.npad = (u16_len > 2) ? UNCHAR(p_data[2]) : 0;
+	k.padc = (u16_len > 3) ? CTL(p_data[3]) : 0;
+	k.eol = (u16_len > 4) ? UNCHAR(p_data[4]) : K_CR;
+	k.qctl = (u16_len > 5) ? p_data[5] : K_QCTL;
+	if ( (u16_len > 6) && _k_isPrefix(p_data[6]) && (p_data[6] != k.qctl) )
+	{
+		k.qbin = p_data[6];
+	}
+	k.chkt = ( (u16_len > 7) && (p_data[7] >= '1') && (p_data[7] <= '3') ) ? p_data[7] - '0' : 1;
+	if ( (u16_len > 8) && _k_isPrefix(p_data[8]) && (p_data[8] != k.qctl) && (p_data[8] != k.qbin) )
+	{
+		k.rept = p_data[8];
+	}
+	if (u16_len > 9)
+	{
+		u8_senderCaps = UNCHAR(p_data[9]);
+		/* Skip further CAPAS fields, WINDO and MAXLX follow behind them */
+		while ( (UNCHAR(p_data[u8_pos]) & K_CAP_MORE) && (u8_pos + 1 < u16_len) )
+		{
+			u8_pos++;
+		}
+		u8_pos++;
+	}
+
+	/* Only the capabilities we've got as well */
+	u8_caps = u8_senderCaps & (K_CAP_AT | K_CAP_LS);
+#if KERMIT_MAXL > K_MAXL
+	u8_caps |= u8_senderCaps & K_CAP_LP;
+#endif
+#if KERMIT_WINDOW > 1
+	if ( (u16_len > u8_pos) && (u8_senderCaps & K_CAP_SW) )
+	{
+		k.window = UNCHAR(p_data[u8_pos]);
+		if (k.window > k.slots)	k.window = k.slots;
+		if (k.window)	u8_caps |= K_CAP_SW;
+	}
+#endif
+	if (!k.window)	k.window = 1;
+	/* Shifts only on a 7-bit link, which the sender tells by asking for the
+	 * 8th-bit prefix. Else the 8th bit comes as it is, see _k_decode() */
+	if (!k.qbin)	u8_caps &= ~K_CAP_LS;
+	k.lockShift = (u8_caps & K_CAP_LS) ? 1 : 0;
+
+	p_reply[0] = TOCHAR(K_MAXL);
+	p_reply[1] = TOCHAR((TIMEOUT + 999) / 1000);
+	p_reply[2] = TOCHAR(0);
+	p_reply[3] = CTL(0);
+	p_reply[4] = TOCHAR(K_CR);
+	p_reply[5] = K_QCTL;
+	p_reply[6] = k.qbin ? 'Y' : 'N';
+	p_reply[7] = '0' + k.chkt;
+	p_reply[8] = k.rept ? k.rept : ' ';
+	p_reply[9] = TOCHAR(u8_caps);
+	p_reply[10] = TOCHAR(k.window);
+	p_reply[11] = TOCHAR(KERMIT_MAXL / 95);
+	p_reply[12] = TOCHAR(KERMIT_MAXL % 95);
+	return 13;
+}
+
+/**
+  * @brief Checks the file length announced by an attribute packet
+  *
+  * @param p_size	Receives the length in Bytes, stays zero if not announced
+  *					exactly
+  * @return		Zero if the file fits (or no length has been announced)
+  */
+static uint8_t _k_attributes(const uint8_t *p_data, uint16_t u16_len, FSIZE_t maxSize, FSIZE_t *p_size)
+{
+	uint16_t u16_pos = 0;
+	uint8_t u8_len, u8_cnt;
+	FSIZE_t size;
+
+	while (u16_pos + 2 <= u16_len)
+	{
+		u8_len = UNCHAR(p_data[u16_pos + 1]);
+		if (u16_pos + 2 + u8_len > u16_len)	break;
+
+		/* '1' is the length in Bytes, '!' in kBytes, both as decimal number */
+		if ( (p_data[u16_pos] == '1') || (p_data[u16_pos] == '!') )
+		{
+			size = 0;
+			for (u8_cnt = 0; u8_cnt < u8_len; u8_cnt++)
+			{
+				/* Checked before multiplying, the length may be larger than FSIZE_t */
+				if (size > maxSize / 10)	return 1;
+				size = size * 10 + (p_data[u16_pos + 2 + u8_cnt] - '0');
+				if (size > maxSize)	return 1;
+			}
+			if ( (p_data[u16_pos] == '!') && (size > maxSize / 1024) )	return 1;
+			if (p_data[u16_pos] == '1')	*p_size = size;
+		}
+		u16_pos += 2 + u8_len;
+	}
+	return 0;
+}
+
+/**
+  * @brief Receives a file with the Kermit protocol
+  *
+  * @param p_ffd		File opened for writing
+  * @param p_maxsize	Maximum amount of Bytes to accept. Holds the amount of
+  *						Bytes received after the transfer.
+  *
+  * @return				FM_OK if successful, else the reason of the failure
+  */
+enum file_modem kermit_receive(FIL *p_ffd, FSIZE_t *p_maxsize)
+{
+	enum kermitPacketResult packetResult;	// Result of _k_receivePacket
+	enum kermitPhase phase = KS_INIT;	// Which packet types are expected
+	enum file_modem fileResult = FM_INVALID_START;	// Result once the sender says goodbye
+	uint8_t seq, type;			// Sequence number and type of the received packet
+	uint8_t dist;				// Distance of the packet to the lowest missing one
+	uint8_t slot;				// Window slot of the packet being processed
+	uint8_t gap;				// For NAKing packets the sender skipped
+	uint8_t reply[K_REPLY];		// Data field of our Ack
+	uint8_t replyLen;
+	uint8_t initReply[K_REPLY];	// Our Send-Init parameters, for repeated Send-Inits
+	uint8_t initReplyLen = 0;
+	FSIZE_t total;				// File length before the data packet, for the statistics
+	FSIZE_t announced;			// File length from the attributes
+	FSIZE_t maxSize = _fm_limit(p_ffd, *p_maxsize, f_tell(p_ffd));	// Limit of the application or the file system
+	uint8_t failedAttempts = 0;	// Counter of Timeouts or damaged packets. Resets
+								// after every valid packet.
+	uint16_t idlePackets = 0;	// Valid packets since the window moved the last time
+	uint8_t excecuteLoop = 0;	// Loop and Function-Result variable, same as xmodem_receive
+
+	memset(&k, 0, sizeof(k));
+	k.eol = K_CR;
+	k.qctl = K_QCTL;
+	k.chkt = 1;
+	k.window = 1;
+
+	/* The window can't be larger than the buffers the pool has got left */
+	if (_fm_pool && (_fm_pool->bufSize >= KERMIT_MAXL))	k.slots = _k_takeSlots(_fm_pool);
+#ifdef KERMIT_EXTERNAL_POOL
+	if (!k.slots)
+	{
+		/* Not a single buffer, the sender doesn't get an answer */
+		*p_maxsize = 0;
+		return FM_INVALID_START;
+	}
+#else
+	if (!k.slots)
+	{
+		fm_pool_init(&kslotPool, u8a_kslotMem, sizeof(u8a_kslotMem), KERMIT_MAXL);
+		k.slots = _k_takeSlots(&kslotPool);
+	}
+#endif
+
+	/* Dump Rx Buffer before we start, just to be safe */
+	_flushRx();
+	_fm_statStart();
+
+	/* --- Main Receive Loop --- */
+	do{
+		packetResult = _k_receivePacket(&seq, &type);
+
+		if (packetResult != KP_OK)
+		{
+			/* Timeout or damaged packet: Ask again for the lowest one missing */
+			if (packetResult == KP_TIMEOUT)
+			{
+				FM_STAT(timeouts);
+			}
+			else
+			{
+				FM_STAT(errors);
+			}
+			failedAttempts++;
+			if (failedAttempts >= ((phase == KS_INIT) ? 2 * SRT_TRY : MAX_ERR))
+			{
+				if (phase != KS_INIT)	_k_sendError("Too many retries");
+				excecuteLoop = (phase == KS_INIT) ? 2 : 3;
+				break;
+			}
+			if (packetResult == KP_INVALID)	_flushRx();
+			FM_STAT(retries);
+			_k_sendPacket('N', k.wlo, 0, 0, k.chkt);
+			continue;
+		}
+		failedAttempts = 0;
+
+		if (type == 'E')
+		{
+			/* Error packet of the sender, the transfer is over */
+			excecuteLoop = 4;
+			break;
+		}
+
+		/* A peer that keeps sending without getting anywhere is given up on */
+		if (++idlePackets > K_IDLE_PACKETS)
+		{
+			if (phase != KS_INIT)	_k_sendError("Too many retries");
+			excecuteLoop = (phase == KS_INIT) ? 2 : 3;
+			break;
+		}
+
+		dist = (seq - k.wlo) & 0x3F;
+		if (dist >= k.window)
+		{
+			/* Already processed, our Ack got lost. Anything else is ignored */
+			if (dist >= 64 - k.window)
+			{
+				FM_STAT(retries);
+				if (type == 'S')
+				{
+					_k_sendPacket('Y', seq, initReply, initReplyLen, 1);
+				}
+				else
+				{
+					_k_sendPacket('Y', seq, 0, 0, k.chkt);
+				}
+			}
+			continue;
+		}
+
+		if ( (phase == KS_INIT) && (type != 'S') )
+		{
+			/* Nothing goes before the Send-Init */
+			_k_sendPacket('N', k.wlo, 0, 0, k.chkt);
+			continue;
+		}
+
+		if (dist)
+		{
+			/* Ahead of the lowest missing packet: Keep it and NAK the ones
+			 * between the highest stored packet and this one */
+			if (!(k.stored & (1UL << dist)))
+			{
+				for (gap = dist - 1; gap && !(k.stored & (1UL << gap)); gap--);
+				if (k.stored & (1UL << gap))	gap++;
+				for (; gap < dist; gap++)
+				{
+					_k_sendPacket('N', k.wlo + gap, 0, 0, k.chkt);
+				}
+				k.stored |= (1UL << dist);
+				idlePackets = 0;
+			}
+			_k_sendPacket('Y', seq, 0, 0, k.chkt);
+			continue;
+		}
+
+		/* The lowest missing packet arrived: Process it and everything stored behind it */
+		k.stored |= 1;
+		idlePackets = 0;
+		do{
+			slot = k.slotBase;
+			type = u8a_kslotType[slot];
+			replyLen = 0;
+
+			switch(type)
+			{
+				case 'S':	/* Send-Init */
+					if (phase != KS_INIT)	break;
+					initReplyLen = _k_sendInit(p_kslot[slot], u16a_kslotLen[slot], initReply);
+					/* The Ack of the Send-Init still uses the single character check */
+					_k_sendPacket('Y', k.wlo, initReply, initReplyLen, 1);
+					replyLen = 0xFF;
+					phase = KS_FILE;
+					break;
+				case 'F':	/* File header */
+					if (fileResult != FM_INVALID_START)
+					{
+						_k_sendError("One file per transfer");
+						excecuteLoop = fileResult + 1;
+					}
+					else if (phase == KS_FILE)
+					{
+						fileResult = FM_OK;
+						k.shifted = 0;
+						phase = KS_DATA;
+					}
+					break;
+				case 'A':	/* Attributes */
+					if (phase != KS_DATA)	break;
+					announced = 0;
+					if (_k_attributes(p_kslot[slot], u16a_kslotLen[slot], maxSize, &announced))
+					{
+						/* Refuse the file, it is too large */
+						reply[0] = 'N';
+						reply[1] = '1';
+						replyLen = 2;
+						fileResult = FM_SIZE_EXCEEDED;
+					}
+					else if (announced && !k.total)
+					{
+						/* Lets the disk prepare for the file */
+						file_modem_expect(p_ffd, announced);
+					}
+					break;
+				case 'D':	/* Data, dropped if we refused the file */
+					if ( (phase != KS_DATA) || (fileResult == FM_SIZE_EXCEEDED) )	break;
+					total = k.total;
+					fileResult = _k_decode(p_ffd, p_kslot[slot], u16a_kslotLen[slot], maxSize);
+					_fm_statPacket((uint32_t)(k.total - total));
+					if (fileResult != FM_OK)
+					{
+						_k_sendFailure(fileResult);
+						excecuteLoop = fileResult + 1;
+					}
+					break;
+				case 'Z':	/* End of File, "D" if the sender discarded it */
+					if (phase != KS_DATA)	break;
+					if ( (_k_flush(p_ffd) != FM_OK) || _fm_sync(p_ffd) )
+					{
+						_k_sendError("Disk full");
+						excecuteLoop = FM_DISK_FULL + 1;
+						break;
+					}
+					if ( (u16a_kslotLen[slot] > 0) && (p_kslot[slot][0] == 'D') && (fileResult == FM_OK) )
+					{
+						fileResult = FM_ABORTED;
+					}
+					phase = KS_FILE;
+					break;
+				case 'B':	/* Break, end of the transfer */
+					if (phase == KS_FILE)	excecuteLoop = fileResult + 1;
+					break;
+				default:
+					/* Server commands, text headers and such aren't supported */
+					_k_sendError("Unsupported packet");
+					excecuteLoop = FM_ABORTED + 1;
+					break;
+			}
+			if (excecuteLoop && (type != 'B'))	break;
+
+			/* Only the packet that just arrived still waits for its Ack */
+			if ( (k.wlo == seq) && (replyLen != 0xFF) )
+			{
+				_k_sendPacket('Y', seq, reply, replyLen, k.chkt);
+			}
+
+			/* Slide the window */
+			k.stored >>= 1;
+			k.wlo = (k.wlo + 1) & 0x3F;
+			k.slotBase = (k.slotBase + 1) % k.slots;
+		}while( (k.stored & 1) && !excecuteLoop );
+	/* Loop as long as executeLoop is Zero.
+	 * If not Zero, exit loop, subscract 1 from it
+	 * and return it as function result. */
+	}while(excecuteLoop == 0);
+
+	/* A failed or aborted file gives up its expected size, the allocated tail is cut off */
+	if (excecuteLoop != FM_OK + 1)	file_modem_expect(p_ffd, 0);
+
+	while (k.slots)
+	{
+		fm_pool_put(k.p_pool, p_kslot[--k.slots]);
+	}
+
+	/* Return the amount of bytes received */
+	*p_maxsize = k.total;
+
+	/* Return the Result */
+	return (enum file_modem)(--excecuteLoop);
+}
@@ -0,0 +1,662 @@
+/*
+ * nmodem.c
+ *
+ * N-Modem, the native protocol of the file modem. Compared to X-Modem it gets
+ * rid of the stop-and-wait and the fixed packet sizes: Frames are COBS encoded
+ * and delimited by a zero byte, carry file offsets and a CRC-32, and are
+ * sent with a sliding window. The receiver acknowledges with the offset up to
+ * which everything has been stored plus a bitmap of the packets it got beyond
+ * that (selective repeat), so the sender only has to repeat what got lost.
+ *
+ * Frame layout before COBS encoding, multi-byte fields are LSB first:
+ *   Type | Fields | CRC-32 over Type and Fields (4 Bytes)
+ *
+ *   'S' Setup	Version | Window | Packet Size (2) | Offset (4)
+ *				Sent by the receiver until the sender answers with a Setup frame
+ *				of its own, holding the window and packet size it is going to use
+ *				(less or equal to what the receiver offered). Offset is where
+ *				the receiver wants the data to start from. The receiver confirms
+ *				the sender's Setup with an Ack, which starts the transfer.
+ *   'D' Data	Offset (4) | Payload (1 .. Packet Size)
+ *				All but the last Data frame carry exactly Packet Size Bytes.
+ *   'A' Ack	Offset (4) | Bitmap (4)
+ *				Everything below Offset has been stored. Bit n is set if the
+ *				packet at Offset + n * Packet Size has been stored as well.
+ *   'E' End	Length (4)
+ *				Total file length, sent by the sender after the last Data frame
+ *				and repeated until it has been acknowledged up to Length.
+ *   'X' Cancel	Aborts the transfer, from either side.
+ *   'P' Probe	Sequence | Time (4) | Filler (0 .. Packet Size - 1)
+ *				Optional, sent by the receiver before the first Setup to measure
+ *				the link (see nmodem_probe()). The sender returns every Probe
+ *				unchanged. A sender that doesn't know it ignores it, the receiver
+ *				then keeps its parameters.
+ *
+ * Offsets and the length carry the lower 32 bits only. Both sides extend them
+ * to the full offset relative to the acknowledged one, which works as long as
+ * the window is far below 4 GiB, so files of any size can be transferred.
+ *
+ * Created: 18.10.2026 10:14:52
+ *  Author: gfcwfzkm
+ */
+
+#include "file_modem_int.h"
+
+#if (NMODEM_WINDOW < 1) || (NMODEM_WINDOW > 32)
+#error "NMODEM_WINDOW has to be between 1 and 32"
+#endif
+#if (NMODEM_PACKET < 1) || (NMODEM_PACKET > PCK_1K)
+#error "NMODEM_PACKET has to be between 1 and 1024"
+#endif
+
+#define NM_VERSION	1
+
+#define NM_SETUP	0x53	// 'S', Setup / Negotiation
+#define NM_DATA		0x44	// 'D', Data at an Offset
+#define NM_ACK		0x41	// 'A', Acknowledge with selective repeat bitmap
+#define NM_END		0x45	// 'E', End of File, holds the file length
+#define NM_CANCEL	0x58	// 'X', Abort
+#define NM_PROBE	0x50	// 'P', Link probe, echoed by the sender
+
+#define NM_HEAD		5		// Frame Type + Offset
+#define NM_CRC		4		// CRC-32 at the end of each frame
+#define NM_TXFRAME	16		// Largest frame the receiver sends (Setup / Ack, with CRC)
+#define NM_OVERHEAD	(NM_HEAD + NM_CRC + 2)	// Frame Bytes beside the payload, COBS included
+
+#define NM_PROBE_HEAD	6	// Type, Sequence and Time of a Probe
+#define NM_PROBE_SMALL	4	// Probes without filler, for the round trip time
+#define NM_PROBE_LARGE	2	// Probes of a full data frame, for the rate
+#define NM_PROBE_MIN	64	// Smallest packet size the probe picks
+#define NM_TIMEOUT_MIN	1000	// Shortest timeout the probe picks, ms. Senders repeat lost packets on a timer of their own
+#define NM_TIMEOUT_MAX	30000	// Longest timeout the probe picks, ms
+
+/* Frames without any new data (damaged, duplicates, outside of the window)
+ * the receiver takes before it gives up. A peer that keeps talking without
+ * getting anywhere would keep it busy forever otherwise. */
+#define NM_IDLE_FRAMES	(2 * MAX_ERR * NMODEM_WINDOW)
+
+enum nmFrameResult {NMF_OK,NMF_TIMEOUT,NMF_INVALID};
+
+/**
+  * @brief Appends the CRC-32, COBS encodes and sends a frame
+  *
+  * @param p_frame	Frame to send, needs NM_CRC Bytes of room behind it
+  * @param u16_len	Length of the frame, without CRC
+  */
+static void _nm_sendFrame(uint8_t *p_frame, uint16_t u16_len)
+{
+	uint32_t u32_crc = 0xFFFFFFFFUL;
+	uint16_t u16_pos, u16_run, u16_cnt;
+	uint8_t u8_code;
+
+	for (u16_pos = 0; u16_pos < u16_len; u16_pos++)
+	{
+		u32_crc = _crc32_update(u32_crc, p_frame[u16_pos]);
+	}
+	_fm_put32(&p_frame[u16_len], ~u32_crc);
+	u16_len += NM_CRC;
+
+	/* COBS: Every block starts with its length + 1 and stands for up to 254
+	 * non-zero Bytes followed by a zero, which isn't sent. A block of 254 Bytes
+	 * (code 0xFF) has no zero behind it. The zero behind the last block is
+	 * virtual and gets dropped by the receiver. */
+	u16_pos = 0;
+	do{
+		u16_run = _fm_span(&p_frame[u16_pos], (u16_len - u16_pos > 254) ? 254 : u16_len - u16_pos, 0, 0, 0);
+		u8_code = (uint8_t)(u16_run + 1);
+		if (_sendBlock)
+		{
+			_sendBlock(&u8_code, 1);
+			if (u16_run)	_sendBlock(&p_frame[u16_pos], u16_run);
+			u16_pos += u16_run;
+		}
+		else
+		{
+			_sendByte(u8_code);
+			for (u16_cnt = 0; u16_cnt < u16_run; u16_cnt++)
+			{
+				_sendByte(p_frame[u16_pos++]);
+			}
+		}
+		if (u16_pos == u16_len)	break;
+		/* Skip the zero the block stands for */
+		if (u16_run < 254)	u16_pos++;
+	}while(1);
+
+	/* Frame delimiter, through the block function as well to keep the order */
+	u8_code = 0;
+	if (_sendBlock)	_sendBlock(&u8_code, 1);
+	else			_sendByte(0);
+}
+
+/**
+  * @brief Receives and COBS decodes a frame, and checks its CRC-32
+  *
+  * Anything up to the next frame delimiter gets dropped if the frame is
+  * damaged, so the receiver is back in sync with the next frame. A frame
+  * too large for the buffer, or a run of delimiters as long, is reported as
+  * invalid right away, a stream without structure must not keep the
+  * receiver in here.
+  *
+  * @param p_frame	Buffer for the decoded frame
+  * @param u16_max	Size of the buffer
+  * @param p_len	Length of the decoded frame, without CRC
+  *
+  * @return			NMF_OK, NMF_TIMEOUT or NMF_INVALID
+  */
+static enum nmFrameResult _nm_receiveFrame(uint8_t *p_frame, uint16_t u16_max, uint16_t *p_len)
+{
+	uint16_t u16_cnt = 0, u16_pos;
+	uint8_t u8_ch, u8_code = 0xFF, u8_left = 0;
+	uint32_t u32_crc = 0xFFFFFFFFUL;
+
+	/* Skip delimiters, the first non-zero Byte is the first COBS code */
+	do{
+		if (_fm_recByte(&u8_ch))	return NMF_TIMEOUT;
+		if (++u16_cnt > u16_max)		return NMF_INVALID;
+	}while(u8_ch == 0);
+	u16_cnt = 0;
+
+	do{
+		if (u8_left == 0)
+		{
+			/* Start of a new block, the last one implied a zero unless it was full */
+			if (u8_code != 0xFF)
+			{
+				if (u16_cnt < u16_max)	p_frame[u16_cnt] = 0;
+				u16_cnt++;
+			}
+			u8_code = u8_ch;
+			u8_left = u8_ch - 1;
+		}
+		else
+		{
+			if (u16_cnt >= u16_max)	return NMF_INVALID;
+			p_frame[u16_cnt++] = u8_ch;
+			u8_left--;
+		}
+		if (_fm_recByte(&u8_ch))	return NMF_TIMEOUT;
+	}while(u8_ch != 0);
+
+	/* Truncated block, oversized or too short frame? */
+	if (u8_left || (u16_cnt > u16_max) || (u16_cnt <= NM_CRC))	return NMF_INVALID;
+
+	u16_cnt -= NM_CRC;
+	for (u16_pos = 0; u16_pos < u16_cnt; u16_pos++)
+	{
+		u32_crc = _crc32_update(u32_crc, p_frame[u16_pos]);
+	}
+	if (~u32_crc != _fm_get32(&p_frame[u16_cnt]))	return NMF_INVALID;
+
+	*p_len = u16_cnt;
+	return NMF_OK;
+}
+
+/**
+  * @brief Sends an Ack frame with the current receive state
+  *
+  * @param offset		Everything below has been stored
+  * @param u32_bitmap	Packets stored beyond the offset
+  */
+static void _nm_sendAck(FSIZE_t offset, uint32_t u32_bitmap)
+{
+	uint8_t u8a_frame[NM_TXFRAME];
+
+	u8a_frame[0] = NM_ACK;
+	_fm_put32(&u8a_frame[1], (uint32_t)offset);
+	_fm_put32(&u8a_frame[5], u32_bitmap);
+	_nm_sendFrame(u8a_frame, 9);
+}
+
+/**
+  * @brief Sends a single-byte frame (Cancel)
+  */
+static void _nm_sendType(uint8_t u8_type)
+{
+	uint8_t u8a_frame[NM_TXFRAME];
+
+	u8a_frame[0] = u8_type;
+	_nm_sendFrame(u8a_frame, 1);
+}
+
+/**
+  * @brief Writes a packet to its offset in the file
+  *
+  * @return		One if the write failed or the disk is full, zero if successful
+  */
+static uint8_t _nm_store(FIL *p_ffd, FSIZE_t offset, const uint8_t *p_buf, uint16_t u16_len)
+{
+	/* Packets can arrive out of order, seeks only if it didn't */
+	if (_fm_seek(p_ffd, offset))	return 1;
+	return _fm_write(p_ffd, p_buf, u16_len);
+}
+
+/**
+  * @brief Receives a file with the N-Modem protocol
+  *
+  * @param p_ffd		File opened for writing, data gets written from offset 0 on
+  * @param p_maxsize	Maximum amount of Bytes to accept. Holds the file length
+  *						after a successful transfer.
+  *
+  * @return				FM_OK if successful, else the reason of the failure
+  */
+enum file_modem nmodem_receive(FIL *p_ffd, FSIZE_t *p_maxsize)
+{
+	return nmodem_resume(p_ffd, p_maxsize, 0);
+}
+
+/**
+  * @brief Receives the rest of a file with the N-Modem protocol
+  *
+  * The Setup frame asks the sender to start at the offset, e.g. where the
+  * journal of an interrupted transfer ended (see fm_journal_open()).
+  *
+  * @param p_ffd		File opened for writing, holding the data below offset
+  * @param p_maxsize	Maximum file length to accept. Holds the file length
+  *						after a successful transfer.
+  * @param start		Offset to continue at
+  *
+  * @return				FM_OK if successful, else the reason of the failure
+  */
+enum file_modem nmodem_resume(FIL *p_ffd, FSIZE_t *p_maxsize, FSIZE_t start)
+{
+	enum nmFrameResult frameResult;	// Result of _nm_receiveFrame
+	uint8_t setupFrame[NM_TXFRAME];	// Our Setup frame, repeated until the sender answers
+	uint16_t frameLen;			// Length of the received frame, without CRC
+	uint16_t packetSize = 0;	// Negotiated packet size. Zero while negotiating
+	uint8_t window = 0;			// Negotiated window, in packets
+	FSIZE_t baseOffset = start;	// Everything below this offset has been stored
+	uint32_t receivedMap = 0;	// Bit n set: packet at baseOffset + n * packetSize is stored
+	FSIZE_t endOffset = start;	// End of the highest packet stored so far
+	uint8_t lastStored = 0;		// The short, last packet is stored, endOffset is the end of the file
+	FSIZE_t offset;				// Offset of the received data frame
+	FSIZE_t maxSize = _fm_limit(p_ffd, *p_maxsize, 0);	// Highest file end the application or file system allows
+	uint32_t slot;				// Packet number within the window
+	uint16_t payload;			// Payload length of the received data frame
+	uint8_t failedAttempts = 0;	// Counter of Timeouts. Resets after every valid frame
+	uint16_t idleFrames = 0;	// Frames since the last one with new data
+	uint8_t excecuteLoop = 0;	// Loop and Function-Result variable, same as xmodem_receive
+
+	/* Dump Rx Buffer before we start, just to be safe */
+	_flushRx();
+	_fm_statStart();
+
+	/* --- Negotiation: Offer our window and packet size until the sender answers --- */
+	setupFrame[0] = NM_SETUP;
+	setupFrame[1] = NM_VERSION;
+	setupFrame[2] = _fm_tune.window;
+	setupFrame[3] = (uint8_t)_fm_tune.packet;
+	setupFrame[4] = (uint8_t)(_fm_tune.packet >> 8);
+	_fm_put32(&setupFrame[5], (uint32_t)start);
+
+	while (!packetSize)
+	{
+		_nm_sendFrame(setupFrame, 9);
+		frameResult = _nm_receiveFrame(u8a_workbuf, WORKBUF_SIZ, &frameLen);
+
+		if ( (frameResult == NMF_OK) && (u8a_workbuf[0] == NM_CANCEL) )
+		{
+			*p_maxsize = 0;
+			return FM_ABORTED;
+		}
+		if ( (frameResult == NMF_OK) && (u8a_workbuf[0] == NM_SETUP) && (frameLen >= 5) &&
+			(u8a_workbuf[1] == NM_VERSION) )
+		{
+			window = u8a_workbuf[2];
+			packetSize = u8a_workbuf[3] | ((uint16_t)u8a_workbuf[4] << 8);
+
+			/* The sender must not ask for more than it has been offered */
+			if (!window || (window > _fm_tune.window) || (packetSize > _fm_tune.packet))
+			{
+				packetSize = 0;
+			}
+		}
+		if (!packetSize)
+		{
+			if (frameResult != NMF_TIMEOUT)	_flushRx();
+			if (++failedAttempts >= 2 * SRT_TRY)
+			{
+				*p_maxsize = 0;
+				return FM_INVALID_START;
+			}
+		}
+	}
+	failedAttempts = 0;
+
+	/* Confirm the sender's choice, it starts sending data after this */
+	_nm_sendAck(baseOffset, receivedMap);
+
+	/* --- Main Receive Loop --- */
+	do{
+		frameResult = _nm_receiveFrame(u8a_workbuf, WORKBUF_SIZ, &frameLen);
+
+		if (frameResult == NMF_TIMEOUT)
+		{
+			/* Nothing from the sender, repeat our state so it knows what to resend */
+			FM_STAT(timeouts);
+			failedAttempts++;
+			if (failedAttempts >= MAX_ERR)
+			{
+				excecuteLoop = 3;
+			}
+			else
+			{
+				_nm_sendAck(baseOffset, receivedMap);
+			}
+			continue;
+		}
+		/* A peer that keeps sending without getting anywhere is given up on */
+		if (++idleFrames > NM_IDLE_FRAMES)
+		{
+			_nm_sendType(NM_CANCEL);
+			excecuteLoop = 3;
+			continue;
+		}
+		/* Damaged frames are dropped. The gap shows up in the next Ack */
+		if (frameResult == NMF_INVALID)
+		{
+			FM_STAT(errors);
+			continue;
+		}
+
+		failedAttempts = 0;
+		switch(u8a_workbuf[0])
+		{
+			case NM_DATA:
+				if (frameLen <= NM_HEAD)	break;
+				/* Extend the 32-bit offset around the acknowledged one. Older
+				 * frames end up far above the window and get ignored */
+				offset = baseOffset + (uint32_t)(_fm_get32(&u8a_workbuf[1]) - (uint32_t)baseOffset);
+				payload = frameLen - NM_HEAD;
+
+				if ( (offset >= baseOffset) && (payload <= packetSize) &&
+					!((offset - baseOffset) % packetSize) )
+				{
+					slot = (uint32_t)((offset - baseOffset) / packetSize);
+					/* Only the last packet is short, nothing may lie beyond it. The
+					 * window would slide over a hole after a short one otherwise */
+					if ( (lastStored && (offset + payload > endOffset)) ||
+						((payload < packetSize) && (offset + payload < endOffset)) )
+					{
+						FM_STAT(errors);
+					}
+					else if ( (slot < window) && !(receivedMap & (1UL << slot)) )
+					{
+						/* File size larger than originally allowed/states? */
+						if ( (payload > maxSize) || (offset > maxSize - payload) )
+						{
+							_nm_sendType(NM_CANCEL);
+							return FM_SIZE_EXCEEDED;
+						}
+						if (_nm_store(p_ffd, offset, &u8a_workbuf[NM_HEAD], payload))
+						{
+							// Error, Disk full!
+							_nm_sendType(NM_CANCEL);
+							return FM_DISK_FULL;
+						}
+
+						_fm_statPacket(payload);
+						idleFrames = 0;
+						receivedMap |= (1UL << slot);
+						if (offset + payload > endOffset)	endOffset = offset + payload;
+						if (payload < packetSize)	lastStored = 1;
+
+						/* Slide the window over everything that is complete now.
+						 * Only the last packet is short, so don't go beyond its end */
+						while (receivedMap & 1)
+						{
+							receivedMap >>= 1;
+							baseOffset += packetSize;
+						}
+						if (baseOffset > endOffset)	baseOffset = endOffset;
+					}
+					else
+					{
+						/* Sent again, although we got it already */
+						FM_STAT(retries);
+					}
+				}
+				/* Duplicates and packets outside of the window get acknowledged as
+				 * well, the sender learns from the Ack what is still missing */
+				_nm_sendAck(baseOffset, receivedMap);
+				break;
+			case NM_END:
+				if (frameLen < 5)	break;
+				/* Done as soon as everything up to the announced length is stored */
+				if ( ((uint32_t)baseOffset == _fm_get32(&u8a_workbuf[1])) && (baseOffset == endOffset) )
+				{
+					if (_fm_sync(p_ffd))
+					{
+						// Error, Disk full!
+						_nm_sendType(NM_CANCEL);
+						return FM_DISK_FULL;
+					}
+					excecuteLoop = 1;
+				}
+				_nm_sendAck(baseOffset, receivedMap);
+				break;
+			case NM_SETUP:
+				/* Our Ack to its Setup got lost, the sender still waits for it */
+				_nm_sendAck(baseOffset, receivedMap);
+				break;
+			case NM_CANCEL:	/* Aborted by Sender */
+				_flushRx();
+				excecuteLoop = 4;
+				break;
+		}
+	/* Loop as long as executeLoop is Zero.
+	 * If not Zero, exit loop, subscract 1 from it
+	 * and return it as function result. */
+	}while(excecuteLoop == 0);
+
+	/* Return the amount of bytes received */
+	*p_maxsize = baseOffset;
+
+	/* Return the Result */
+	return (enum file_modem)(--excecuteLoop);
+}
+
+/**
+  * @brief Sends a Probe frame
+  *
+  * @param u8_seq		Sequence number, the echo is told apart by it
+  * @param u16_filler	Filler Bytes behind the head, up to NMODEM_PACKET - 1
+  * @param u32_now		Current time, comes back with the echo
+  */
+static void _nm_sendProbe(uint8_t u8_seq, uint16_t u16_filler, uint32_t u32_now)
+{
+	uint16_t u16_pos;
+
+	u8a_workbuf[0] = NM_PROBE;
+	u8a_workbuf[1] = u8_seq;
+	_fm_put32(&u8a_workbuf[2], u32_now);
+	/* Zeros in between, the COBS encoding has the same work as with data */
+	for (u16_pos = 0; u16_pos < u16_filler; u16_pos++)
+	{
+		u8a_workbuf[NM_PROBE_HEAD + u16_pos] = (uint8_t)(u16_pos * 37 + u8_seq);
+	}
+	_nm_sendFrame(u8a_workbuf, NM_PROBE_HEAD + u16_filler);
+}
+
+/**
+  * @brief Waits for the echo of a Probe
+  *
+  * @param millis	Millisecond clock
+  * @param p_seq	Sequence number of the echo
+  * @param p_rtt	Round trip time of the echo, ms
+  *
+  * @return			Zero if an intact echo arrived, one if not
+  */
+static uint8_t _nm_awaitProbe(uint32_t (*millis)(void), uint8_t *p_seq, uint32_t *p_rtt)
+{
+	uint16_t frameLen;
+
+	if (_nm_receiveFrame(u8a_workbuf, WORKBUF_SIZ, &frameLen) != NMF_OK)	return 1;
+	if ( (frameLen < NM_PROBE_HEAD) || (u8a_workbuf[0] != NM_PROBE) )		return 1;
+	*p_seq = u8a_workbuf[1];
+	*p_rtt = millis() - _fm_get32(&u8a_workbuf[2]);
+	return 0;
+}
+
+/**
+  * @brief Measures the link with Probe frames and picks the link parameters
+  *
+  * Meant to be called right before nmodem_receive(), the sender waits for the
+  * first Setup anyway. A few small Probes give the round trip time, full sized
+  * ones the time per Byte, a burst of a full window shows if the link (and the
+  * receive path behind it) keeps up with data sent back to back. From that:
+  * - Packet size: The one moving the most payload, given the damaged Bytes
+  * - Window: The full one, less if the burst overran
+  * - Timeout: Twice the slowest answer plus the time of a full window
+  * - Retries: Twice the default if any Probe got lost
+  * - Pace: None unless the burst overran, else the default
+  * The parameters are used for all following transfers (file_modem_tune()).
+  *
+  * @param p_tune	Gets the picked parameters, may be NULL
+  * @param millis	Millisecond clock
+  *
+  * @return			FM_OK if the link has been measured, FM_INVALID_START if the
+  *					sender doesn't answer Probes. The parameters stay unchanged then.
+  */
+enum file_modem nmodem_probe(struct fm_tune *p_tune, uint32_t (*millis)(void))
+{
+	static const struct fm_tune defaults = FM_TUNE_DEFAULT;
+	struct fm_tune tune = _fm_tune;
+	uint32_t rtt;				// Round trip time of an echo, ms
+	uint32_t rttSmall = 0xFFFFFFFFUL;	// Fastest round trip of a small Probe, ms
+	uint32_t rttLarge = 0xFFFFFFFFUL;	// Fastest round trip of a full sized Probe, ms
+	uint32_t rttMax = 0;		// Slowest answer to a single Probe, ms
+	uint32_t byteUs;			// Time per Byte on the link, us
+	uint32_t packetUs;			// Time per packet of the picked size, us
+	uint32_t linkBytes;			// Bytes of all Probes and their echoes
+	uint32_t errPpm;			// Damaged Bytes per million
+	uint32_t success, efficiency, bestEfficiency = 0;
+	uint16_t size;
+	uint8_t seq = 0, echoSeq, lost = 0, burstLost = 0, inOrder = 0, u8_cnt;
+	uint8_t lateEchoes = 0;		// Echoes of the burst behind a gap: Damage, not an overrun
+	uint8_t largeEchoes = 0;	// Full sized Probes that came back on their own
+	uint8_t b_overrun;			// The receive path didn't keep up with the burst
+
+	if (!millis)	return FM_INVALID_START;
+	_flushRx();
+
+	/* Round trip time. If the first two go unanswered, the sender doesn't know Probes */
+	for (u8_cnt = 0; u8_cnt < NM_PROBE_SMALL; u8_cnt++, seq++)
+	{
+		_nm_sendProbe(seq, 0, millis());
+		if (_nm_awaitProbe(millis, &echoSeq, &rtt) || (echoSeq != seq))
+		{
+			lost++;
+			if ( (lost == 2) && (u8_cnt == 1) )
+			{
+				_flushRx();
+				return FM_INVALID_START;
+			}
+			continue;
+		}
+		if (rtt < rttSmall)	rttSmall = rtt;
+		if (rtt > rttMax)	rttMax = rtt;
+	}
+	if (rttSmall == 0xFFFFFFFFUL)
+	{
+		_flushRx();
+		return FM_INVALID_START;
+	}
+
+	/* Time per Byte, with Probes as large as a full data frame */
+	for (u8_cnt = 0; u8_cnt < NM_PROBE_LARGE; u8_cnt++, seq++)
+	{
+		_flushRx();
+		_nm_sendProbe(seq, NMODEM_PACKET - 1, millis());
+		if (_nm_awaitProbe(millis, &echoSeq, &rtt) || (echoSeq != seq))
+		{
+			lost++;
+			continue;
+		}
+		if (rtt < rttLarge)	rttLarge = rtt;
+		if (rtt > rttMax)	rttMax = rtt;
+		largeEchoes++;
+	}
+
+	/* A full window back to back, like the sender sends the data */
+	_flushRx();
+	for (u8_cnt = 0; u8_cnt < NMODEM_WINDOW; u8_cnt++)
+	{
+		_nm_sendProbe(seq + u8_cnt, NMODEM_PACKET - 1, millis());
+	}
+	for (u8_cnt = 0; u8_cnt < NMODEM_WINDOW; u8_cnt++)
+	{
+		if (_nm_awaitProbe(millis, &echoSeq, &rtt))
+		{
+			burstLost++;
+			continue;
+		}
+		/* In order up to the first gap, lost on the way there or back */
+		if ( !burstLost && (inOrder == u8_cnt) && (echoSeq == (uint8_t)(seq + u8_cnt)) )
+		{
+			inOrder++;
+		}
+		else
+		{
+			lateEchoes++;
+		}
+	}
+	lost += burstLost;
+	_flushRx();
+
+	/* Link speed, unknown if too fast for the clock or no large Probe came back */
+	if ( (rttLarge != 0xFFFFFFFFUL) && (rttLarge > rttSmall) )
+	{
+		byteUs = (rttLarge - rttSmall) * 1000UL / (2UL * (NMODEM_PACKET - 1));
+	}
+	else
+	{
+		byteUs = 0;
+	}
+
+	/* Damaged Bytes, every lost Probe counts as one */
+	linkBytes = 2UL * ( NM_PROBE_SMALL * (NM_PROBE_HEAD + NM_CRC + 2) +
+		(uint32_t)(NM_PROBE_LARGE + NMODEM_WINDOW) * (NMODEM_PACKET + NM_OVERHEAD) );
+	errPpm = (uint32_t)lost * 1000000UL / linkBytes;
+
+	/* Packet size moving the most payload: Share of payload in a frame times
+	 * the chance of the frame getting through */
+	for (size = NMODEM_PACKET; ; size >>= 1)
+	{
+		success = errPpm * (size + NM_OVERHEAD + size / 254);
+		success = (success >= 1000000UL) ? 0 : 1000000UL - success;
+		efficiency = (uint32_t)size * success / (size + NM_OVERHEAD + size / 254);
+		if (efficiency > bestEfficiency)
+		{
+			bestEfficiency = efficiency;
+			tune.packet = size;
+		}
+		if (size / 2 < NM_PROBE_MIN)	break;
+	}
+
+	/* The full window. It costs the receiver nothing, the packets go straight
+	 * to the file, and keeps the link busy while lost ones are repeated */
+	packetUs = byteUs * (tune.packet + NM_OVERHEAD);
+	tune.window = NMODEM_WINDOW;
+	/* The burst overran, the rest of it went missing although the full sized
+	 * Probes came through on their own: Not more than came through in one go.
+	 * Single Probes lost in between are damage */
+	b_overrun = burstLost && !lateEchoes && (largeEchoes == NM_PROBE_LARGE);
+	if (b_overrun && (inOrder < tune.window))
+	{
+		tune.window = inOrder ? inOrder : 1;
+	}
+
+	/* Timeout: Twice the slowest single answer and the time of a full window */
+	rtt = 2 * rttMax + (uint32_t)tune.window * packetUs / 1000UL;
+	if (rtt < NM_TIMEOUT_MIN)	rtt = NM_TIMEOUT_MIN;
+	if (rtt > NM_TIMEOUT_MAX)	rtt = NM_TIMEOUT_MAX;
+	tune.timeout = (uint16_t)rtt;
+
+	tune.maxErr = lost ? 2 * defaults.maxErr : defaults.maxErr;
+	tune.pace = b_overrun ? defaults.pace : 0;
+
+	file_modem_tune(&tune);
+	if (p_tune)	*p_tune = _fm_tune;
+	return FM_OK;
+}
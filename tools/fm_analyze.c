@@ -0,0 +1,761 @@
+/*
+ * fm_analyze.c
+ *
+ * Offline analyzer for captured X-Modem, Y-Modem and Z-Modem sessions. Runs
+ * on the host: It decodes the packets of a capture, reconstructs when each
+ * part of them was on the line (header, payload, check, answer, gap until the
+ * next one), flags retransmissions and stalls and prints where the transfer
+ * lost its time. Optionally the timeline is written in the Chrome trace event
+ * format, which chrome://tracing and ui.perfetto.dev open.
+ *
+ * Capture format, one chunk of Bytes per line, '#' starts a comment:
+ *   <time in microseconds> <D|A> <hex Bytes ...>
+ * D are Bytes towards the receiver of the file (packets of the sender), A
+ * the ones back to the sender (ACK, NAK, ...). Such a log is easily written
+ * by recByte and sendByte of the target or by a serial sniffer. If all Bytes
+ * of a line carry the same timestamp, -b spreads them by the baud rate.
+ *
+ * Build:	gcc -O2 -o fm_analyze fm_analyze.c
+ * Usage:	fm_analyze [-b baud] [-s stall_ms] [-t trace.json] [-v] capture.txt
+ *
+ * Created: 18.10.2026 17:02:44
+ *  Author: gfcwfzkm
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+
+#define SOH		0x01
+#define STX		0x02
+#define EOT		0x04
+#define ACK		0x06
+#define NAK		0x15
+#define CAN		0x18
+#define FILL	0x1C	// Run-length fill record of this library (XMODEM_FILL_EXT)
+#define CRC16	0x43	// 'C'
+#define FILLREQ	0x46	// 'F'
+
+/* Z-Modem */
+#define ZPAD	0x2A	// '*'
+#define ZDLE	0x18
+#define ZBIN	0x41	// 'A', binary header with CRC-16
+#define ZHEX	0x42	// 'B', hex header
+#define ZBIN32	0x43	// 'C', binary header with CRC-32
+#define ZCRCE	0x68	// 'h', end of frame, header follows
+#define ZCRCG	0x69	// 'i', frame continues, no answer
+#define ZCRCQ	0x6A	// 'j', frame continues, ZACK expected
+#define ZCRCW	0x6B	// 'k', end of frame, ZACK expected
+#define ZRUB0	0x6C	// 'l', 0x7F
+#define ZRUB1	0x6D	// 'm', 0xFF
+
+#define ZRPOS	9
+#define ZDATA	10
+#define ZFILE	4
+#define ZSINIT	2
+#define ZCOMMAND	18
+
+static const char *const zTypes[] = {"ZRQINIT", "ZRINIT", "ZSINIT", "ZACK", "ZFILE", "ZSKIP", "ZNAK",
+	"ZABORT", "ZFIN", "ZRPOS", "ZDATA", "ZEOF", "ZFERR", "ZCRC", "ZCHALLENGE", "ZCOMPL", "ZCAN",
+	"ZFREECNT", "ZCOMMAND", "ZSTDERR"};
+
+/* One Byte of the capture */
+struct capByte {
+	uint64_t t;			// Time in microseconds
+	uint8_t b;
+};
+
+/* All Bytes of one direction */
+struct capStream {
+	struct capByte *p_bytes;
+	size_t len, size;
+};
+
+/* Trace threads, one row each in the viewer */
+enum traceTid {TID_DATA = 1, TID_ANSWER, TID_IDLE};
+
+/* Time breakdown of the session */
+struct summary {
+	uint64_t header, payload, check, answer, gap;
+	uint64_t start, end;
+	uint64_t payloadBytes, resentBytes;
+	uint32_t packets, resent, badCheck, naks, stalls;
+	uint64_t stallTime;
+	uint32_t garbage;
+};
+
+static FILE *traceFile;
+static uint8_t b_firstEvent = 1;
+static uint8_t b_verbose;
+static uint64_t stallLimit = 1000000;
+
+/**
+  * @brief Writes a complete event (slice) to the trace file
+  */
+static void _traceSlice(enum traceTid tid, const char *p_name, uint64_t u64_start, uint64_t u64_end, const char *p_args)
+{
+	if (!traceFile)	return;
+	fprintf(traceFile, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%llu%s%s%s}",
+		b_firstEvent ? "\n" : ",\n", p_name, tid, (unsigned long long)u64_start,
+		(unsigned long long)(u64_end - u64_start), p_args ? ",\"args\":{" : "", p_args ? p_args : "", p_args ? "}" : "");
+	b_firstEvent = 0;
+}
+
+/**
+  * @brief Writes an instant event (marker) to the trace file
+  */
+static void _traceMark(enum traceTid tid, const char *p_name, uint64_t u64_time)
+{
+	if (!traceFile)	return;
+	fprintf(traceFile, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%llu}",
+		b_firstEvent ? "\n" : ",\n", p_name, tid, (unsigned long long)u64_time);
+	b_firstEvent = 0;
+}
+
+static void _traceOpen(const char *p_name)
+{
+	static const char *const threads[] = {"", "Data (sender)", "Answers (receiver)", "Idle"};
+	int i;
+
+	traceFile = fopen(p_name, "w");
+	if (!traceFile)
+	{
+		perror(p_name);
+		exit(1);
+	}
+	fprintf(traceFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (i = TID_DATA; i <= TID_IDLE; i++)
+	{
+		fprintf(traceFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			b_firstEvent ? "\n" : ",\n", i, threads[i]);
+		b_firstEvent = 0;
+	}
+}
+
+static void _traceClose(void)
+{
+	if (!traceFile)	return;
+	fprintf(traceFile, "\n]}\n");
+	fclose(traceFile);
+}
+
+static void _push(struct capStream *p_s, uint64_t u64_t, uint8_t u8_b)
+{
+	if (p_s->len == p_s->size)
+	{
+		p_s->size = p_s->size ? p_s->size * 2 : 4096;
+		p_s->p_bytes = realloc(p_s->p_bytes, p_s->size * sizeof(struct capByte));
+		if (!p_s->p_bytes)	exit(1);
+	}
+	p_s->p_bytes[p_s->len].t = u64_t;
+	p_s->p_bytes[p_s->len].b = u8_b;
+	p_s->len++;
+}
+
+/**
+  * @brief Reads the capture into the two directions
+  *
+  * @param u32_baud	If not zero, Bytes of a line are spread by one character time each
+  */
+static void _readCapture(FILE *p_in, uint32_t u32_baud, struct capStream *p_data, struct capStream *p_answer)
+{
+	char *p_line = NULL, *p_pos, *p_end;
+	size_t lineSize = 0;
+	unsigned long long t;
+	unsigned long val;
+	char dir;
+	uint64_t byteTime = u32_baud ? 10000000ULL / u32_baud : 0;
+	uint32_t lineNo = 0, n;
+
+	while (getline(&p_line, &lineSize, p_in) > 0)
+	{
+		lineNo++;
+		p_pos = p_line;
+		while (isspace((unsigned char)*p_pos))	p_pos++;
+		if (!*p_pos || (*p_pos == '#'))	continue;
+
+		t = strtoull(p_pos, &p_end, 10);
+		if (p_end == p_pos)
+		{
+			fprintf(stderr, "Line %lu: Timestamp missing\n", (unsigned long)lineNo);
+			continue;
+		}
+		p_pos = p_end;
+		while (isspace((unsigned char)*p_pos))	p_pos++;
+		dir = toupper((unsigned char)*p_pos++);
+		if ( (dir != 'D') && (dir != 'A') )
+		{
+			fprintf(stderr, "Line %lu: Direction has to be D or A\n", (unsigned long)lineNo);
+			continue;
+		}
+
+		for (n = 0; ; n++)
+		{
+			val = strtoul(p_pos, &p_end, 16);
+			if (p_end == p_pos)	break;
+			p_pos = p_end;
+			_push((dir == 'D') ? p_data : p_answer, t + n * byteTime, (uint8_t)val);
+		}
+	}
+	free(p_line);
+}
+
+/**
+  * @brief Finds the first Byte at or after a point in time
+  */
+static size_t _findTime(const struct capStream *p_s, size_t u_from, uint64_t u64_t)
+{
+	while ( (u_from < p_s->len) && (p_s->p_bytes[u_from].t < u64_t) )	u_from++;
+	return u_from;
+}
+
+static uint16_t _crc16_update(uint16_t crc, uint8_t data)
+{
+	uint8_t i;
+
+	crc ^= (uint16_t)data << 8;
+	for (i = 0; i < 8; i++)
+	{
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+/**
+  * @brief Accounts the answer to a packet and the gap until the next one
+  *
+  * @param p_ans		Index into the answers, moved past the answer
+  * @param u64_end		End of the packet
+  * @param u64_next		Start of the next packet, UINT64_MAX if there is none
+  * @param p_answer		Holds the answer Byte, zero if there was none
+  */
+static uint64_t _xAnswer(const struct capStream *p_a, size_t *p_ans, uint64_t u64_end, uint64_t u64_next,
+	uint8_t *p_answer, struct summary *p_sum)
+{
+	uint64_t t = u64_end;
+	char name[32];
+
+	*p_answer = 0;
+	*p_ans = _findTime(p_a, *p_ans, u64_end);
+	/* Skip over pokes and such, the answer is ACK, NAK or CAN */
+	while ( (*p_ans < p_a->len) && (p_a->p_bytes[*p_ans].t < u64_next) )
+	{
+		uint8_t b = p_a->p_bytes[(*p_ans)++].b;
+		if ( (b == ACK) || (b == NAK) || (b == CAN) )
+		{
+			*p_answer = b;
+			t = p_a->p_bytes[*p_ans - 1].t;
+			p_sum->answer += t - u64_end;
+			snprintf(name, sizeof(name), "%s", (b == ACK) ? "ACK" : (b == NAK) ? "NAK" : "CAN");
+			_traceSlice(TID_ANSWER, name, u64_end, t, NULL);
+			if (b == NAK)	p_sum->naks++;
+			break;
+		}
+	}
+	return t;
+}
+
+/**
+  * @brief Decodes a X-Modem or Y-Modem session
+  */
+static void _analyzeXmodem(const struct capStream *p_d, const struct capStream *p_a, struct summary *p_sum)
+{
+	size_t pos = 0, ans = 0, i;
+	uint8_t b_useCRC = 1, b_useFill = 0, answer, blk, b_resent, b_bad;
+	uint8_t prevBlk = 0, b_havePrev = 0;	// Block number of the packet before
+	uint8_t ackedBlk = 0, b_haveAcked = 0;	// Block number of the last acknowledged packet
+	uint16_t size, checkLen, crc, recvCRC;
+	uint64_t tStart, tHead, tPayload, tCheck, tNext, tIdle = 0, count;
+	char name[48], args[160];
+
+	/* The first poke of the receiver decides the check */
+	if (p_a->len)
+	{
+		for (i = 0; (i < p_a->len) && (!p_d->len || (p_a->p_bytes[i].t <= p_d->p_bytes[0].t)); i++)
+		{
+			if (p_a->p_bytes[i].b == NAK)		{ b_useCRC = 0; b_useFill = 0; }
+			if (p_a->p_bytes[i].b == CRC16)		{ b_useCRC = 1; b_useFill = 0; }
+			if (p_a->p_bytes[i].b == FILLREQ)	{ b_useCRC = 1; b_useFill = 1; }
+		}
+	}
+	checkLen = b_useCRC ? 2 : 1;
+	printf("Protocol:        X-Modem / Y-Modem, %s%s\n", b_useCRC ? "CRC-16" : "Checksum", b_useFill ? ", fill records" : "");
+
+	while (pos < p_d->len)
+	{
+		uint8_t c = p_d->p_bytes[pos].b;
+
+		if ( (c == SOH) || (c == STX) || (b_useFill && (c == FILL)) )
+		{
+			size = (c == SOH) ? 128 : (c == STX) ? 1024 : 5;
+			if (pos + 3 + size + checkLen > p_d->len)
+			{
+				printf("Capture ends within a packet\n");
+				break;
+			}
+			tStart = p_d->p_bytes[pos].t;
+			tHead = p_d->p_bytes[pos + 2].t;
+			tPayload = p_d->p_bytes[pos + 2 + size].t;
+			tCheck = p_d->p_bytes[pos + 2 + size + checkLen].t;
+			blk = p_d->p_bytes[pos + 1].b;
+			b_bad = ((p_d->p_bytes[pos + 2].b ^ blk) != 0xFF);
+
+			crc = 0;
+			for (i = 0; i < size; i++)
+			{
+				uint8_t d = p_d->p_bytes[pos + 3 + i].b;
+				crc = b_useCRC ? _crc16_update(crc, d) : (uint8_t)(crc + d);
+			}
+			recvCRC = p_d->p_bytes[pos + 3 + size].b;
+			if (b_useCRC)	recvCRC = (recvCRC << 8) | p_d->p_bytes[pos + 4 + size].b;
+			if (crc != recvCRC)	b_bad = 1;
+
+			/* Same block number again: The sender repeats the packet */
+			b_resent = b_havePrev && (blk == prevBlk);
+			prevBlk = blk;
+			b_havePrev = 1;
+
+			if (tIdle && (tStart > tIdle))
+			{
+				p_sum->gap += tStart - tIdle;
+				_traceSlice(TID_IDLE, (tStart - tIdle >= stallLimit) ? "stall" : "gap", tIdle, tStart, NULL);
+				if (tStart - tIdle >= stallLimit)
+				{
+					p_sum->stalls++;
+					p_sum->stallTime += tStart - tIdle;
+				}
+			}
+			if (!p_sum->packets)	p_sum->start = tStart;
+
+			p_sum->packets++;
+			p_sum->header += tHead - tStart;
+			p_sum->payload += tPayload - tHead;
+			p_sum->check += tCheck - tPayload;
+			if (b_bad)	p_sum->badCheck++;
+			if (b_resent)
+			{
+				p_sum->resent++;
+				p_sum->resentBytes += size;
+			}
+
+			/* Y-Modem header block: File name and size */
+			if ( (blk == 0) && !b_bad && !b_haveAcked )
+			{
+				if (p_d->p_bytes[pos + 3].b)
+				{
+					printf("Y-Modem file:    ");
+					for (i = 0; (i < size) && p_d->p_bytes[pos + 3 + i].b; i++)	putchar(p_d->p_bytes[pos + 3 + i].b);
+					printf(", size ");
+					for (i++; (i < size) && isdigit(p_d->p_bytes[pos + 3 + i].b); i++)	putchar(p_d->p_bytes[pos + 3 + i].b);
+					printf("\n");
+				}
+			}
+
+			snprintf(name, sizeof(name), "%s %u%s%s", (c == SOH) ? "SOH" : (c == STX) ? "STX" : "FILL", blk,
+				b_resent ? " (resent)" : "", b_bad ? " (bad)" : "");
+			snprintf(args, sizeof(args), "\"block\":%u,\"size\":%u,\"resent\":%s,\"bad\":%s", blk, size,
+				b_resent ? "true" : "false", b_bad ? "true" : "false");
+			_traceSlice(TID_DATA, name, tStart, tCheck, args);
+			_traceSlice(TID_DATA, "header", tStart, tHead, NULL);
+			_traceSlice(TID_DATA, "payload", tHead, tPayload, NULL);
+			_traceSlice(TID_DATA, "check", tPayload, tCheck, NULL);
+			if (b_resent)	_traceMark(TID_DATA, "retransmission", tStart);
+
+			pos += 3 + size + checkLen;
+			tNext = (pos < p_d->len) ? p_d->p_bytes[pos].t : UINT64_MAX;
+			tIdle = _xAnswer(p_a, &ans, tCheck, tNext, &answer, p_sum);
+			p_sum->end = tIdle;
+
+			if (b_verbose)
+			{
+				printf("  %10.3f ms  %-20s head %6.2f  data %8.2f  check %5.2f  answer %7.2f ms  %s\n",
+					tStart / 1000.0, name, (tHead - tStart) / 1000.0, (tPayload - tHead) / 1000.0,
+					(tCheck - tPayload) / 1000.0, (tIdle - tCheck) / 1000.0,
+					(answer == ACK) ? "ACK" : (answer == NAK) ? "NAK" : (answer == CAN) ? "CAN" : "-");
+			}
+			/* Payload counts once it got acknowledged, the first time */
+			if ( !b_bad && (answer == ACK) && !(b_haveAcked && (blk == ackedBlk)) )
+			{
+				if (c == FILL)
+				{
+					count = ((uint64_t)p_d->p_bytes[pos - 7].b << 24) | ((uint64_t)p_d->p_bytes[pos - 6].b << 16) |
+							((uint64_t)p_d->p_bytes[pos - 5].b << 8) | p_d->p_bytes[pos - 4].b;
+					p_sum->payloadBytes += count;
+				}
+				else
+				{
+					p_sum->payloadBytes += size;
+				}
+				ackedBlk = blk;
+				b_haveAcked = 1;
+			}
+		}
+		else if (c == EOT)
+		{
+			tStart = p_d->p_bytes[pos++].t;
+			tNext = (pos < p_d->len) ? p_d->p_bytes[pos].t : UINT64_MAX;
+			_traceSlice(TID_DATA, "EOT", tStart, tStart + 1, NULL);
+			tIdle = _xAnswer(p_a, &ans, tStart, tNext, &answer, p_sum);
+			p_sum->end = tIdle;
+			if (b_verbose)	printf("  %10.3f ms  EOT %s\n", tStart / 1000.0, (answer == ACK) ? "ACK" : "NAK");
+			/* Y-Modem: A new block 0 follows for the next file */
+			if (answer == ACK)	b_haveAcked = b_havePrev = 0;
+		}
+		else if (c == CAN)
+		{
+			_traceMark(TID_DATA, "cancel", p_d->p_bytes[pos].t);
+			printf("Cancelled by the sender at %.3f ms\n", p_d->p_bytes[pos].t / 1000.0);
+			break;
+		}
+		else
+		{
+			p_sum->garbage++;
+			pos++;
+		}
+	}
+}
+
+/**
+  * @brief Reads a Z-Modem Byte, undoing the ZDLE escapes
+  *
+  * @return		The Byte, 0x100 + frame end type if a subpacket ends, -1 at the end
+  */
+static int _zByte(const struct capStream *p_s, size_t *p_pos)
+{
+	uint8_t c;
+
+	if (*p_pos >= p_s->len)	return -1;
+	c = p_s->p_bytes[(*p_pos)++].b;
+	if (c != ZDLE)	return c;
+	if (*p_pos >= p_s->len)	return -1;
+	c = p_s->p_bytes[(*p_pos)++].b;
+	if ( (c >= ZCRCE) && (c <= ZCRCW) )	return 0x100 | c;
+	if (c == ZRUB0)	return 0x7F;
+	if (c == ZRUB1)	return 0xFF;
+	return c ^ 0x40;
+}
+
+static int _hexNibble(uint8_t c)
+{
+	if ( (c >= '0') && (c <= '9') )	return c - '0';
+	if ( (c >= 'a') && (c <= 'f') )	return c - 'a' + 10;
+	return -1;
+}
+
+/**
+  * @brief Searches and decodes the next Z-Modem header
+  *
+  * @param p_pos	Search position, moved behind the header
+  * @param p_hdr	Holds type and the four header Bytes
+  * @param p_start	Holds the time the header started
+  * @param p_fmt	Holds the header format (ZBIN, ZHEX, ZBIN32)
+  *
+  * @return			One if a header has been found
+  */
+static uint8_t _zHeader(const struct capStream *p_s, size_t *p_pos, uint8_t *p_hdr, uint64_t *p_start, uint8_t *p_fmt)
+{
+	size_t i;
+	int c, n, hi, lo;
+
+	for (i = *p_pos; i + 3 < p_s->len; i++)
+	{
+		if ( (p_s->p_bytes[i].b != ZPAD) || (p_s->p_bytes[i + 1].b != ZDLE && p_s->p_bytes[i + 1].b != ZPAD) )	continue;
+		*p_start = p_s->p_bytes[i].t;
+		*p_pos = i + 1;
+		while ( (*p_pos < p_s->len) && (p_s->p_bytes[*p_pos].b == ZPAD) )	(*p_pos)++;
+		if ( (*p_pos + 1 >= p_s->len) || (p_s->p_bytes[*p_pos].b != ZDLE) )	continue;
+		*p_fmt = p_s->p_bytes[*p_pos + 1].b;
+		*p_pos += 2;
+
+		if (*p_fmt == ZHEX)
+		{
+			/* Type, 4 Bytes and the CRC-16 as hex digits */
+			if (*p_pos + 14 > p_s->len)	return 0;
+			for (n = 0; n < 5; n++)
+			{
+				hi = _hexNibble(p_s->p_bytes[*p_pos + 2 * n].b);
+				lo = _hexNibble(p_s->p_bytes[*p_pos + 2 * n + 1].b);
+				if ( (hi < 0) || (lo < 0) )	break;
+				p_hdr[n] = (uint8_t)((hi << 4) | lo);
+			}
+			if (n < 5)	continue;
+			*p_pos += 14;
+			/* CR LF and maybe XON */
+			while ( (*p_pos < p_s->len) && ((p_s->p_bytes[*p_pos].b & 0x7F) == 0x0D ||
+				(p_s->p_bytes[*p_pos].b & 0x7F) == 0x0A || p_s->p_bytes[*p_pos].b == 0x11) )	(*p_pos)++;
+			return 1;
+		}
+		if ( (*p_fmt == ZBIN) || (*p_fmt == ZBIN32) )
+		{
+			for (n = 0; n < 5 + ((*p_fmt == ZBIN) ? 2 : 4); n++)
+			{
+				c = _zByte(p_s, p_pos);
+				if ( (c < 0) || (c > 0xFF) )	break;
+				if (n < 5)	p_hdr[n] = (uint8_t)c;
+			}
+			if (n < 5 + ((*p_fmt == ZBIN) ? 2 : 4))	continue;
+			return 1;
+		}
+	}
+	*p_pos = p_s->len;
+	return 0;
+}
+
+/**
+  * @brief Checks if a Z-Modem header starts at a position
+  */
+static uint8_t _zHeaderStart(const struct capStream *p_s, size_t u_pos)
+{
+	uint8_t c;
+
+	if (u_pos + 2 >= p_s->len)	return 0;
+	if (p_s->p_bytes[u_pos].b != ZPAD)	return 0;
+	if ( (p_s->p_bytes[u_pos + 1].b == ZPAD) && (p_s->p_bytes[u_pos + 2].b == ZDLE) )	return 1;
+	c = p_s->p_bytes[u_pos + 2].b;
+	return (p_s->p_bytes[u_pos + 1].b == ZDLE) && ((c == ZBIN) || (c == ZHEX) || (c == ZBIN32));
+}
+
+static const char *_zName(uint8_t u8_type)
+{
+	return (u8_type < sizeof(zTypes) / sizeof(zTypes[0])) ? zTypes[u8_type] : "unknown";
+}
+
+/**
+  * @brief Decodes the subpackets following a data carrying Z-Modem header
+  *
+  * @param p_offset	File offset of the data, counted up
+  * @param p_sent	Highest offset sent so far, to spot retransmissions
+  */
+static void _zData(const struct capStream *p_s, size_t *p_pos, uint8_t u8_fmt, uint8_t u8_type, uint64_t *p_offset,
+	uint64_t *p_sent, struct summary *p_sum)
+{
+	uint64_t tStart, tPayload, tEnd;
+	uint32_t len;
+	int c, n;
+	char name[64], args[128];
+
+	while (*p_pos < p_s->len)
+	{
+		tStart = p_s->p_bytes[*p_pos].t;
+		len = 0;
+		do{
+			/* A new header within the data: The sender dropped the frame,
+			 * usually after a ZRPOS of the receiver */
+			if (_zHeaderStart(p_s, *p_pos))
+			{
+				if (len)	_traceSlice(TID_DATA, "dropped", tStart, p_s->p_bytes[*p_pos - 1].t, NULL);
+				return;
+			}
+			c = _zByte(p_s, p_pos);
+			if ( (c >= 0) && (c <= 0xFF) )	len++;
+		}while( (c >= 0) && (c <= 0xFF) );
+		if (c < 0)	return;
+		tPayload = p_s->p_bytes[*p_pos - 1].t;
+
+		/* CRC behind the frame end */
+		for (n = 0; n < ((u8_fmt == ZBIN32) ? 4 : 2); n++)
+		{
+			if (_zByte(p_s, p_pos) < 0)	return;
+		}
+		tEnd = p_s->p_bytes[*p_pos - 1].t;
+
+		p_sum->packets++;
+		p_sum->payload += tPayload - tStart;
+		p_sum->check += tEnd - tPayload;
+		if (u8_type == ZDATA)
+		{
+			if (*p_offset < *p_sent)
+			{
+				p_sum->resent++;
+				p_sum->resentBytes += len;
+				_traceMark(TID_DATA, "retransmission", tStart);
+			}
+			else
+			{
+				p_sum->payloadBytes += len;
+			}
+		}
+		snprintf(name, sizeof(name), "%s %u @%llu%s", (u8_type == ZDATA) ? "data" : _zName(u8_type), len,
+			(unsigned long long)*p_offset, (*p_offset < *p_sent) ? " (resent)" : "");
+		snprintf(args, sizeof(args), "\"offset\":%llu,\"size\":%u,\"end\":\"ZCRC%c\"",
+			(unsigned long long)*p_offset, len, "EGQW"[(c & 0xFF) - ZCRCE]);
+		_traceSlice(TID_DATA, name, tStart, tEnd, args);
+		if (b_verbose)
+		{
+			printf("  %10.3f ms  %-28s data %8.2f  check %5.2f ms  ZCRC%c\n", tStart / 1000.0, name,
+				(tPayload - tStart) / 1000.0, (tEnd - tPayload) / 1000.0, "EGQW"[(c & 0xFF) - ZCRCE]);
+		}
+		if (u8_type == ZDATA)
+		{
+			*p_offset += len;
+			if (*p_offset > *p_sent)	*p_sent = *p_offset;
+		}
+		p_sum->end = tEnd;
+
+		/* ZCRCE and ZCRCW end the frame, a header follows */
+		if ( ((c & 0xFF) == ZCRCE) || ((c & 0xFF) == ZCRCW) )	return;
+	}
+}
+
+/**
+  * @brief Decodes a Z-Modem session
+  */
+static void _analyzeZmodem(const struct capStream *p_d, const struct capStream *p_a, struct summary *p_sum)
+{
+	size_t posD = 0, posA = 0;
+	uint8_t hdrD[5], hdrA[5], fmtD = 0, fmtA = 0, b_haveD, b_haveA;
+	uint64_t tD = 0, tA = 0, offset = 0, sent = 0, tLast = 0;
+	char name[64];
+
+	printf("Protocol:        Z-Modem\n");
+	b_haveD = _zHeader(p_d, &posD, hdrD, &tD, &fmtD);
+	b_haveA = _zHeader(p_a, &posA, hdrA, &tA, &fmtA);
+
+	/* Walk through the headers of both sides in the order they were sent */
+	while (b_haveD || b_haveA)
+	{
+		if (b_haveD && (!b_haveA || (tD <= tA)))
+		{
+			uint64_t pos = hdrD[1] | ((uint64_t)hdrD[2] << 8) | ((uint64_t)hdrD[3] << 16) | ((uint64_t)hdrD[4] << 24);
+
+			if (!p_sum->start)	p_sum->start = tD;
+			if (tLast && (tD > tLast))
+			{
+				p_sum->gap += tD - tLast;
+				if (tD - tLast >= stallLimit)
+				{
+					p_sum->stalls++;
+					p_sum->stallTime += tD - tLast;
+					_traceSlice(TID_IDLE, "stall", tLast, tD, NULL);
+				}
+			}
+			snprintf(name, sizeof(name), "%s", _zName(hdrD[0]));
+			_traceSlice(TID_DATA, name, tD, p_d->p_bytes[posD - 1].t, NULL);
+			p_sum->header += p_d->p_bytes[posD - 1].t - tD;
+			if (b_verbose)	printf("  %10.3f ms  > %s %llu\n", tD / 1000.0, name, (unsigned long long)pos);
+
+			if ( (hdrD[0] == ZDATA) || (hdrD[0] == ZFILE) || (hdrD[0] == ZSINIT) || (hdrD[0] == ZCOMMAND) )
+			{
+				if (hdrD[0] == ZDATA)	offset = pos;
+				_zData(p_d, &posD, fmtD, hdrD[0], &offset, &sent, p_sum);
+			}
+			tLast = p_d->p_bytes[posD - 1].t;
+			p_sum->end = tLast;
+			b_haveD = _zHeader(p_d, &posD, hdrD, &tD, &fmtD);
+		}
+		else
+		{
+			uint64_t pos = hdrA[1] | ((uint64_t)hdrA[2] << 8) | ((uint64_t)hdrA[3] << 16) | ((uint64_t)hdrA[4] << 24);
+
+			snprintf(name, sizeof(name), "%s %llu", _zName(hdrA[0]), (unsigned long long)pos);
+			_traceSlice(TID_ANSWER, name, tA, p_a->p_bytes[posA - 1].t, NULL);
+			p_sum->answer += p_a->p_bytes[posA - 1].t - tA;
+			if (b_verbose)	printf("  %10.3f ms  < %s\n", tA / 1000.0, name);
+			if ( (hdrA[0] == ZRPOS) && sent )
+			{
+				/* Receiver asks to go back: Everything sent beyond is lost */
+				p_sum->naks++;
+				_traceMark(TID_ANSWER, "ZRPOS", tA);
+			}
+			if (tA > tLast)	tLast = tA;
+			b_haveA = _zHeader(p_a, &posA, hdrA, &tA, &fmtA);
+		}
+	}
+}
+
+static void _usage(const char *p_name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] capture.txt\n"
+		"  -b baud      Spread the Bytes of a line by the character time\n"
+		"  -s ms        Gaps at least this long count as stall (1000)\n"
+		"  -t file      Write the timeline in Chrome trace format\n"
+		"  -v           Print every packet\n", p_name);
+}
+
+int main(int argc, char **argv)
+{
+	struct capStream data = {0}, answer = {0};
+	struct summary sum;
+	uint32_t baud = 0;
+	uint64_t total;
+	size_t i;
+	uint8_t b_zmodem = 0;
+	FILE *p_in;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:s:t:vh")) != -1)
+	{
+		switch (opt)
+		{
+			case 'b':	baud = strtoul(optarg, NULL, 0);						break;
+			case 's':	stallLimit = strtoull(optarg, NULL, 0) * 1000;			break;
+			case 't':	_traceOpen(optarg);										break;
+			case 'v':	b_verbose = 1;											break;
+			default:
+				_usage(argv[0]);
+				return 1;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		_usage(argv[0]);
+		return 1;
+	}
+	p_in = fopen(argv[optind], "r");
+	if (!p_in)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	_readCapture(p_in, baud, &data, &answer);
+	fclose(p_in);
+
+	/* Z-Modem starts with "**", ZDLE on one of the sides */
+	for (i = 0; i + 2 < data.len; i++)
+	{
+		if ( (data.p_bytes[i].b == ZPAD) && (data.p_bytes[i + 1].b == ZPAD) && (data.p_bytes[i + 2].b == ZDLE) )
+		{
+			b_zmodem = 1;
+			break;
+		}
+	}
+	for (i = 0; !b_zmodem && (i + 2 < answer.len); i++)
+	{
+		if ( (answer.p_bytes[i].b == ZPAD) && (answer.p_bytes[i + 1].b == ZPAD) && (answer.p_bytes[i + 2].b == ZDLE) )
+		{
+			b_zmodem = 1;
+		}
+	}
+
+	memset(&sum, 0, sizeof(sum));
+	if (b_zmodem)
+	{
+		_analyzeZmodem(&data, &answer, &sum);
+	}
+	else
+	{
+		_analyzeXmodem(&data, &answer, &sum);
+	}
+	_traceClose();
+
+	total = sum.end - sum.start;
+	printf("Packets:         %lu, %lu resent (%llu Bytes), %lu damaged, %lu NAK / ZRPOS\n",
+		(unsigned long)sum.packets, (unsigned long)sum.resent, (unsigned long long)sum.resentBytes,
+		(unsigned long)sum.badCheck, (unsigned long)sum.naks);
+	printf("Payload:         %llu Bytes in %.3f s, %.0f Bytes/s\n", (unsigned long long)sum.payloadBytes,
+		total / 1e6, total ? sum.payloadBytes * 1e6 / total : 0.0);
+	printf("Time spent in:   header %.3f s, payload %.3f s, check %.3f s, answer %.3f s, gaps %.3f s\n",
+		sum.header / 1e6, sum.payload / 1e6, sum.check / 1e6, sum.answer / 1e6, sum.gap / 1e6);
+	printf("Stalls:          %lu, %.3f s in total (>= %llu ms)\n", (unsigned long)sum.stalls, sum.stallTime / 1e6,
+		(unsigned long long)(stallLimit / 1000));
+	if (sum.garbage)	printf("Garbage:         %lu Bytes outside of packets\n", (unsigned long)sum.garbage);
+
+	free(data.p_bytes);
+	free(answer.p_bytes);
+	return 0;
+}
@@ -0,0 +1,799 @@
+/*
+ * fm_diskbench.c
+ *
+ * Measures what the storage path of the receivers costs in FatFs: a file is
+ * written the way a receiver writes it, packet by packet through _fm_write()
+ * and _fm_sync(), with different strategies: every packet straight to
+ * f_write, coalesced in the buffer of a sink or in the write scheduler,
+ * f_sync after every packet or every few kB, with the clusters allocated up
+ * front (f_expand or f_lseek) or not, or announced with file_modem_expect().
+ *
+ * Runs on the host, linked with the library and the real FatFs on a RAM
+ * disk. The RAM disk gives the CPU time spent in the library, FatFs and the
+ * copying. It is sparse: sectors only take memory once something else than
+ * zeros got written to them. The latency disk adds a modelled time per disk command, per
+ * sector and per CTRL_SYNC (defaults roughly an SD card on an 8 MHz SPI bus)
+ * without actually waiting. It takes FM_CTRL_WRITE_HINT like an SD driver
+ * would: The sectors get pre-erased, which saves part of the time per sector,
+ * and a write continuing the last one within them needs no command of its
+ * own (the multiple block write stays open until CTRL_SYNC or a read). Every strategy gets a freshly formatted disk.
+ * Per MB of file data it reports the throughput on both disks, the f_write,
+ * f_sync and other FatFs calls (f_lseek, f_expand, f_truncate) and the
+ * commands and sectors that reached the disk.
+ *
+ * With -g it checks files beyond 4 GiB instead: xmodem_receive() gets a file
+ * of -m MiB from a sender in the process, every MiB a 1k packet holding its
+ * offset followed by a fill record of zeros, once on an exFAT volume, where
+ * it has to arrive intact, and once on FAT32, which has to refuse it with
+ * FM_SIZE_EXCEEDED at 4 GiB. The zeros take no memory on the sparse disk,
+ * e.g. -g -m 8192 -d 10496 needs about 100 MB.
+ *
+ * The library has to be compiled with f_write, f_sync and f_lseek renamed to
+ * the counting wrappers below (-Df_write=cnt_f_write ...) and, for -g, with
+ * XMODEM_FILL_EXT. FatFs needs FF_USE_MKFS and FF_USE_EXPAND, and
+ * FF_FS_EXFAT for -g. tools/fm_diskbench.sh does all that.
+ *
+ * Usage:	fm_diskbench [options], see _usage() or run with -h
+ *
+ * Created: 18.10.2026 21:32:08
+ *  Author: gfcwfzkm
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "file_modem_int.h"
+#include "diskio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#define SECTOR		FF_MIN_SS	// Sector size of the RAM disk
+#define CHUNK		8			// Sectors the RAM disk allocates at once
+#define LARGE_STEP	(1UL << 20)	// -g: A packet holding the offset every MiB, fill records between
+#define STX			0x02
+#define EOT			0x04
+#define ACK			0x06
+#define NAK			0x15
+#define CAN			0x18
+#define FILL		0x1C
+#define FILLREQ		0x46
+
+enum prealloc {PRE_NONE, PRE_LSEEK, PRE_EXPAND, PRE_EXPECT, PRE_EXPECT_MORE};
+
+/* A way of getting the packets into the file */
+struct strategy {
+	const char *p_name;
+	uint16_t bufSize;		// Buffer of the sink, zero for none
+	uint32_t syncEvery;		// Sync interval of the sink in Bytes, zero only at the end
+	uint32_t schedSize;		// Buffer of a write scheduler session, zero for none
+	enum prealloc prealloc;
+};
+
+static const struct strategy _strategies[] = {
+	{"per packet",					0,		0,		0,		PRE_NONE},
+	{"per packet, sync 1",			0,		1,		0,		PRE_NONE},
+	{"per packet, sync 16k",		0,		16384,	0,		PRE_NONE},
+	{"per packet, sync 256k",		0,		262144,	0,		PRE_NONE},
+	{"per packet, lseek",			0,		0,		0,		PRE_LSEEK},
+#if FF_USE_EXPAND
+	{"per packet, expand",			0,		0,		0,		PRE_EXPAND},
+	{"per packet, expect",			0,		0,		0,		PRE_EXPECT},
+	{"per packet, expect more",		0,		0,		0,		PRE_EXPECT_MORE},
+#endif
+	{"coalesced 4k",				4096,	0,		0,		PRE_NONE},
+	{"coalesced 16k",				16384,	0,		0,		PRE_NONE},
+	{"coalesced 32k",				32768,	0,		0,		PRE_NONE},
+	{"coalesced 32k, sync 256k",	32768,	262144,	0,		PRE_NONE},
+	{"coalesced 32k, lseek",		32768,	0,		0,		PRE_LSEEK},
+#if FF_USE_EXPAND
+	{"coalesced 32k, expand",		32768,	0,		0,		PRE_EXPAND},
+	{"coalesced 32k, expect",		32768,	0,		0,		PRE_EXPECT},
+#endif
+	{"scheduler 2x16k",				0,		0,		32768,	PRE_NONE},
+#if FF_USE_EXPAND
+	{"scheduler 2x16k, expect",		0,		0,		32768,	PRE_EXPECT},
+#endif
+};
+
+/* Calls counted during a run */
+struct counters {
+	uint32_t writes, syncs, others;		// FatFs: f_write, f_sync, f_lseek / f_expand / f_truncate
+	uint32_t readCmds, writeCmds;		// Disk commands
+	uint64_t readSectors, writeSectors;	// Sectors transferred
+	uint32_t diskSyncs;					// CTRL_SYNC
+	uint32_t hints;						// FM_CTRL_WRITE_HINT
+	uint64_t diskNs;					// Modelled time of the latency disk
+};
+
+/* Result of a run */
+struct run {
+	struct counters cnt;
+	uint64_t cpuNs;
+	uint8_t b_failed;
+};
+
+static uint8_t **pp_chunks;		// Chunks of the RAM disk, NULL while all zeros
+static size_t chunkCount;
+static LBA_t diskSectors;
+static struct counters cnt;
+static uint64_t cmdNs = 250000, sectorNs = 520000, syncNs = 1000000, eraseNs = 150000;
+
+/* Pre-erased sectors and the open multiple block write of the latency disk */
+static LBA_t hintStart, hintEnd, openNext;
+static uint8_t b_writeOpen;
+
+static uint32_t packetSize = 1024;
+static uint64_t fileSize = 8UL << 20;
+static uint32_t diskSize = 64;
+static uint32_t clusterSize;
+
+/* ----- FatFs with counters, the library calls these ----- */
+
+FRESULT cnt_f_write(FIL *fp, const void *buff, UINT btw, UINT *bw)
+{
+	cnt.writes++;
+	return f_write(fp, buff, btw, bw);
+}
+
+FRESULT cnt_f_sync(FIL *fp)
+{
+	cnt.syncs++;
+	return f_sync(fp);
+}
+
+FRESULT cnt_f_lseek(FIL *fp, FSIZE_t ofs)
+{
+	cnt.others++;
+	return f_lseek(fp, ofs);
+}
+
+/* ----- Sparse RAM disk, with the time a real one would take ----- */
+
+static const uint8_t u8a_zero[SECTOR];
+
+/* Sets the whole disk to zeros, the memory taken so far is kept */
+static void _diskClear(void)
+{
+	size_t i;
+
+	for (i = 0; i < chunkCount; i++)
+	{
+		if (pp_chunks[i])	memset(pp_chunks[i], 0, CHUNK * SECTOR);
+	}
+}
+
+static void _diskFree(void)
+{
+	size_t i;
+
+	for (i = 0; i < chunkCount; i++)	free(pp_chunks[i]);
+	free(pp_chunks);
+}
+
+static void _diskReadSectors(BYTE *buff, LBA_t sector, UINT count)
+{
+	for (; count; count--, sector++, buff += SECTOR)
+	{
+		if (pp_chunks[sector / CHUNK])
+		{
+			memcpy(buff, &pp_chunks[sector / CHUNK][(sector % CHUNK) * SECTOR], SECTOR);
+		}
+		else
+		{
+			memset(buff, 0, SECTOR);
+		}
+	}
+}
+
+/* Zero if written, one if out of memory */
+static uint8_t _diskWriteSectors(const BYTE *buff, LBA_t sector, UINT count)
+{
+	uint8_t **pp_c;
+
+	for (; count; count--, sector++, buff += SECTOR)
+	{
+		pp_c = &pp_chunks[sector / CHUNK];
+		if (!*pp_c)
+		{
+			if (!memcmp(buff, u8a_zero, SECTOR))	continue;
+			*pp_c = calloc(CHUNK, SECTOR);
+			if (!*pp_c)	return 1;
+		}
+		memcpy(&(*pp_c)[(sector % CHUNK) * SECTOR], buff, SECTOR);
+	}
+	return 0;
+}
+
+DSTATUS disk_status(BYTE pdrv)
+{
+	return pdrv ? STA_NOINIT : 0;
+}
+
+DSTATUS disk_initialize(BYTE pdrv)
+{
+	return disk_status(pdrv);
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
+{
+	if (pdrv || (sector >= diskSectors) || (count > diskSectors - sector))	return RES_PARERR;
+	_diskReadSectors(buff, sector, count);
+	b_writeOpen = 0;
+	cnt.readCmds++;
+	cnt.readSectors += count;
+	cnt.diskNs += cmdNs + count * sectorNs;
+	return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count)
+{
+	if (pdrv || (sector >= diskSectors) || (count > diskSectors - sector))	return RES_PARERR;
+	if (_diskWriteSectors(buff, sector, count))	return RES_ERROR;
+	cnt.writeSectors += count;
+	if ( (sector >= hintStart) && (sector + count <= hintEnd) )
+	{
+		/* Pre-erased, and no new command if the open write goes on here */
+		if (!b_writeOpen || (sector != openNext))
+		{
+			cnt.writeCmds++;
+			cnt.diskNs += cmdNs;
+		}
+		cnt.diskNs += count * (sectorNs - eraseNs);
+		b_writeOpen = 1;
+		openNext = sector + count;
+		return RES_OK;
+	}
+	b_writeOpen = 0;
+	cnt.writeCmds++;
+	cnt.diskNs += cmdNs + count * sectorNs;
+	return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+	if (pdrv)	return RES_PARERR;
+	switch (cmd)
+	{
+		case CTRL_SYNC:
+			b_writeOpen = 0;
+			cnt.diskSyncs++;
+			cnt.diskNs += syncNs;
+			return RES_OK;
+		case FM_CTRL_WRITE_HINT:
+			/* Erase start, end and erase, then waiting for it like for a sync */
+			hintStart = ((LBA_t*)buff)[0];
+			hintEnd = hintStart + ((LBA_t*)buff)[1];
+			b_writeOpen = 0;
+			cnt.hints++;
+			cnt.diskNs += 3 * cmdNs + syncNs;
+			return RES_OK;
+		case GET_SECTOR_COUNT:	*(LBA_t*)buff = diskSectors;	return RES_OK;
+		case GET_SECTOR_SIZE:	*(WORD*)buff = SECTOR;			return RES_OK;
+		case GET_BLOCK_SIZE:	*(DWORD*)buff = 1;				return RES_OK;
+		default:				return RES_PARERR;
+	}
+}
+
+DWORD get_fattime(void)
+{
+	/* 18.10.2026 00:00:00 */
+	return ((DWORD)(2026 - 1980) << 25) | ((DWORD)10 << 21) | ((DWORD)18 << 16);
+}
+
+/* The library waits with this, nothing to wait for here */
+void _delay_ms(double __ms)
+{
+	(void)__ms;
+}
+
+/* ----- Benchmark ----- */
+
+static uint64_t _cpuNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+  * @brief Content of the packet at the offset, different for every packet
+  */
+static void _fillPacket(uint8_t *p_buf, FSIZE_t offset, uint32_t u32_len)
+{
+	uint32_t i;
+
+	for (i = 0; i < u32_len; i++)
+	{
+		p_buf[i] = (uint8_t)((offset + i) * 7 + ((offset + i) >> 9));
+	}
+}
+
+/**
+  * @brief Formats the disk and creates the file
+  *
+  * @param u8_format	FM_ANY, FM_FAT32 or FM_EXFAT
+  * @return				Zero if successful
+  */
+static uint8_t _prepare(FATFS *p_fs, FIL *p_file, BYTE u8_format)
+{
+	static uint8_t u8a_work[4 * SECTOR];
+#ifdef FM_MKFS_PARM
+	MKFS_PARM opt = {FM_ANY, 0, 0, 0, 0};
+
+	opt.fmt = u8_format;
+	opt.au_size = clusterSize;
+	if (f_mkfs("", &opt, u8a_work, sizeof(u8a_work)) != FR_OK)	return 1;
+#else
+	if (f_mkfs("", u8_format, clusterSize, u8a_work, sizeof(u8a_work)) != FR_OK)	return 1;
+#endif
+	if (f_mount(p_fs, "", 1) != FR_OK)	return 1;
+	return (f_open(p_file, "bench.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK);
+}
+
+/**
+  * @brief Checks the file written against the packets
+  *
+  * @return		Zero if the file is complete
+  */
+static uint8_t _verify(void)
+{
+	static uint8_t u8a_got[SECTOR * 16], u8a_exp[SECTOR * 16];
+	FIL file;
+	FSIZE_t offset = 0;
+	UINT br;
+
+	if (f_open(&file, "bench.bin", FA_READ) != FR_OK)	return 1;
+	if (f_size(&file) != fileSize)
+	{
+		f_close(&file);
+		return 1;
+	}
+	do{
+		if (f_read(&file, u8a_got, sizeof(u8a_got), &br) != FR_OK)	break;
+		_fillPacket(u8a_exp, offset, br);
+		if (memcmp(u8a_got, u8a_exp, br))	break;
+		offset += br;
+	}while (br);
+	f_close(&file);
+	return (offset != fileSize);
+}
+
+/**
+  * @brief Writes the file with a strategy, like a receiver would
+  */
+static void _runStrategy(const struct strategy *p_st, struct run *p_r)
+{
+	static uint8_t u8a_packet[65535];
+	static uint8_t u8a_sinkBuf[65535];
+	static uint8_t *p_schedBuf;
+	static struct fm_sched sched;
+	struct fm_session session;
+	struct fm_sink sink;
+	struct fm_fanout fanout;
+	uint8_t b_fanout = p_st->bufSize || p_st->syncEvery;
+	FATFS fs;
+	FIL file;
+	FSIZE_t offset;
+	uint32_t u32_len;
+	uint64_t start;
+	uint8_t b_failed = 0;
+
+	memset(p_r, 0, sizeof(*p_r));
+	_diskClear();
+	hintStart = hintEnd = 0;
+	b_writeOpen = 0;
+	if (_prepare(&fs, &file, FM_ANY))
+	{
+		p_r->b_failed = 1;
+		return;
+	}
+	if (p_st->schedSize && !p_schedBuf)	p_schedBuf = malloc(p_st->schedSize);
+
+	memset(&cnt, 0, sizeof(cnt));
+	start = _cpuNs();
+
+	/* Allocate the clusters up front */
+	if (p_st->prealloc == PRE_LSEEK)
+	{
+		b_failed |= (cnt_f_lseek(&file, fileSize) != FR_OK) || (f_tell(&file) != fileSize);
+		b_failed |= (cnt_f_lseek(&file, 0) != FR_OK);
+	}
+#if FF_USE_EXPAND
+	else if (p_st->prealloc == PRE_EXPAND)
+	{
+		cnt.others++;
+		b_failed |= (f_expand(&file, fileSize, 1) != FR_OK);
+	}
+	else if (p_st->prealloc >= PRE_EXPECT)
+	{
+		/* Like a Kermit sender announcing the size, or more than it sends */
+		cnt.others++;
+		file_modem_expect(&file, (p_st->prealloc == PRE_EXPECT) ? fileSize : fileSize + (fileSize >> 2));
+		b_failed |= (f_size(&file) == 0) || !cnt.hints;
+	}
+#endif
+
+	if (p_st->schedSize)
+	{
+		fm_sched_init(&sched, p_st->schedSize, NULL, NULL, NULL, NULL);
+		fm_sched_open(&session, &file, p_schedBuf, p_st->schedSize, 1);
+	}
+	if (b_fanout)
+	{
+		fm_sink_file(&sink, &file, u8a_sinkBuf, p_st->bufSize, p_st->syncEvery);
+		fm_fanout_open(&fanout, &file, &sink, 1, FM_FANOUT_ALL);
+	}
+
+	/* The packets, as they come from the receiver */
+	for (offset = 0; (offset < fileSize) && !b_failed; offset += u32_len)
+	{
+		u32_len = (fileSize - offset < packetSize) ? (uint32_t)(fileSize - offset) : packetSize;
+		_fillPacket(u8a_packet, offset, u32_len);
+		b_failed |= _fm_write(&file, u8a_packet, (uint16_t)u32_len);
+	}
+
+	/* End of the transfer */
+	b_failed |= _fm_sync(&file);
+	if (b_fanout)			b_failed |= fm_fanout_close(&fanout);
+	if (p_st->schedSize)	b_failed |= fm_sched_close(&session);
+	if (p_st->prealloc == PRE_LSEEK)
+	{
+		/* Cut off what was allocated too much, if anything */
+		cnt.others++;
+		b_failed |= (f_truncate(&file) != FR_OK) || _fm_sync(&file);
+	}
+	b_failed |= (f_close(&file) != FR_OK);
+
+	p_r->cpuNs = _cpuNs() - start;
+	p_r->cnt = cnt;
+	p_r->b_failed = b_failed || _verify();
+	f_mount(NULL, "", 0);
+}
+
+#if defined(XMODEM_FILL_EXT) && FF_FS_EXFAT
+/* ----- Files beyond 4 GiB (-g): X-Modem sender in the process ----- */
+
+static uint8_t u8a_xpkt[PCK_1K + 5];
+static uint16_t xpktLen, xpktPos;	// Packet the receiver reads next, Bytes of it read
+static FSIZE_t xAcked;				// File Bytes in the packets acknowledged so far
+static FSIZE_t xCur;				// File Bytes the current packet stands for
+static uint8_t xBlock;
+static uint8_t b_xStarted, b_xEot;
+
+static uint16_t _crc16(const uint8_t *p_buf, uint16_t u16_len)
+{
+	uint16_t crc = 0;
+	uint8_t i;
+
+	while (u16_len--)
+	{
+		crc ^= (uint16_t)*p_buf++ << 8;
+		for (i = 0; i < 8; i++)	crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+/**
+  * @brief Content of the packet at the start of every MiB: its offset,
+  *        followed by the usual pattern
+  */
+static void _markPacket(uint8_t *p_buf, FSIZE_t offset)
+{
+	uint8_t i;
+
+	_fillPacket(p_buf, offset, PCK_1K);
+	for (i = 0; i < 8; i++)	p_buf[i] = (uint8_t)((uint64_t)offset >> (8 * i));
+}
+
+/**
+  * @brief Builds the packet following xAcked: the offset packet at the start
+  *        of a MiB, a fill record up to the next one, or EOT at the end
+  */
+static void _xNext(void)
+{
+	uint32_t u32_run;
+	uint16_t crc, u16_len;
+
+	xpktPos = 0;
+	if (xAcked >= fileSize)
+	{
+		u8a_xpkt[0] = EOT;
+		xpktLen = 1;
+		b_xEot = 1;
+		return;
+	}
+	xBlock++;
+	u8a_xpkt[1] = xBlock;
+	u8a_xpkt[2] = (uint8_t)~xBlock;
+	if (xAcked % LARGE_STEP == 0)
+	{
+		u8a_xpkt[0] = STX;
+		_markPacket(&u8a_xpkt[3], xAcked);
+		xCur = u16_len = PCK_1K;
+	}
+	else
+	{
+		u32_run = LARGE_STEP - (uint32_t)(xAcked % LARGE_STEP);
+		if (u32_run > fileSize - xAcked)	u32_run = (uint32_t)(fileSize - xAcked);
+		u8a_xpkt[0] = FILL;
+		u8a_xpkt[3] = (uint8_t)(u32_run >> 24);
+		u8a_xpkt[4] = (uint8_t)(u32_run >> 16);
+		u8a_xpkt[5] = (uint8_t)(u32_run >> 8);
+		u8a_xpkt[6] = (uint8_t)u32_run;
+		u8a_xpkt[7] = 0;
+		xCur = u32_run;
+		u16_len = 5;
+	}
+	crc = _crc16(&u8a_xpkt[3], u16_len);
+	u8a_xpkt[3 + u16_len] = (uint8_t)(crc >> 8);
+	u8a_xpkt[4 + u16_len] = (uint8_t)crc;
+	xpktLen = u16_len + 5;
+}
+
+/* The receiver's answer: Fill records asked for, the packet acknowledged or asked for again */
+static void _xSendByte(uint8_t u8_ch)
+{
+	if (!b_xStarted)
+	{
+		/* Without fill records it would be -m MiB of 1k packets, not what -g is about */
+		if (u8_ch != FILLREQ)	return;
+		b_xStarted = 1;
+		_xNext();
+	}
+	else if (u8_ch == ACK)
+	{
+		if (b_xEot)
+		{
+			xpktLen = xpktPos = 0;
+			return;
+		}
+		xAcked += xCur;
+		_xNext();
+	}
+	else if (u8_ch == NAK)
+	{
+		xpktPos = 0;
+	}
+	else if (u8_ch == CAN)
+	{
+		xpktLen = xpktPos = 0;
+		b_xEot = 1;
+	}
+}
+
+/* Nothing waiting is a timeout right away, time doesn't matter here */
+static uint8_t _xRecByte(uint8_t *p_ch, uint16_t u16_timeout)
+{
+	(void)u16_timeout;
+	if (xpktPos >= xpktLen)	return 1;
+	*p_ch = u8a_xpkt[xpktPos++];
+	return 0;
+}
+
+static void _xFlushRx(void)
+{
+	xpktPos = xpktLen;
+}
+
+/**
+  * @brief Checks the file received with -g: the offset packet at the start
+  *        of every MiB and zeros in between
+  *
+  * @return		Zero if the file is complete
+  */
+static uint8_t _verifyLarge(void)
+{
+	static uint8_t u8a_got[LARGE_STEP], u8a_exp[PCK_1K];
+	FIL file;
+	FSIZE_t offset = 0;
+	UINT br;
+	uint32_t i;
+
+	if (f_open(&file, "bench.bin", FA_READ) != FR_OK)	return 1;
+	if (f_size(&file) != fileSize)
+	{
+		f_close(&file);
+		return 1;
+	}
+	do{
+		if (f_read(&file, u8a_got, sizeof(u8a_got), &br) != FR_OK)	break;
+		_markPacket(u8a_exp, offset);
+		if (memcmp(u8a_got, u8a_exp, (br < PCK_1K) ? br : PCK_1K))	break;
+		for (i = PCK_1K; (i < br) && !u8a_got[i]; i++);
+		if (i < br)	break;
+		offset += br;
+	}while (br);
+	f_close(&file);
+	return (offset != fileSize);
+}
+
+/**
+  * @brief Receives the file of -g on a volume of the format
+  *
+  * @param p_size	Size of the file afterwards
+  * @param p_intact	One if the file arrived complete
+  * @param p_ns		CPU time of the transfer
+  * @return			Result of xmodem_receive(), FM_DISK_FULL if the volume
+  *					couldn't be set up
+  */
+static enum file_modem _runLarge(BYTE u8_format, FSIZE_t *p_size, uint8_t *p_intact, uint64_t *p_ns)
+{
+	FATFS fs;
+	FIL file;
+	FSIZE_t maxSize = fileSize + PCK_1K;
+	enum file_modem result;
+	uint64_t start;
+
+	*p_size = 0;
+	*p_intact = 0;
+	_diskClear();
+	hintStart = hintEnd = 0;
+	b_writeOpen = 0;
+	if (_prepare(&fs, &file, u8_format))	return FM_DISK_FULL;
+
+	xpktLen = xpktPos = 0;
+	xAcked = xCur = 0;
+	xBlock = 0;
+	b_xStarted = b_xEot = 0;
+	file_modem_init(_xRecByte, _xSendByte, _xFlushRx);
+	start = _cpuNs();
+	result = xmodem_receive(&file, &maxSize);
+	*p_ns = _cpuNs() - start;
+	*p_size = f_size(&file);
+	f_close(&file);
+	if (result == FM_OK)	*p_intact = !_verifyLarge();
+	f_mount(NULL, "", 0);
+	return result;
+}
+
+/**
+  * @brief Files beyond 4 GiB: The file has to arrive on exFAT and, if it
+  *        is larger than FAT32 allows, be refused there
+  *
+  * @return		Zero if both went as they should
+  */
+static uint8_t _large(void)
+{
+	static const char *const resultNames[] = {"OK", "INVALID_START", "TIMEOUT", "ABORTED", "-", "DISK_FULL",
+		"SIZE_EXCEEDED"};
+	static const struct {
+		const char *p_name;
+		BYTE u8_format;
+		uint8_t b_fits;			// The file fits the format
+	} formats[] = {
+		{"exFAT",	FM_EXFAT,	1},
+		{"FAT32",	FM_FAT32,	0},
+	};
+	enum file_modem result, expected;
+	FSIZE_t size;
+	uint64_t ns;
+	uint8_t b_intact, b_failed = 0, b_ok;
+	size_t i;
+
+	printf("%llu Bytes with X-Modem, a 1k packet and a fill record of zeros per MiB:\n",
+		(unsigned long long)fileSize);
+	printf("%-8s %-14s %12s %-7s %9s  %s\n", "Volume", "Result", "File", "Data", "CPU [s]", "Expected");
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+	{
+		expected = (formats[i].b_fits || (fileSize <= 0xFFFFFFFFUL)) ? FM_OK : FM_SIZE_EXCEEDED;
+		result = _runLarge(formats[i].u8_format, &size, &b_intact, &ns);
+		b_ok = (result == expected) && ((result != FM_OK) || b_intact);
+		printf("%-8s %-14s %12llu %-7s %9.2f  %s%s\n", formats[i].p_name, resultNames[result],
+			(unsigned long long)size, (result != FM_OK) ? "-" : (b_intact ? "intact" : "BAD"), ns / 1e9,
+			resultNames[expected], b_ok ? "" : ", FAILED");
+		b_failed |= !b_ok;
+	}
+	return b_failed;
+}
+#endif
+
+static void _usage(const char *p_name)
+{
+	printf("Usage: %s [options]\n"
+		"  -p Bytes     Packet size, as the receiver writes them (1024)\n"
+		"  -m MiB       File size (8)\n"
+		"  -d MiB       Disk size (64)\n"
+		"  -a Bytes     Cluster size, 0 for the FatFs default (0)\n"
+		"  -l us        Latency disk: time per command (250)\n"
+		"  -s us        Latency disk: time per sector (520)\n"
+		"  -y us        Latency disk: time per CTRL_SYNC (1000)\n"
+		"  -e us        Latency disk: time per sector saved by pre-erasing (150)\n"
+		"  -r runs      Runs per strategy, the CPU time is the lowest of them (3)\n"
+		"  -g           Instead of the strategies: receive a file of -m MiB with X-Modem fill\n"
+		"               records on exFAT and FAT32, e.g. -g -m 8192 -d 10496\n", p_name);
+}
+
+int main(int argc, char **argv)
+{
+	const struct strategy *p_st;
+	struct run best = {0}, r;
+	uint32_t runs = 3, u32_run;
+	double mb, ramMBs, latMBs;
+	uint8_t b_failed = 0, b_large = 0;
+	int opt;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "p:m:d:a:l:s:y:e:r:gh")) != -1)
+	{
+		switch (opt)
+		{
+			case 'p':	packetSize = strtoul(optarg, NULL, 0);				break;
+			case 'm':	fileSize = strtoull(optarg, NULL, 0) << 20;			break;
+			case 'd':	diskSize = strtoul(optarg, NULL, 0);				break;
+			case 'a':	clusterSize = strtoul(optarg, NULL, 0);				break;
+			case 'l':	cmdNs = strtoull(optarg, NULL, 0) * 1000;			break;
+			case 's':	sectorNs = strtoull(optarg, NULL, 0) * 1000;		break;
+			case 'y':	syncNs = strtoull(optarg, NULL, 0) * 1000;			break;
+			case 'e':	eraseNs = strtoull(optarg, NULL, 0) * 1000;			break;
+			case 'r':	runs = strtoul(optarg, NULL, 0);					break;
+			case 'g':	b_large = 1;										break;
+			default:
+				_usage(argv[0]);
+				return 1;
+		}
+	}
+	if (!packetSize || (packetSize > 65535) || !fileSize || !diskSize || !runs || (eraseNs > sectorNs))
+	{
+		_usage(argv[0]);
+		return 1;
+	}
+	if ( (fileSize > (FSIZE_t)-1) || ((uint64_t)diskSize << 20 < fileSize + (fileSize >> 2) + (1UL << 20)) )
+	{
+		printf("The file doesn't fit on the disk\n");
+		return 1;
+	}
+	diskSectors = (LBA_t)(((uint64_t)diskSize << 20) / SECTOR);
+	chunkCount = ((size_t)diskSectors + CHUNK - 1) / CHUNK;
+	pp_chunks = calloc(chunkCount, sizeof(*pp_chunks));
+	if (!pp_chunks)
+	{
+		printf("No memory for the RAM disk\n");
+		return 1;
+	}
+
+	if (b_large)
+	{
+#if defined(XMODEM_FILL_EXT) && FF_FS_EXFAT
+		b_failed = _large();
+#else
+		printf("-g needs the library with XMODEM_FILL_EXT and FatFs with FF_FS_EXFAT\n");
+		b_failed = 1;
+#endif
+		_diskFree();
+		return b_failed;
+	}
+
+	mb = fileSize / 1e6;
+	printf("%llu Bytes in packets of %lu Bytes, per MB:\n", (unsigned long long)fileSize, (unsigned long)packetSize);
+	printf("%-26s %9s %9s %8s %8s %8s %8s %8s %8s %8s\n", "Strategy", "RAM MB/s", "Lat MB/s",
+		"f_write", "f_sync", "other", "rd cmd", "wr cmd", "wr sect", "ctrlsync");
+	for (i = 0; i < sizeof(_strategies) / sizeof(_strategies[0]); i++)
+	{
+		p_st = &_strategies[i];
+
+		/* Same work every run, the lowest CPU time is the least disturbed one */
+		for (u32_run = 0; u32_run < runs; u32_run++)
+		{
+			_runStrategy(p_st, &r);
+			if (!u32_run || (r.cpuNs < best.cpuNs))	best = r;
+		}
+
+		printf("%-26s ", p_st->p_name);
+		if (best.b_failed)
+		{
+			printf("FAILED\n");
+			b_failed = 1;
+			continue;
+		}
+		ramMBs = fileSize / (best.cpuNs / 1e9) / 1e6;
+		latMBs = fileSize / ((best.cpuNs + best.cnt.diskNs) / 1e9) / 1e6;
+		printf("%9.1f %9.2f %8.1f %8.1f %8.1f %8.1f %8.1f %8.0f %8.1f\n", ramMBs, latMBs,
+			best.cnt.writes / mb, best.cnt.syncs / mb, best.cnt.others / mb,
+			best.cnt.readCmds / mb, best.cnt.writeCmds / mb, best.cnt.writeSectors / mb, best.cnt.diskSyncs / mb);
+	}
+	_diskFree();
+	return b_failed;
+}
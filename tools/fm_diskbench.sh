@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+# fm_diskbench.sh
+#
+# Builds tools/fm_diskbench.c together with the library and FatFs for the
+# host and runs it. The FatFs sources are copied, ffconf.h gets the options
+# the benchmark needs (f_mkfs, f_expand, exFAT with long file names, no RTOS,
+# no multi partition). The library is compiled with f_write, f_sync and
+# f_lseek renamed to the counting wrappers of fm_diskbench, and with the fill
+# records for -g.
+#
+# Usage:	FATFS_DIR=path/to/fatfs/source tools/fm_diskbench.sh [fm_diskbench options]
+# Env:		CC (gcc), CFLAGS (-O2)
+#
+# Created: 18.10.2026 21:58:44
+#  Author: gfcwfzkm
+#
+
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+
+SRC_DIR=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ -z "$FATFS_DIR" ] || [ ! -f "$FATFS_DIR/ff.c" ] || [ ! -f "$FATFS_DIR/diskio.h" ]; then
+	echo "FATFS_DIR has to point to the directory holding ff.c, ff.h, ffconf.h and diskio.h" >&2
+	exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/fatfs" "$WORK/util"
+cp "$FATFS_DIR"/*.c "$FATFS_DIR"/*.h "$WORK/fatfs/" || exit 1
+rm -f "$WORK/fatfs/diskio.c"
+sed -e 's/^\(#define[ 	]*FF_USE_MKFS[ 	]*\)[0-9]*/\11/' \
+	-e 's/^\(#define[ 	]*FF_USE_EXPAND[ 	]*\)[0-9]*/\11/' \
+	-e 's/^\(#define[ 	]*FF_FS_EXFAT[ 	]*\)[0-9]*/\11/' \
+	-e 's/^\(#define[ 	]*FF_USE_LFN[ 	]*\)0/\11/' \
+	-e 's/^\(#define[ 	]*FF_FS_READONLY[ 	]*\)[0-9]*/\10/' \
+	-e 's/^\(#define[ 	]*FF_FS_MINIMIZE[ 	]*\)[0-9]*/\10/' \
+	-e 's/^\(#define[ 	]*FF_FS_REENTRANT[ 	]*\)[0-9]*/\10/' \
+	-e 's/^\(#define[ 	]*FF_MULTI_PARTITION[ 	]*\)[0-9]*/\10/' \
+	"$FATFS_DIR/ffconf.h" > "$WORK/fatfs/ffconf.h" || exit 1
+echo "void _delay_ms(double __ms);" > "$WORK/util/delay.h"
+
+# f_mkfs takes a MKFS_PARM since R0.14, sectors are LBA_t since R0.14
+BENCH_DEFS="-DXMODEM_FILL_EXT"
+grep -q "MKFS_PARM" "$WORK/fatfs/ff.h" && BENCH_DEFS="$BENCH_DEFS -DFM_MKFS_PARM"
+grep -q "LBA_t" "$WORK/fatfs/ff.h" || { BENCH_DEFS="$BENCH_DEFS -DLBA_t=DWORD"; COUNT_LBA="-DLBA_t=DWORD"; }
+COUNT_DEFS="-Df_write=cnt_f_write -Df_sync=cnt_f_sync -Df_lseek=cnt_f_lseek -DXMODEM_FILL_EXT $COUNT_LBA"
+INC="-I$WORK -I$SRC_DIR -I$WORK/fatfs"
+
+for f in "$WORK"/fatfs/*.c; do
+	"$CC" $CFLAGS $INC -c "$f" -o "$WORK/ff_$(basename "$f" .c).o" || exit 1
+done
+for f in "$SRC_DIR"/*.c; do
+	"$CC" $CFLAGS $COUNT_DEFS $INC -c "$f" -o "$WORK/fm_$(basename "$f" .c).o" || exit 1
+done
+"$CC" $CFLAGS $BENCH_DEFS $INC -c "$SRC_DIR/tools/fm_diskbench.c" -o "$WORK/fm_diskbench.o" || exit 1
+"$CC" $CFLAGS -o "$WORK/fm_diskbench" "$WORK"/*.o || exit 1
+"$WORK/fm_diskbench" "$@"
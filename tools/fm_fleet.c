@@ -0,0 +1,2196 @@
+/*
+ * fm_fleet.c
+ *
+ * Load generator: Runs many device sessions at once against a host end and
+ * reports how the host copes as the amount of sessions grows. Every device
+ * is a process of its own running the library (its state is global, one
+ * session per process), sending a file with xmodem_send_memory() (-d up) or
+ * receiving one with xmodem_receive() (-d down), with nmodem_receive() for
+ * -p nmodem (-P: after measuring the link with nmodem_probe()) or with
+ * kermit_receive() for -p kermit. The host end of a session is, depending on
+ * the link:
+ *   pty		A pseudo terminal, the host end is another process running the
+ *				library, or the command given with -x (the host transfer service
+ *				under test) with the terminal as stdin and stdout
+ *   socket		A socket pair, host end as with pty
+ *   inproc		A link in memory, the host end is a small X-Modem sender or
+ *				receiver, an N-Modem or a Kermit sender inside the device process. No
+ *				system calls on the link, which leaves the CPU time of the
+ *				library
+ * The command of -x runs in a directory of its own per session, the file is
+ * called "data" there (e.g. -x "rx -c data" for -d up).
+ *
+ * Link model, for every direction the tool sends: -b baud rate (character
+ * time, the line holds one Byte at a time), -l latency, -e rate of damaged
+ * Bytes, -S rate of stalls (the line stops for -L ms, what is sent meanwhile
+ * arrives afterwards). A command of -x sends without the model.
+ *
+ * For every session count of -n all sessions start at the same time. It
+ * reports the aggregate throughput of the data that arrived intact, the
+ * percentiles of the transfer times and of the response times (from the
+ * last Byte a device handed to the link until the first Byte of the answer
+ * arrived), and the CPU time of the devices and the host ends, also as a
+ * share of all CPUs over the time the pass took.
+ *
+ * -V runs inproc on a virtual clock instead: the link becomes a discrete
+ * event simulation, every wait of a device (timeouts of recByte, the pause
+ * through file_modem_delay(), a full line) jumps straight to the next Byte
+ * arriving, the timer of the built-in host or the end of the wait. Hours of
+ * transfers with damage, stalls and timeouts take seconds, and the same seed
+ * gives the same results, down to the digest over all records of a pass. A
+ * session that failed can then be run on its own with -r, -k lists its
+ * Bytes and events on the virtual clock.
+ *
+ * Runs on Linux, linked with the library. FatFs is replaced by a file in
+ * memory. Thousands of sessions need as many processes (twice with a host
+ * process) and pseudo terminals, see ulimit -u and /proc/sys/kernel/pty/max.
+ *
+ * Build:	tools/fm_fleet.sh, or by hand with ff.h and a util/delay.h declaring
+ *			_delay_ms() in the include path:
+ *			gcc -O2 -Ishim -Ifatfs -I. -o fm_fleet tools/fm_fleet.c *.c
+ * Usage:	fm_fleet [options], see _usage() or run with -h
+ *
+ * Created: 19.10.2026 13:17:42
+ *  Author: gfcwfzkm
+ */
+
+#define _GNU_SOURCE
+
+#include "file_modem_int.h"
+#include "diskio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define NEVER		UINT64_MAX
+#define QUEUE_SIZ	16384	// Bytes on their way in one direction, a full N-Modem window and more
+#define HIST_SUB	8		// Buckets per power of two of the histograms
+#define HIST_BUCKETS	(HIST_SUB * 30)
+#define HOST_POKE	1000000	// Built-in host: Time between two pokes of the receiver, us
+#define HOST_WAIT	10000000	// Built-in host: Time without an answer before it repeats, us
+#define HOST_TRIES	10		// Built-in host: Repetitions before it gives up
+#define HOST_RTO	500000	// Built-in N-Modem sender: Time for an Ack beside the link model, us
+#define NM_HEAD		5		// N-Modem: Type and Offset of a frame
+#define NM_FRAME	(NM_HEAD + NMODEM_PACKET + 4)	// N-Modem: Largest frame with its CRC, before COBS
+#define K_WINDOW	31		// Kermit: Window the built-in sender offers
+#define K_MAXLX		1024	// Kermit: Long packet length it offers
+#define K_PACKET	(K_MAXLX + 10)	// Kermit: Largest packet, mark to end of line
+#define K_MINDATA	90		// Kermit: Shortest data field the sender shrinks to
+#define TOCHAR(x)	((uint8_t)((x) + 32))
+#define UNCHAR(x)	((uint8_t)((x) - 32))
+#define SLACK		1000	// Bytes due within this time are handled together, see _slack(), us
+#define LINGER		2000000	// Time an end waits for the other one to close the link, us
+#define SUB			0x1A	// Padding of the last packet
+#define VIRTUAL_START	1000000	// -V: Virtual clock at the start of a session, us (not zero, see lastSendUs)
+#define TRACE_BYTES	16		// -k: Bytes per line
+
+enum transport {T_PTY, T_SOCKET, T_INPROC};
+static const char *const _transportNames[] = {"pty", "socket", "inproc"};
+
+enum protocol {P_XMODEM, P_NMODEM, P_KERMIT};
+static const char *const _protocolNames[] = {"xmodem", "nmodem", "kermit"};
+
+/* Kermit: Packet the built-in sender sends next */
+enum kermitNext {KN_FILE, KN_ATTR, KN_DATA, KN_EOF, KN_DISCARD, KN_BREAK, KN_NONE};
+
+enum role {ROLE_DEVICE, ROLE_HOST};
+static const char *const _roleNames[] = {"device", "host"};
+static const char *const _resultNames[] = {"OK", "INVALID_START", "TIMEOUT", "ABORTED", "-", "DISK_FULL",
+	"SIZE_EXCEEDED"};
+
+/* What a process of a session reports, written to the result pipe in one
+ * piece (below PIPE_BUF, so the records of the processes don't mix) */
+struct result {
+	uint32_t session;
+	uint8_t role;
+	uint8_t result;			// enum file_modem, FM_OK for a command of -x that exited with 0
+	uint8_t b_judged;		// Received the file and compared it
+	uint8_t b_intact;
+	uint64_t bytes;			// File data sent or received
+	uint64_t startUs;		// Monotonic clock
+	uint64_t endUs;
+	uint64_t cpuUs;
+	uint32_t retries;		// Packets asked for again, by the receiving end
+	uint32_t timeouts;		// Timeouts while waiting for a packet, by the receiving end
+	uint32_t latency[HIST_BUCKETS];	// Response times, see _histIndex()
+};
+
+/* Bytes on their way in one direction, each with the time it arrives */
+struct queue {
+	uint8_t data[QUEUE_SIZ];
+	uint64_t due[QUEUE_SIZ];
+	uint32_t head, tail;
+	uint64_t lineFree;		// The line is busy with the previous Byte until then
+	uint32_t stallSeed;
+};
+
+/* Built-in end of the host for the in-process link: X-Modem both ways, an
+ * N-Modem or a Kermit sender */
+struct hostEnd {
+	uint8_t pkt[PCK_1K + 5];
+	uint16_t pktLen, pktNeed;
+	uint8_t block;			// Next block to receive or the one being sent
+	uint8_t b_started, b_done, b_crc, tries;
+	uint8_t *p_buf;			// Receiving: The file so far
+	size_t len;
+	size_t pos, cur;		// Sending: Offset and payload of the packet in flight, cur zero for EOT
+	uint64_t timerAt;
+	uint32_t retries, timeouts;
+	enum file_modem result;
+
+	/* N-Modem sender */
+	uint8_t frame[NMODEM_PACKET + 64];	// COBS encoded frame until its delimiter
+	uint16_t frameLen;
+	uint8_t b_running, b_endSent;
+	uint8_t window;
+	uint16_t packet;
+	size_t base, next;		// Everything below base arrived, next is the first packet never sent
+	uint32_t acked;			// Packets beyond base the receiver has, from its last Ack
+	uint64_t arriveAt[32];	// When the last copy of a packet arrives, by packet number % 32
+	uint64_t rtoUs, progressAt;
+
+	/* Kermit sender, the window and the timer as with N-Modem */
+	uint8_t kpkt[32][K_PACKET];	// Packets in the window as sent, by sequence number % 32
+	uint16_t kpktLen[32];
+	uint64_t kacked;		// Bit n: packet with sequence number n got its Ack
+	uint8_t lowSeq, nextSeq;	// Lowest packet without Ack, next one to send
+	uint8_t chkt, rept;
+	uint16_t kdata;			// Data field length for new packets, shrinks with damage
+	uint8_t kclean;			// Acks without a repetition since kdata changed
+	enum kermitNext knext;
+	size_t dataPos;			// File data put into packets so far
+};
+
+/* Options */
+static enum transport transport = T_PTY;
+static enum protocol protocol = P_XMODEM;
+static uint8_t b_up = 1;
+static uint32_t fileSize = 65536;
+static uint32_t baud = 115200;
+static uint32_t latencyUs;
+static double damageRate;
+static double stallRate;
+static uint64_t stallUs = 5000000;
+static const char *p_hostCmd;
+static uint32_t seed = 1;
+static uint8_t b_verbose;
+static uint8_t b_virtual;
+static uint8_t b_trace;
+static uint8_t b_probe;
+static uint32_t sessionBase;		// -r: Number of the only session
+
+/* Link of this process */
+static uint64_t charUs;				// Character time of the model, zero for no limit
+static int linkFd = -1;
+static uint8_t b_linkDead;
+static struct queue txq;			// Bytes this process sends, for inproc the device's
+static struct queue rxq;			// inproc only: Bytes of the built-in host to the device
+static uint8_t u8a_rx[4096];
+static size_t rxPos, rxLen;
+static uint32_t damageSeed;
+static struct hostEnd host;
+static const uint8_t *p_sendData;	// File the built-in host sends
+static uint64_t virtualUs = VIRTUAL_START;
+
+/* -k: Bytes arriving, one line per direction and TRACE_BYTES */
+static struct {
+	char line[32 + 3 * TRACE_BYTES];
+	uint8_t b_toDevice, count;
+} trace;
+
+/* Session of this process */
+static struct result res;
+static uint64_t lastSendUs;			// Last Byte handed to the link, zero once answered
+static uint8_t *p_got;
+static size_t gotSize, gotCap;
+
+/* --- Time and statistics --- */
+
+static uint64_t _realUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Clock of the link and the sessions, virtual with -V */
+static uint64_t _nowUs(void)
+{
+	return b_virtual ? virtualUs : _realUs();
+}
+
+/* Bytes due within this time are handled together. Saves wake-ups, which
+ * the virtual clock doesn't have */
+static uint64_t _slack(void)
+{
+	return b_virtual ? 0 : SLACK;
+}
+
+static uint64_t _cpuUs(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/**
+  * @brief Histogram bucket of a time: HIST_SUB buckets per power of two,
+  *        i.e. at most 1/HIST_SUB off
+  */
+static uint16_t _histIndex(uint64_t u64_us)
+{
+	uint16_t u16_exp = 0;
+
+	if (u64_us < HIST_SUB)	return (uint16_t)u64_us;
+	while ((u64_us >> u16_exp) >= 2 * HIST_SUB)	u16_exp++;
+	if (HIST_SUB * (u16_exp + 1) + (u64_us >> u16_exp) - HIST_SUB >= HIST_BUCKETS)	return HIST_BUCKETS - 1;
+	return (uint16_t)(HIST_SUB * (u16_exp + 1) + (u64_us >> u16_exp) - HIST_SUB);
+}
+
+/* Lowest time of a bucket */
+static uint64_t _histValue(uint16_t u16_idx)
+{
+	if (u16_idx < HIST_SUB)	return u16_idx;
+	return (uint64_t)(u16_idx % HIST_SUB + HIST_SUB) << (u16_idx / HIST_SUB - 1);
+}
+
+/**
+  * @brief Time below which the given share of the histogram lies, in us
+  *        (middle of the bucket)
+  */
+static uint64_t _histPercentile(const uint64_t *p_hist, double share)
+{
+	uint64_t u64_total = 0, u64_sum = 0;
+	uint16_t i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)	u64_total += p_hist[i];
+	if (!u64_total)	return 0;
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		u64_sum += p_hist[i];
+		if (u64_sum >= share * u64_total)	break;
+	}
+	if (i >= HIST_BUCKETS - 1)	return _histValue(HIST_BUCKETS - 1);
+	/* Middle of the bucket */
+	return (_histValue(i) + _histValue(i + 1)) / 2;
+}
+
+/* Percentile of the transfer times, not beyond the longest one */
+static uint64_t _percentileUpTo(const uint64_t *p_hist, double share, uint64_t u64_max)
+{
+	uint64_t u64_us = _histPercentile(p_hist, share);
+
+	return (u64_us > u64_max) ? u64_max : u64_us;
+}
+
+/* --- Trace (-k) --- */
+
+static void _traceFlush(void)
+{
+	if (trace.count)	printf("%s\n", trace.line);
+	trace.count = 0;
+}
+
+/**
+  * @brief Lists a Byte that arrived, at the time of the session
+  */
+static void _traceByte(uint8_t b_toDevice, uint8_t u8_ch)
+{
+	size_t len;
+
+	if (!b_trace)	return;
+	if ( trace.count && ((trace.b_toDevice != b_toDevice) || (trace.count == TRACE_BYTES)) )	_traceFlush();
+	if (!trace.count)
+	{
+		snprintf(trace.line, sizeof(trace.line), "%12.6f %s", (_nowUs() - res.startUs) / 1e6,
+			b_toDevice ? "host > dev" : "dev > host");
+		trace.b_toDevice = b_toDevice;
+	}
+	len = strlen(trace.line);
+	snprintf(&trace.line[len], sizeof(trace.line) - len, " %02X", u8_ch);
+	trace.count++;
+}
+
+/**
+  * @brief Lists something that happened between the Bytes
+  */
+static void _traceEvent(const char *p_what)
+{
+	if (!b_trace)	return;
+	_traceFlush();
+	printf("%12.6f %s\n", (_nowUs() - res.startUs) / 1e6, p_what);
+}
+
+/* --- Link model --- */
+
+/**
+  * @brief Draws if the line stalls before the next Byte, from the state of its queue
+  */
+static uint8_t _stall(struct queue *p_q)
+{
+	p_q->stallSeed = p_q->stallSeed * 1103515245UL + 12345;
+	return (p_q->stallSeed >> 8) % 1000000 < (uint32_t)(stallRate * 1000000);
+}
+
+static uint8_t _damage(uint8_t u8_ch)
+{
+	damageSeed = damageSeed * 1103515245UL + 12345;
+	if ( (damageSeed >> 8) % 1000000 >= (uint32_t)(damageRate * 1000000) )	return u8_ch;
+	return u8_ch ^ (uint8_t)(1 << ((damageSeed >> 4) & 7));
+}
+
+static uint8_t _queueEmpty(const struct queue *p_q)
+{
+	return p_q->head == p_q->tail;
+}
+
+static uint8_t _queueFull(const struct queue *p_q)
+{
+	return p_q->tail - p_q->head == QUEUE_SIZ;
+}
+
+/* Arrival of the next Byte, NEVER if there is none */
+static uint64_t _queueDue(const struct queue *p_q)
+{
+	return _queueEmpty(p_q) ? NEVER : p_q->due[p_q->head % QUEUE_SIZ];
+}
+
+static uint8_t _queuePop(struct queue *p_q)
+{
+	return p_q->data[p_q->head++ % QUEUE_SIZ];
+}
+
+/**
+  * @brief Puts a Byte on the line: damaged at the rate of -e, after the
+  *        previous one at the baud rate (and a stall at the rate of -S),
+  *        arriving after the latency
+  */
+static void _queuePush(struct queue *p_q, uint8_t u8_ch)
+{
+	uint64_t now = _nowUs();
+
+	if (p_q->lineFree < now)	p_q->lineFree = now;
+	if ( (stallRate > 0) && _stall(p_q) )
+	{
+		p_q->lineFree += stallUs;
+		_traceEvent((p_q == &txq) ? "stall dev > host" : "stall host > dev");
+	}
+	p_q->lineFree += charUs;
+	p_q->data[p_q->tail % QUEUE_SIZ] = (damageRate > 0) ? _damage(u8_ch) : u8_ch;
+	p_q->due[p_q->tail % QUEUE_SIZ] = p_q->lineFree + latencyUs;
+	p_q->tail++;
+}
+
+/* --- Built-in host end (inproc) --- */
+
+static uint16_t _crc16(const uint8_t *p_buf, uint16_t u16_len)
+{
+	uint16_t crc = 0;
+	uint8_t i;
+
+	while (u16_len--)
+	{
+		crc ^= (uint16_t)*p_buf++ << 8;
+		for (i = 0; i < 8; i++)	crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+static void _hostSend(uint8_t u8_ch)
+{
+	if (!_queueFull(&rxq))	_queuePush(&rxq, u8_ch);
+}
+
+/**
+  * @brief Sends the packet at host.pos, or EOT after the last one
+  */
+static void _hostSendPacket(const uint8_t *p_data)
+{
+	uint16_t u16_size = host.b_crc ? PCK_1K : PCK_SIZ, u16_crc, i;
+	uint8_t u8_sum = 0;
+
+	host.timerAt = _nowUs() + HOST_WAIT;
+	if (host.pos >= fileSize)
+	{
+		host.cur = 0;
+		_hostSend(0x04);
+		return;
+	}
+	host.cur = (fileSize - host.pos < u16_size) ? fileSize - host.pos : u16_size;
+	host.pkt[0] = host.b_crc ? 0x02 : 0x01;
+	host.pkt[1] = host.block;
+	host.pkt[2] = (uint8_t)~host.block;
+	memcpy(&host.pkt[3], &p_data[host.pos], host.cur);
+	memset(&host.pkt[3 + host.cur], SUB, u16_size - host.cur);
+	for (i = 0; i < 3 + u16_size; i++)	_hostSend(host.pkt[i]);
+	if (host.b_crc)
+	{
+		u16_crc = _crc16(&host.pkt[3], u16_size);
+		_hostSend((uint8_t)(u16_crc >> 8));
+		_hostSend((uint8_t)u16_crc);
+	}
+	else
+	{
+		for (i = 0; i < u16_size; i++)	u8_sum += host.pkt[3 + i];
+		_hostSend(u8_sum);
+	}
+}
+
+static void _put32(uint8_t *p_buf, uint32_t u32_val)
+{
+	p_buf[0] = (uint8_t)u32_val;
+	p_buf[1] = (uint8_t)(u32_val >> 8);
+	p_buf[2] = (uint8_t)(u32_val >> 16);
+	p_buf[3] = (uint8_t)(u32_val >> 24);
+}
+
+static uint32_t _get32(const uint8_t *p_buf)
+{
+	return (uint32_t)p_buf[0] | ((uint32_t)p_buf[1] << 8) | ((uint32_t)p_buf[2] << 16) | ((uint32_t)p_buf[3] << 24);
+}
+
+/**
+  * @brief Sends an N-Modem frame: CRC-32 behind it, COBS encoded and delimited
+  */
+static void _nhostSendFrame(const uint8_t *p_frame, uint16_t u16_len)
+{
+	uint8_t u8a_buf[NM_FRAME];
+	uint32_t crc = 0xFFFFFFFFUL;
+	uint16_t i, run, n;
+
+	memcpy(u8a_buf, p_frame, u16_len);
+	for (i = 0; i < u16_len; i++)	crc = _crc32_update(crc, u8a_buf[i]);
+	_put32(&u8a_buf[u16_len], ~crc);
+	u16_len += 4;
+
+	/* Blocks of up to 254 non-zero Bytes, each standing for a zero behind it
+	 * unless it is full. The scanning kernel finds the next zero, the same as
+	 * in the receiver's _nm_sendFrame */
+	for (i = 0; ; )
+	{
+		run = _fm_span(&u8a_buf[i], (u16_len - i > 254) ? 254 : u16_len - i, 0, 0, 0);
+		_hostSend((uint8_t)(run + 1));
+		for (n = 0; n < run; n++)	_hostSend(u8a_buf[i++]);
+		if (i == u16_len)	break;
+		/* Skip the zero the block stands for */
+		if (run < 254)	i++;
+	}
+	_hostSend(0);
+}
+
+/**
+  * @brief Sends the N-Modem Data frame at the offset
+  */
+static void _nhostSendData(const uint8_t *p_data, size_t offset)
+{
+	uint8_t u8a_frame[NM_HEAD + NMODEM_PACKET];
+	uint16_t u16_len = (fileSize - offset < host.packet) ? (uint16_t)(fileSize - offset) : host.packet;
+
+	u8a_frame[0] = 'D';
+	_put32(&u8a_frame[1], (uint32_t)offset);
+	memcpy(&u8a_frame[NM_HEAD], &p_data[offset], u16_len);
+	_nhostSendFrame(u8a_frame, NM_HEAD + u16_len);
+	/* The time for the Ack counts from the arrival, not from queueing it up */
+	host.arriveAt[(offset / host.packet) % 32] = rxq.due[(rxq.tail - 1) % QUEUE_SIZ];
+}
+
+static void _nhostSendEnd(void)
+{
+	uint8_t u8a_frame[NM_HEAD];
+
+	u8a_frame[0] = 'E';
+	_put32(&u8a_frame[1], fileSize);
+	_nhostSendFrame(u8a_frame, NM_HEAD);
+	host.b_endSent = 1;
+}
+
+/**
+  * @brief Repeats the packets the receiver lacks while a later one got
+  *        through. The link keeps the order, they are lost.
+  */
+static void _nhostRepeatLost(const uint8_t *p_data)
+{
+	size_t offset;
+	uint64_t latest;
+	uint8_t u8_highest, u8_slot;
+
+	if (!host.acked)	return;
+	for (u8_highest = 31; !(host.acked & (1UL << u8_highest)); u8_highest--);
+	latest = host.arriveAt[(host.base / host.packet + u8_highest) % 32];
+	for (offset = host.base, u8_slot = 0; u8_slot < u8_highest; offset += host.packet, u8_slot++)
+	{
+		/* Not if the last copy went out after the one that got through */
+		if ( !(host.acked & (1UL << u8_slot)) && (host.arriveAt[(offset / host.packet) % 32] < latest) )
+		{
+			_nhostSendData(p_data, offset);
+			host.retries++;
+		}
+	}
+}
+
+/**
+  * @brief A frame of the device arrived at the built-in N-Modem sender
+  */
+static void _nhostFrame(const uint8_t *p_data, const uint8_t *p_frame, uint16_t u16_len)
+{
+	uint8_t u8a_setup[9];
+	uint32_t u32_offset;
+	uint16_t u16_packet;
+
+	switch (p_frame[0])
+	{
+		case 'S':
+			/* Answered again while our answer is on its way or got lost */
+			if ( (u16_len < 9) || (p_frame[1] != 1) || host.b_running )	return;
+			u16_packet = p_frame[3] | ((uint16_t)p_frame[4] << 8);
+			host.window = (p_frame[2] < NMODEM_WINDOW) ? p_frame[2] : NMODEM_WINDOW;
+			host.packet = (u16_packet < NMODEM_PACKET) ? u16_packet : NMODEM_PACKET;
+			u32_offset = _get32(&p_frame[5]);
+			if (!host.window || !host.packet || (u32_offset > fileSize))	return;
+			host.base = host.next = u32_offset;
+			/* The round trip of an Ack on the link model */
+			host.rtoUs = 2 * latencyUs + 64 * charUs + HOST_RTO;
+			memcpy(u8a_setup, p_frame, 9);
+			u8a_setup[2] = host.window;
+			u8a_setup[3] = (uint8_t)host.packet;
+			u8a_setup[4] = (uint8_t)(host.packet >> 8);
+			_nhostSendFrame(u8a_setup, 9);
+			host.b_started = 1;
+			host.progressAt = _nowUs();
+			host.timerAt = host.progressAt + HOST_WAIT;
+			return;
+		case 'A':
+			if ( (u16_len < 9) || !host.b_started )	return;
+			/* The first one confirms our Setup and starts the transfer */
+			if (!host.b_running)
+			{
+				host.b_running = 1;
+				host.timerAt = _nowUs() + host.rtoUs;
+			}
+			u32_offset = _get32(&p_frame[1]);
+			if ( (u32_offset < host.base) || (u32_offset > host.next) )	return;
+			if (u32_offset > host.base)
+			{
+				host.base = u32_offset;
+				host.progressAt = _nowUs();
+			}
+			host.acked = _get32(&p_frame[5]);
+			_nhostRepeatLost(p_data);
+			if (host.base == fileSize)
+			{
+				/* The End, and again for every Ack after we took it as done: the
+				 * receiver lost it and still waits */
+				if (host.b_endSent && !host.b_done)
+				{
+					host.b_done = 1;
+					host.result = FM_OK;
+					host.timerAt = NEVER;
+				}
+				else
+				{
+					_nhostSendEnd();
+				}
+				return;
+			}
+			/* New packets as far as the window reaches */
+			while ( (host.next < fileSize) && (host.next < host.base + (size_t)host.window * host.packet) )
+			{
+				_nhostSendData(p_data, host.next);
+				host.next += host.packet;
+			}
+			if (host.next > fileSize)	host.next = fileSize;
+			return;
+		case 'X':
+			host.b_done = 1;
+			host.result = FM_ABORTED;
+			host.timerAt = NEVER;
+			return;
+		case 'P':
+			/* Back unchanged, see nmodem_probe() */
+			_nhostSendFrame(p_frame, u16_len);
+			return;
+	}
+}
+
+/**
+  * @brief A Byte of the device arrived at the built-in N-Modem sender
+  */
+static void _nhostByte(const uint8_t *p_data, uint8_t u8_ch)
+{
+	uint8_t u8a_frame[NM_FRAME];
+	uint32_t crc = 0xFFFFFFFFUL;
+	uint16_t i, len = 0;
+	uint8_t u8_code;
+
+	if (u8_ch)
+	{
+		/* Too long for a frame, dropped at the delimiter */
+		if (host.frameLen < sizeof(host.frame))	host.frame[host.frameLen] = u8_ch;
+		if (host.frameLen < UINT16_MAX)	host.frameLen++;
+		return;
+	}
+	if (!host.frameLen || (host.frameLen > sizeof(host.frame)))
+	{
+		host.frameLen = 0;
+		return;
+	}
+
+	/* COBS decoding, every block but a full one stands for a zero behind it */
+	for (i = 0; i < host.frameLen; )
+	{
+		u8_code = host.frame[i++];
+		if ( (i + u8_code - 1 > host.frameLen) || ((size_t)len + u8_code - 1 > sizeof(u8a_frame)) )
+		{
+			host.frameLen = 0;
+			return;
+		}
+		memcpy(&u8a_frame[len], &host.frame[i], u8_code - 1);
+		len += u8_code - 1;
+		i += u8_code - 1;
+		if ( (u8_code < 0xFF) && (i < host.frameLen) )
+		{
+			if (len == sizeof(u8a_frame))
+			{
+				host.frameLen = 0;
+				return;
+			}
+			u8a_frame[len++] = 0;
+		}
+	}
+	host.frameLen = 0;
+	if (len <= 4)	return;
+	len -= 4;
+	for (i = 0; i < len; i++)	crc = _crc32_update(crc, u8a_frame[i]);
+	if (~crc != _get32(&u8a_frame[len]))	return;
+	_nhostFrame(p_data, u8a_frame, len);
+}
+
+/**
+  * @brief The timer of the built-in N-Modem sender expired: repeats what
+  *        should have been acknowledged by now
+  */
+static void _nhostTimer(const uint8_t *p_data)
+{
+	uint64_t now = _nowUs();
+	size_t offset;
+	uint32_t u32_slot;
+	uint8_t b_repeated = 0;
+
+	if (host.b_done)
+	{
+		host.timerAt = NEVER;
+		return;
+	}
+	if (now - host.progressAt > (uint64_t)HOST_TRIES * HOST_WAIT)
+	{
+		host.b_done = 1;
+		host.result = host.b_running ? FM_TIMEOUT : FM_INVALID_START;
+		host.timerAt = NEVER;
+		return;
+	}
+	host.timerAt = now + (host.b_running ? host.rtoUs : HOST_WAIT);
+	if (!host.b_running)	return;
+
+	for (offset = host.base, u32_slot = 0; offset < host.next; offset += host.packet, u32_slot++)
+	{
+		if ( !(host.acked & (1UL << u32_slot)) && (host.arriveAt[(offset / host.packet) % 32] + host.rtoUs <= now) )
+		{
+			_nhostSendData(p_data, offset);
+			host.retries++;
+			b_repeated = 1;
+		}
+	}
+	if (host.b_endSent)
+	{
+		_nhostSendEnd();
+		b_repeated = 1;
+	}
+	if (b_repeated)
+	{
+		host.timeouts++;
+		_traceEvent("host timeout");
+	}
+}
+
+/**
+  * @brief Kermit block check over the characters, type 1 to 3
+  *
+  * @return		Amount of check characters
+  */
+static uint8_t _khostCheck(const uint8_t *p_buf, uint16_t u16_len, uint8_t u8_chkt, uint8_t *p_out)
+{
+	uint16_t u16_sum = 0, i;
+	uint8_t j;
+
+	for (i = 0; i < u16_len; i++)
+	{
+		if (u8_chkt != 3)
+		{
+			u16_sum += p_buf[i];
+			continue;
+		}
+		/* CRC-CCITT, reflected and starting at zero */
+		u16_sum ^= p_buf[i];
+		for (j = 0; j < 8; j++)	u16_sum = (u16_sum & 1) ? (u16_sum >> 1) ^ 0x8408 : u16_sum >> 1;
+	}
+	switch (u8_chkt)
+	{
+		case 2:
+			p_out[0] = TOCHAR((u16_sum >> 6) & 0x3F);
+			p_out[1] = TOCHAR(u16_sum & 0x3F);
+			return 2;
+		case 3:
+			p_out[0] = TOCHAR((u16_sum >> 12) & 0x0F);
+			p_out[1] = TOCHAR((u16_sum >> 6) & 0x3F);
+			p_out[2] = TOCHAR(u16_sum & 0x3F);
+			return 3;
+	}
+	p_out[0] = TOCHAR((u16_sum + ((u16_sum & 0xC0) >> 6)) & 0x3F);
+	return 1;
+}
+
+/**
+  * @brief Builds a Kermit packet into its window slot and sends it. Long
+  *        packets if it doesn't fit into a normal one.
+  */
+static void _khostSendPacket(uint8_t u8_seq, uint8_t u8_type, const uint8_t *p_data, uint16_t u16_len)
+{
+	uint8_t *p_pkt = host.kpkt[u8_seq % 32];
+	uint8_t u8_chkt = host.b_running ? host.chkt : 1;
+	uint16_t n = 0, i;
+
+	p_pkt[n++] = 0x01;
+	if (u16_len + 2 + u8_chkt <= 94)
+	{
+		p_pkt[n++] = TOCHAR(u16_len + 2 + u8_chkt);
+		p_pkt[n++] = TOCHAR(u8_seq);
+		p_pkt[n++] = u8_type;
+	}
+	else
+	{
+		p_pkt[n++] = TOCHAR(0);
+		p_pkt[n++] = TOCHAR(u8_seq);
+		p_pkt[n++] = u8_type;
+		p_pkt[n++] = TOCHAR((u16_len + u8_chkt) / 95);
+		p_pkt[n++] = TOCHAR((u16_len + u8_chkt) % 95);
+		n += _khostCheck(&p_pkt[1], 5, 1, &p_pkt[n]);
+	}
+	memcpy(&p_pkt[n], p_data, u16_len);
+	n += u16_len;
+	n += _khostCheck(&p_pkt[1], n - 1, u8_chkt, &p_pkt[n]);
+	p_pkt[n++] = '\r';
+	host.kpktLen[u8_seq % 32] = n;
+	for (i = 0; i < n; i++)	_hostSend(p_pkt[i]);
+	host.arriveAt[u8_seq % 32] = rxq.due[(rxq.tail - 1) % QUEUE_SIZ];
+}
+
+/* Sends a packet of the window again, as it was. New packets get half as
+ * long, like C-Kermit does on a noisy line */
+static void _khostResend(uint8_t u8_seq)
+{
+	uint16_t i;
+
+	host.kdata /= 2;
+	if (host.kdata < K_MINDATA)	host.kdata = K_MINDATA;
+	host.kclean = 0;
+
+	for (i = 0; i < host.kpktLen[u8_seq % 32]; i++)	_hostSend(host.kpkt[u8_seq % 32][i]);
+	host.arriveAt[u8_seq % 32] = rxq.due[(rxq.tail - 1) % QUEUE_SIZ];
+	host.retries++;
+}
+
+/**
+  * @brief Sends the Send-Init: long packets, sliding windows, attributes,
+  *        CRC and repeat counts, control prefixing only (the link is 8-bit)
+  */
+static void _khostSendInit(void)
+{
+	const uint8_t u8a_init[13] = {TOCHAR(94), TOCHAR(HOST_WAIT / 1000000), TOCHAR(0), 0x40, TOCHAR('\r'), '#',
+		'Y', '3', '~', TOCHAR(0x02 | 0x04 | 0x08), TOCHAR(K_WINDOW), TOCHAR(K_MAXLX / 95), TOCHAR(K_MAXLX % 95)};
+
+	_khostSendPacket(0, 'S', u8a_init, sizeof(u8a_init));
+}
+
+/**
+  * @brief Takes the parameters of the receiver's Ack to the Send-Init
+  */
+static void _khostInitReply(const uint8_t *p_data, uint16_t u16_len)
+{
+	uint16_t u16_pos = 10, u16_maxl;
+	uint8_t u8_caps = (u16_len > 9) ? UNCHAR(p_data[9]) : 0;
+
+	/* Both asked for the CRC, or the single character check */
+	host.chkt = ( (u16_len > 7) && (p_data[7] == '3') ) ? 3 : 1;
+	host.rept = ( (u16_len > 8) && (p_data[8] == '~') ) ? '~' : 0;
+	while ( (u16_pos < u16_len) && (UNCHAR(p_data[u16_pos - 1]) & 0x01) )	u16_pos++;
+	host.window = 1;
+	if ( (u8_caps & 0x04) && (u16_len > u16_pos) && UNCHAR(p_data[u16_pos]) )
+	{
+		host.window = UNCHAR(p_data[u16_pos]);
+		if (host.window > K_WINDOW)	host.window = K_WINDOW;
+	}
+	u16_maxl = (u16_len > 0) ? UNCHAR(p_data[0]) : 80;
+	if ( (u8_caps & 0x02) && (u16_len > u16_pos + 2) )
+	{
+		u16_maxl = UNCHAR(p_data[u16_pos + 1]) * 95 + UNCHAR(p_data[u16_pos + 2]);
+		if (u16_maxl > K_MAXLX)	u16_maxl = K_MAXLX;
+	}
+	/* Room for the data field, beside sequence number, type, long header and check */
+	host.packet = u16_maxl - 5 - host.chkt;
+	host.kdata = host.packet;
+	host.kclean = 0;
+}
+
+/**
+  * @brief Encodes file data into the data field of a Kermit packet
+  *
+  * @return		Length of the data field
+  */
+static uint16_t _khostEncode(const uint8_t *p_data, uint8_t *p_out)
+{
+	uint8_t u8a_ch[2], u8_ch, u8_ch7, u8_enc;
+	uint16_t n = 0, u16_need;
+	size_t run;
+
+	while (host.dataPos < fileSize)
+	{
+		u8_ch = p_data[host.dataPos];
+		u8_ch7 = u8_ch & 0x7F;
+		u8_enc = 1;
+		if ( (u8_ch7 < 32) || (u8_ch7 == 127) )
+		{
+			u8a_ch[0] = '#';
+			u8a_ch[1] = u8_ch ^ 64;
+			u8_enc = 2;
+		}
+		else if ( (u8_ch7 == '#') || (host.rept && (u8_ch7 == host.rept)) )
+		{
+			u8a_ch[0] = '#';
+			u8a_ch[1] = u8_ch;
+			u8_enc = 2;
+		}
+		else
+		{
+			u8a_ch[0] = u8_ch;
+		}
+		for (run = 1; (run < 94) && (host.dataPos + run < fileSize) && (p_data[host.dataPos + run] == u8_ch); run++);
+
+		/* A repeat count where it is shorter */
+		if ( host.rept && (run * u8_enc > 2u + u8_enc) )
+		{
+			u16_need = 2 + u8_enc;
+			if (n + u16_need > host.kdata)	break;
+			p_out[n++] = host.rept;
+			p_out[n++] = TOCHAR(run);
+		}
+		else
+		{
+			run = 1;
+			if (n + u8_enc > host.kdata)	break;
+		}
+		memcpy(&p_out[n], u8a_ch, u8_enc);
+		n += u8_enc;
+		host.dataPos += run;
+	}
+	return n;
+}
+
+/**
+  * @brief Sends new Kermit packets as far as the window reaches
+  */
+static void _khostFill(const uint8_t *p_data)
+{
+	uint8_t u8a_field[K_MAXLX];
+	uint16_t u16_len;
+
+	while ( (host.knext != KN_NONE) && (((host.nextSeq - host.lowSeq) & 63) < host.window) )
+	{
+		host.kacked &= ~(1ULL << host.nextSeq);
+		switch (host.knext)
+		{
+			case KN_FILE:
+				_khostSendPacket(host.nextSeq, 'F', (const uint8_t *)"DATA", 4);
+				host.knext = KN_ATTR;
+				break;
+			case KN_ATTR:
+				u16_len = (uint16_t)snprintf((char *)&u8a_field[2], sizeof(u8a_field) - 2, "%lu", (unsigned long)fileSize);
+				u8a_field[0] = '1';
+				u8a_field[1] = TOCHAR(u16_len);
+				_khostSendPacket(host.nextSeq, 'A', u8a_field, 2 + u16_len);
+				host.knext = KN_DATA;
+				break;
+			case KN_DATA:
+				u16_len = _khostEncode(p_data, u8a_field);
+				_khostSendPacket(host.nextSeq, 'D', u8a_field, u16_len);
+				if (host.dataPos >= fileSize)	host.knext = KN_EOF;
+				break;
+			case KN_EOF:
+			case KN_DISCARD:
+				_khostSendPacket(host.nextSeq, 'Z', (const uint8_t *)"D", (host.knext == KN_DISCARD) ? 1 : 0);
+				host.knext = KN_BREAK;
+				break;
+			default:
+				_khostSendPacket(host.nextSeq, 'B', NULL, 0);
+				host.knext = KN_NONE;
+				break;
+		}
+		host.nextSeq = (host.nextSeq + 1) & 63;
+	}
+}
+
+/**
+  * @brief A packet of the device arrived at the built-in Kermit sender
+  */
+static void _khostPacket(const uint8_t *p_data, const uint8_t *p_pkt, uint16_t u16_len)
+{
+	uint8_t u8a_chk[3], u8_chkt, u8_chkLen, u8_seq, u8_dist, u8_out;
+	uint16_t u16_data;
+
+	/* The Ack of the Send-Init and the NAKs before it have the single character check */
+	if ( (u16_len < 4) || (UNCHAR(p_pkt[0]) + 1 != u16_len) )	return;
+	u8_chkt = host.b_running ? host.chkt : 1;
+	if (u16_len < 3 + u8_chkt)	return;
+	u16_data = u16_len - 3 - u8_chkt;
+	u8_chkLen = _khostCheck(p_pkt, 3 + u16_data, u8_chkt, u8a_chk);
+	if (memcmp(u8a_chk, &p_pkt[3 + u16_data], u8_chkLen))	return;
+	u8_seq = UNCHAR(p_pkt[1]) & 63;
+
+	if (p_pkt[2] == 'E')
+	{
+		host.b_done = 1;
+		host.result = FM_ABORTED;
+		host.timerAt = NEVER;
+		return;
+	}
+	if (!host.b_running)
+	{
+		if (p_pkt[2] == 'N')	_khostSendInit();
+		if ( (p_pkt[2] != 'Y') || u8_seq )	return;
+		_khostInitReply(&p_pkt[3], u16_data);
+		host.b_running = 1;
+		host.lowSeq = host.nextSeq = 1;
+		host.progressAt = _nowUs();
+		host.timerAt = host.progressAt + host.rtoUs;
+		_khostFill(p_data);
+		return;
+	}
+
+	u8_out = (host.nextSeq - host.lowSeq) & 63;
+	u8_dist = (u8_seq - host.lowSeq) & 63;
+	if (p_pkt[2] == 'Y')
+	{
+		if (u8_dist >= u8_out)	return;
+		host.kacked |= 1ULL << u8_seq;
+		/* A window full without damage: twice as long again */
+		if ( (++host.kclean >= host.window) && (host.kdata < host.packet) )
+		{
+			host.kdata = (host.kdata > host.packet / 2) ? host.packet : 2 * host.kdata;
+			host.kclean = 0;
+		}
+		/* The receiver refused the file: The data in flight gets dropped, and
+		 * the file discarded instead of ended */
+		if ( (host.kpkt[u8_seq % 32][3] == 'A') && u16_data && (p_pkt[3] == 'N') && (host.knext <= KN_EOF) )
+		{
+			host.knext = KN_DISCARD;
+			host.result = FM_SIZE_EXCEEDED;
+		}
+	}
+	else if (p_pkt[2] == 'N')
+	{
+		/* A NAK of the next one to send acknowledges all before it */
+		if (u8_dist == u8_out)
+		{
+			while (host.lowSeq != host.nextSeq)
+			{
+				host.kacked |= 1ULL << host.lowSeq;
+				host.lowSeq = (host.lowSeq + 1) & 63;
+			}
+		}
+		else if ( (u8_dist < u8_out) && !(host.kacked & (1ULL << u8_seq)) )
+		{
+			_khostResend(u8_seq);
+		}
+	}
+	if (host.kacked & (1ULL << host.lowSeq))	host.progressAt = _nowUs();
+	while ( (host.lowSeq != host.nextSeq) && (host.kacked & (1ULL << host.lowSeq)) )
+	{
+		host.lowSeq = (host.lowSeq + 1) & 63;
+	}
+	if ( (host.knext == KN_NONE) && (host.lowSeq == host.nextSeq) )
+	{
+		/* The Break got its Ack */
+		host.b_done = 1;
+		if (host.result != FM_SIZE_EXCEEDED)	host.result = FM_OK;
+		host.timerAt = NEVER;
+		return;
+	}
+	_khostFill(p_data);
+}
+
+/**
+  * @brief A Byte of the device arrived at the built-in Kermit sender
+  */
+static void _khostByte(const uint8_t *p_data, uint8_t u8_ch)
+{
+	if (host.b_done)	return;
+	if (u8_ch == 0x01)
+	{
+		/* A mark starts over */
+		host.frameLen = 0;
+		host.pktLen = 1;
+		return;
+	}
+	if (!host.pktLen)	return;
+	if (u8_ch == '\r')
+	{
+		host.pktLen = 0;
+		_khostPacket(p_data, host.frame, host.frameLen);
+		return;
+	}
+	if (host.frameLen < sizeof(host.frame))	host.frame[host.frameLen++] = u8_ch;
+}
+
+/**
+  * @brief The timer of the built-in Kermit sender expired: the Send-Init
+  *        until it got its Ack, then the oldest packet without one
+  */
+static void _khostTimer(void)
+{
+	uint64_t now = _nowUs();
+
+	if (host.b_done)
+	{
+		host.timerAt = NEVER;
+		return;
+	}
+	if (!host.b_started)
+	{
+		host.b_started = 1;
+		host.progressAt = now;
+		host.rtoUs = 2 * latencyUs + 64 * charUs + HOST_RTO;
+	}
+	if (now - host.progressAt > (uint64_t)HOST_TRIES * HOST_WAIT)
+	{
+		host.b_done = 1;
+		host.result = host.b_running ? FM_TIMEOUT : FM_INVALID_START;
+		host.timerAt = NEVER;
+		return;
+	}
+	if (!host.b_running)
+	{
+		/* Long enough for the receiver to NAK on its own */
+		_khostSendInit();
+		host.timerAt = now + HOST_POKE + host.rtoUs;
+		return;
+	}
+	host.timerAt = now + host.rtoUs;
+	if ( (host.lowSeq != host.nextSeq) && (host.arriveAt[host.lowSeq % 32] + host.rtoUs <= now) )
+	{
+		_khostResend(host.lowSeq);
+		host.timeouts++;
+		_traceEvent("host timeout");
+	}
+}
+
+/**
+  * @brief A Byte of the device arrived at the built-in host
+  */
+static void _hostByte(const uint8_t *p_data, uint8_t u8_ch)
+{
+	uint16_t u16_size;
+
+	if (protocol == P_NMODEM)
+	{
+		_nhostByte(p_data, u8_ch);
+		return;
+	}
+	if (protocol == P_KERMIT)
+	{
+		_khostByte(p_data, u8_ch);
+		return;
+	}
+	if (host.b_done)	return;
+	if (!b_up)
+	{
+		/* Sending: Pokes start it, ACK moves on, anything else repeats. Until
+		 * the first packet got through, a poke may switch to checksum */
+		if ( (!host.b_started || (!host.pos && host.cur)) && ((u8_ch == 'C') || (u8_ch == 0x15)) )
+		{
+			host.b_started = 1;
+			host.b_crc = (u8_ch == 'C');
+		}
+		else if (!host.b_started)
+		{
+			return;
+		}
+		else if (u8_ch == 0x06)
+		{
+			if (!host.cur)
+			{
+				host.b_done = 1;
+				host.result = FM_OK;
+				host.timerAt = NEVER;
+				return;
+			}
+			host.pos += host.cur;
+			host.block++;
+			host.tries = 0;
+		}
+		else if (u8_ch == 0x18)
+		{
+			host.b_done = 1;
+			host.result = FM_ABORTED;
+			host.timerAt = NEVER;
+			return;
+		}
+		else
+		{
+			host.retries++;
+		}
+		_hostSendPacket(p_data);
+		return;
+	}
+
+	/* Receiving with CRC-16 and 1k packets */
+	host.timerAt = _nowUs() + HOST_WAIT;
+	if (!host.pktLen)
+	{
+		if (u8_ch == 0x04)
+		{
+			_hostSend(0x06);
+			host.b_done = 1;
+			host.result = FM_OK;
+			host.timerAt = NEVER;
+			return;
+		}
+		if ( (u8_ch != 0x01) && (u8_ch != 0x02) )	return;
+		host.b_started = 1;
+		host.pktNeed = (u8_ch == 0x02) ? PCK_1K + 5 : PCK_SIZ + 5;
+	}
+	host.pkt[host.pktLen++] = u8_ch;
+	if (host.pktLen < host.pktNeed)	return;
+
+	u16_size = host.pktNeed - 5;
+	host.pktLen = 0;
+	if ( ((host.pkt[1] ^ host.pkt[2]) != 0xFF) ||
+		(_crc16(&host.pkt[3], u16_size) != ((uint16_t)host.pkt[3 + u16_size] << 8 | host.pkt[4 + u16_size])) )
+	{
+		host.retries++;
+		_hostSend(0x15);
+		return;
+	}
+	if (host.pkt[1] == host.block)
+	{
+		if (host.len + u16_size > fileSize + PCK_1K)
+		{
+			host.b_done = 1;
+			host.result = FM_SIZE_EXCEEDED;
+			host.timerAt = NEVER;
+			_hostSend(0x18);
+			return;
+		}
+		memcpy(&host.p_buf[host.len], &host.pkt[3], u16_size);
+		host.len += u16_size;
+		host.block++;
+		host.tries = 0;
+	}
+	/* The previous one again if our ACK got lost */
+	_hostSend( (host.pkt[1] == (uint8_t)(host.block - 1)) ? 0x06 : 0x15 );
+}
+
+/**
+  * @brief The timer of the built-in host expired: poke, or repeat what is unanswered
+  */
+static void _hostTimer(const uint8_t *p_data)
+{
+	if (protocol == P_NMODEM)
+	{
+		_nhostTimer(p_data);
+		return;
+	}
+	if (protocol == P_KERMIT)
+	{
+		_khostTimer();
+		return;
+	}
+	if (host.b_done)
+	{
+		host.timerAt = NEVER;
+		return;
+	}
+	if (++host.tries > HOST_TRIES)
+	{
+		host.b_done = 1;
+		host.result = host.b_started ? FM_TIMEOUT : FM_INVALID_START;
+		host.timerAt = NEVER;
+		return;
+	}
+	if (host.b_started)
+	{
+		host.timeouts++;
+		_traceEvent("host timeout");
+	}
+	if (!b_up)
+	{
+		host.timerAt = NEVER;
+		if (host.b_started)	_hostSendPacket(p_data);
+		return;
+	}
+	host.pktLen = 0;
+	_hostSend(host.b_started ? 0x15 : 'C');
+	host.timerAt = _nowUs() + (host.b_started ? HOST_WAIT : HOST_POKE);
+}
+
+/* --- Event loop of a process --- */
+
+/**
+  * @brief Sends what is due of the queue to the link
+  */
+static void _flushDue(void)
+{
+	uint64_t now = _nowUs() + _slack();
+	uint8_t u8a_out[512];
+	size_t len;
+	ssize_t n;
+
+	if (b_linkDead)
+	{
+		txq.head = txq.tail;
+		return;
+	}
+	while (_queueDue(&txq) <= now)
+	{
+		/* Taken off the queue only once written */
+		for (len = 0; (len < sizeof(u8a_out)) && (txq.head + len != txq.tail) &&
+			(txq.due[(txq.head + len) % QUEUE_SIZ] <= now); len++)
+		{
+			u8a_out[len] = txq.data[(txq.head + len) % QUEUE_SIZ];
+		}
+		n = write(linkFd, u8a_out, len);
+		if (n < 0)
+		{
+			if (errno == EAGAIN)	return;
+			if (errno == EINTR)		continue;
+			b_linkDead = 1;
+			txq.head = txq.tail;
+			return;
+		}
+		txq.head += (uint32_t)n;
+		if ((size_t)n < len)	return;
+	}
+}
+
+/**
+  * @brief Runs the link until the deadline, or until a Byte for this process
+  *        is there if b_wantByte
+  *
+  * inproc delivers the Bytes of the device to the built-in host and runs its
+  * timer, the other links write due Bytes and read what arrived. Waiting on
+  * the virtual clock moves it to whatever comes next.
+  *
+  * @return		One if a Byte is there
+  */
+static uint8_t _run(uint64_t deadline, uint8_t b_wantByte)
+{
+	struct pollfd pfd;
+	struct timespec ts;
+	uint64_t now, wake;
+	ssize_t n;
+
+	for (;;)
+	{
+		now = _nowUs() + _slack();
+		if (transport == T_INPROC)
+		{
+			while (_queueDue(&txq) <= now)
+			{
+				_traceByte(0, txq.data[txq.head % QUEUE_SIZ]);
+				_hostByte(p_sendData, _queuePop(&txq));
+			}
+			if (host.timerAt <= now)		_hostTimer(p_sendData);
+			if (b_wantByte && (_queueDue(&rxq) <= now))	return 1;
+			if (now >= deadline)	return 0;
+
+			wake = deadline;
+			if (_queueDue(&txq) < wake)		wake = _queueDue(&txq);
+			if (host.timerAt < wake)		wake = host.timerAt;
+			if (b_wantByte && (_queueDue(&rxq) < wake))	wake = _queueDue(&rxq);
+			if (b_virtual)
+			{
+				virtualUs = wake;
+				continue;
+			}
+			ts.tv_sec = (time_t)((wake - now) / 1000000);
+			ts.tv_nsec = (long)((wake - now) % 1000000 * 1000);
+			nanosleep(&ts, NULL);
+			continue;
+		}
+
+		_flushDue();
+		if (b_wantByte && (rxPos < rxLen))	return 1;
+		now = _nowUs() + _slack();
+		if (now >= deadline)	return 0;
+
+		wake = deadline;
+		pfd.fd = linkFd;
+		/* A full buffer waits for the library to take from it */
+		pfd.events = (b_linkDead || (rxLen == sizeof(u8a_rx))) ? 0 : POLLIN;
+		if (!_queueEmpty(&txq))
+		{
+			if (_queueDue(&txq) > now)
+			{
+				if (_queueDue(&txq) < wake)	wake = _queueDue(&txq);
+			}
+			else
+			{
+				pfd.events |= POLLOUT;
+			}
+		}
+		ts.tv_sec = (time_t)((wake - now) / 1000000);
+		ts.tv_nsec = (long)((wake - now) % 1000000 * 1000);
+		if ( (ppoll(&pfd, 1, &ts, NULL) <= 0) || !pfd.events || !(pfd.revents & (POLLIN | POLLHUP | POLLERR)) )	continue;
+		if (rxPos == rxLen)	rxPos = rxLen = 0;
+		n = read(linkFd, &u8a_rx[rxLen], sizeof(u8a_rx) - rxLen);
+		if (n > 0)
+		{
+			rxLen += n;
+		}
+		else if ( (n == 0) || ((errno != EAGAIN) && (errno != EINTR)) )
+		{
+			/* The other end is gone, nothing more will arrive */
+			b_linkDead = 1;
+		}
+	}
+}
+
+static uint8_t _linkRecByte(uint8_t *p_ch, uint16_t u16_timeout)
+{
+	uint64_t now;
+
+	if (!_run(_nowUs() + (uint64_t)u16_timeout * 1000, 1))
+	{
+		_traceEvent("device timeout");
+		return 1;
+	}
+	*p_ch = (transport == T_INPROC) ? _queuePop(&rxq) : u8a_rx[rxPos++];
+	_traceByte(1, *p_ch);
+	if (lastSendUs)
+	{
+		now = _nowUs();
+		res.latency[_histIndex(now - lastSendUs)]++;
+		lastSendUs = 0;
+	}
+	return 0;
+}
+
+static void _linkSendByte(uint8_t u8_ch)
+{
+	/* Like a UART driver with a full buffer, wait until the line takes it */
+	while (_queueFull(&txq))	_run(_queueDue(&txq), 0);
+	_queuePush(&txq, u8_ch);
+	lastSendUs = _nowUs();
+}
+
+static void _linkFlushRx(void)
+{
+	uint64_t now;
+
+	_run(_nowUs(), 0);
+	if (transport == T_INPROC)
+	{
+		now = _nowUs() + _slack();
+		while (_queueDue(&rxq) <= now)	_queuePop(&rxq);
+		return;
+	}
+	rxPos = rxLen = 0;
+	while (!b_linkDead && (read(linkFd, u8a_rx, sizeof(u8a_rx)) > 0));
+}
+
+/* The pause of the library in one piece, see file_modem_delay() */
+static void _linkDelay(uint16_t u16_ms)
+{
+	_run(_nowUs() + (uint64_t)u16_ms * 1000, 0);
+}
+
+static uint32_t _linkMillis(void)
+{
+	return (uint32_t)(_nowUs() / 1000);
+}
+
+/* --- Shims --- */
+
+void _delay_ms(double ms)
+{
+	_run(_nowUs() + (uint64_t)(ms * 1000), 0);
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw)
+{
+	if (fp->fptr + btw > gotCap)
+	{
+		gotCap = (fp->fptr + btw) * 2;
+		p_got = realloc(p_got, gotCap);
+		if (!p_got)	return FR_INT_ERR;
+	}
+	memcpy(&p_got[fp->fptr], buff, btw);
+	fp->fptr += btw;
+	if (fp->fptr > gotSize)	gotSize = fp->fptr;
+	*bw = btw;
+	return FR_OK;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs)
+{
+	fp->fptr = ofs;
+	return FR_OK;
+}
+
+FRESULT f_sync(FIL *fp)
+{
+	(void)fp;
+	return FR_OK;
+}
+
+/* Only used by the sinks and the file size hints, none of them in here */
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br)
+{
+	(void)fp;
+	(void)buff;
+	(void)btr;
+	*br = 0;
+	return FR_OK;
+}
+
+FRESULT f_truncate(FIL *fp)
+{
+	(void)fp;
+	return FR_OK;
+}
+
+FRESULT f_expand(FIL *fp, FSIZE_t fsz, BYTE opt)
+{
+	(void)fp;
+	(void)fsz;
+	(void)opt;
+	return FR_DENIED;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+	(void)pdrv;
+	(void)cmd;
+	(void)buff;
+	return RES_PARERR;
+}
+
+/* --- Sessions --- */
+
+/**
+  * @brief File of a session, different for every session
+  */
+static uint8_t *_sessionData(uint32_t u32_session)
+{
+	uint8_t *p_data = malloc(fileSize ? fileSize : 1);
+	uint32_t u32_state = seed * 2654435761UL + u32_session, i;
+
+	for (i = 0; p_data && (i < fileSize); i++)
+	{
+		u32_state = u32_state * 1103515245UL + 12345;
+		p_data[i] = (uint8_t)(u32_state >> 16);
+	}
+	return p_data;
+}
+
+/**
+  * @brief Checks what the receiver got: the data, followed by SUB padding up
+  *        to the end of the last packet at most
+  */
+static uint8_t _intact(const uint8_t *p_data, size_t size, const uint8_t *p_recv, size_t recvSize)
+{
+	size_t i;
+
+	if ( (recvSize < size) || (recvSize - size >= PCK_1K) )	return 0;
+	if (memcmp(p_data, p_recv, size))	return 0;
+	for (i = size; i < recvSize; i++)
+	{
+		if (p_recv[i] != SUB)	return 0;
+	}
+	return 1;
+}
+
+/**
+  * @brief Waits until the parent lets all sessions of a pass start
+  */
+static void _awaitStart(int goFd)
+{
+	char c;
+
+	while ( (read(goFd, &c, 1) < 0) && (errno == EINTR) );
+	close(goFd);
+}
+
+/**
+  * @brief Runs one end of a session with the library, in a process of its own
+  *
+  * The device sends with b_up or receives, the host end the other way round.
+  * The built-in host of inproc runs inside the device.
+  */
+static void _runEnd(uint32_t u32_session, enum role role, int fd, int goFd, int resultFd)
+{
+	struct result r;
+	struct fm_stats stats;
+	char what[32];
+	FATFS fs;
+	FIL file;
+	FSIZE_t maxSize;
+	uint64_t deadline;
+	uint8_t *p_data = _sessionData(u32_session);
+	uint8_t b_send = (role == ROLE_DEVICE) == b_up;
+
+	memset(&res, 0, sizeof(res));
+	res.session = u32_session;
+	res.role = (uint8_t)role;
+	damageSeed = seed ^ (u32_session * 2 + role + 1) * 2654435761UL;
+	txq.stallSeed = damageSeed ^ 0x5A5A5A5AUL;
+	rxq.stallSeed = damageSeed ^ 0xA5A5A5A5UL;
+	linkFd = fd;
+	if (fd >= 0)	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	memset(&host, 0, sizeof(host));
+	host.block = 1;
+	host.timerAt = NEVER;
+	if (transport == T_INPROC)
+	{
+		p_sendData = p_data;
+		if (b_up)
+		{
+			host.p_buf = malloc(fileSize + 2 * PCK_1K);
+			host.timerAt = 0;
+		}
+		/* The Kermit sender starts on its own */
+		if (protocol == P_KERMIT)	host.timerAt = 0;
+	}
+	memset(&fs, 0, sizeof(fs));
+	memset(&file, 0, sizeof(file));
+	fs.fs_type = FS_FAT32;
+	file.obj.fs = &fs;
+	maxSize = (FSIZE_t)fileSize + 2 * PCK_1K;
+
+	file_modem_init(_linkRecByte, _linkSendByte, _linkFlushRx);
+	file_modem_delay(_linkDelay);
+	memset(&stats, 0, sizeof(stats));
+	file_modem_stats(&stats, _linkMillis);
+	_awaitStart(goFd);
+	res.startUs = _nowUs();
+	if (b_send)
+	{
+		res.result = xmodem_send_memory(p_data, fileSize);
+		res.bytes = fileSize;
+	}
+	else
+	{
+		/* The tuning stays the default if the sender doesn't answer */
+		if (b_probe)	nmodem_probe(NULL, _linkMillis);
+		switch (protocol)
+		{
+			case P_NMODEM:	res.result = nmodem_receive(&file, &maxSize);	break;
+			case P_KERMIT:	res.result = kermit_receive(&file, &maxSize);	break;
+			default:		res.result = xmodem_receive(&file, &maxSize);	break;
+		}
+		res.bytes = gotSize;
+		res.b_judged = 1;
+		res.b_intact = (res.result == FM_OK) && _intact(p_data, fileSize, p_got, gotSize);
+		res.retries = stats.retries;
+		res.timeouts = stats.timeouts;
+	}
+	/* What is still on its way, e.g. the last ACK */
+	while (!_queueEmpty(&txq) && !b_linkDead)	_run(_queueDue(&txq) + 1000, 0);
+	res.endUs = _nowUs();
+	res.cpuUs = _cpuUs();
+
+	/* Stays on the link until the other end is done with it, closing a
+	 * pseudo terminal may drop what the other end hasn't read yet */
+	for (deadline = res.endUs + LINGER; (linkFd >= 0) && !b_linkDead && (_nowUs() < deadline); rxPos = rxLen = 0)
+	{
+		_run(deadline, 1);
+	}
+
+	/* The built-in host reports on its own, without CPU time of its own */
+	if (transport == T_INPROC)
+	{
+		memset(&r, 0, sizeof(r));
+		r.session = u32_session;
+		r.role = ROLE_HOST;
+		r.result = host.b_done ? (uint8_t)host.result : FM_TIMEOUT;
+		r.startUs = res.startUs;
+		r.endUs = res.endUs;
+		r.retries = host.retries;
+		r.timeouts = host.timeouts;
+		if (b_up)
+		{
+			r.bytes = host.len;
+			r.b_judged = 1;
+			r.b_intact = (r.result == FM_OK) && _intact(p_data, fileSize, host.p_buf, host.len);
+		}
+		else
+		{
+			r.bytes = fileSize;
+		}
+		snprintf(what, sizeof(what), "host %s", _resultNames[r.result]);
+		_traceEvent(what);
+		if (write(resultFd, &r, sizeof(r)) < 0)	_exit(1);
+	}
+	snprintf(what, sizeof(what), "%s %s", _roleNames[role], _resultNames[res.result]);
+	_traceEvent(what);
+	fflush(stdout);
+	if (write(resultFd, &res, sizeof(res)) < 0)	_exit(1);
+	_exit(0);
+}
+
+/* A process of a pass, reaped by the parent */
+struct proc {
+	pid_t pid;
+	uint32_t session;
+	uint8_t b_command;		// Runs the command of -x, the parent reports for it
+	uint64_t startUs;
+};
+
+/**
+  * @brief Starts the command of -x as host end, in the directory of the session
+  */
+static pid_t _startCommand(uint32_t u32_session, const char *p_root, int fd, const char *p_slave, int devFd, const int *p_goPipe)
+{
+	char dir[256], path[300];
+	uint8_t *p_data;
+	FILE *fp;
+	pid_t pid;
+	int null;
+
+	snprintf(dir, sizeof(dir), "%s/s%lu", p_root, (unsigned long)u32_session);
+	if (mkdir(dir, 0700))	return -1;
+	if (!b_up)
+	{
+		/* The file the service sends to the device */
+		snprintf(path, sizeof(path), "%s/data", dir);
+		p_data = _sessionData(u32_session);
+		fp = fopen(path, "wb");
+		if ( !p_data || !fp || (fwrite(p_data, 1, fileSize, fp) != fileSize) )
+		{
+			if (fp)	fclose(fp);
+			free(p_data);
+			return -1;
+		}
+		fclose(fp);
+		free(p_data);
+	}
+
+	pid = fork();
+	if (pid)	return pid;
+
+	/* The pseudo terminal becomes its controlling terminal */
+	close(devFd);
+	close(p_goPipe[1]);
+	setsid();
+	if (p_slave)
+	{
+		close(fd);
+		fd = open(p_slave, O_RDWR);
+	}
+	_awaitStart(p_goPipe[0]);
+	if ( (fd >= 0) && !chdir(dir) )
+	{
+		dup2(fd, 0);
+		dup2(fd, 1);
+		if ((null = open("/dev/null", O_WRONLY)) >= 0)	dup2(null, 2);
+		execl("/bin/sh", "sh", "-c", p_hostCmd, (char *)NULL);
+	}
+	_exit(127);
+}
+
+/**
+  * @brief Result of a command of -x once it exited: compares the file it received
+  */
+static void _commandResult(const struct proc *p_p, int status, const struct rusage *p_ru, const char *p_root,
+	struct result *p_r)
+{
+	char path[300];
+	struct stat st;
+	uint8_t *p_data, *p_recv = NULL;
+	FILE *fp;
+
+	memset(p_r, 0, sizeof(*p_r));
+	p_r->session = p_p->session;
+	p_r->role = ROLE_HOST;
+	p_r->result = (WIFEXITED(status) && !WEXITSTATUS(status)) ? FM_OK : FM_ABORTED;
+	p_r->startUs = p_p->startUs;
+	p_r->endUs = _nowUs();
+	p_r->cpuUs = (uint64_t)(p_ru->ru_utime.tv_sec + p_ru->ru_stime.tv_sec) * 1000000 + p_ru->ru_utime.tv_usec +
+		p_ru->ru_stime.tv_usec;
+	p_r->bytes = fileSize;
+
+	snprintf(path, sizeof(path), "%s/s%lu/data", p_root, (unsigned long)p_p->session);
+	if (b_up)
+	{
+		p_r->b_judged = 1;
+		p_data = _sessionData(p_p->session);
+		fp = fopen(path, "rb");
+		if ( fp && !fstat(fileno(fp), &st) && (p_recv = malloc(st.st_size + 1)) )
+		{
+			p_r->bytes = fread(p_recv, 1, st.st_size, fp);
+			p_r->b_intact = p_data && _intact(p_data, fileSize, p_recv, p_r->bytes);
+		}
+		if (fp)	fclose(fp);
+		free(p_recv);
+		free(p_data);
+	}
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/s%lu", p_root, (unsigned long)p_p->session);
+	rmdir(path);
+}
+
+/**
+  * @brief Opens the link of a session: two file descriptors, the device's and the host's
+  *
+  * @return		Zero if successful
+  */
+static uint8_t _openLink(int *p_dev, int *p_host, char *p_slave, size_t slaveSize)
+{
+	struct termios tio;
+	int sv[2];
+
+	*p_dev = *p_host = -1;
+	if (transport == T_SOCKET)
+	{
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))	return 1;
+		*p_dev = sv[0];
+		*p_host = sv[1];
+		return 0;
+	}
+	if (transport == T_INPROC)	return 0;
+
+	*p_dev = posix_openpt(O_RDWR | O_NOCTTY);
+	if ( (*p_dev < 0) || grantpt(*p_dev) || unlockpt(*p_dev) || ptsname_r(*p_dev, p_slave, slaveSize) )	return 1;
+	*p_host = open(p_slave, O_RDWR | O_NOCTTY);
+	if (*p_host < 0)	return 1;
+	tcgetattr(*p_host, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(*p_host, TCSANOW, &tio);
+	return 0;
+}
+
+/* An end of a session that failed, listed with -v */
+struct failure {
+	uint32_t session;
+	uint8_t role, result, b_notIntact;
+	uint64_t bytes, us;
+};
+
+/* Totals of a pass */
+struct pass {
+	uint32_t sessions, failed;
+	uint64_t intactBytes;
+	uint64_t wallUs;
+	uint64_t deviceCpuUs, hostCpuUs;
+	uint64_t retries, timeouts;
+	uint64_t realUs;					// Real time, differs from wallUs with -V
+	uint32_t digest;					// Over what the records of the sessions tell, see _digest()
+	struct failure *p_failures;			// -v, listed once the pass is done
+	uint32_t failures;
+	uint64_t times[HIST_BUCKETS];		// Transfer times of the sessions
+	uint64_t latency[HIST_BUCKETS];		// Response times of the devices
+};
+
+/**
+  * @brief FNV-1a over the parts of a record the seed decides with -V,
+  *        everything but the CPU time
+  */
+static uint32_t _digest(const struct result *p_r)
+{
+	uint32_t u32_hash = 2166136261UL;
+	uint64_t u64_vals[] = {p_r->session, p_r->role, p_r->result, p_r->b_intact, p_r->bytes, p_r->endUs - p_r->startUs,
+		p_r->retries, p_r->timeouts};
+	const uint8_t *p_byte;
+	size_t i;
+
+	for (i = 0; i < sizeof(u64_vals) + sizeof(p_r->latency); i++)
+	{
+		p_byte = (i < sizeof(u64_vals)) ? (const uint8_t *)u64_vals + i : (const uint8_t *)p_r->latency + i - sizeof(u64_vals);
+		u32_hash = (u32_hash ^ *p_byte) * 16777619UL;
+	}
+	return u32_hash;
+}
+
+/**
+  * @brief Collects what a session reported
+  */
+static void _account(struct pass *p_pass, const struct result *p_r, uint8_t *p_ok, uint8_t *p_records, uint64_t *p_end)
+{
+	struct failure *p_f;
+	uint32_t u32_idx = p_r->session - sessionBase;
+	uint16_t i;
+
+	/* The records arrive in any order */
+	p_pass->digest += _digest(p_r);
+	p_pass->retries += p_r->retries;
+	p_pass->timeouts += p_r->timeouts;
+	p_records[u32_idx]++;
+	if ( p_pass->p_failures && ((p_r->result != FM_OK) || (p_r->b_judged && !p_r->b_intact)) )
+	{
+		p_f = &p_pass->p_failures[p_pass->failures++];
+		p_f->session = p_r->session;
+		p_f->role = p_r->role;
+		p_f->result = p_r->result;
+		p_f->b_notIntact = p_r->b_judged && !p_r->b_intact;
+		p_f->bytes = p_r->bytes;
+		p_f->us = p_r->endUs - p_r->startUs;
+	}
+	if (p_r->role == ROLE_DEVICE)
+	{
+		p_pass->deviceCpuUs += p_r->cpuUs;
+		for (i = 0; i < HIST_BUCKETS; i++)	p_pass->latency[i] += p_r->latency[i];
+	}
+	else
+	{
+		p_pass->hostCpuUs += p_r->cpuUs;
+	}
+	if ( (p_r->result != FM_OK) || (p_r->b_judged && !p_r->b_intact) )	p_ok[u32_idx] = 0;
+	if (p_r->b_judged && p_r->b_intact)	p_pass->intactBytes += fileSize;
+	if (p_r->endUs > p_end[u32_idx])	p_end[u32_idx] = p_r->endUs;
+}
+
+/* Failures in the order of the sessions, not of the processes finishing */
+static int _failureOrder(const void *p_a, const void *p_b)
+{
+	const struct failure *p_fa = (const struct failure *)p_a, *p_fb = (const struct failure *)p_b;
+
+	if (p_fa->session != p_fb->session)	return (p_fa->session < p_fb->session) ? -1 : 1;
+	return (int)p_fa->role - (int)p_fb->role;
+}
+
+/**
+  * @brief Runs a pass with the given amount of sessions at the same time,
+  *        numbered from sessionBase
+  *
+  * @return		Zero if all processes could be started
+  */
+static uint8_t _runPass(uint32_t u32_sessions, struct pass *p_pass)
+{
+	char root[] = "/tmp/fm_fleet.XXXXXX";
+	char slave[64];
+	struct proc *p_procs;
+	struct failure *p_f;
+	struct result r;
+	struct rusage ru;
+	struct pollfd pfd;
+	uint64_t *p_end, start;
+	uint32_t u32_procs = 0, u32_running, u32_results = 0, u32_expected, i, j;
+	uint8_t *p_ok, *p_records, b_error = 0;
+	int resultPipe[2], goPipe[2], devFd, hostFd, status;
+	pid_t pid;
+	ssize_t n;
+
+	memset(p_pass, 0, sizeof(*p_pass));
+	p_pass->sessions = u32_sessions;
+	if (b_verbose)	p_pass->p_failures = calloc(2 * u32_sessions, sizeof(struct failure));
+	p_procs = calloc(2 * u32_sessions, sizeof(struct proc));
+	p_ok = malloc(u32_sessions);
+	p_end = calloc(u32_sessions, sizeof(uint64_t));
+	p_records = calloc(u32_sessions, 1);
+	/* Commands don't get to see them */
+	if (!p_procs || !p_ok || !p_end || !p_records || pipe2(resultPipe, O_CLOEXEC) || pipe2(goPipe, O_CLOEXEC))	return 1;
+	memset(p_ok, 1, u32_sessions);
+	if (p_hostCmd && (transport != T_INPROC) && !mkdtemp(root))	return 1;
+
+	fflush(stdout);
+	for (i = 0; (i < u32_sessions) && !b_error; i++)
+	{
+		if (_openLink(&devFd, &hostFd, slave, sizeof(slave)))
+		{
+			fprintf(stderr, "Session %lu: No link (%s)\n", (unsigned long)i, strerror(errno));
+			b_error = 1;
+			if (devFd >= 0)	close(devFd);
+			break;
+		}
+
+		/* The host end first, the device may poke right away */
+		if (hostFd >= 0)
+		{
+			if (p_hostCmd)
+			{
+				pid = _startCommand(sessionBase + i, root, hostFd, (transport == T_PTY) ? slave : NULL, devFd, goPipe);
+				p_procs[u32_procs].b_command = 1;
+			}
+			else if (!(pid = fork()))
+			{
+				close(devFd);
+				close(resultPipe[0]);
+				close(goPipe[1]);
+				_runEnd(sessionBase + i, ROLE_HOST, hostFd, goPipe[0], resultPipe[1]);
+			}
+			close(hostFd);
+			if (pid < 0)
+			{
+				fprintf(stderr, "Session %lu: No host end (%s)\n", (unsigned long)i, strerror(errno));
+				b_error = 1;
+				close(devFd);
+				break;
+			}
+			p_procs[u32_procs].pid = pid;
+			p_procs[u32_procs++].session = sessionBase + i;
+		}
+
+		pid = fork();
+		if (!pid)
+		{
+			close(resultPipe[0]);
+			close(goPipe[1]);
+			_runEnd(sessionBase + i, ROLE_DEVICE, devFd, goPipe[0], resultPipe[1]);
+		}
+		if (devFd >= 0)	close(devFd);
+		if (pid < 0)
+		{
+			fprintf(stderr, "Session %lu: No device (%s)\n", (unsigned long)i, strerror(errno));
+			b_error = 1;
+			break;
+		}
+		p_procs[u32_procs].pid = pid;
+		p_procs[u32_procs++].session = sessionBase + i;
+	}
+
+	/* All at once, or none on an error */
+	if (b_error)
+	{
+		for (j = 0; j < u32_procs; j++)	kill(p_procs[j].pid, SIGKILL);
+	}
+	close(resultPipe[1]);
+	close(goPipe[0]);
+	/* The virtual clock of the sessions starts there too */
+	start = _nowUs();
+	p_pass->realUs = _realUs();
+	for (j = 0; j < u32_procs; j++)	p_procs[j].startUs = start;
+	close(goPipe[1]);
+
+	/* A record per end, the parent writes the ones of the commands */
+	u32_expected = 2 * i;
+	u32_running = u32_procs;
+	pfd.fd = resultPipe[0];
+	pfd.events = POLLIN;
+	while (u32_running || (u32_results < u32_expected))
+	{
+		if (poll(&pfd, 1, u32_running ? 10 : 1000) > 0)
+		{
+			n = read(resultPipe[0], &r, sizeof(r));
+			if (n == (ssize_t)sizeof(r))
+			{
+				if (!b_error)	_account(p_pass, &r, p_ok, p_records, p_end);
+				u32_results++;
+			}
+			else if (n <= 0)
+			{
+				/* All writers are gone */
+				if (!u32_running)	break;
+			}
+		}
+		while ( u32_running && ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) )
+		{
+			u32_running--;
+			for (j = 0; (j < u32_procs) && (p_procs[j].pid != pid); j++);
+			if ( (j < u32_procs) && p_procs[j].b_command )
+			{
+				_commandResult(&p_procs[j], status, &ru, root, &r);
+				if (!b_error)	_account(p_pass, &r, p_ok, p_records, p_end);
+				u32_results++;
+			}
+			else if ( !WIFEXITED(status) || WEXITSTATUS(status) )
+			{
+				/* Died before it reported */
+				if (j < u32_procs)	p_ok[p_procs[j].session - sessionBase] = 0;
+			}
+		}
+	}
+	close(resultPipe[0]);
+	p_pass->realUs = _realUs() - p_pass->realUs;
+	if (p_hostCmd && (transport != T_INPROC))	rmdir(root);
+
+	if (p_pass->p_failures)
+	{
+		qsort(p_pass->p_failures, p_pass->failures, sizeof(struct failure), _failureOrder);
+		for (i = 0; i < p_pass->failures; i++)
+		{
+			p_f = &p_pass->p_failures[i];
+			printf("  session %lu %s: %s, %llu Bytes%s after %.2f s\n", (unsigned long)p_f->session, _roleNames[p_f->role],
+				(p_f->result < sizeof(_resultNames) / sizeof(_resultNames[0])) ? _resultNames[p_f->result] : "?",
+				(unsigned long long)p_f->bytes, p_f->b_notIntact ? " not intact" : "", p_f->us / 1e6);
+		}
+		free(p_pass->p_failures);
+		p_pass->p_failures = NULL;
+	}
+
+	for (i = 0; i < u32_sessions; i++)
+	{
+		if (!p_ok[i] || (p_records[i] < 2))	p_pass->failed++;
+		if (p_end[i] > start)
+		{
+			if (p_end[i] - start > p_pass->wallUs)	p_pass->wallUs = p_end[i] - start;
+			p_pass->times[_histIndex(p_end[i] - start)]++;
+		}
+	}
+	free(p_procs);
+	free(p_ok);
+	free(p_records);
+	free(p_end);
+	return b_error;
+}
+
+static void _usage(const char *p_name)
+{
+	printf("Usage: %s [options]\n"
+		"  -n counts    Sessions at the same time, comma separated (1,10,100)\n"
+		"  -t link      pty, socket or inproc (pty)\n"
+		"  -d dir       up: the devices send, down: the devices receive (up)\n"
+		"  -p protocol  xmodem, or nmodem or kermit with -d down and inproc or -x (xmodem)\n"
+		"  -P           nmodem: The devices measure the link with nmodem_probe() first\n"
+		"  -m Bytes     File size of every session (65536)\n"
+		"  -b baud      Link model: baud rate, 0 for no limit (115200)\n"
+		"  -l ms        Link model: latency in each direction (0)\n"
+		"  -e rate      Link model: probability of a damaged Byte (0)\n"
+		"  -S rate      Link model: probability of a stall before a Byte (0)\n"
+		"  -L ms        Link model: length of a stall (5000)\n"
+		"  -x command   Host end, run with sh -c in a directory per session, the\n"
+		"               file is \"data\" there. Not for inproc (the library)\n"
+		"  -s seed      Seed for the data, the damage and the stalls (1)\n"
+		"  -V           Virtual time: inproc as a simulation, as fast as the CPU\n"
+		"               allows and the same results for the same seed\n"
+		"  -r session   Runs only this session, e.g. one -v listed\n"
+		"  -k           With -r: list the Bytes and events of the session\n"
+		"  -v           List the ends of the sessions that failed\n", p_name);
+}
+
+int main(int argc, char **argv)
+{
+	const char *p_counts = "1,10,100";
+	char *p_end;
+	struct pass pass;
+	uint32_t u32_sessions;
+	uint8_t b_failed = 0, b_replay = 0, b_transport = 0;
+	double wall, cpus = (double)sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:d:p:Pm:b:l:e:S:L:x:s:Vr:kvh")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n':	p_counts = optarg;								break;
+			case 't':
+				for (transport = T_PTY; transport <= T_INPROC; transport++)
+				{
+					if (!strcmp(optarg, _transportNames[transport]))	break;
+				}
+				if (transport > T_INPROC)
+				{
+					_usage(argv[0]);
+					return 1;
+				}
+				b_transport = 1;
+				break;
+			case 'd':	b_up = strcmp(optarg, "down") != 0;				break;
+			case 'p':
+				for (protocol = P_XMODEM; protocol <= P_KERMIT; protocol++)
+				{
+					if (!strcmp(optarg, _protocolNames[protocol]))	break;
+				}
+				if (protocol > P_KERMIT)
+				{
+					_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'P':	b_probe = 1;									break;
+			case 'm':	fileSize = strtoul(optarg, NULL, 0);			break;
+			case 'b':	baud = strtoul(optarg, NULL, 0);				break;
+			case 'l':	latencyUs = strtoul(optarg, NULL, 0) * 1000;	break;
+			case 'e':	damageRate = strtod(optarg, NULL);				break;
+			case 'S':	stallRate = strtod(optarg, NULL);				break;
+			case 'L':	stallUs = strtoul(optarg, NULL, 0) * 1000ULL;	break;
+			case 'x':	p_hostCmd = optarg;								break;
+			case 's':	seed = strtoul(optarg, NULL, 0);				break;
+			case 'V':	b_virtual = 1;									break;
+			case 'r':
+				sessionBase = strtoul(optarg, NULL, 0);
+				p_counts = "1";
+				b_replay = 1;
+				break;
+			case 'k':	b_trace = 1;									break;
+			case 'v':	b_verbose = 1;									break;
+			default:
+				_usage(argv[0]);
+				return 1;
+		}
+	}
+	/* The virtual clock only exists in the device processes */
+	if (b_virtual && !b_transport)	transport = T_INPROC;
+	if ( !fileSize || (p_hostCmd && (transport == T_INPROC)) || (b_virtual && (transport != T_INPROC)) ||
+		(b_trace && !b_replay) ||
+		/* The library has no N-Modem sender, only the built-in host or a command */
+		((protocol != P_XMODEM) && (b_up || ((transport != T_INPROC) && !p_hostCmd))) ||
+		(b_probe && (protocol != P_NMODEM)) )
+	{
+		_usage(argv[0]);
+		return 1;
+	}
+	/* Start, 8 data bits and stop */
+	charUs = baud ? (10000000 + baud - 1) / baud : 0;
+	signal(SIGPIPE, SIG_IGN);
+	if (cpus < 1)	cpus = 1;
+
+	printf("%s%s, %s, devices %s %lu Bytes, %lu baud, %lu ms latency, damage %g, stalls %g of %lu ms, host end %s\n",
+		_transportNames[transport], b_virtual ? " on virtual time" : "", _protocolNames[protocol], b_up ? "send" : "receive",
+		(unsigned long)fileSize, (unsigned long)baud, (unsigned long)(latencyUs / 1000), damageRate, stallRate,
+		(unsigned long)(stallUs / 1000), p_hostCmd ? p_hostCmd : (transport == T_INPROC) ? "built-in" : "library");
+	if (b_replay)	printf("Session %lu only\n", (unsigned long)sessionBase);
+	printf("%8s %6s %9s %9s   %8s %8s %8s   %8s %8s %8s   %8s %8s   %9s %9s %6s", "Sessions", "Failed", "MB/s",
+		"kB/s each", "Time p50", "p99", "max [s]", "Resp p50", "p90", "p99 [ms]", "Retries", "Timeouts", "Dev CPU s",
+		"Host CPU s", "CPU %");
+	/* Speedup over real time and what to compare with another run */
+	if (b_virtual)	printf("   %8s %8s", "Real s", "Digest");
+	printf("\n");
+	for (p_end = (char *)p_counts; *p_end; )
+	{
+		u32_sessions = strtoul(p_end, &p_end, 0);
+		if (*p_end == ',')	p_end++;
+		if (!u32_sessions)	continue;
+
+		if (_runPass(u32_sessions, &pass))
+		{
+			printf("%8lu could not start all sessions\n", (unsigned long)u32_sessions);
+			b_failed = 1;
+			break;
+		}
+		wall = pass.wallUs ? pass.wallUs / 1e6 : 1e-6;
+		printf("%8lu %6lu %9.3f %9.2f   %8.2f %8.2f %8.2f   %8.1f %8.1f %8.1f   %8lu %8lu   %9.2f %9.2f %6.1f",
+			(unsigned long)pass.sessions, (unsigned long)pass.failed, pass.intactBytes / wall / 1e6,
+			pass.intactBytes / wall / 1e3 / pass.sessions,
+			_percentileUpTo(pass.times, 0.5, pass.wallUs) / 1e6, _percentileUpTo(pass.times, 0.99, pass.wallUs) / 1e6, wall,
+			_histPercentile(pass.latency, 0.5) / 1e3, _histPercentile(pass.latency, 0.9) / 1e3,
+			_histPercentile(pass.latency, 0.99) / 1e3, (unsigned long)pass.retries, (unsigned long)pass.timeouts,
+			pass.deviceCpuUs / 1e6, pass.hostCpuUs / 1e6, (pass.deviceCpuUs + pass.hostCpuUs) / 1e6 /
+			(b_virtual ? pass.realUs / 1e6 : wall) / cpus * 100);
+		if (b_virtual)	printf("   %8.2f %08lx", pass.realUs / 1e6, (unsigned long)pass.digest);
+		printf("\n");
+		if (pass.failed)	b_failed = 1;
+	}
+	return b_failed;
+}
@@ -0,0 +1,675 @@
+/*
+ * fm_fuzz.c
+ *
+ * Feeds hostile and malformed streams to the receive functions and measures
+ * what a misbehaving peer can cost: the CPU time spent per input Byte, the
+ * Bytes sent back and written to the file, and how long the receiver can be
+ * kept busy without accepting a packet before it gives up (stall).
+ *
+ * Runs on the host, linked with the library. Time is virtual: recByte
+ * advances the clock by the timeout instead of waiting and _delay_ms only
+ * adds to the clock, so a run takes as much real time as the receiver needs
+ * CPU. The peer sends at the line rate (or trickles with a gap between the
+ * Bytes) into an endless receive buffer, flushRx drops what has arrived so
+ * far. FatFs is replaced by a file that only counts the Bytes.
+ *
+ * A scenario the receiver doesn't give up on within the input or time limit
+ * is reported as NOT ABORTED and makes the program exit with 1.
+ *
+ * Build:	tools/fm_fuzz.sh, or by hand with ff.h and a util/delay.h declaring
+ *			_delay_ms() in the include path:
+ *			gcc -O2 -Ishim -Ifatfs -I. -o fm_fuzz tools/fm_fuzz.c *.c
+ * Usage:	fm_fuzz [options], see _usage() or run with -h
+ *
+ * Created: 18.10.2026 20:05:41
+ *  Author: gfcwfzkm
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "file_modem_int.h"
+#include "diskio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#define NEVER		UINT64_MAX
+#define PAT_SIZ		16384	// Largest pattern a scenario repeats
+
+enum proto {P_XMODEM, P_NMODEM, P_KERMIT};
+static const char *const _protoNames[] = {"xmodem", "nmodem", "kermit"};
+static const char *const _resultNames[] = {"OK", "INVALID_START", "TIMEOUT", "ABORTED", "-", "DISK_FULL",
+	"SIZE_EXCEEDED"};
+
+/* What the peer sends: A prefix once, then a pattern over and over, either
+ * the same or built anew for every repetition */
+struct feed {
+	uint8_t prefix[PAT_SIZ];
+	uint16_t prefixLen;
+	uint8_t pattern[PAT_SIZ];
+	uint16_t patternLen;		// Zero: The peer is silent after the prefix
+	uint32_t gapUs;				// Pause between two Bytes, on top of the character time
+	void (*next)(struct feed *p_f, uint32_t u32_rep);	// Builds the pattern for a repetition, NULL if fixed
+	/* State */
+	uint32_t pos;				// Position in the prefix, then in the pattern
+	uint32_t rep;				// Repetitions of the pattern so far
+	uint8_t inPattern;
+};
+
+struct scenario {
+	enum proto proto;
+	const char *p_name;
+	void (*build)(struct feed *p_f);
+};
+
+/* Result of one scenario */
+struct run {
+	uint64_t input;			// Bytes of the peer taken or dropped by the receiver
+	uint64_t sent;			// Bytes the receiver sent back
+	uint64_t written;		// Bytes written to the file
+	uint64_t cpuNs;			// CPU time of the receive function
+	uint64_t duration;		// Virtual time until it returned, us
+	uint64_t stall;			// Virtual time since the last accepted packet, us
+	enum file_modem result;
+	uint8_t capped;			// Stopped by the limits, not by the receiver
+};
+
+/* Limits and link */
+static uint32_t byteUs = 87;				// Character time, 115200 baud
+static uint64_t maxInput = 16UL << 20;		// Input Bytes before the peer goes silent
+static uint64_t maxTime = 24ULL * 3600 * 1000000;	// Virtual time before the peer goes silent
+static FSIZE_t maxSize = 1UL << 20;			// Limit passed to the receive function
+
+/* Virtual link */
+static struct feed feed;
+static uint64_t now;			// Virtual clock, us
+static uint64_t nextAt;			// Arrival of the next Byte of the peer, NEVER if silent
+static uint64_t lastPacket;		// Virtual time the last packet got accepted
+static uint32_t packets;
+static struct run *p_run;
+static struct fm_stats stats;
+static uint32_t seed = 1;
+
+/* --- Peer side helpers --- */
+
+static uint16_t _crc16(const uint8_t *p_buf, uint16_t u16_len)
+{
+	uint16_t crc = 0;
+	uint8_t i;
+
+	while (u16_len--)
+	{
+		crc ^= (uint16_t)*p_buf++ << 8;
+		for (i = 0; i < 8; i++)	crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+static uint32_t _crc32(const uint8_t *p_buf, uint16_t u16_len)
+{
+	uint32_t crc = 0xFFFFFFFFUL;
+	uint8_t i;
+
+	while (u16_len--)
+	{
+		crc ^= *p_buf++;
+		for (i = 0; i < 8; i++)	crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+	}
+	return ~crc;
+}
+
+static uint8_t _random(void)
+{
+	seed = seed * 1103515245UL + 12345;
+	return (uint8_t)(seed >> 16);
+}
+
+/**
+  * @brief Appends an X-Modem packet with 1k payload of one value and CRC-16
+  */
+static uint16_t _xPacket(uint8_t *p_out, uint8_t u8_blk, uint8_t u8_val, uint8_t b_badCrc)
+{
+	uint16_t crc;
+
+	p_out[0] = 0x02;
+	p_out[1] = u8_blk;
+	p_out[2] = ~u8_blk;
+	memset(&p_out[3], u8_val, PCK_1K);
+	crc = _crc16(&p_out[3], PCK_1K) ^ (b_badCrc ? 0x5A5A : 0);
+	p_out[3 + PCK_1K] = (uint8_t)(crc >> 8);
+	p_out[4 + PCK_1K] = (uint8_t)crc;
+	return PCK_1K + 5;
+}
+
+/**
+  * @brief Appends an N-Modem frame: CRC-32, COBS and the delimiter
+  */
+static uint16_t _nFrame(uint8_t *p_out, const uint8_t *p_body, uint16_t u16_len, uint8_t b_badCrc)
+{
+	uint8_t raw[PCK_1K + 16];
+	uint32_t crc = _crc32(p_body, u16_len) ^ (b_badCrc ? 0x5A5A5A5AUL : 0);
+	uint16_t u16_pos = 0, u16_out = 0, u16_code;
+
+	memcpy(raw, p_body, u16_len);
+	raw[u16_len++] = (uint8_t)crc;
+	raw[u16_len++] = (uint8_t)(crc >> 8);
+	raw[u16_len++] = (uint8_t)(crc >> 16);
+	raw[u16_len++] = (uint8_t)(crc >> 24);
+
+	do{
+		u16_code = u16_out++;
+		while ( (u16_pos < u16_len) && raw[u16_pos] && (u16_out - u16_code < 255) )
+		{
+			p_out[u16_out++] = raw[u16_pos++];
+		}
+		p_out[u16_code] = (uint8_t)(u16_out - u16_code);
+		if ( (u16_pos < u16_len) && !raw[u16_pos] )
+		{
+			u16_pos++;
+			if (u16_pos == u16_len)	p_out[u16_out++] = 1;
+		}
+	}while(u16_pos < u16_len);
+	p_out[u16_out++] = 0;
+	return u16_out;
+}
+
+static uint16_t _nSetup(uint8_t *p_out)
+{
+	const uint8_t setup[] = {'S', 1, 1, (uint8_t)PCK_SIZ, 0, 0, 0, 0, 0};
+	return _nFrame(p_out, setup, sizeof(setup), 0);
+}
+
+static uint16_t _nData(uint8_t *p_out, uint32_t u32_offset, uint16_t u16_len, uint8_t b_badCrc)
+{
+	uint8_t body[5 + PCK_SIZ];
+
+	body[0] = 'D';
+	body[1] = (uint8_t)u32_offset;
+	body[2] = (uint8_t)(u32_offset >> 8);
+	body[3] = (uint8_t)(u32_offset >> 16);
+	body[4] = (uint8_t)(u32_offset >> 24);
+	memset(&body[5], 0x55, u16_len);
+	return _nFrame(p_out, body, 5 + u16_len, b_badCrc);
+}
+
+/**
+  * @brief Appends a Kermit packet with the single character check
+  */
+static uint16_t _kPacket(uint8_t *p_out, uint8_t u8_seq, uint8_t u8_type, const char *p_data, uint8_t b_badCheck)
+{
+	uint16_t u16_len = strlen(p_data), u16_cnt, u16_sum = 0;
+
+	p_out[0] = 0x01;
+	p_out[1] = (uint8_t)(u16_len + 3 + 32);
+	p_out[2] = (uint8_t)((u8_seq & 0x3F) + 32);
+	p_out[3] = u8_type;
+	memcpy(&p_out[4], p_data, u16_len);
+	for (u16_cnt = 1; u16_cnt < u16_len + 4; u16_cnt++)	u16_sum += p_out[u16_cnt];
+	p_out[u16_len + 4] = (uint8_t)(((u16_sum + ((u16_sum & 0xC0) >> 6)) & 0x3F) + 32 + (b_badCheck ? 1 : 0));
+	p_out[u16_len + 5] = 0x0D;
+	return u16_len + 6;
+}
+
+/* Send-Init: MAXL 94, no padding, CR, '#' control prefix, no 8th-bit prefix,
+ * check type 1, '~' repeat prefix */
+#define K_INIT	"~* @-#N1~"
+
+/* --- Scenarios --- */
+
+static void _silence(struct feed *p_f)		{ (void)p_f; }
+
+static void _noise(struct feed *p_f)
+{
+	for (p_f->patternLen = 0; p_f->patternLen < PAT_SIZ; p_f->patternLen++)	p_f->pattern[p_f->patternLen] = _random();
+}
+
+static void _noiseTrickle(struct feed *p_f)
+{
+	_noise(p_f);
+	p_f->gapUs = TIMEOUT * 1000UL - byteUs - 1000;
+}
+
+static void _xBadCrc(struct feed *p_f)		{ p_f->patternLen = _xPacket(p_f->pattern, 1, 0xAA, 1); }
+
+static void _xBadCrcTrickle(struct feed *p_f)
+{
+	_xBadCrc(p_f);
+	p_f->gapUs = TIMEOUT * 1000UL - byteUs - 1000;
+}
+
+static void _xDuplicates(struct feed *p_f)
+{
+	p_f->prefixLen = _xPacket(p_f->prefix, 1, 0xAA, 0);
+	p_f->patternLen = _xPacket(p_f->pattern, 1, 0xAA, 0);
+}
+
+static void _xEndlessNext(struct feed *p_f, uint32_t u32_rep)
+{
+	p_f->patternLen = _xPacket(p_f->pattern, (uint8_t)(u32_rep + 1), (uint8_t)u32_rep, 0);
+}
+
+static void _xEndless(struct feed *p_f)		{ p_f->next = _xEndlessNext; }
+
+#ifdef XMODEM_FILL_EXT
+static void _xFillBomb(struct feed *p_f)
+{
+	uint8_t *p = p_f->pattern;
+	uint16_t crc;
+
+	/* One record standing for just less than the limit, the next one is refused */
+	p[0] = 0x1C;	p[1] = 1;	p[2] = 0xFE;
+	p[3] = (uint8_t)((maxSize - 2) >> 24);	p[4] = (uint8_t)((maxSize - 2) >> 16);
+	p[5] = (uint8_t)((maxSize - 2) >> 8);	p[6] = (uint8_t)(maxSize - 2);	p[7] = 0x55;
+	crc = _crc16(&p[3], 5);
+	p[8] = (uint8_t)(crc >> 8);	p[9] = (uint8_t)crc;
+	memcpy(&p[10], p, 10);
+	p[11] = 2;	p[12] = 0xFD;
+	crc = _crc16(&p[13], 5);
+	p[18] = (uint8_t)(crc >> 8);	p[19] = (uint8_t)crc;
+	p_f->patternLen = 20;
+}
+#endif
+
+static void _nNoDelimiter(struct feed *p_f)
+{
+	_noise(p_f);
+	for (p_f->pos = 0; p_f->pos < p_f->patternLen; p_f->pos++)	p_f->pattern[p_f->pos] |= 1;
+	p_f->pos = 0;
+}
+
+static void _nDelimiters(struct feed *p_f)
+{
+	memset(p_f->pattern, 0, 256);
+	p_f->patternLen = 256;
+}
+
+static void _nBadCrc(struct feed *p_f)
+{
+	p_f->prefixLen = _nSetup(p_f->prefix);
+	p_f->patternLen = _nData(p_f->pattern, 0, PCK_SIZ, 1);
+}
+
+static void _nDuplicates(struct feed *p_f)
+{
+	p_f->prefixLen = _nSetup(p_f->prefix);
+	p_f->patternLen = _nData(p_f->pattern, 0, PCK_SIZ, 0);
+}
+
+static void _nOutOfWindow(struct feed *p_f)
+{
+	p_f->prefixLen = _nSetup(p_f->prefix);
+	p_f->patternLen = _nData(p_f->pattern, 0x40000000UL, PCK_SIZ, 0);
+}
+
+static void _nEndlessNext(struct feed *p_f, uint32_t u32_rep)
+{
+	p_f->patternLen = _nData(p_f->pattern, u32_rep * PCK_SIZ, PCK_SIZ, 0);
+}
+
+static void _nEndless(struct feed *p_f)
+{
+	p_f->prefixLen = _nSetup(p_f->prefix);
+	p_f->next = _nEndlessNext;
+}
+
+static void _kNoMark(struct feed *p_f)
+{
+	_noise(p_f);
+	for (p_f->pos = 0; p_f->pos < p_f->patternLen; p_f->pos++)	p_f->pattern[p_f->pos] |= 2;
+	p_f->pos = 0;
+}
+
+static void _kMarks(struct feed *p_f)
+{
+	memset(p_f->pattern, 0x01, 256);
+	p_f->patternLen = 256;
+}
+
+static void _kBadCheck(struct feed *p_f)	{ p_f->patternLen = _kPacket(p_f->pattern, 0, 'S', K_INIT, 1); }
+
+static void _kDuplicates(struct feed *p_f)
+{
+	p_f->prefixLen = _kPacket(p_f->prefix, 0, 'S', K_INIT, 0);
+	p_f->patternLen = _kPacket(p_f->pattern, 0, 'S', K_INIT, 0);
+}
+
+static void _kBeforeInit(struct feed *p_f)	{ p_f->patternLen = _kPacket(p_f->pattern, 0, 'D', "data", 0); }
+
+static void _kRepeatNext(struct feed *p_f, uint32_t u32_rep)
+{
+	/* 30 times "~~X": 90 characters for 30 * 94 Bytes */
+	static const char bomb[] = "~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X"
+		"~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X~~X";
+	p_f->patternLen = _kPacket(p_f->pattern, (uint8_t)(u32_rep + 2), 'D', bomb, 0);
+}
+
+static void _kRepeatBomb(struct feed *p_f)
+{
+	p_f->prefixLen = _kPacket(p_f->prefix, 0, 'S', K_INIT, 0);
+	p_f->prefixLen += _kPacket(&p_f->prefix[p_f->prefixLen], 1, 'F', "FILE", 0);
+	p_f->next = _kRepeatNext;
+}
+
+static const struct scenario _scenarios[] = {
+	{P_XMODEM,	"silence",				_silence},
+	{P_XMODEM,	"noise",				_noise},
+	{P_XMODEM,	"noise trickle",		_noiseTrickle},
+	{P_XMODEM,	"bad CRC flood",		_xBadCrc},
+	{P_XMODEM,	"bad CRC trickle",		_xBadCrcTrickle},
+	{P_XMODEM,	"duplicate flood",		_xDuplicates},
+	{P_XMODEM,	"endless file",			_xEndless},
+#ifdef XMODEM_FILL_EXT
+	{P_XMODEM,	"fill bomb",			_xFillBomb},
+#endif
+	{P_NMODEM,	"silence",				_silence},
+	{P_NMODEM,	"noise",				_noise},
+	{P_NMODEM,	"noise trickle",		_noiseTrickle},
+	{P_NMODEM,	"no delimiter",			_nNoDelimiter},
+	{P_NMODEM,	"delimiter flood",		_nDelimiters},
+	{P_NMODEM,	"bad CRC flood",		_nBadCrc},
+	{P_NMODEM,	"duplicate flood",		_nDuplicates},
+	{P_NMODEM,	"out of window flood",	_nOutOfWindow},
+	{P_NMODEM,	"endless file",			_nEndless},
+	{P_KERMIT,	"silence",				_silence},
+	{P_KERMIT,	"noise",				_noise},
+	{P_KERMIT,	"noise trickle",		_noiseTrickle},
+	{P_KERMIT,	"no mark",				_kNoMark},
+	{P_KERMIT,	"mark flood",			_kMarks},
+	{P_KERMIT,	"bad check flood",		_kBadCheck},
+	{P_KERMIT,	"duplicate flood",		_kDuplicates},
+	{P_KERMIT,	"data before init",		_kBeforeInit},
+	{P_KERMIT,	"repeat bomb",			_kRepeatBomb},
+};
+
+/* --- Virtual link and storage --- */
+
+/**
+  * @brief Takes the next Byte of the peer, schedules the one after it
+  */
+static uint8_t _take(void)
+{
+	uint8_t u8_ch;
+
+	if (!feed.inPattern)
+	{
+		u8_ch = feed.prefix[feed.pos++];
+	}
+	else
+	{
+		u8_ch = feed.pattern[feed.pos++];
+	}
+	if ( (!feed.inPattern && (feed.pos >= feed.prefixLen)) || (feed.inPattern && (feed.pos >= feed.patternLen)) )
+	{
+		if (feed.inPattern)	feed.rep++;
+		feed.inPattern = 1;
+		feed.pos = 0;
+		if (feed.next)	feed.next(&feed, feed.rep);
+	}
+	p_run->input++;
+
+	if (!feed.patternLen && feed.inPattern)
+	{
+		nextAt = NEVER;
+	}
+	else if ( (p_run->input >= maxInput) || (nextAt >= maxTime) )
+	{
+		/* The receiver should have given up long ago */
+		p_run->capped = 1;
+		nextAt = NEVER;
+	}
+	else
+	{
+		nextAt += byteUs + feed.gapUs;
+	}
+	return u8_ch;
+}
+
+static void _progress(void)
+{
+	if (stats.packets != packets)
+	{
+		packets = stats.packets;
+		lastPacket = now;
+	}
+}
+
+static uint8_t _linkRecByte(uint8_t *p_ch, uint16_t u16_timeout)
+{
+	_progress();
+	if ( (nextAt == NEVER) || (nextAt > now + u16_timeout * 1000ULL) )
+	{
+		now += u16_timeout * 1000ULL;
+		return 1;
+	}
+	if (nextAt > now)	now = nextAt;
+	*p_ch = _take();
+	return 0;
+}
+
+static void _linkSendByte(uint8_t u8_ch)
+{
+	(void)u8_ch;
+	p_run->sent++;
+}
+
+static void _linkFlushRx(void)
+{
+	_progress();
+	while ( (nextAt != NEVER) && (nextAt <= now) )	_take();
+}
+
+void _delay_ms(double ms)
+{
+	now += (uint64_t)(ms * 1000);
+}
+
+static uint32_t _millis(void)
+{
+	return (uint32_t)(now / 1000);
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw)
+{
+	(void)buff;
+	p_run->written += btw;
+	fp->fptr += btw;
+	*bw = btw;
+	return FR_OK;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs)
+{
+	fp->fptr = ofs;
+	return FR_OK;
+}
+
+FRESULT f_sync(FIL *fp)
+{
+	(void)fp;
+	return FR_OK;
+}
+
+/* Only used by the tuning cache, the sinks and the file size hints, none of them in here */
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br)
+{
+	(void)fp;
+	(void)buff;
+	(void)btr;
+	*br = 0;
+	return FR_OK;
+}
+
+FRESULT f_truncate(FIL *fp)
+{
+	(void)fp;
+	return FR_OK;
+}
+
+FRESULT f_expand(FIL *fp, FSIZE_t fsz, BYTE opt)
+{
+	(void)fp;
+	(void)fsz;
+	(void)opt;
+	return FR_DENIED;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+	(void)pdrv;
+	(void)cmd;
+	(void)buff;
+	return RES_PARERR;
+}
+
+/* --- Runner --- */
+
+static void _runScenario(const struct scenario *p_s, struct run *p_r)
+{
+	struct timespec t0, t1;
+	FATFS fs;
+	FIL file;
+	FSIZE_t size = maxSize;
+
+	memset(p_r, 0, sizeof(*p_r));
+	memset(&feed, 0, sizeof(feed));
+	memset(&stats, 0, sizeof(stats));
+	memset(&fs, 0, sizeof(fs));
+	memset(&file, 0, sizeof(file));
+	fs.fs_type = FS_FAT32;
+	file.obj.fs = &fs;
+	p_run = p_r;
+	now = lastPacket = 0;
+	packets = 0;
+
+	p_s->build(&feed);
+	feed.inPattern = !feed.prefixLen;
+	if (feed.inPattern && feed.next)	feed.next(&feed, 0);
+	nextAt = (feed.prefixLen || feed.patternLen) ? byteUs : NEVER;
+
+	file_modem_init(_linkRecByte, _linkSendByte, _linkFlushRx);
+	file_modem_stats(&stats, _millis);
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t0);
+	switch (p_s->proto)
+	{
+		case P_XMODEM:	p_r->result = xmodem_receive(&file, &size);	break;
+		case P_NMODEM:	p_r->result = nmodem_receive(&file, &size);	break;
+		case P_KERMIT:	p_r->result = kermit_receive(&file, &size);	break;
+	}
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1);
+
+	_progress();
+	file_modem_stats(NULL, NULL);
+	p_r->cpuNs = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+	p_r->duration = now;
+	p_r->stall = now - lastPacket;
+}
+
+static void _usage(const char *p_name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -p proto     Only xmodem, nmodem or kermit\n"
+		"  -b baud      Line rate of the peer (115200)\n"
+		"  -i MiB       Input after which a receiver counts as not giving up (16)\n"
+		"  -t hours     Virtual time after which it counts as not giving up (24)\n"
+		"  -m Bytes     Size limit passed to the receive functions (1048576)\n"
+		"  -r runs      Runs per scenario, the CPU time is the lowest of them (3)\n"
+		"  -s seed      Seed for the noise (1)\n", p_name);
+}
+
+int main(int argc, char **argv)
+{
+	const struct scenario *p_s;
+	struct run best = {0}, r;
+	uint32_t runs = 3, u32_run, u32_seed;
+	double nsPerByte, worstNs = 0;
+	uint64_t worstStall = 0;
+	const char *p_worstNs = "-", *p_worstStall = "-";
+	int proto = -1, opt;
+	uint8_t b_failed = 0;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "p:b:i:t:m:r:s:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'p':
+				for (proto = 0; (proto < 3) && strcmp(optarg, _protoNames[proto]); proto++);
+				if (proto == 3)
+				{
+					_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'b':	byteUs = 10000000UL / strtoul(optarg, NULL, 0);			break;
+			case 'i':	maxInput = strtoull(optarg, NULL, 0) << 20;				break;
+			case 't':	maxTime = strtoull(optarg, NULL, 0) * 3600 * 1000000;	break;
+			case 'm':	maxSize = strtoull(optarg, NULL, 0);					break;
+			case 'r':	runs = strtoul(optarg, NULL, 0);						break;
+			case 's':	seed = strtoul(optarg, NULL, 0);						break;
+			default:
+				_usage(argv[0]);
+				return 1;
+		}
+	}
+	if (!byteUs || !runs)
+	{
+		_usage(argv[0]);
+		return 1;
+	}
+	u32_seed = seed;
+
+	printf("%-7s %-20s %10s %8s %10s %8s %10s %10s  %s\n", "Proto", "Scenario", "Input", "Sent", "Written",
+		"ns/Byte", "Time [s]", "Stall [s]", "Result");
+	for (i = 0; i < sizeof(_scenarios) / sizeof(_scenarios[0]); i++)
+	{
+		p_s = &_scenarios[i];
+		if ( (proto >= 0) && (p_s->proto != (enum proto)proto) )	continue;
+
+		/* Same input every run, the lowest CPU time is the least disturbed one */
+		for (u32_run = 0; u32_run < runs; u32_run++)
+		{
+			seed = u32_seed;
+			_runScenario(p_s, &r);
+			if (!u32_run || (r.cpuNs < best.cpuNs))	best = r;
+		}
+
+		printf("%-7s %-20s %10llu %8llu %10llu ", _protoNames[p_s->proto], p_s->p_name,
+			(unsigned long long)best.input, (unsigned long long)best.sent, (unsigned long long)best.written);
+		if (best.input)
+		{
+			nsPerByte = (double)best.cpuNs / best.input;
+			printf("%8.1f ", nsPerByte);
+			if (nsPerByte > worstNs)
+			{
+				worstNs = nsPerByte;
+				p_worstNs = p_s->p_name;
+			}
+		}
+		else
+		{
+			printf("%8s ", "-");
+		}
+		printf("%10.1f %10.1f  ", best.duration / 1e6, best.stall / 1e6);
+		if (best.capped)
+		{
+			printf("NOT ABORTED\n");
+			b_failed = 1;
+		}
+		else
+		{
+			printf("%s\n", _resultNames[best.result]);
+		}
+		if (best.stall > worstStall)
+		{
+			worstStall = best.stall;
+			p_worstStall = p_s->p_name;
+		}
+	}
+	printf("\nWorst CPU per input Byte: %.1f ns (%s)\n", worstNs, p_worstNs);
+	printf("Worst stall before abort: %.1f s (%s)\n", worstStall / 1e6, p_worstStall);
+	return b_failed;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# fm_fuzz.sh
+#
+# Builds tools/fm_fuzz.c together with the library for the host and runs it.
+# Only ff.h, ffconf.h and diskio.h of FatFs are needed, fm_fuzz replaces the
+# few FatFs functions the receivers call. _delay_ms comes from fm_fuzz as
+# well, a util/delay.h declaring it is generated.
+#
+# Usage:	FATFS_DIR=path/to/fatfs/source tools/fm_fuzz.sh [fm_fuzz options]
+# Env:		CC (gcc), CFLAGS (-O2), e.g. CFLAGS="-O2 -DXMODEM_FILL_EXT" for the
+#			fill records
+#
+# Created: 18.10.2026 20:41:19
+#  Author: gfcwfzkm
+#
+
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+
+SRC_DIR=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ -z "$FATFS_DIR" ] || [ ! -f "$FATFS_DIR/ff.h" ] || [ ! -f "$FATFS_DIR/diskio.h" ]; then
+	echo "FATFS_DIR has to point to the directory holding ff.h, ffconf.h and diskio.h" >&2
+	exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/util"
+echo "void _delay_ms(double __ms);" > "$WORK/util/delay.h"
+
+"$CC" $CFLAGS -I"$WORK" -I"$SRC_DIR" -I"$FATFS_DIR" -o "$WORK/fm_fuzz" \
+	"$SRC_DIR/tools/fm_fuzz.c" "$SRC_DIR"/*.c || exit 1
+"$WORK/fm_fuzz" "$@"
@@ -0,0 +1,607 @@
+/*
+ * fm_interop.c
+ *
+ * Runs the X-Modem engines of the library against lrzsz, the reference most
+ * hosts have, over a pseudo terminal: sx sends to xmodem_receive() and
+ * xmodem_send_memory() sends to rx, with 128 Byte and 1k packets, CRC and
+ * checksum. C-Kermit sends to kermit_receive(): plain, with long packets and
+ * sliding windows, and with parity over a 7-bit link, where the 8th bit comes
+ * prefixed or shifted. For every case and file size it reports whether the
+ * file arrived intact, the throughput, the packets, retries, damaged packets
+ * and timeouts and the exit status of the peer program. With -e, Bytes on the
+ * way to the receiver get damaged at the given rate, which exercises the
+ * error recovery of both sides.
+ *
+ * The library has no Y-Modem (sb, rb), Z-Modem (sz, rz) or Kermit sender
+ * (kermit -r), those cases are listed as not supported.
+ *
+ * Runs on the host, linked with the library. FatFs is replaced by a file in
+ * memory, time is real (the delays of the library included). The peer
+ * programs run in a temporary directory, with the pseudo terminal as stdin
+ * and stdout.
+ *
+ * Build:	tools/fm_interop.sh, or by hand with ff.h and a util/delay.h declaring
+ *			_delay_ms() in the include path:
+ *			gcc -O2 -Ishim -Ifatfs -I. -o fm_interop tools/fm_interop.c *.c
+ * Usage:	fm_interop [options], see _usage() or run with -h
+ *
+ * Created: 18.10.2026 22:47:15
+ *  Author: gfcwfzkm
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "file_modem_int.h"
+#include "diskio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define PEER_START	500		// Time the peer program gets to set up the terminal, ms. It flushes
+							// the input doing so, a poke sent before would get lost
+#define PEER_WAIT	10000	// Time the peer program gets to exit after the engine returned, ms
+#define PEER_ARGS	12		// Most arguments of a peer program, with the file name
+#define SUB			0x1A	// Padding of the last packet
+
+static const char *const _resultNames[] = {"OK", "INVALID_START", "TIMEOUT", "ABORTED", "-", "DISK_FULL",
+	"SIZE_EXCEEDED"};
+
+/* A pairing of a peer program with one of the engines */
+struct peerCase {
+	const char *p_name;
+	const char *p_prog;		// lrzsz program without prefix, or "kermit"
+	const char *p_opt;		// Options selecting the variant, separated by spaces, NULL for none
+	uint8_t b_weSend;		// xmodem_send_memory() to the program, else the program to p_receive
+	uint8_t b_supported;
+	uint8_t b_7bit;			// The link drops the 8th bit on the way to the receiver, like a UART with parity
+	enum file_modem (*p_receive)(FIL *p_ffd, FSIZE_t *p_maxsize);
+};
+
+static const struct peerCase _cases[] = {
+	{"sx, CRC, 128",		"sx",		NULL,	0,	1,	0,	xmodem_receive},
+	{"sx -k, CRC, 1k",		"sx",		"-k",	0,	1,	0,	xmodem_receive},
+	{"rx, checksum, 128",	"rx",		NULL,	1,	1,	0,	NULL},
+	{"rx -c, CRC, 1k",		"rx",		"-c",	1,	1,	0,	NULL},
+	{"kermit -s",			"kermit",	"-Y -q -i -s",					0,	1,	0,	kermit_receive},
+	{"kermit -s, 1k, win 4", "kermit",	"-Y -q -i -e 1024 -v 4 -s",		0,	1,	0,	kermit_receive},
+	{"kermit -s, parity",	"kermit",	"-Y -q -i -p e -s",				0,	1,	1,	kermit_receive},
+	{"sb, Y-Modem",			"sb",		NULL,	0,	0,	0,	NULL},
+	{"sz, Z-Modem",			"sz",		NULL,	0,	0,	0,	NULL},
+	{"rb, Y-Modem",			"rb",		NULL,	1,	0,	0,	NULL},
+	{"rz, Z-Modem",			"rz",		NULL,	1,	0,	0,	NULL},
+	{"kermit -r",			"kermit",	"-Y -q -i -r",					1,	0,	0,	NULL},
+};
+
+/* Result of one case and size */
+struct run {
+	enum file_modem result;
+	uint8_t b_intact;		// The receiver got the data, plus padding
+	int peerStatus;			// Exit status of the peer program, -1 if it had to be killed
+	uint64_t us;			// Time the engine took
+	struct fm_stats stats;
+};
+
+/* Options */
+static const char *p_prefix = "";
+static const char *p_kermit = "kermit";
+static double damageRate;
+static uint8_t b_verbose;
+static uint32_t seed = 1;
+
+/* Link */
+static int masterFd = -1;
+static uint8_t b_damageRx, b_damageTx, b_7bitRx;
+static uint8_t u8a_rx[4096], u8a_tx[4096];
+static size_t rxPos, rxLen, txLen;
+
+/* File in memory, for xmodem_receive() */
+static uint8_t *p_got;
+static size_t gotSize, gotCap;
+
+/* --- Link over the pseudo terminal --- */
+
+static uint8_t _damage(uint8_t u8_ch)
+{
+	seed = seed * 1103515245UL + 12345;
+	if ( (seed >> 8) % 1000000 >= (uint32_t)(damageRate * 1000000) )	return u8_ch;
+	return u8_ch ^ (uint8_t)(1 << ((seed >> 4) & 7));
+}
+
+static void _linkFlushTx(void)
+{
+	size_t pos = 0;
+	ssize_t n;
+
+	while (pos < txLen)
+	{
+		n = write(masterFd, &u8a_tx[pos], txLen - pos);
+		if (n < 0)
+		{
+			if (errno == EINTR)	continue;
+			break;
+		}
+		pos += n;
+	}
+	txLen = 0;
+}
+
+static uint8_t _linkRecByte(uint8_t *p_ch, uint16_t u16_timeout)
+{
+	struct pollfd pfd;
+	ssize_t n;
+
+	_linkFlushTx();
+	if (rxPos == rxLen)
+	{
+		pfd.fd = masterFd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, u16_timeout) <= 0)	return 1;
+		n = read(masterFd, u8a_rx, sizeof(u8a_rx));
+		if (n <= 0)	return 1;
+		rxPos = 0;
+		rxLen = n;
+	}
+	*p_ch = u8a_rx[rxPos++];
+	if (b_7bitRx)	*p_ch &= 0x7F;
+	if (b_damageRx)	*p_ch = _damage(*p_ch);
+	return 0;
+}
+
+static void _linkSendByte(uint8_t u8_ch)
+{
+	if (b_damageTx)	u8_ch = _damage(u8_ch);
+	u8a_tx[txLen++] = u8_ch;
+	if (txLen == sizeof(u8a_tx))	_linkFlushTx();
+}
+
+static void _linkFlushRx(void)
+{
+	struct pollfd pfd;
+
+	_linkFlushTx();
+	rxPos = rxLen = 0;
+	pfd.fd = masterFd;
+	pfd.events = POLLIN;
+	while ( (poll(&pfd, 1, 0) > 0) && (read(masterFd, u8a_rx, sizeof(u8a_rx)) > 0) );
+}
+
+/* --- Shims --- */
+
+void _delay_ms(double ms)
+{
+	struct timespec ts;
+
+	_linkFlushTx();
+	ts.tv_sec = (time_t)(ms / 1000);
+	ts.tv_nsec = (long)((ms - ts.tv_sec * 1000.0) * 1000000);
+	nanosleep(&ts, NULL);
+}
+
+static uint64_t _nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t _millis(void)
+{
+	return (uint32_t)(_nowUs() / 1000);
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw)
+{
+	if (fp->fptr + btw > gotCap)
+	{
+		gotCap = (fp->fptr + btw) * 2;
+		p_got = realloc(p_got, gotCap);
+		if (!p_got)	return FR_INT_ERR;
+	}
+	memcpy(&p_got[fp->fptr], buff, btw);
+	fp->fptr += btw;
+	if (fp->fptr > gotSize)	gotSize = fp->fptr;
+	*bw = btw;
+	return FR_OK;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs)
+{
+	fp->fptr = ofs;
+	return FR_OK;
+}
+
+FRESULT f_sync(FIL *fp)
+{
+	(void)fp;
+	return FR_OK;
+}
+
+/* Only used by the tuning cache, the sinks and the file size hints, none of them in here */
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br)
+{
+	(void)fp;
+	(void)buff;
+	(void)btr;
+	*br = 0;
+	return FR_OK;
+}
+
+FRESULT f_truncate(FIL *fp)
+{
+	(void)fp;
+	return FR_OK;
+}
+
+FRESULT f_expand(FIL *fp, FSIZE_t fsz, BYTE opt)
+{
+	(void)fp;
+	(void)fsz;
+	(void)opt;
+	return FR_DENIED;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+	(void)pdrv;
+	(void)cmd;
+	(void)buff;
+	return RES_PARERR;
+}
+
+/* --- Runner --- */
+
+/**
+  * @brief Checks what the receiver got: the data, followed by SUB padding up
+  *        to the end of the last packet at most
+  */
+static uint8_t _intact(const uint8_t *p_data, size_t size, const uint8_t *p_recv, size_t recvSize)
+{
+	size_t i;
+
+	if ( (recvSize < size) || (recvSize - size >= PCK_1K) )	return 0;
+	if (memcmp(p_data, p_recv, size))	return 0;
+	for (i = size; i < recvSize; i++)
+	{
+		if (p_recv[i] != SUB)	return 0;
+	}
+	return 1;
+}
+
+/**
+  * @brief Reads a file written by the peer program
+  */
+static uint8_t *_readFile(const char *p_path, size_t *p_size)
+{
+	struct stat st;
+	uint8_t *p_buf;
+	FILE *fp = fopen(p_path, "rb");
+
+	*p_size = 0;
+	if (!fp)	return NULL;
+	if ( fstat(fileno(fp), &st) || !(p_buf = malloc(st.st_size + 1)) )
+	{
+		fclose(fp);
+		return NULL;
+	}
+	*p_size = fread(p_buf, 1, st.st_size, fp);
+	fclose(fp);
+	return p_buf;
+}
+
+/**
+  * @brief Name of the peer program to run, with the lrzsz prefix or the
+  *        C-Kermit of -K
+  */
+static void _peerProg(const struct peerCase *p_c, char *p_prog, size_t size)
+{
+	if (!strcmp(p_c->p_prog, "kermit"))
+	{
+		snprintf(p_prog, size, "%s", p_kermit);
+	}
+	else
+	{
+		snprintf(p_prog, size, "%s%s", p_prefix, p_c->p_prog);
+	}
+}
+
+/**
+  * @brief Starts the peer program on the slave side of the pseudo terminal
+  *
+  * @return		Process ID, -1 if it couldn't be started (not installed)
+  */
+static pid_t _startPeer(const struct peerCase *p_c, const char *p_dir, const char *p_slave)
+{
+	char prog[256], opt[64];
+	const char *argv[PEER_ARGS + 2];
+	char *p_arg;
+	int argc = 0, fd, null, execPipe[2], err;
+	pid_t pid;
+
+	_peerProg(p_c, prog, sizeof(prog));
+	argv[argc++] = prog;
+	if (p_c->p_opt)
+	{
+		snprintf(opt, sizeof(opt), "%s", p_c->p_opt);
+		for (p_arg = strtok(opt, " "); p_arg && (argc < PEER_ARGS); p_arg = strtok(NULL, " "))
+		{
+			argv[argc++] = p_arg;
+		}
+	}
+	argv[argc++] = p_c->b_weSend ? "out.bin" : "in.bin";
+	argv[argc] = NULL;
+
+	/* The pipe closes on a successful exec, else the child reports the error */
+	if (pipe(execPipe))	return -1;
+	fcntl(execPipe[1], F_SETFD, FD_CLOEXEC);
+	pid = fork();
+	if (pid)
+	{
+		close(execPipe[1]);
+		if ( (pid > 0) && (read(execPipe[0], &err, sizeof(err)) == sizeof(err)) )
+		{
+			waitpid(pid, NULL, 0);
+			pid = -1;
+		}
+		close(execPipe[0]);
+		return pid;
+	}
+
+	/* Child: The pseudo terminal becomes its controlling terminal, stdin and stdout */
+	close(execPipe[0]);
+	close(masterFd);
+	setsid();
+	fd = open(p_slave, O_RDWR);
+	if ( (fd >= 0) && !chdir(p_dir) )
+	{
+		dup2(fd, 0);
+		dup2(fd, 1);
+		if (!b_verbose && ((null = open("/dev/null", O_WRONLY)) >= 0))	dup2(null, 2);
+		execvp(prog, (char *const *)argv);
+	}
+	err = errno;
+	if (write(execPipe[1], &err, sizeof(err)) < 0)	_exit(127);
+	_exit(127);
+}
+
+/**
+  * @brief Waits for the peer program to exit, kills it if it doesn't
+  *
+  * @return		Exit status, -1 if killed
+  */
+static int _waitPeer(pid_t pid)
+{
+	uint32_t u32_waited;
+	int status;
+
+	for (u32_waited = 0; u32_waited < PEER_WAIT; u32_waited += 10)
+	{
+		if (waitpid(pid, &status, WNOHANG) == pid)
+		{
+			return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+		}
+		_linkFlushRx();
+		_delay_ms(10);
+	}
+	kill(pid, SIGKILL);
+	waitpid(pid, &status, 0);
+	return -1;
+}
+
+static void _runCase(const struct peerCase *p_c, const uint8_t *p_data, size_t size, struct run *p_r)
+{
+	char dir[] = "/tmp/fm_interop.XXXXXX";
+	char path[64];
+	struct termios tio;
+	FATFS fs;
+	FIL file;
+	FSIZE_t maxSize;
+	FILE *fp;
+	uint8_t *p_recv;
+	size_t recvSize;
+	uint64_t start;
+	int slaveFd;
+	pid_t pid;
+
+	memset(p_r, 0, sizeof(*p_r));
+	p_r->result = FM_INVALID_START;
+	p_r->peerStatus = -1;
+	if (!mkdtemp(dir))	return;
+
+	/* The data to send, a file for sx and kermit */
+	snprintf(path, sizeof(path), "%s/in.bin", dir);
+	if ( !(fp = fopen(path, "wb")) || (fwrite(p_data, 1, size, fp) != size) )
+	{
+		if (fp)	fclose(fp);
+		goto cleanup;
+	}
+	fclose(fp);
+
+	/* Raw pseudo terminal. The slave stays open here as well, so the master
+	 * doesn't see a hangup before the program opened it */
+	masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+	if ( (masterFd < 0) || grantpt(masterFd) || unlockpt(masterFd) )	goto cleanup;
+	slaveFd = open(ptsname(masterFd), O_RDWR | O_NOCTTY);
+	if (slaveFd < 0)	goto cleanup;
+	tcgetattr(slaveFd, &tio);
+	tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF);
+	tio.c_oflag &= ~OPOST;
+	tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	tio.c_cflag &= ~(CSIZE | PARENB);
+	tio.c_cflag |= CS8;
+	tcsetattr(slaveFd, TCSANOW, &tio);
+
+	rxPos = rxLen = txLen = 0;
+	gotSize = 0;
+	b_damageRx = !p_c->b_weSend && (damageRate > 0);
+	b_damageTx = p_c->b_weSend && (damageRate > 0);
+	b_7bitRx = p_c->b_7bit;
+	memset(&fs, 0, sizeof(fs));
+	memset(&file, 0, sizeof(file));
+	fs.fs_type = FS_FAT32;
+	file.obj.fs = &fs;
+	maxSize = (FSIZE_t)size + 2 * PCK_1K;
+
+	pid = _startPeer(p_c, dir, ptsname(masterFd));
+	if (pid < 0)
+	{
+		p_r->peerStatus = 127;
+		close(slaveFd);
+		goto cleanup;
+	}
+
+	_delay_ms(PEER_START);
+	file_modem_init(_linkRecByte, _linkSendByte, _linkFlushRx);
+	file_modem_stats(&p_r->stats, _millis);
+	start = _nowUs();
+	if (p_c->b_weSend)
+	{
+		p_r->result = xmodem_send_memory(p_data, (FSIZE_t)size);
+	}
+	else
+	{
+		p_r->result = p_c->p_receive(&file, &maxSize);
+	}
+	_linkFlushTx();
+	p_r->us = _nowUs() - start;
+	file_modem_stats(NULL, NULL);
+
+	p_r->peerStatus = _waitPeer(pid);
+	close(slaveFd);
+
+	/* Compare what arrived */
+	if (p_c->b_weSend)
+	{
+		snprintf(path, sizeof(path), "%s/out.bin", dir);
+		p_recv = _readFile(path, &recvSize);
+		p_r->b_intact = p_recv && _intact(p_data, size, p_recv, recvSize);
+		free(p_recv);
+	}
+	else
+	{
+		p_r->b_intact = _intact(p_data, size, p_got, gotSize);
+	}
+
+cleanup:
+	if (masterFd >= 0)	close(masterFd);
+	masterFd = -1;
+	snprintf(path, sizeof(path), "%s/in.bin", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/out.bin", dir);
+	unlink(path);
+	rmdir(dir);
+}
+
+static void _usage(const char *p_name)
+{
+	printf("Usage: %s [options] [case ...]\n"
+		"  -n sizes     File sizes in Bytes, comma separated (1000,100000)\n"
+		"  -e rate      Damage Bytes on the way to the receiver with this probability (0)\n"
+		"  -P prefix    Prefix of the lrzsz programs, e.g. l for lsx / lrx\n"
+		"  -K program   C-Kermit to run (kermit)\n"
+		"  -s seed      Seed for the data and the damage (1)\n"
+		"  -v           Show the messages of the peer programs\n"
+		"Cases are the peer programs: sx, rx, sb, sz, rb, rz, kermit (all)\n", p_name);
+}
+
+int main(int argc, char **argv)
+{
+	const struct peerCase *p_c;
+	const char *p_sizes = "1000,100000";
+	char *p_end;
+	struct run r;
+	uint8_t *p_data;
+	size_t size, i, j;
+	uint32_t u32_seed;
+	uint8_t b_failed = 0, b_selected;
+	int opt, arg;
+	char prog[256];
+
+	while ((opt = getopt(argc, argv, "n:e:P:K:s:vh")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n':	p_sizes = optarg;						break;
+			case 'e':	damageRate = strtod(optarg, NULL);		break;
+			case 'P':	p_prefix = optarg;						break;
+			case 'K':	p_kermit = optarg;						break;
+			case 's':	seed = strtoul(optarg, NULL, 0);		break;
+			case 'v':	b_verbose = 1;							break;
+			default:
+				_usage(argv[0]);
+				return 1;
+		}
+	}
+	signal(SIGPIPE, SIG_IGN);
+	u32_seed = seed;
+
+	printf("%-20s %9s  %-14s %-6s %8s %8s %7s %7s %6s %8s  %s\n", "Case", "Size", "Result", "Data",
+		"Time [s]", "kB/s", "Packets", "Retries", "Errors", "Timeouts", "Peer exit");
+	for (i = 0; i < sizeof(_cases) / sizeof(_cases[0]); i++)
+	{
+		p_c = &_cases[i];
+		b_selected = (optind == argc);
+		for (arg = optind; arg < argc; arg++)
+		{
+			if (!strcmp(argv[arg], p_c->p_prog))	b_selected = 1;
+		}
+		if (!b_selected)	continue;
+
+		if (!p_c->b_supported)
+		{
+			printf("%-20s %9s  not supported, the library has no counterpart\n", p_c->p_name, "-");
+			continue;
+		}
+
+		for (p_end = (char *)p_sizes; *p_end; )
+		{
+			size = strtoul(p_end, &p_end, 0);
+			if (*p_end == ',')	p_end++;
+			if (!size)	continue;
+
+			/* Same data for every case */
+			seed = u32_seed;
+			p_data = malloc(size);
+			if (!p_data)	return 1;
+			for (j = 0; j < size; j++)
+			{
+				seed = seed * 1103515245UL + 12345;
+				p_data[j] = (uint8_t)(seed >> 16);
+			}
+
+			_runCase(p_c, p_data, size, &r);
+			free(p_data);
+
+			printf("%-20s %9lu  %-14s %-6s %8.2f %8.1f %7lu %7lu %6lu %8lu  ", p_c->p_name, (unsigned long)size,
+				_resultNames[r.result], r.b_intact ? "intact" : "BAD", r.us / 1e6,
+				r.us ? size / (r.us / 1e6) / 1e3 : 0.0, (unsigned long)r.stats.packets,
+				(unsigned long)r.stats.retries, (unsigned long)r.stats.errors, (unsigned long)r.stats.timeouts);
+			if (r.peerStatus < 0)
+			{
+				printf("killed\n");
+			}
+			else if (r.peerStatus == 127)
+			{
+				_peerProg(p_c, prog, sizeof(prog));
+				printf("%s not found\n", prog);
+			}
+			else
+			{
+				printf("%d\n", r.peerStatus);
+			}
+			if ( (r.result != FM_OK) || !r.b_intact || r.peerStatus )	b_failed = 1;
+		}
+	}
+	free(p_got);
+	return b_failed;
+}
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# fm_interop.sh
+#
+# Builds tools/fm_interop.c together with the library for the host and runs it.
+# Only ff.h, ffconf.h and diskio.h of FatFs are needed, fm_interop replaces the
+# few FatFs functions the receivers call. _delay_ms comes from fm_interop as
+# well, a util/delay.h declaring it is generated. The lrzsz programs and
+# C-Kermit (kermit, or the program of -K) have to be in the PATH.
+#
+# Usage:	FATFS_DIR=path/to/fatfs/source tools/fm_interop.sh [fm_interop options]
+# Env:		CC (gcc), CFLAGS (-O2), e.g. CFLAGS="-O2 -DXMODEM_FILL_EXT" to see
+#			what asking lrzsz for fill records costs
+#
+# Created: 18.10.2026 23:20:37
+#  Author: gfcwfzkm
+#
+
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+
+SRC_DIR=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ -z "$FATFS_DIR" ] || [ ! -f "$FATFS_DIR/ff.h" ] || [ ! -f "$FATFS_DIR/diskio.h" ]; then
+	echo "FATFS_DIR has to point to the directory holding ff.h, ffconf.h and diskio.h" >&2
+	exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/util"
+echo "void _delay_ms(double __ms);" > "$WORK/util/delay.h"
+
+"$CC" $CFLAGS -I"$WORK" -I"$SRC_DIR" -I"$FATFS_DIR" -o "$WORK/fm_interop" \
+	"$SRC_DIR/tools/fm_interop.c" "$SRC_DIR"/*.c || exit 1
+"$WORK/fm_interop" "$@"
@@ -0,0 +1,276 @@
+/*
+ * fm_scanbench.c
+ *
+ * Measures the scanning kernel of the codecs (_fm_span() in fm_scan.c)
+ * against the Byte by Byte loops it replaced, the way the codecs use it:
+ *   cobs		N-Modem sender, runs up to the next zero, at most 254 Bytes
+ *   kermit		Kermit decoder, runs up to the next control prefix or repeat
+ *				prefix within a data field of -f Bytes
+ * on three kinds of data: random Bytes, text (a prefix every ~60 Bytes) and
+ * control heavy data (every 8th Byte on average is one the codec looks for).
+ * Both loops have to find the same positions, otherwise the tool exits
+ * with 1.
+ *
+ * Per case it reports MB/s of the reference and the kernel, the speedup and,
+ * on x86, Bytes per TSC cycle of the kernel. Only fm_scan.c is linked, the
+ * header of the library needs ff.h and ffconf.h of FatFs.
+ *
+ * Usage:	fm_scanbench [options], see _usage() or run with -h
+ *
+ * Created: 19.10.2026 12:04:51
+ *  Author: gfcwfzkm
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "file_modem_int.h"
+/* Before x86intrin.h, which may define __SSE2__ for its own functions */
+#if defined(__SSE2__)
+#define SB_KERNEL	"SSE2, 16 Bytes at once"
+#else
+#define SB_KERNEL	"SWAR, a machine word at once"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SB_TSC	1
+#endif
+
+#define QCTL	'#'
+#define REPT	'~'
+
+enum data {DATA_RANDOM, DATA_TEXT, DATA_CONTROL};
+
+static const char *const _dataNames[] = {"random", "text", "control"};
+
+static uint8_t *p_data;
+static uint32_t dataSize = 1UL << 20;
+static uint16_t fieldSize = 1024;
+static uint32_t rounds = 64;
+
+/* ----- Data ----- */
+
+static uint32_t _rand(uint32_t *p_state)
+{
+	/* xorshift32, the same data on every host */
+	*p_state ^= *p_state << 13;
+	*p_state ^= *p_state >> 17;
+	*p_state ^= *p_state << 5;
+	return *p_state;
+}
+
+/**
+  * @brief Fills the buffer with one kind of data
+  *
+  * Text and control heavy data hold zeros and prefixes at the same rate, so
+  * both codecs see the same density of Bytes to stop at.
+  */
+static void _fill(enum data kind)
+{
+	static const uint8_t u8a_stop[] = {0, QCTL, REPT};
+	uint32_t u32_state = 0x2545F491UL, u32_rnd, i;
+
+	for (i = 0; i < dataSize; i++)
+	{
+		u32_rnd = _rand(&u32_state);
+		switch (kind)
+		{
+			case DATA_RANDOM:
+				p_data[i] = (uint8_t)u32_rnd;
+				break;
+			case DATA_TEXT:
+				/* Printable, but not the prefixes */
+				p_data[i] = (uint8_t)('A' + (u32_rnd % 58));
+				if (!((u32_rnd >> 8) % 60))	p_data[i] = u8a_stop[(u32_rnd >> 16) % 3];
+				break;
+			case DATA_CONTROL:
+				p_data[i] = ((u32_rnd >> 8) & 7) ? (uint8_t)(0x80 | u32_rnd) : u8a_stop[(u32_rnd >> 16) % 3];
+				break;
+		}
+	}
+}
+
+/* ----- Scans ----- */
+
+/* Byte by Byte, as the codecs did before */
+static uint16_t _refSpan(const uint8_t *p_buf, uint16_t u16_len, uint8_t u8_a, uint8_t u8_b, uint8_t u8_c)
+{
+	uint16_t u16_pos = 0;
+
+	while ( (u16_pos < u16_len) && (p_buf[u16_pos] != u8_a) && (p_buf[u16_pos] != u8_b) &&
+		(p_buf[u16_pos] != u8_c) )
+	{
+		u16_pos++;
+	}
+	return u16_pos;
+}
+
+typedef uint16_t (*span_fn)(const uint8_t*, uint16_t, uint8_t, uint8_t, uint8_t);
+
+/**
+  * @brief Walks the data like the COBS encoder: runs up to a zero, at most 254 Bytes
+  *
+  * @return		Sum of the run lengths and positions, to compare both scans
+  */
+static uint64_t _scanCobs(span_fn span)
+{
+	uint64_t u64_sum = 0;
+	uint32_t u32_pos = 0;
+	uint16_t u16_run, u16_max;
+
+	while (u32_pos < dataSize)
+	{
+		u16_max = (dataSize - u32_pos > 254) ? 254 : (uint16_t)(dataSize - u32_pos);
+		u16_run = span(&p_data[u32_pos], u16_max, 0, 0, 0);
+		u64_sum += u16_run ^ u32_pos;
+		/* The zero is replaced by the code Byte, a full run has none */
+		u32_pos += u16_run + (u16_run < u16_max);
+	}
+	return u64_sum;
+}
+
+/**
+  * @brief Walks the data like the Kermit decoder: data fields, runs up to a prefix
+  */
+static uint64_t _scanKermit(span_fn span)
+{
+	uint64_t u64_sum = 0;
+	uint32_t u32_field, u32_pos, u32_end;
+	uint16_t u16_run;
+
+	for (u32_field = 0; u32_field < dataSize; u32_field += fieldSize)
+	{
+		u32_end = (dataSize - u32_field > fieldSize) ? u32_field + fieldSize : dataSize;
+		for (u32_pos = u32_field; u32_pos < u32_end; u32_pos += u16_run + 2)
+		{
+			/* Skips the prefix and the Byte it applies to */
+			u16_run = span(&p_data[u32_pos], (uint16_t)(u32_end - u32_pos), QCTL, REPT, QCTL);
+			u64_sum += u16_run ^ u32_pos;
+		}
+	}
+	return u64_sum;
+}
+
+static uint64_t _cpuNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t _cycles(void)
+{
+#ifdef SB_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* Result of timing one scan */
+struct timing {
+	uint64_t ns;
+	uint64_t cycles;
+	uint64_t sum;
+};
+
+/**
+  * @brief Times a scan, the lowest of a few repetitions of all rounds
+  */
+static void _time(uint64_t (*scan)(span_fn), span_fn span, struct timing *p_t)
+{
+	struct timing t;
+	uint32_t u32_rep, u32_round;
+
+	for (u32_rep = 0; u32_rep < 3; u32_rep++)
+	{
+		t.sum = 0;
+		t.ns = _cpuNs();
+		t.cycles = _cycles();
+		for (u32_round = 0; u32_round < rounds; u32_round++)
+		{
+			t.sum += scan(span);
+		}
+		t.cycles = _cycles() - t.cycles;
+		t.ns = _cpuNs() - t.ns;
+		if (!u32_rep || (t.ns < p_t->ns))	*p_t = t;
+	}
+}
+
+static void _usage(const char *p_name)
+{
+	printf("Usage: %s [options]\n"
+		"  -m KiB       Data scanned per round (1024)\n"
+		"  -f Bytes     Kermit data field (1024)\n"
+		"  -n rounds    Rounds per measurement, the time is the lowest of 3 (64)\n", p_name);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct {
+		const char *p_name;
+		uint64_t (*scan)(span_fn);
+	} cases[] = {
+		{"cobs", _scanCobs},
+		{"kermit", _scanKermit},
+	};
+	struct timing ref, fast;
+	double mb;
+	uint8_t b_failed = 0;
+	int opt, kind;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "m:f:n:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'm':	dataSize = strtoul(optarg, NULL, 0) << 10;			break;
+			case 'f':	fieldSize = (uint16_t)strtoul(optarg, NULL, 0);	break;
+			case 'n':	rounds = strtoul(optarg, NULL, 0);					break;
+			default:
+				_usage(argv[0]);
+				return 1;
+		}
+	}
+	if (!dataSize || (fieldSize < 3) || !rounds)
+	{
+		_usage(argv[0]);
+		return 1;
+	}
+	p_data = malloc(dataSize);
+	if (!p_data)
+	{
+		printf("No memory for the data\n");
+		return 1;
+	}
+
+	mb = (double)dataSize * rounds / 1e6;
+	printf("Kernel: %s\n", SB_KERNEL);
+	printf("%-8s %-8s %10s %10s %8s %10s\n", "Codec", "Data", "Ref MB/s", "Span MB/s", "Speedup", "B/cycle");
+	for (kind = DATA_RANDOM; kind <= DATA_CONTROL; kind++)
+	{
+		_fill((enum data)kind);
+		for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+		{
+			_time(cases[i].scan, _refSpan, &ref);
+			_time(cases[i].scan, _fm_span, &fast);
+			printf("%-8s %-8s ", cases[i].p_name, _dataNames[kind]);
+			if (ref.sum != fast.sum)
+			{
+				printf("MISMATCH\n");
+				b_failed = 1;
+				continue;
+			}
+			printf("%10.1f %10.1f %7.1fx ", mb / (ref.ns / 1e9), mb / (fast.ns / 1e9), (double)ref.ns / fast.ns);
+			if (fast.cycles)	printf("%10.2f\n", (double)dataSize * rounds / fast.cycles);
+			else				printf("%10s\n", "-");
+		}
+	}
+	free(p_data);
+	return b_failed;
+}
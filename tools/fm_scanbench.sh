@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# fm_scanbench.sh
+#
+# Builds tools/fm_scanbench.c with fm_scan.c for the host and runs it. Only
+# ff.h and ffconf.h of FatFs are needed, for the header of the library.
+#
+# Usage:	FATFS_DIR=path/to/fatfs/source tools/fm_scanbench.sh [fm_scanbench options]
+# Env:		CC (gcc), CFLAGS (-O2), e.g. CFLAGS="-O2 -U__SSE2__" on x86 for the
+#			SWAR kernel
+#
+# Created: 19.10.2026 12:31:07
+#  Author: gfcwfzkm
+#
+
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+
+SRC_DIR=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ -z "$FATFS_DIR" ] || [ ! -f "$FATFS_DIR/ff.h" ]; then
+	echo "FATFS_DIR has to point to the directory holding ff.h and ffconf.h" >&2
+	exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+"$CC" $CFLAGS -I"$SRC_DIR" -I"$FATFS_DIR" -o "$WORK/fm_scanbench" \
+	"$SRC_DIR/tools/fm_scanbench.c" "$SRC_DIR/fm_scan.c" || exit 1
+"$WORK/fm_scanbench" "$@"
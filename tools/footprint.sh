@@ -0,0 +1,161 @@
+#!/bin/sh
+#
+# footprint.sh
+#
+# Reports the memory footprint of the file modem for every configuration
+# profile: code size (flash), static RAM (.data + .bss, e.g. u8a_workbuf and
+# the kermit window) and the worst-case stack depth of every receive and send
+# function, including the callbacks and FatFs.
+#
+# The stack depth is taken from the call graph gcc writes with
+# -fcallgraph-info=su (gcc 10 or newer). Calls through the function pointers
+# (recByte, sendByte, flushRx) are counted with CALLBACK_STACK Bytes. Functions
+# gcc doesn't know the size of (diskio, libc) are listed and counted with
+# EXTERN_STACK Bytes. If FATFS_DIR contains ff.c, FatFs is part of the graph.
+# The write and sync functions of the sinks (dedup, pack, journal) are listed
+# on their own, a receiver writing to a sink needs its own depth plus theirs
+# instead of CALLBACK_STACK.
+#
+# Usage:	FATFS_DIR=path/to/fatfs/source tools/footprint.sh [profile ...]
+# Env:		CC (avr-gcc), SIZE (avr-size), NM (avr-nm), MCU (atmega1284p),
+#			ARCH (-mmcu=$MCU), F_CPU (16000000), CFLAGS (-Os), CALLBACK_STACK (16),
+#			EXTERN_STACK (0)
+#
+# Created: 18.10.2026 15:40:03
+#  Author: gfcwfzkm
+#
+
+CC=${CC:-avr-gcc}
+SIZE=${SIZE:-avr-size}
+NM=${NM:-avr-nm}
+MCU=${MCU:-atmega1284p}
+ARCH=${ARCH--mmcu=$MCU}
+F_CPU=${F_CPU:-16000000}
+CFLAGS=${CFLAGS:--Os}
+CALLBACK_STACK=${CALLBACK_STACK:-16}
+EXTERN_STACK=${EXTERN_STACK:-0}
+
+SRC_DIR=$(cd "$(dirname "$0")/.." && pwd)
+ENGINES="file_modem nmodem kermit fm_stats fm_sched fm_sink fm_pool fm_scan fm_dedup fm_pack fm_peer fm_journal"
+ENTRIES="xmodem_receive nmodem_receive kermit_receive nmodem_resume nmodem_probe xmodem_send_stream xmodem_send_memory
+	fm_dedup.c:_dedupWrite fm_dedup.c:_dedupSync fm_dedup_restore fm_pack.c:_packWrite fm_pack.c:_packSync fm_pack_read
+	fm_journal.c:_journalWrite fm_journal.c:_journalSync fm_journal_open fm_peer_begin fm_peer_end"
+
+# Configuration profiles: name and the defines that make them up
+profile_flags()
+{
+	case "$1" in
+		default)	echo "" ;;
+		fill)		echo "-DXMODEM_FILL_EXT" ;;
+		small)		echo "-DNMODEM_WINDOW=2 -DNMODEM_PACKET=256 -DKERMIT_WINDOW=1 -DKERMIT_MAXL=94" ;;
+		large)		echo "-DXMODEM_FILL_EXT -DNMODEM_WINDOW=32 -DKERMIT_WINDOW=8" ;;
+		*)			return 1 ;;
+	esac
+}
+PROFILES=${*:-"default fill small large"}
+
+if [ -z "$FATFS_DIR" ] || [ ! -f "$FATFS_DIR/ff.h" ]; then
+	echo "FATFS_DIR has to point to the directory holding ff.h and ffconf.h" >&2
+	exit 1
+fi
+if ! command -v "$CC" >/dev/null 2>&1; then
+	echo "$CC not found, set CC" >&2
+	exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+for PROFILE in $PROFILES; do
+	if ! FLAGS=$(profile_flags "$PROFILE"); then
+		echo "Unknown profile $PROFILE" >&2
+		exit 1
+	fi
+	OUT="$WORK/$PROFILE"
+	mkdir -p "$OUT"
+
+	OBJS=""
+	for SRC in $ENGINES; do
+		"$CC" $ARCH -DF_CPU="$F_CPU"UL $CFLAGS $FLAGS -ffunction-sections \
+			-fcallgraph-info=su -I"$SRC_DIR" -I"$FATFS_DIR" \
+			-c "$SRC_DIR/$SRC.c" -o "$OUT/$SRC.o" || exit 1
+		OBJS="$OBJS $OUT/$SRC.o"
+	done
+	if [ -f "$FATFS_DIR/ff.c" ]; then
+		"$CC" $ARCH -DF_CPU="$F_CPU"UL $CFLAGS -fcallgraph-info=su \
+			-I"$FATFS_DIR" -c "$FATFS_DIR/ff.c" -o "$OUT/ff.o" || exit 1
+	fi
+
+	echo "=== Profile: $PROFILE ${FLAGS:+($FLAGS)}"
+	echo
+	echo "Flash / static RAM per object (file_modem.o and the fm_*.o are shared by the engines):"
+	"$SIZE" $OBJS | sed "s#$OUT/##"
+	echo
+	echo "Largest static RAM users:"
+	"$NM" --size-sort -S $OBJS 2>/dev/null | awk '
+		function hex(s,    i, v) {
+			v = 0
+			for (i = 1; i <= length(s); i++)	v = v * 16 + index("0123456789abcdef", tolower(substr(s, i, 1))) - 1
+			return v
+		}
+		$3 ~ /^[bBdD]$/ { printf "  %-24s %6d Bytes\n", $4, hex($2) }' | sort -n -k2 | tail -n 5
+	echo
+	echo "Worst-case stack, callbacks counted with $CALLBACK_STACK Bytes:"
+	cat "$OUT"/*.ci | awk -v entries="$ENTRIES" -v cbStack="$CALLBACK_STACK" -v extStack="$EXTERN_STACK" '
+		function str(line, key,    s) {
+			if (!match(line, key ": \"[^\"]*\""))	return ""
+			s = substr(line, RSTART + length(key) + 3, RLENGTH - length(key) - 4)
+			return s
+		}
+		/^node:/ {
+			t = str($0, "title")
+			if (match($0, /[0-9]+ bytes/))	frame[t] = substr($0, RSTART, RLENGTH) + 0
+		}
+		/^edge:/ {
+			s = str($0, "sourcename"); d = str($0, "targetname")
+			if (!((s, d) in seen)) {
+				seen[s, d] = 1
+				callee[s] = callee[s] " " d
+			}
+		}
+		# Deepest stack below a function, path through the deepest callee
+		function depth(f,    n, i, list, d, best, bestPath, name) {
+			if (f in memo)		return memo[f]
+			if (f in onStack)	{ recursive = recursive " " f; return 0 }
+			if (f == "__indirect_call") { memo[f] = cbStack; path[f] = "callback"; return cbStack }
+			if (!(f in frame)) {
+				unknown[f] = 1
+				memo[f] = extStack; path[f] = f "?"
+				return extStack
+			}
+			onStack[f] = 1
+			best = 0; bestPath = ""
+			n = split(callee[f], list, " ")
+			for (i = 1; i <= n; i++) {
+				d = depth(list[i])
+				if (d > best) { best = d; bestPath = path[list[i]] }
+			}
+			delete onStack[f]
+			memo[f] = frame[f] + best
+			name = f
+			sub(/^.*:/, "", name)
+			path[f] = name (bestPath != "" ? " > " bestPath : "")
+			return memo[f]
+		}
+		END {
+			n = split(entries, e, " ")
+			for (i = 1; i <= n; i++) {
+				# Static functions: file:function, the graph names them by the full path
+				f = e[i]
+				if (index(f, ":"))
+					for (t in frame)	if (substr(t, length(t) - length(f)) == "/" f)	f = t
+				name = e[i]
+				sub(/^.*:/, "", name)
+				printf "  %-18s %5d Bytes  (%s)\n", name, depth(f), path[f]
+			}
+			for (f in unknown)	u = u " " f
+			if (u != "")			printf "  Unknown stack usage, counted with %d Bytes:%s\n", extStack, u
+			if (recursive != "")	printf "  Recursion, not counted:%s\n", recursive
+		}'
+	echo
+done
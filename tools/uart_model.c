@@ -0,0 +1,371 @@
+/*
+ * uart_model.c
+ *
+ * Virtual UART for overrun analysis of the file_modem receivers. Runs on the
+ * host, not on the target: A sender streams packets at a given baud rate into
+ * a hardware FIFO, which is either polled directly by recByte or emptied into
+ * a ring buffer by the RX interrupt. The receiver spends some cycles on every
+ * byte and is busy after every packet (f_write, f_sync, _delay_ms, ...), with
+ * the interrupts optionally disabled for a part of that time (SD card drivers
+ * often do so). Every byte that finds the FIFO or the ring buffer full is
+ * counted as overrun.
+ *
+ * The numbers for the busy windows have to be measured on the real target,
+ * for example by toggling a pin around f_write and looking at it with a scope.
+ *
+ * Build:	gcc -O2 -o uart_model uart_model.c
+ * Usage:	uart_model [options], see _usage() or run with -h
+ *
+ * Created: 18.10.2026 14:12:37
+ *  Author: gfcwfzkm
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+#define NEVER	UINT64_MAX
+
+/* Configuration of the modelled target and link */
+struct uart_cfg {
+	uint32_t cpuHz;			// CPU clock of the target
+	uint32_t baud;			// Baud rate of the link, 10 bits per byte (8N1)
+	uint16_t fifo;			// Depth of the UART hardware receive FIFO (2 on AVR)
+	uint16_t ring;			// Size of the software ring buffer, 0 if recByte polls the UART
+	uint32_t isrLatency;	// Cycles from a byte arriving until the RX interrupt runs
+	uint32_t isrByte;		// Cycles the RX interrupt needs per byte
+	uint32_t byteCycles;	// Cycles the receiver needs per byte (recByte, CRC, copy)
+	uint32_t busyCycles;	// Cycles the receiver is busy after each packet
+	uint32_t irqOffCycles;	// Part of busyCycles with the interrupts disabled
+	uint16_t payload;		// Payload Bytes per packet
+	uint16_t overhead;		// Header, check and framing Bytes per packet
+	uint16_t ackBytes;		// Bytes of the acknowledge sent back for every packet
+	uint32_t turnaround;	// Cycles the sender needs to react on an acknowledge
+	uint16_t window;		// Packets the sender may send before waiting for an acknowledge
+	uint32_t packets;		// Amount of packets to simulate
+};
+
+/* Result of one simulation run */
+struct uart_res {
+	uint32_t overruns;		// Bytes lost in total
+	uint32_t fifoOverruns;	// ... because the hardware FIFO was full
+	uint32_t ringOverruns;	// ... because the ring buffer was full
+	uint16_t fifoMax;		// Highest fill level of the hardware FIFO
+	uint16_t ringMax;		// Highest fill level of the ring buffer
+	uint64_t cycles;		// Duration of the transfer in cycles
+};
+
+enum cpuState {CPU_WAIT, CPU_BYTE, CPU_BUSY};
+
+/**
+  * @brief Converts a baud rate into the cycles one 8N1 byte takes on the wire
+  */
+static uint64_t _byteTime(const struct uart_cfg *p_cfg, uint32_t u32_baud)
+{
+	return ((uint64_t)p_cfg->cpuHz * 10 + u32_baud - 1) / u32_baud;
+}
+
+static uint64_t _min(uint64_t a, uint64_t b)
+{
+	return (a < b) ? a : b;
+}
+
+/**
+  * @brief Runs the event driven simulation of one transfer
+  *
+  * Events are the end of a byte on the wire, the RX interrupt, the receiver
+  * being done with a byte or a packet and an acknowledge reaching the sender.
+  * Interrupt cycles are stolen from whatever the receiver does at that time.
+  *
+  * @param p_cfg	Configuration to simulate
+  * @param u32_baud	Baud rate to use instead of p_cfg->baud
+  * @param p_res	Results of the run
+  */
+static void _simulate(const struct uart_cfg *p_cfg, uint32_t u32_baud, struct uart_res *p_res)
+{
+	uint64_t byteTime = _byteTime(p_cfg, u32_baud);
+	uint32_t pckLen = p_cfg->payload + p_cfg->overhead;
+	uint64_t now = 0;
+	uint64_t tArrive = byteTime;	// Next byte fully received by the UART
+	uint64_t tIsr = NEVER;			// Next run of the RX interrupt
+	uint64_t tCpu = NEVER;			// Receiver done with the current byte or packet
+	uint64_t tIrqOn = 0;			// Interrupts are disabled until then
+	uint64_t *p_tAck;				// Acknowledges on their way back to the sender
+	uint32_t ackHead = 0, ackTail = 0;
+	uint32_t sentPck = 0, sentByte = 0, inFlight = 0;
+	uint32_t donePck = 0, doneByte = 0;
+	uint32_t fifo = 0, ring = 0, lost = 0;
+	enum cpuState cpu = CPU_WAIT;
+
+	memset(p_res, 0, sizeof(struct uart_res));
+	p_tAck = malloc(sizeof(uint64_t) * (p_cfg->window + 1));
+	if (p_tAck == NULL)	exit(1);
+
+	while (donePck < p_cfg->packets)
+	{
+		uint64_t tAck = (ackHead != ackTail) ? p_tAck[ackTail] : NEVER;
+
+		now = _min(_min(tArrive, tIsr), _min(tCpu, tAck));
+		if (now == NEVER)	break;
+
+		if (now == tAck)
+		{
+			/* Acknowledge reached the sender, it may continue if it was stalled */
+			ackTail = (ackTail + 1) % (p_cfg->window + 1);
+			inFlight--;
+			if ( (tArrive == NEVER) && (sentPck < p_cfg->packets) )
+			{
+				tArrive = now + byteTime;
+			}
+		}
+		else if (now == tArrive)
+		{
+			/* A byte is complete on the wire */
+			if (fifo < p_cfg->fifo)
+			{
+				fifo++;
+				if (fifo > p_res->fifoMax)	p_res->fifoMax = fifo;
+				if ( p_cfg->ring && (tIsr == NEVER) )
+				{
+					tIsr = now + p_cfg->isrLatency;
+					if (tIsr < tIrqOn)	tIsr = tIrqOn;
+				}
+			}
+			else
+			{
+				p_res->fifoOverruns++;
+				lost++;
+			}
+
+			if (++sentByte == pckLen)
+			{
+				sentByte = 0;
+				sentPck++;
+				inFlight++;
+			}
+			if ( (sentPck < p_cfg->packets) && (inFlight < p_cfg->window) )
+			{
+				tArrive = now + byteTime;
+			}
+			else
+			{
+				tArrive = NEVER;
+			}
+		}
+		else if (now == tIsr)
+		{
+			/* RX interrupt moves the FIFO into the ring buffer */
+			uint32_t moved = fifo;
+
+			while (fifo)
+			{
+				fifo--;
+				if (ring < p_cfg->ring)
+				{
+					ring++;
+					if (ring > p_res->ringMax)	p_res->ringMax = ring;
+				}
+				else
+				{
+					p_res->ringOverruns++;
+					lost++;
+				}
+			}
+			tIsr = NEVER;
+			if (tCpu != NEVER)	tCpu += (uint64_t)p_cfg->isrByte * moved;
+		}
+		else
+		{
+			/* Receiver is done with a byte or a packet */
+			if (cpu == CPU_BUSY)
+			{
+				/* Packet processed, acknowledge it */
+				p_tAck[ackHead] = now + (uint64_t)p_cfg->ackBytes * byteTime + p_cfg->turnaround;
+				ackHead = (ackHead + 1) % (p_cfg->window + 1);
+				donePck++;
+			}
+			else if (++doneByte == pckLen)
+			{
+				/* Last byte of the packet, busy time starts */
+				doneByte = 0;
+				cpu = CPU_BUSY;
+				tCpu = now + p_cfg->busyCycles;
+				tIrqOn = now + p_cfg->irqOffCycles;
+				if ( (tIsr != NEVER) && (tIsr < tIrqOn) )	tIsr = tIrqOn;
+				continue;
+			}
+			cpu = CPU_WAIT;
+			tCpu = NEVER;
+		}
+
+		/* Lost bytes are still part of the packet, the receiver would fail its check.
+		 * They are consumed without costing anything to keep the packets in sync */
+		if (cpu == CPU_WAIT)
+		{
+			if (lost)
+			{
+				lost--;
+				cpu = CPU_BYTE;
+				tCpu = now;
+			}
+			else if (p_cfg->ring ? (ring != 0) : (fifo != 0))
+			{
+				if (p_cfg->ring)
+				{
+					ring--;
+				}
+				else
+				{
+					fifo--;
+				}
+				cpu = CPU_BYTE;
+				tCpu = now + p_cfg->byteCycles;
+			}
+		}
+	}
+
+	free(p_tAck);
+	p_res->overruns = p_res->fifoOverruns + p_res->ringOverruns;
+	p_res->cycles = now;
+}
+
+/**
+  * @brief Searches the highest baud rate that doesn't lose a single byte
+  *
+  * Binary search, assumes that no rate above one that loses bytes works again.
+  *
+  * @return		Highest sustainable baud rate, 0 if not even 300 baud work
+  */
+static uint32_t _maxBaud(const struct uart_cfg *p_cfg)
+{
+	struct uart_res res;
+	uint32_t lo = 300, hi = p_cfg->cpuHz, mid;
+
+	_simulate(p_cfg, lo, &res);
+	if (res.overruns)	return 0;
+	_simulate(p_cfg, hi, &res);
+	if (!res.overruns)	return hi;
+
+	while (lo + 1 < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		_simulate(p_cfg, mid, &res);
+		if (res.overruns)
+		{
+			hi = mid;
+		}
+		else
+		{
+			lo = mid;
+		}
+	}
+	return lo;
+}
+
+static void _usage(const char *p_name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -P protocol  Packet layout preset: xmodem, xmodem1k, nmodem, kermit\n"
+		"  -c hz        CPU clock (16000000)\n"
+		"  -b baud      Baud rate to report on (115200)\n"
+		"  -f depth     UART hardware RX FIFO depth (2)\n"
+		"  -r size      Ring buffer size, 0 for a polling recByte (64)\n"
+		"  -l cycles    RX interrupt latency (40)\n"
+		"  -i cycles    RX interrupt cycles per byte (30)\n"
+		"  -y cycles    Receiver cycles per byte (150)\n"
+		"  -B cycles    Receiver busy cycles after each packet (f_write, ...) (40000)\n"
+		"  -d cycles    Part of the busy cycles with interrupts disabled (0)\n"
+		"  -p bytes     Payload per packet\n"
+		"  -o bytes     Overhead per packet\n"
+		"  -a bytes     Acknowledge length\n"
+		"  -t cycles    Sender turnaround after an acknowledge (0)\n"
+		"  -w packets   Sender window, 1 for stop and wait\n"
+		"  -n packets   Packets to simulate (200)\n", p_name);
+}
+
+int main(int argc, char **argv)
+{
+	struct uart_cfg cfg = {
+		.cpuHz = 16000000, .baud = 115200, .fifo = 2, .ring = 64,
+		.isrLatency = 40, .isrByte = 30, .byteCycles = 150,
+		.busyCycles = 40000, .irqOffCycles = 0,
+		.payload = 1024, .overhead = 5, .ackBytes = 1,
+		.turnaround = 0, .window = 1, .packets = 200
+	};
+	struct uart_res res;
+	uint32_t maxBaud;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "P:c:b:f:r:l:i:y:B:d:p:o:a:t:w:n:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'P':
+				if (!strcmp(optarg, "xmodem"))
+				{
+					cfg.payload = 128;	cfg.overhead = 5;	cfg.ackBytes = 1;	cfg.window = 1;
+				}
+				else if (!strcmp(optarg, "xmodem1k"))
+				{
+					cfg.payload = 1024;	cfg.overhead = 5;	cfg.ackBytes = 1;	cfg.window = 1;
+				}
+				else if (!strcmp(optarg, "nmodem"))
+				{
+					/* Data frame: Type, Offset, CRC-32, COBS overhead and delimiter */
+					cfg.payload = 1024;	cfg.overhead = 16;	cfg.ackBytes = 16;	cfg.window = 8;
+				}
+				else if (!strcmp(optarg, "kermit"))
+				{
+					/* Extended header, 3 Byte check and EOL, about 10% prefixing */
+					cfg.payload = 1024;	cfg.overhead = 113;	cfg.ackBytes = 10;	cfg.window = 4;
+				}
+				else
+				{
+					_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'c':	cfg.cpuHz = strtoul(optarg, NULL, 0);		break;
+			case 'b':	cfg.baud = strtoul(optarg, NULL, 0);		break;
+			case 'f':	cfg.fifo = strtoul(optarg, NULL, 0);		break;
+			case 'r':	cfg.ring = strtoul(optarg, NULL, 0);		break;
+			case 'l':	cfg.isrLatency = strtoul(optarg, NULL, 0);	break;
+			case 'i':	cfg.isrByte = strtoul(optarg, NULL, 0);		break;
+			case 'y':	cfg.byteCycles = strtoul(optarg, NULL, 0);	break;
+			case 'B':	cfg.busyCycles = strtoul(optarg, NULL, 0);	break;
+			case 'd':	cfg.irqOffCycles = strtoul(optarg, NULL, 0);break;
+			case 'p':	cfg.payload = strtoul(optarg, NULL, 0);		break;
+			case 'o':	cfg.overhead = strtoul(optarg, NULL, 0);	break;
+			case 'a':	cfg.ackBytes = strtoul(optarg, NULL, 0);	break;
+			case 't':	cfg.turnaround = strtoul(optarg, NULL, 0);	break;
+			case 'w':	cfg.window = strtoul(optarg, NULL, 0);		break;
+			case 'n':	cfg.packets = strtoul(optarg, NULL, 0);		break;
+			default:
+				_usage(argv[0]);
+				return 1;
+		}
+	}
+	if (!cfg.cpuHz || !cfg.baud || !cfg.fifo || !cfg.window || !cfg.packets ||
+		(cfg.payload + cfg.overhead == 0) || (cfg.irqOffCycles > cfg.busyCycles))
+	{
+		_usage(argv[0]);
+		return 1;
+	}
+
+	_simulate(&cfg, cfg.baud, &res);
+	maxBaud = _maxBaud(&cfg);
+
+	printf("Packets:         %lu x (%u + %u) Bytes, window %u\n", (unsigned long)cfg.packets,
+		cfg.payload, cfg.overhead, cfg.window);
+	printf("At %lu baud:     %lu overruns (FIFO %lu, ring %lu)\n", (unsigned long)cfg.baud,
+		(unsigned long)res.overruns, (unsigned long)res.fifoOverruns, (unsigned long)res.ringOverruns);
+	printf("Highest fill:    FIFO %u of %u, ring %u of %u\n", res.fifoMax, cfg.fifo,
+		res.ringMax, cfg.ring);
+	printf("Throughput:      %.0f Bytes/s\n", (double)cfg.packets * cfg.payload * cfg.cpuHz / res.cycles);
+	printf("Max. sustainable baud: %lu\n", (unsigned long)maxBaud);
+
+	return res.overruns ? 2 : 0;
+}